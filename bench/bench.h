@@ -0,0 +1,44 @@
+// Shared by the benchmarks. Each one is a single file that includes this, and
+// through it the whole compiler, so that it can call and time its internals.
+
+#include "libdyibicc.c"
+
+// The same sequence on every run, so that generated workloads are too.
+static uint64_t rng_state = 0x2545f4914f6cdd1dULL;
+
+static inline uint64_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+// Results are stored here so that the work producing them isn't optimized out.
+static volatile uintptr_t sink;
+
+// A context with what compiling on this thread needs, as
+// dyibicc_set_environment() would set it up.
+static inline UserContext* init_bench_context(void) {
+  static UserContext ctx;
+  ctx.intern_pool.alloc_lifetime = AL_UserContext;
+  ctx.header_cache.alloc_lifetime = AL_UserContext;
+  ctx.base_macros.alloc_lifetime = AL_UserContext;
+  ctx.include_cache.alloc_lifetime = AL_Manual;
+  ctx.file_exists_cache.alloc_lifetime = AL_Manual;
+  mutex_init(&ctx.lock);
+  user_context = &ctx;
+  alloc_init(AL_UserContext);
+  alloc_init(AL_Temp);
+  alloc_init(AL_Compile);
+  compiler_state.hashmap__use_intern_cache = true;
+  return &ctx;
+}
+
+// As between translation units, everything allocated for the previous one is
+// gone, including compiler_state and so the per-thread intern cache.
+static inline void reset_compile(void) {
+  codegen_free();
+  alloc_reset(AL_Compile);
+  alloc_reset(AL_Temp);
+  compiler_state.hashmap__use_intern_cache = true;  // As compile_file() does.
+}
@@ -0,0 +1,110 @@
+// Time and peak memory of parsing and generating code for a translation unit
+// of many functions. parse() generates each function as soon as it's parsed,
+// and then discards its nodes, so only one function body is in memory at a
+// time. A "static inline" function is still kept until the end of the unit,
+// where codegen() emits it if it's used, which is how every function used to
+// be generated. So the same functions declared "static inline" stand in for
+// the previous pipeline here. Both have to give the same amount of code.
+//
+// Built and run by `ninja -C out/lr bench`.
+
+#include "bench.h"
+
+//
+// Workload.
+//
+
+#define NUM_FUNCTIONS 8000
+#define ITERATIONS 3
+
+// Functions with loops, conditions and calls to the previous function, which
+// keeps all of them used when they're "static inline". The last one isn't
+// static, so it's always emitted.
+static size_t make_function(char* buf, char* storage, int n, int k) {
+  if (n == 0) {
+    return sprintf(buf,
+                   "%s int function_0(int* values, int count) {\n"
+                   "  return count;\n"
+                   "}\n\n",
+                   storage);
+  }
+  return sprintf(buf,
+                 "%s int function_%d(int* values, int count) {\n"
+                 "  int total = 0;\n"
+                 "  for (int i = 0; i < count; ++i) {\n"
+                 "    if (values[i] > %d)\n"
+                 "      total += values[i] * %d - (total >> 2);\n"
+                 "    else\n"
+                 "      total ^= values[i] + %d;\n"
+                 "  }\n"
+                 "  return total + function_%d(values, count - 1);\n"
+                 "}\n\n",
+                 storage, n, k, k, k, n - 1);
+}
+
+static char* make_source(char* storage, size_t* size) {
+  char* buf = malloc(NUM_FUNCTIONS * 512);
+  size_t len = 0;
+  rng_state = 0x2545f4914f6cdd1dULL;
+  for (int n = 0; n < NUM_FUNCTIONS; ++n)
+    len += make_function(buf + len, storage, n, (int)(rng() % 100));
+  len += sprintf(buf + len, "int entry(int* values, int count) {\n"
+                            "  return function_%d(values, count);\n"
+                            "}\n",
+                 NUM_FUNCTIONS - 1);
+  *size = len;
+  return buf;
+}
+
+static Token* preprocess_source(char* src, size_t size) {
+  char* copy = bumpcalloc(1, size + 1, AL_Compile);
+  memcpy(copy, src, size);
+  init_macros();
+  Token* tok = preprocess(tokenize_filecontents("bench.c", copy));
+  alloc_reset(AL_Temp);
+  return tok;
+}
+
+static size_t bench(char* name, char* src, size_t size) {
+  uint64_t best = UINT64_MAX;
+  size_t peak = 0;
+  size_t code_size = 0;
+  for (int i = 0; i < ITERATIONS; ++i) {
+    reset_compile();
+    Token* tok = preprocess_source(src, size);
+    alloc_take_peak(AL_Compile);
+    alloc_take_peak(AL_Temp);
+    uint64_t start = get_time_ns();
+    codegen_init();
+    CompiledUnit* unit = codegen(parse(tok));
+    best = MIN(best, get_time_ns() - start);
+    // Including the tokens, which are the same for both.
+    peak = alloc_take_peak(AL_Compile) + alloc_take_peak(AL_Temp);
+    code_size = unit->code_size;
+    free(unit);
+  }
+  printf("  %-14s %8.1f ms %8.1f MB peak, %zu bytes of code\n", name, (double)best / 1e6,
+         (double)peak / (1 << 20), code_size);
+  return code_size;
+}
+
+int main(void) {
+  init_bench_context();
+
+  size_t static_size, inline_size;
+  char* static_src = make_source("static", &static_size);
+  char* inline_src = make_source("static inline", &inline_size);
+  printf("parse and generate %d functions, %.1f MB generated source:\n", NUM_FUNCTIONS,
+         (double)static_size / (1 << 20));
+  size_t deferred = bench("static inline", inline_src, inline_size);
+  size_t pipelined = bench("static", static_src, static_size);
+  if (deferred != pipelined) {
+    fprintf(stderr, "%zu bytes of code, previously %zu\n", pipelined, deferred);
+    exit(1);
+  }
+
+  reset_compile();
+  free(static_src);
+  free(inline_src);
+  return 0;
+}
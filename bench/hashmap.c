@@ -0,0 +1,269 @@
+// Microbenchmark for hashmap.c, comparing against the previous linear-probing
+// implementation (reproduced below as oldmap_*).
+//
+// Built and run by `ninja -C out/lr bench`.
+
+#include "bench.h"
+
+//
+// Previous implementation, FNV-1a and linear probing with tombstones.
+//
+
+typedef struct {
+  char* key;
+  int keylen;
+  void* val;
+} OldHashEntry;
+
+typedef struct {
+  OldHashEntry* buckets;
+  int capacity;
+  int used;
+} OldHashMap;
+
+#define OLD_INIT_SIZE 16
+#define OLD_HIGH_WATERMARK 70
+#define OLD_LOW_WATERMARK 50
+#define OLD_TOMBSTONE ((void*)-1)
+
+static uint64_t oldmap_fnv_hash(char* s, int len) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (int i = 0; i < len; i++) {
+    hash *= 0x100000001b3;
+    hash ^= (unsigned char)s[i];
+  }
+  return hash;
+}
+
+static void oldmap_put2(OldHashMap* map, char* key, int keylen, void* val);
+
+static void oldmap_rehash(OldHashMap* map) {
+  int nkeys = 0;
+  for (int i = 0; i < map->capacity; i++)
+    if (map->buckets[i].key && map->buckets[i].key != OLD_TOMBSTONE)
+      nkeys++;
+
+  int cap = map->capacity;
+  while ((nkeys * 100) / cap >= OLD_LOW_WATERMARK)
+    cap = cap * 2;
+
+  OldHashMap map2 = {0};
+  map2.buckets = bumpcalloc(cap, sizeof(OldHashEntry), AL_Compile);
+  map2.capacity = cap;
+
+  for (int i = 0; i < map->capacity; i++) {
+    OldHashEntry* ent = &map->buckets[i];
+    if (ent->key && ent->key != OLD_TOMBSTONE)
+      oldmap_put2(&map2, ent->key, ent->keylen, ent->val);
+  }
+  *map = map2;
+}
+
+static bool oldmap_match(OldHashEntry* ent, char* key, int keylen) {
+  return ent->key && ent->key != OLD_TOMBSTONE && ent->keylen == keylen &&
+         memcmp(ent->key, key, keylen) == 0;
+}
+
+static OldHashEntry* oldmap_get_entry(OldHashMap* map, char* key, int keylen) {
+  if (!map->buckets)
+    return NULL;
+
+  uint64_t hash = oldmap_fnv_hash(key, keylen);
+
+  for (int i = 0; i < map->capacity; i++) {
+    OldHashEntry* ent = &map->buckets[(hash + i) % map->capacity];
+    if (oldmap_match(ent, key, keylen))
+      return ent;
+    if (ent->key == NULL)
+      return NULL;
+  }
+  return NULL;
+}
+
+static OldHashEntry* oldmap_get_or_insert_entry(OldHashMap* map, char* key, int keylen) {
+  if (!map->buckets) {
+    map->buckets = bumpcalloc(OLD_INIT_SIZE, sizeof(OldHashEntry), AL_Compile);
+    map->capacity = OLD_INIT_SIZE;
+  } else if ((map->used * 100) / map->capacity >= OLD_HIGH_WATERMARK) {
+    oldmap_rehash(map);
+  }
+
+  uint64_t hash = oldmap_fnv_hash(key, keylen);
+
+  for (int i = 0; i < map->capacity; i++) {
+    OldHashEntry* ent = &map->buckets[(hash + i) % map->capacity];
+
+    if (oldmap_match(ent, key, keylen)) {
+      ent->key = key;
+      return ent;
+    }
+
+    if (ent->key == OLD_TOMBSTONE) {
+      ent->key = key;
+      ent->keylen = keylen;
+      return ent;
+    }
+
+    if (ent->key == NULL) {
+      ent->key = key;
+      ent->keylen = keylen;
+      map->used++;
+      return ent;
+    }
+  }
+  return NULL;
+}
+
+static void* oldmap_get2(OldHashMap* map, char* key, int keylen) {
+  OldHashEntry* ent = oldmap_get_entry(map, key, keylen);
+  return ent ? ent->val : NULL;
+}
+
+static void oldmap_put2(OldHashMap* map, char* key, int keylen, void* val) {
+  oldmap_get_or_insert_entry(map, key, keylen)->val = val;
+}
+
+static void oldmap_delete2(OldHashMap* map, char* key, int keylen) {
+  OldHashEntry* ent = oldmap_get_entry(map, key, keylen);
+  if (ent)
+    ent->key = OLD_TOMBSTONE;
+}
+
+//
+// Workloads.
+//
+
+#define NUM_KEYS 50000
+#define NUM_SMALL_MAPS 20000
+#define KEYS_PER_SMALL_MAP 12
+
+static char* keys[NUM_KEYS];
+static int keylens[NUM_KEYS];
+static char* miss_keys[NUM_KEYS];
+static int miss_keylens[NUM_KEYS];
+
+// Identifier-ish keys of mixed lengths with shared prefixes, roughly like
+// what shows up in system headers.
+static char* make_key(int i, int* len) {
+  static const char* prefixes[] = {"", "_", "__", "str", "mem", "pthread_", "__builtin_", "SDL_"};
+  char buf[64];
+  int n = snprintf(buf, sizeof(buf), "%s%c%x_%d", prefixes[rng() % 8], 'a' + (int)(rng() % 26),
+                   (unsigned)rng() & 0xfff, i);
+  *len = n;
+  return bumpstrndup(buf, n, AL_Temp);
+}
+
+#define BENCH(name, ops, body)                                                  \
+  do {                                                                          \
+    uint64_t start_ = get_time_ns();                                            \
+    body;                                                                       \
+    uint64_t elapsed_ = get_time_ns() - start_;                                 \
+    printf("  %-28s %8.2f ns/op\n", name, (double)elapsed_ / (double)(ops)); \
+  } while (0)
+
+static void bench_old(void) {
+  printf("old (linear probing, fnv):\n");
+  alloc_reset(AL_Compile);
+  OldHashMap map = {0};
+  BENCH("insert", NUM_KEYS, {
+    map = (OldHashMap){0};
+    for (int i = 0; i < NUM_KEYS; ++i)
+      oldmap_put2(&map, keys[i], keylens[i], (void*)(uintptr_t)(i + 1));
+  });
+  BENCH("lookup hit", NUM_KEYS * 10, {
+    uintptr_t sum = 0;
+    for (int r = 0; r < 10; ++r)
+      for (int i = 0; i < NUM_KEYS; ++i)
+        sum += (uintptr_t)oldmap_get2(&map, keys[i], keylens[i]);
+    sink = sum;
+  });
+  BENCH("lookup miss", NUM_KEYS * 10, {
+    uintptr_t sum = 0;
+    for (int r = 0; r < 10; ++r)
+      for (int i = 0; i < NUM_KEYS; ++i)
+        sum += (uintptr_t)oldmap_get2(&map, miss_keys[i], miss_keylens[i]);
+    sink = sum;
+  });
+  BENCH("insert/delete churn", NUM_KEYS * 4, {
+    map = (OldHashMap){0};
+    for (int r = 0; r < 4; ++r) {
+      for (int i = 0; i < NUM_KEYS; ++i) {
+        oldmap_put2(&map, keys[i], keylens[i], (void*)1);
+        if (i >= 64)
+          oldmap_delete2(&map, keys[i - 64], keylens[i - 64]);
+      }
+    }
+  });
+  BENCH("small scope maps", NUM_SMALL_MAPS * KEYS_PER_SMALL_MAP * 2, {
+    uintptr_t sum = 0;
+    for (int m = 0; m < NUM_SMALL_MAPS; ++m) {
+      OldHashMap small = {0};
+      int base = (m * 7) % (NUM_KEYS - KEYS_PER_SMALL_MAP);
+      for (int i = 0; i < KEYS_PER_SMALL_MAP; ++i)
+        oldmap_put2(&small, keys[base + i], keylens[base + i], (void*)1);
+      for (int i = 0; i < KEYS_PER_SMALL_MAP; ++i)
+        sum += (uintptr_t)oldmap_get2(&small, miss_keys[base + i], miss_keylens[base + i]);
+    }
+    sink = sum;
+  });
+}
+
+static void bench_new(void) {
+  printf("new (hashmap.c):\n");
+  alloc_reset(AL_Compile);
+  HashMap map = {0};
+  BENCH("insert", NUM_KEYS, {
+    map = (HashMap){.alloc_lifetime = AL_Compile};
+    for (int i = 0; i < NUM_KEYS; ++i)
+      hashmap_put2(&map, keys[i], keylens[i], (void*)(uintptr_t)(i + 1));
+  });
+  BENCH("lookup hit", NUM_KEYS * 10, {
+    uintptr_t sum = 0;
+    for (int r = 0; r < 10; ++r)
+      for (int i = 0; i < NUM_KEYS; ++i)
+        sum += (uintptr_t)hashmap_get2(&map, keys[i], keylens[i]);
+    sink = sum;
+  });
+  BENCH("lookup miss", NUM_KEYS * 10, {
+    uintptr_t sum = 0;
+    for (int r = 0; r < 10; ++r)
+      for (int i = 0; i < NUM_KEYS; ++i)
+        sum += (uintptr_t)hashmap_get2(&map, miss_keys[i], miss_keylens[i]);
+    sink = sum;
+  });
+  BENCH("insert/delete churn", NUM_KEYS * 4, {
+    map = (HashMap){.alloc_lifetime = AL_Compile};
+    for (int r = 0; r < 4; ++r) {
+      for (int i = 0; i < NUM_KEYS; ++i) {
+        hashmap_put2(&map, keys[i], keylens[i], (void*)1);
+        if (i >= 64)
+          hashmap_delete2(&map, keys[i - 64], keylens[i - 64]);
+      }
+    }
+  });
+  BENCH("small scope maps", NUM_SMALL_MAPS * KEYS_PER_SMALL_MAP * 2, {
+    uintptr_t sum = 0;
+    for (int m = 0; m < NUM_SMALL_MAPS; ++m) {
+      HashMap small = {.alloc_lifetime = AL_Compile};
+      int base = (m * 7) % (NUM_KEYS - KEYS_PER_SMALL_MAP);
+      for (int i = 0; i < KEYS_PER_SMALL_MAP; ++i)
+        hashmap_put2(&small, keys[base + i], keylens[base + i], (void*)1);
+      for (int i = 0; i < KEYS_PER_SMALL_MAP; ++i)
+        sum += (uintptr_t)hashmap_get2(&small, miss_keys[base + i], miss_keylens[base + i]);
+    }
+    sink = sum;
+  });
+}
+
+int main(void) {
+  init_bench_context();
+
+  for (int i = 0; i < NUM_KEYS; ++i) {
+    keys[i] = make_key(i, &keylens[i]);
+    miss_keys[i] = make_key(i + NUM_KEYS, &miss_keylens[i]);
+  }
+
+  bench_old();
+  bench_new();
+  return 0;
+}
@@ -0,0 +1,150 @@
+// Evaluation of #if expressions: by eval_pp_expr() directly from the tokens,
+// and by parsing them as C constant expressions (reproduced below as
+// old_eval), which is what eval_const_expr() did before and still does for the
+// expressions eval_pp_expr() leaves to it. That they agree is tested by
+// test/ifexpr.c; this only times them on a large generated set.
+//
+// Built and run by `ninja -C out/lr bench`.
+
+#include "bench.h"
+
+//
+// Previous implementation, through const_expr().
+//
+
+static long old_eval(Token* expr) {
+  for (Token* t = expr; t->kind != TK_EOF; t = t->next) {
+    if (t->kind == TK_IDENT) {
+      Token* next = t->next;
+      *t = *new_num_token(0, t);
+      t->next = next;
+    }
+  }
+  convert_pp_tokens(expr);
+
+  Token* rest;
+  long val = (long)const_expr(&rest, expr);
+  if (rest->kind != TK_EOF)
+    error_tok(rest, "extra token");
+  return val;
+}
+
+//
+// Workload.
+//
+
+#define NUM_GENERATED 20000
+#define ITERATIONS 5
+
+static char* literals[] = {
+    "0",          "1",          "7",          "-1",         "0u",
+    "3U",         "0x7fffffff", "0x80000000", "0xffffffff", "2147483648",
+    "1L",         "-1L",        "1ul",        "0xffffffffffffffff",
+    "0x8000000000000000",       "'a'",        "u'x'",       "FOO",
+};
+
+static char* divisors[] = {"1", "2", "3u", "7L", "0x10", "5ul", "2147483648"};
+
+static char* binary_ops[] = {"+",  "-",  "*",  "&",  "|",  "^",  "<",
+                             "<=", ">",  ">=", "==", "!=", "&&", "||"};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+// Something like the expressions in system headers, but with more of each kind
+// of operator.
+static size_t make_expr(char* buf, int depth) {
+  int r = (int)(rng() % 100);
+  if (depth == 0 || r < 20)
+    return sprintf(buf, "%s", literals[rng() % COUNT(literals)]);
+  size_t len = 0;
+  if (r < 30) {
+    len += sprintf(buf, "%c(", "-~!+"[rng() % 4]);
+    len += make_expr(buf + len, depth - 1);
+    return len + sprintf(buf + len, ")");
+  }
+  if (r < 40) {
+    len += sprintf(buf, "(");
+    len += make_expr(buf + len, depth - 1);
+    return len + sprintf(buf + len, ") %s %d", rng() % 2 ? "<<" : ">>", (int)(rng() % 40));
+  }
+  if (r < 47) {
+    len += sprintf(buf, "(");
+    len += make_expr(buf + len, depth - 1);
+    return len + sprintf(buf + len, ") %s %s", rng() % 2 ? "/" : "%",
+                         divisors[rng() % COUNT(divisors)]);
+  }
+  if (r < 55) {
+    len += sprintf(buf, "(");
+    len += make_expr(buf + len, depth - 1);
+    len += sprintf(buf + len, " ? ");
+    len += make_expr(buf + len, depth - 1);
+    len += sprintf(buf + len, " : ");
+    len += make_expr(buf + len, depth - 1);
+    return len + sprintf(buf + len, ")");
+  }
+  len += make_expr(buf, depth - 1);
+  len += sprintf(buf + len, " %s ", binary_ops[rng() % COUNT(binary_ops)]);
+  return len + make_expr(buf + len, depth - 1);
+}
+
+static char* make_source(void) {
+  char* buf = malloc(NUM_GENERATED * 2048);
+  size_t len = 0;
+  for (int i = 0; i < NUM_GENERATED; ++i) {
+    len += sprintf(buf + len, "#if ");
+    len += make_expr(buf + len, 5);
+    buf[len++] = '\n';
+  }
+  buf[len] = '\0';
+  return buf;
+}
+
+// Returns the expressions of each #if line of src, each terminated by an EOF,
+// as eval_const_expr() gets them.
+static Token** read_exprs(char* src, int* num_exprs) {
+  char* copy = bumpstrdup(src, AL_Compile);
+  Token* tok = tokenize(new_file("ifexpr", copy));
+  int n = 0;
+  for (Token* t = tok; t->kind != TK_EOF; t = t->next)
+    n += t->at_bol;
+  Token** exprs = bumpcalloc(n, sizeof(Token*), AL_Compile);
+  for (int i = 0; i < n; ++i)
+    exprs[i] = copy_line(&tok, tok->next->next);
+  *num_exprs = n;
+  return exprs;
+}
+
+static long eval_new(Token* expr) {
+  long val;
+  if (!eval_pp_expr(expr, &val))
+    val = old_eval(expr);
+  return val;
+}
+
+static void bench(char* name, char* src, long (*fn)(Token*)) {
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < ITERATIONS; ++i) {
+    reset_compile();
+    int n;
+    Token** exprs = read_exprs(src, &n);
+    long sum = 0;
+    uint64_t start = get_time_ns();
+    for (int j = 0; j < n; ++j)
+      sum += fn(exprs[j]);
+    best = MIN(best, get_time_ns() - start);
+    sink = (uintptr_t)sum;
+  }
+  printf("  %-28s %8.1f ms\n", name, (double)best / 1e6);
+}
+
+int main(void) {
+  init_bench_context();
+
+  char* src = make_source();
+  printf("evaluate %d generated #if expressions:\n", NUM_GENERATED);
+  bench("old (const_expr)", src, old_eval);
+  bench("new (eval_pp_expr)", src, eval_new);
+  free(src);
+  reset_compile();
+  return 0;
+}
@@ -0,0 +1,153 @@
+// Preprocessing translation units that include a platform-heavy header, most of
+// which is in #if groups for other platforms and for features that aren't
+// enabled. The header is tokenized once for the context, and then only its
+// active groups are copied into each translation unit (see tokenize_header()).
+// For comparison, the same text pasted into the main file is tokenized in full
+// and skipped token by token. Both have to give the same tokens.
+//
+// Built and run by `ninja -C out/lr bench`.
+
+#include "bench.h"
+
+#define NUM_BLOCKS 500
+#define ITERATIONS 10
+
+static char header_path[] = "/bench/platform.h";
+static char* header;
+
+static size_t make_decls(char* buf, char* prefix, int n, int count) {
+  size_t len = 0;
+  for (int i = 0; i < count; ++i) {
+    len += sprintf(buf + len,
+                   "extern int __attribute__((__nonnull__(1))) %s_function_%d_%d(\n"
+                   "    struct %s_state* __restrict state, const char* name, unsigned long "
+                   "flags);\n",
+                   prefix, n, i, prefix);
+  }
+  return len;
+}
+
+// Something like a block of a system header: declarations for each platform,
+// of which only the last is used here, and some for a feature that isn't
+// enabled, with conditionals of its own.
+static size_t make_block(char* buf, int n) {
+  size_t len = 0;
+  len += sprintf(buf + len, "#if defined(_WIN32) || defined(_WIN64)\n");
+  len += make_decls(buf + len, "win", n, 8);
+  len += sprintf(buf + len, "#elif defined(__APPLE__)\n");
+  len += make_decls(buf + len, "mac", n, 6);
+  len += sprintf(buf + len, "#else\n");
+  len += make_decls(buf + len, "linux", n, 3);
+  len += sprintf(buf + len, "#endif\n");
+  len += sprintf(buf + len, "#ifdef __USE_FEATURE_%d\n", (int)(rng() % 64));
+  len += make_decls(buf + len, "feature", n, 2);
+  len += sprintf(buf + len, "# if __FEATURE_LEVEL > %d\n", (int)(rng() % 4));
+  len += make_decls(buf + len, "level", n, 2);
+  len += sprintf(buf + len, "# endif\n#endif\n");
+  return len;
+}
+
+static char* make_header(void) {
+  char* buf = malloc(NUM_BLOCKS * 8192);
+  size_t len = sprintf(buf, "#ifndef PLATFORM_H\n#define PLATFORM_H\n");
+  for (int n = 0; n < NUM_BLOCKS; ++n)
+    len += make_block(buf + len, n);
+  sprintf(buf + len, "#endif\n");
+  return buf;
+}
+
+static bool load_header(const char* path, char** contents, size_t* size) {
+  if (strcmp(path, header_path) != 0)
+    return false;
+  *size = strlen(header);
+  *contents = malloc(*size + 1);
+  memcpy(*contents, header, *size + 1);
+  return true;
+}
+
+static int output(const char* fmt, va_list ap) {
+  return vfprintf(stderr, fmt, ap);
+}
+
+static char* include_source(void) {
+  return format(AL_Compile, "#include \"%s\"\nint main_unit;\n", header_path);
+}
+
+static char* pasted_source(void) {
+  size_t len = strlen(header);
+  char* src = bumpcalloc(1, len + sizeof("int main_unit;\n"), AL_Compile);
+  memcpy(src, header, len);
+  strcpy(src + len, "int main_unit;\n");
+  return src;
+}
+
+static Token* preprocess_unit(char* (*make_src)(void)) {
+  init_macros();
+  return preprocess(tokenize_filecontents("bench.c", make_src()));
+}
+
+static void bench(char* name, char* (*make_src)(void)) {
+  uint64_t best = UINT64_MAX;
+  size_t peak = 0;
+  for (int i = 0; i < ITERATIONS; ++i) {
+    reset_compile();
+    alloc_take_peak(AL_Compile);
+    uint64_t start = get_time_ns();
+    Token* tok = preprocess_unit(make_src);
+    best = MIN(best, get_time_ns() - start);
+    peak = alloc_take_peak(AL_Compile);
+    sink = (uintptr_t)tok;
+  }
+  printf("  %-20s %8.2f ms %8.1f MB AL_Compile per translation unit\n", name, (double)best / 1e6,
+         (double)peak / (1 << 20));
+}
+
+// The spelling of each token, with its spacing, in memory that outlives the
+// translation unit.
+static char* spell_tokens(Token* tok, int* num_tokens) {
+  size_t size = 1;
+  for (Token* t = tok; t->kind != TK_EOF; t = t->next)
+    size += t->len + 1;
+  char* buf = malloc(size);
+  char* p = buf;
+  *num_tokens = 0;
+  for (; tok->kind != TK_EOF; tok = tok->next, ++*num_tokens) {
+    if (tok->at_bol || tok->has_space)
+      *p++ = tok->at_bol ? '\n' : ' ';
+    memcpy(p, tok->loc, tok->len);
+    p += tok->len;
+  }
+  *p = '\0';
+  return buf;
+}
+
+// Also tokenizes and caches the header.
+static void check_same(void) {
+  int n;
+  reset_compile();
+  char* pasted = spell_tokens(preprocess_unit(pasted_source), &n);
+  reset_compile();
+  char* included = spell_tokens(preprocess_unit(include_source), &n);
+  if (strcmp(pasted, included) != 0) {
+    fprintf(stderr, "the header's tokens differ from the pasted text's\n");
+    exit(1);
+  }
+  free(pasted);
+  free(included);
+  printf("preprocess %.1f MB header, %d tokens out:\n", (double)strlen(header) / (1 << 20), n);
+}
+
+int main(void) {
+  UserContext* ctx = init_bench_context();
+  ctx->load_file_contents = load_header;
+  ctx->output_function = output;
+
+  header = make_header();
+  check_same();
+  bench("pasted (uncached)", pasted_source);
+  bench("#include (cached)", include_source);
+  free(header);
+  reset_compile();
+  header_cache_free();
+  return 0;
+}
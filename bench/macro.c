@@ -0,0 +1,134 @@
+// Preprocessor throughput on macro-heavy sources: X-macro tables expanded
+// several ways, and generic container macros with nested arguments that are
+// each used more than once in the body. Also the fixed cost of setting up the
+// predefined macros for each translation unit.
+//
+// Built and run by `ninja -C out/lr bench`.
+
+#include "bench.h"
+
+#define SOURCE_SIZE (256 << 10)
+#define ITERATIONS 5
+
+// A table of 64 entries, and every so often a set of functions that expand
+// the whole table through one of the per-entry macros.
+static size_t make_xmacro_item(char* buf, int n) {
+  if (n == 0) {
+    size_t len = sprintf(buf,
+                         "#define AS_ENUM(name, value, desc) name = value,\n"
+                         "#define AS_CASE(name, value, desc) case name: return #name;\n"
+                         "#define AS_DESC(name, value, desc) [name] = desc,\n"
+                         "#define AS_COUNT(name, value, desc) +1\n"
+                         "#define TABLE(X) \\\n");
+    for (int i = 0; i < 64; ++i)
+      len += sprintf(buf + len, "  X(ENTRY_%d, %d, \"entry number %d\") \\\n", i, i * 3, i);
+    return len + sprintf(buf + len, "\n");
+  }
+  return sprintf(buf,
+                 "enum Kind%d { TABLE(AS_ENUM) };\n"
+                 "static const char* kind%d_name(int k) {\n"
+                 "  switch (k) { TABLE(AS_CASE) default: return 0; }\n"
+                 "}\n"
+                 "static const char* kind%d_desc[] = { TABLE(AS_DESC) };\n"
+                 "static int kind%d_count = 0 TABLE(AS_COUNT);\n\n",
+                 n, n, n, n);
+}
+
+// Type-generic vector and min/max macros, nested as they are when one is
+// passed to another.
+static size_t make_container_item(char* buf, int n) {
+  if (n == 0) {
+    return sprintf(buf,
+                   "#define MIN(a, b) ((a) < (b) ? (a) : (b))\n"
+                   "#define MAX(a, b) ((a) > (b) ? (a) : (b))\n"
+                   "#define CLAMP(x, lo, hi) MIN(MAX((x), (lo)), (hi))\n"
+                   "#define VEC(T) struct { T* data; int len; int cap; }\n"
+                   "#define VEC_GROW(v) \\\n"
+                   "  ((v)->cap = MAX((v)->cap * 2, 8), \\\n"
+                   "   (v)->data = realloc((v)->data, sizeof(*(v)->data) * (v)->cap))\n"
+                   "#define VEC_PUSH(v, x) \\\n"
+                   "  ((v)->len == (v)->cap ? (void)VEC_GROW(v) : (void)0, \\\n"
+                   "   (v)->data[(v)->len++] = (x))\n"
+                   "#define VEC_AT(v, i) ((v)->data[CLAMP((i), 0, (v)->len - 1)])\n"
+                   "#define VEC_FOREACH(v, it) \\\n"
+                   "  for (__typeof__((v)->data) it = (v)->data; it < (v)->data + (v)->len; ++it)\n"
+                   "void* realloc(void*, unsigned long);\n\n");
+  }
+  int k = (int)(rng() % 100);
+  return sprintf(buf,
+                 "static int container_%d(VEC(int)* v, VEC(long)* w, int i) {\n"
+                 "  VEC_PUSH(v, CLAMP(i * %d, MIN(i, %d), MAX(i, 1000)));\n"
+                 "  VEC_PUSH(w, (long)VEC_AT(v, MAX(i - 1, 0)));\n"
+                 "  int total = 0;\n"
+                 "  VEC_FOREACH(v, it) total += CLAMP(*it, MIN(total, 0), MAX(total, %d));\n"
+                 "  return MAX(MIN(total, VEC_AT(v, i)), CLAMP(VEC_AT(w, i), 0, %d));\n"
+                 "}\n\n",
+                 n, k, k, k, k);
+}
+
+static char* make_source(size_t (*make_item)(char*, int), size_t* size) {
+  char* buf = malloc(SOURCE_SIZE + 8192);
+  size_t len = 0;
+  for (int n = 0; len < SOURCE_SIZE; ++n)
+    len += make_item(buf + len, n);
+  *size = len;
+  return buf;
+}
+
+static void bench(char* name, char* src, size_t size) {
+  uint64_t best = UINT64_MAX;
+  int num_tokens = 0;
+  for (int i = 0; i < ITERATIONS; ++i) {
+    reset_compile();
+    char* copy = bumpcalloc(1, size + 1, AL_Compile);
+    memcpy(copy, src, size);
+    init_macros();
+    Token* tok = tokenize_filecontents("bench.c", copy);
+    uint64_t start = get_time_ns();
+    tok = preprocess(tok);
+    best = MIN(best, get_time_ns() - start);
+    num_tokens = 0;
+    for (; tok->kind != TK_EOF; tok = tok->next)
+      num_tokens++;
+    sink = (uintptr_t)tok;
+  }
+  double mb_per_s = ((double)size / (1 << 20)) / ((double)best / 1e9);
+  printf("  %-12s %8.1f MB/s %8.1f ms %10d tokens out\n", name, mb_per_s, (double)best / 1e6,
+         num_tokens);
+}
+
+// The first translation unit builds the predefined macros for the context, and
+// the rest only start from them.
+static void bench_init_macros(void) {
+  enum { NUM_UNITS = 1000 };
+  uint64_t total = 0;
+  for (int i = 0; i < NUM_UNITS; ++i) {
+    reset_compile();
+    uint64_t start = get_time_ns();
+    init_macros();
+    total += get_time_ns() - start;
+  }
+  printf("  %-12s %8.2f us per translation unit\n", "init_macros", (double)total / NUM_UNITS / 1e3);
+}
+
+int main(void) {
+  init_bench_context();
+
+  static struct {
+    char* name;
+    size_t (*make_item)(char*, int);
+  } workloads[] = {
+      {"x-macro", make_xmacro_item},
+      {"container", make_container_item},
+  };
+  printf("preprocess macro-heavy source:\n");
+  for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); ++i) {
+    size_t size;
+    char* src = make_source(workloads[i].make_item, &size);
+    bench(workloads[i].name, src, size);
+    free(src);
+  }
+  bench_init_macros();
+  reset_compile();
+  return 0;
+}
@@ -0,0 +1,185 @@
+// Parser throughput on a large generated source, and the cost of the token
+// tests the parser makes on every token: by spelling, as equal() used to
+// compare with strncmp (reproduced below as old_equal), and by TokenId.
+//
+// Built and run by `ninja -C out/lr bench`.
+
+#include "bench.h"
+
+//
+// Previous implementation, comparing the token's spelling.
+//
+
+static bool old_equal(Token* tok, char* op) {
+  return strncmp(tok->loc, op, tok->len) == 0 && op[tok->len] == '\0';
+}
+
+//
+// Workload.
+//
+
+#define SOURCE_SIZE (4 << 20)
+#define ITERATIONS 5
+
+// Type declarations and small functions with the usual mix of statements.
+static size_t make_item(char* buf, int n) {
+  switch (rng() % 4) {
+    case 0:
+      return sprintf(buf,
+                     "typedef struct Item%d {\n"
+                     "  unsigned int flags;\n"
+                     "  const char* name;\n"
+                     "  long long values[4];\n"
+                     "  struct Item%d* next;\n"
+                     "} Item%d;\n\n",
+                     n, n, n);
+    case 1:
+      return sprintf(buf, "static const unsigned short table_%d[] = {%d, %d, %d, %d, %d};\n\n", n,
+                     (int)(rng() % 1000), (int)(rng() % 1000), (int)(rng() % 1000),
+                     (int)(rng() % 1000), (int)(rng() % 1000));
+    default:
+      return sprintf(buf,
+                     "static int function_%d(int* values, int count, unsigned flags) {\n"
+                     "  int total = 0;\n"
+                     "  for (int i = 0; i < count; ++i) {\n"
+                     "    if ((flags & (1u << (i %% 32))) != 0 && values[i] > %d)\n"
+                     "      total += values[i] * 3 - (values[i] >> 2);\n"
+                     "    else if (values[i] == 0)\n"
+                     "      continue;\n"
+                     "    else\n"
+                     "      total -= (int)sizeof(long) + values[i] %% 7;\n"
+                     "  }\n"
+                     "  while (total > 1000 && flags)\n"
+                     "    total /= 2;\n"
+                     "  switch (total & 3) {\n"
+                     "    case 0: return total;\n"
+                     "    case 1: return -total;\n"
+                     "    default: break;\n"
+                     "  }\n"
+                     "  return total ? total : %d;\n"
+                     "}\n\n",
+                     n, (int)(rng() % 100), n);
+  }
+}
+
+static char* make_source(size_t* size) {
+  char* buf = malloc(SOURCE_SIZE + 1024);
+  size_t len = 0;
+  for (int n = 0; len < SOURCE_SIZE; ++n)
+    len += make_item(buf + len, n);
+  *size = len;
+  return buf;
+}
+
+static Token* preprocess_source(char* src, size_t size) {
+  char* copy = bumpcalloc(1, size + 1, AL_Compile);
+  memcpy(copy, src, size);
+  init_macros();
+  return preprocess(tokenize_filecontents("bench.c", copy));
+}
+
+static void bench_parse(char* src, size_t size) {
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < ITERATIONS; ++i) {
+    reset_compile();
+    Token* tok = preprocess_source(src, size);
+    codegen_init();
+    uint64_t start = get_time_ns();
+    Obj* prog = parse(tok);
+    // Less generating the functions, which parse() does as it goes.
+    best = MIN(best, get_time_ns() - start - compiler_state.codegen__time_ns);
+    sink = (uintptr_t)prog;
+  }
+  double mb_per_s = ((double)size / (1 << 20)) / ((double)best / 1e9);
+  printf("  %-28s %8.1f MB/s\n", "parse", mb_per_s);
+}
+
+// The tests at the top of declspec() and stmt(), in the order they're made
+// there. Most tokens are neither a type nor a statement keyword, so fail all of
+// them.
+static struct {
+  char* spelling;
+  TokenId id;
+} tests[] = {
+    {"typedef", KW_TYPEDEF},
+    {"static", KW_STATIC},
+    {"extern", KW_EXTERN},
+    {"inline", ID_INLINE},
+    {"_Thread_local", KW__THREAD_LOCAL},
+    {"__thread", KW___THREAD},
+    {"const", KW_CONST},
+    {"volatile", KW_VOLATILE},
+    {"auto", KW_AUTO},
+    {"register", KW_REGISTER},
+    {"restrict", KW_RESTRICT},
+    {"__restrict", KW___RESTRICT},
+    {"__restrict__", KW___RESTRICT__},
+    {"_Noreturn", KW__NORETURN},
+    {"_Atomic", KW__ATOMIC},
+    {"_Alignas", KW__ALIGNAS},
+    {"struct", KW_STRUCT},
+    {"union", KW_UNION},
+    {"enum", KW_ENUM},
+    {"typeof", KW_TYPEOF},
+    {"return", KW_RETURN},
+    {"if", KW_IF},
+    {"switch", KW_SWITCH},
+    {"case", KW_CASE},
+    {"default", KW_DEFAULT},
+    {"for", KW_FOR},
+    {"while", KW_WHILE},
+    {"do", KW_DO},
+    {"asm", KW_ASM},
+    {"goto", KW_GOTO},
+    {"break", KW_BREAK},
+    {"continue", KW_CONTINUE},
+    {"{", PU_LBRACE},
+    {";", PU_SEMI},
+};
+
+static int classify_by_spelling(Token* tok) {
+  for (size_t i = 0; i < sizeof(tests) / sizeof(*tests); i++) {
+    if (old_equal(tok, tests[i].spelling))
+      return (int)i;
+  }
+  return -1;
+}
+
+static int classify_by_id(Token* tok) {
+  for (size_t i = 0; i < sizeof(tests) / sizeof(*tests); i++) {
+    if (equal(tok, tests[i].id))
+      return (int)i;
+  }
+  return -1;
+}
+
+static void bench_classify(char* name, Token* tok, int (*fn)(Token*)) {
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < ITERATIONS; ++i) {
+    int sum = 0;
+    uint64_t start = get_time_ns();
+    for (Token* t = tok; t->kind != TK_EOF; t = t->next)
+      sum += fn(t);
+    best = MIN(best, get_time_ns() - start);
+    sink = (uintptr_t)sum;
+  }
+  printf("  %-28s %8.1f ms\n", name, (double)best / 1e6);
+}
+
+int main(void) {
+  init_bench_context();
+
+  size_t size;
+  char* src = make_source(&size);
+  printf("parse %.1f MB generated source:\n", (double)size / (1 << 20));
+  bench_parse(src, size);
+
+  reset_compile();
+  Token* tok = preprocess_source(src, size);
+  bench_classify("token tests by spelling", tok, classify_by_spelling);
+  bench_classify("token tests by id", tok, classify_by_id);
+
+  reset_compile();
+  free(src);
+  return 0;
+}
@@ -0,0 +1,194 @@
+// Tokenizer throughput, comparing against the previous separate passes for
+// newline canonicalization and line splicing (reproduced below as old_*), on
+// large generated sources.
+//
+// Built and run by `ninja -C out/lr bench`.
+
+#include "bench.h"
+
+//
+// Previous implementation, a whole-buffer pass for each step.
+//
+
+static void old_canonicalize_newline(char* p) {
+  int i = 0, j = 0;
+
+  while (p[i]) {
+    if (p[i] == '\r' && p[i + 1] == '\n') {
+      i += 2;
+      p[j++] = '\n';
+    } else if (p[i] == '\r') {
+      i++;
+      p[j++] = '\n';
+    } else {
+      p[j++] = p[i++];
+    }
+  }
+
+  p[j] = '\0';
+}
+
+static void old_remove_backslash_newline(char* p) {
+  int i = 0, j = 0;
+  int n = 0;
+
+  while (p[i]) {
+    if (p[i] == '\\' && p[i + 1] == '\n') {
+      i += 2;
+      n++;
+    } else if (p[i] == '\n') {
+      p[j++] = p[i++];
+      for (; n > 0; n--)
+        p[j++] = '\n';
+    } else {
+      p[j++] = p[i++];
+    }
+  }
+
+  for (; n > 0; n--)
+    p[j++] = '\n';
+  p[j] = '\0';
+}
+
+static Token* old_tokenize_filecontents(char* path, char* p) {
+  old_canonicalize_newline(p);
+  old_remove_backslash_newline(p);
+  convert_universal_chars(p);
+  return tokenize(new_file(path, p));
+}
+
+//
+// Workload.
+//
+
+#define SOURCE_SIZE (8 << 20)
+#define ITERATIONS 5
+
+// Something like a generated table, with the occasional comment, string,
+// multi-line macro, and CRLF line ending.
+static size_t make_table_row(char* buf, int row) {
+  int kind = (int)(rng() % 16);
+  char* eol = kind == 0 ? "\r\n" : "\n";
+  if (kind == 1)
+    return sprintf(buf, "/* row %d\n * of the table */%s", row, eol);
+  if (kind == 2)
+    return sprintf(buf, "#define ROW_%d(x) \\\n  ((x) + %d) \\\n  * 2%s", row, row, eol);
+  if (kind == 3) {
+    return sprintf(buf, "  { \"name_%d\", u\"wide\", 'c', %d.5f }, // %x%s", row, row,
+                   (unsigned)rng(), eol);
+  }
+  return sprintf(buf, "  { table_entry_%d, 0x%08x, %u, %d },%s", row, (unsigned)rng(),
+                 (unsigned)(rng() % 100000), row, eol);
+}
+
+// Something like a system header: documentation comments, indented
+// declarations with long names, and messages.
+static size_t make_header_row(char* buf, int row) {
+  switch (rng() % 4) {
+    case 0:
+      return sprintf(buf,
+                     "/*\n * Returns the number of bytes written to the stream for entry %d,\n"
+                     " * or a negative value if the underlying descriptor was closed.\n */\n",
+                     row);
+    case 1:
+      return sprintf(buf,
+                     "extern int __attribute__((__nonnull__(1))) stream_write_entry_%d(\n"
+                     "    struct output_stream_state* __restrict stream_state,\n"
+                     "    const unsigned char* __restrict source_buffer, size_t length);\n",
+                     row);
+    case 2:
+      return sprintf(buf,
+                     "        static const char message_%d[] = \"the configuration value was "
+                     "not recognized\\n\";  // See above.\n",
+                     row);
+    default:
+      return sprintf(buf, "#define STREAM_FLAG_%d (1u << %d)\n\n", row, row % 32);
+  }
+}
+
+// A header with the occasional multi-line macro, which is tokenized from a
+// spliced copy of just those lines.
+static size_t make_spliced_row(char* buf, int row) {
+  if (rng() % 8 == 0) {
+    return sprintf(buf,
+                   "#define STREAM_CHECK_%d(s) \\\n"
+                   "  do { \\\n"
+                   "    if (!(s)->open) /* closed */ \\\n"
+                   "      return -%d; \\\n"
+                   "  } while (0)\n",
+                   row, row);
+  }
+  return make_header_row(buf, row);
+}
+
+static char* make_source(size_t (*make_row)(char*, int), size_t* size) {
+  char* buf = malloc(SOURCE_SIZE + 512);
+  size_t len = 0;
+  for (int row = 0; len < SOURCE_SIZE; ++row)
+    len += make_row(buf + len, row);
+  *size = len;
+  return buf;
+}
+
+static void bench(char* name, char* src, size_t size, Token* (*fn)(char*, char*)) {
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < ITERATIONS; ++i) {
+    reset_compile();
+    char* copy = bumpcalloc(1, size + 1, AL_Compile);
+    memcpy(copy, src, size);
+    uint64_t start = get_time_ns();
+    Token* tok = fn("bench.c", copy);
+    best = MIN(best, get_time_ns() - start);
+    sink = (uintptr_t)tok;
+  }
+  double mb_per_s = ((double)size / (1 << 20)) / ((double)best / 1e9);
+  printf("  %-28s %8.1f MB/s\n", name, mb_per_s);
+}
+
+// Both have to produce the same tokens for the comparison to mean anything.
+// Tokens from spliced lines point into a copy, so they're compared by spelling
+// and line rather than by offset.
+static void check_same(char* src, size_t size) {
+  reset_compile();
+  char* a = bumpcalloc(1, size + 1, AL_Compile);
+  char* b = bumpcalloc(1, size + 1, AL_Compile);
+  memcpy(a, src, size);
+  memcpy(b, src, size);
+  Token* ta = old_tokenize_filecontents("bench.c", a);
+  Token* tb = tokenize_filecontents("bench.c", b);
+  for (; ta && tb; ta = ta->next, tb = tb->next) {
+    if (ta->kind != tb->kind || ta->len != tb->len || memcmp(ta->loc, tb->loc, ta->len) != 0 ||
+        token_line_no(ta) != token_line_no(tb) || ta->at_bol != tb->at_bol ||
+        ta->has_space != tb->has_space) {
+      fprintf(stderr, "token mismatch at offset %d\n", (int)(ta->loc - a));
+      exit(1);
+    }
+  }
+  if (ta || tb) {
+    fprintf(stderr, "token count mismatch\n");
+    exit(1);
+  }
+}
+
+int main(void) {
+  init_bench_context();
+
+  static struct {
+    char* name;
+    size_t (*make_row)(char*, int);
+  } workloads[] = {
+      {"table", make_table_row},
+      {"header", make_header_row},
+      {"spliced header", make_spliced_row},
+  };
+  for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); ++i) {
+    size_t size;
+    char* src = make_source(workloads[i].make_row, &size);
+    printf("tokenize %.1f MB %s-like source:\n", (double)size / (1 << 20), workloads[i].name);
+    check_same(src, size);
+    bench("old (separate passes)", src, size, old_tokenize_filecontents);
+    bench("new (tokenize_filecontents)", src, size, tokenize_filecontents);
+    free(src);
+  }
+  return 0;
+}
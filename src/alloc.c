@@ -3,7 +3,9 @@
 #if X64WIN
 #include <windows.h>
 #else
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 // MSVC chokes during preprocess on __has_feature().
@@ -23,30 +25,129 @@ void __asan_unpoison_memory_region(void const volatile* addr, size_t size);
 #define ASAN_UNPOISON_MEMORY_REGION(addr, size) ((void)(addr), (void)(size))
 #endif
 
-IMPLSTATIC UserContext* user_context;
-IMPLSTATIC jmp_buf toplevel_update_jmpbuf;
-IMPLSTATIC CompilerState compiler_state;
-IMPLSTATIC LinkerState linker_state;
-
-typedef struct HeapData {
-  char* base;
-  char* alloc_pointer;
-  size_t size;
-} HeapData;
-
-static HeapData heap[NUM_BUMP_HEAPS] = {
-    {NULL, NULL, 1024 << 20},  // AL_Compile
-    {NULL, NULL, 128 << 20},   // AL_Temp
-    {NULL, NULL, 128 << 20},   // AL_Link
-    {NULL, NULL, 64 << 20},    // AL_UserContext
+IMPLSTATIC THREAD_LOCAL UserContext* user_context;
+IMPLSTATIC THREAD_LOCAL jmp_buf toplevel_update_jmpbuf;
+IMPLSTATIC THREAD_LOCAL CompilerState compiler_state;
+IMPLSTATIC THREAD_LOCAL LinkerState linker_state;
+
+// Each bump heap is a list of chunks that are mapped on demand, so a heap can
+// grow as large as a translation unit requires. The chunks are kept when the
+// heap is reset so that the next user of the heap (typically the next
+// translation unit) reuses already-mapped pages rather than paying for a fresh
+// map/unmap and page faults. Only chunks beyond |retain_size| are returned to
+// the OS on reset.
+struct HeapChunk {
+  HeapChunk* next;
+  size_t size;  // Size of the whole mapping, including this header.
 };
 
-IMPLSTATIC void alloc_init(AllocLifetime lifetime) {
+// As malloc() does, allocations are aligned for any type, including the long
+// double in TokenLiteral.
+#define BUMP_ALIGNMENT 16
+
+#define HEAP_CHUNK_HEADER_SIZE align_to_u(sizeof(HeapChunk), BUMP_ALIGNMENT)
+#define HEAP_MAX_CHUNK_SIZE ((size_t)64 << 20)
+
+static const size_t heap_initial_chunk_size[NUM_BUMP_HEAPS] = {
+    4 << 20,  // AL_Compile
+    1 << 20,  // AL_Temp
+    1 << 20,  // AL_Link
+    1 << 20,  // AL_UserContext
+};
+
+static const size_t heap_default_retain_size[NUM_BUMP_HEAPS] = {
+    256 << 20,  // AL_Compile
+    256 << 20,  // AL_Temp
+    64 << 20,   // AL_Link
+    64 << 20,   // AL_UserContext
+};
+
+// All heaps but AL_UserContext belong to the thread using them, so that
+// translation units (and separate contexts) can be compiled in parallel. The
+// AL_UserContext slot in this array is unused, that heap is in the current
+// UserContext.
+static THREAD_LOCAL HeapData thread_heaps[NUM_BUMP_HEAPS];
+
+static HeapData* get_heap(AllocLifetime lifetime) {
   assert(lifetime < NUM_BUMP_HEAPS);
-  HeapData* hd = &heap[lifetime];
+  HeapData* hd = lifetime == AL_UserContext ? &user_context->heap : &thread_heaps[lifetime];
+  if (!hd->chunk_size) {
+    hd->chunk_size = heap_initial_chunk_size[lifetime];
+    hd->retain_size = heap_default_retain_size[lifetime];
+  }
+  return hd;
+}
+
+static void heap_note_used(HeapData* hd, size_t size) {
+  hd->used += size;
+  if (hd->used > hd->peak)
+    hd->peak = hd->used;
+}
+
+static char* chunk_begin(HeapChunk* chunk) {
+  return (char*)chunk + HEAP_CHUNK_HEADER_SIZE;
+}
+
+static char* chunk_end(HeapChunk* chunk) {
+  return (char*)chunk + chunk->size;
+}
+
+static void heap_use_chunk(HeapData* hd, HeapChunk* chunk) {
+  hd->current = chunk;
+  hd->alloc_pointer = chunk_begin(chunk);
+  hd->alloc_end = chunk_end(chunk);
+}
+
+// Maps a new chunk large enough for |min_size| bytes of allocations and links
+// it in after the current chunk.
+static void heap_add_chunk(HeapData* hd, size_t min_size) {
+  size_t size = MAX(hd->chunk_size, align_to_u(min_size + HEAP_CHUNK_HEADER_SIZE, get_page_size()));
+  HeapChunk* chunk = allocate_writable_memory(size);
+  if (!chunk) {
+    error("heap exhausted");
+  }
+  ASAN_POISON_MEMORY_REGION(chunk_begin(chunk), size - HEAP_CHUNK_HEADER_SIZE);
+  chunk->size = size;
+  if (hd->current) {
+    chunk->next = hd->current->next;
+    hd->current->next = chunk;
+  } else {
+    chunk->next = hd->first;
+    hd->first = chunk;
+  }
+  hd->chunk_size = MIN(hd->chunk_size * 2, HEAP_MAX_CHUNK_SIZE);
+  heap_use_chunk(hd, chunk);
+}
+
+// Rewinds to the first chunk, unmapping chunks that are beyond the retained
+// size.
+static void heap_rewind(HeapData* hd, size_t retain_size) {
+  size_t retained = 0;
+  HeapChunk** link = &hd->first;
+  while (*link) {
+    HeapChunk* chunk = *link;
+    if (retained + chunk->size > retain_size) {
+      *link = chunk->next;
+      free_executable_memory(chunk, chunk->size);
+      continue;
+    }
+    retained += chunk->size;
+    ASAN_POISON_MEMORY_REGION(chunk_begin(chunk), chunk->size - HEAP_CHUNK_HEADER_SIZE);
+    link = &chunk->next;
+  }
+  hd->current = NULL;
+  hd->alloc_pointer = NULL;
+  hd->alloc_end = NULL;
+  hd->used = 0;
+}
+
+IMPLSTATIC void alloc_init(AllocLifetime lifetime) {
+  HeapData* hd = get_heap(lifetime);
+
+  heap_rewind(hd, hd->retain_size);
+  if (hd->first)
+    heap_use_chunk(hd, hd->first);
 
-  hd->alloc_pointer = hd->base = allocate_writable_memory(hd->size);
-  ASAN_POISON_MEMORY_REGION(hd->base, hd->size);
   if (lifetime == AL_Compile) {
     memset(&compiler_state, 0, sizeof(compiler_state));
   } else if (lifetime == AL_Link) {
@@ -54,17 +155,39 @@ IMPLSTATIC void alloc_init(AllocLifetime lifetime) {
   }
 }
 
+// Discards all allocations in the heap. We allow double resets because we may
+// longjmp out during error handling, and don't know which heaps are
+// initialized at that point.
 IMPLSTATIC void alloc_reset(AllocLifetime lifetime) {
-  assert(lifetime < NUM_BUMP_HEAPS);
-  HeapData* hd = &heap[lifetime];
-  // We allow double resets because we may longjmp out during error handling,
-  // and don't know which heaps are initialized at that point.
-  if (hd->base) {
-    ASAN_POISON_MEMORY_REGION(hd->base, hd->size);
-    free_executable_memory(hd->base, hd->size);
-    hd->alloc_pointer = NULL;
-    hd->base = NULL;
-  }
+  HeapData* hd = get_heap(lifetime);
+  heap_rewind(hd, hd->retain_size);
+  // Everything in it points into AL_Compile, including the cache in front of
+  // the context's intern pool (see intern2()).
+  if (lifetime == AL_Compile)
+    memset(&compiler_state, 0, sizeof(compiler_state));
+}
+
+// Like alloc_reset(), but additionally returns all of the heap's memory to
+// the OS.
+IMPLSTATIC void alloc_release(AllocLifetime lifetime) {
+  heap_rewind(get_heap(lifetime), 0);
+  if (lifetime == AL_Compile)
+    memset(&compiler_state, 0, sizeof(compiler_state));
+}
+
+// Sets the number of bytes that are kept mapped by a heap when it's reset. 0
+// restores the default.
+IMPLSTATIC void alloc_set_retain_size(AllocLifetime lifetime, size_t size) {
+  get_heap(lifetime)->retain_size = size ? size : heap_default_retain_size[lifetime];
+}
+
+// Returns the largest number of bytes that were allocated from the heap at
+// once since the previous call, and restarts tracking from the current usage.
+IMPLSTATIC size_t alloc_take_peak(AllocLifetime lifetime) {
+  HeapData* hd = get_heap(lifetime);
+  size_t ret = hd->peak;
+  hd->peak = hd->used;
+  return ret;
 }
 
 IMPLSTATIC void* bumpcalloc(size_t num, size_t size, AllocLifetime lifetime) {
@@ -72,13 +195,20 @@ IMPLSTATIC void* bumpcalloc(size_t num, size_t size, AllocLifetime lifetime) {
     return calloc(num, size);
   }
 
-  size_t toalloc = align_to_u(num * size, 8);
-  HeapData* hd = &heap[lifetime];
+  size_t toalloc = align_to_u(num * size, BUMP_ALIGNMENT);
+  HeapData* hd = get_heap(lifetime);
+  while (!hd->alloc_pointer || (size_t)(hd->alloc_end - hd->alloc_pointer) < toalloc) {
+    // Move on to the next retained chunk if there is one and it's big enough,
+    // otherwise map a new one.
+    HeapChunk* next = hd->current ? hd->current->next : hd->first;
+    if (next && next->size - HEAP_CHUNK_HEADER_SIZE >= toalloc)
+      heap_use_chunk(hd, next);
+    else
+      heap_add_chunk(hd, toalloc);
+  }
   char* ret = hd->alloc_pointer;
   hd->alloc_pointer += toalloc;
-  if (hd->alloc_pointer > hd->base + hd->size) {
-    error("heap exhausted");
-  }
+  heap_note_used(hd, toalloc);
   ASAN_UNPOISON_MEMORY_REGION(ret, toalloc);
   memset(ret, 0, toalloc);
   return ret;
@@ -94,6 +224,22 @@ IMPLSTATIC void* bumplamerealloc(void* old,
                                  size_t old_size,
                                  size_t new_size,
                                  AllocLifetime lifetime) {
+  // If |old| was the most recent allocation and there's room in the current
+  // chunk, grow it in place.
+  if (lifetime != AL_Manual && old) {
+    HeapData* hd = get_heap(lifetime);
+    size_t old_alloc = align_to_u(old_size, BUMP_ALIGNMENT);
+    size_t new_alloc = align_to_u(new_size, BUMP_ALIGNMENT);
+    if ((char*)old + old_alloc == hd->alloc_pointer && new_alloc >= old_alloc &&
+        (size_t)(hd->alloc_end - (char*)old) >= new_alloc) {
+      ASAN_UNPOISON_MEMORY_REGION(hd->alloc_pointer, new_alloc - old_alloc);
+      memset(hd->alloc_pointer, 0, new_alloc - old_alloc);
+      hd->alloc_pointer = (char*)old + new_alloc;
+      heap_note_used(hd, new_alloc - old_alloc);
+      return old;
+    }
+  }
+
   void* newptr = bumpcalloc(1, new_size, lifetime);
   memcpy(newptr, old, MIN(old_size, new_size));
   ASAN_POISON_MEMORY_REGION(old, old_size);
@@ -175,15 +321,63 @@ IMPLSTATIC bool make_memory_executable(void* m, size_t size) {
 #endif
 }
 
+// Maps a file read-only, and returns NULL if it isn't one that can be used in
+// place. The zero fill past the end of the file in the last page terminates
+// the contents, so a file whose size is a multiple of the page size (including
+// an empty one) isn't mapped.
+IMPLSTATIC void* map_file_readonly(char* path, size_t* size) {
+  void* p = NULL;
+#if X64WIN
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return NULL;
+  LARGE_INTEGER file_size;
+  if (GetFileSizeEx(file, &file_size) && file_size.QuadPart % get_page_size() != 0) {
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping) {
+      p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      *size = (size_t)file_size.QuadPart;
+      CloseHandle(mapping);
+    }
+  }
+  CloseHandle(file);
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size % get_page_size() != 0) {
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+      p = NULL;
+    *size = st.st_size;
+  }
+  close(fd);
+#endif
+  return p;
+}
+
+IMPLSTATIC void unmap_file(void* p, size_t size) {
+#if X64WIN
+  (void)size;
+  UnmapViewOfFile(p);
+#else
+  munmap(p, size);
+#endif
+}
+
 IMPLSTATIC void free_executable_memory(void* p, size_t size) {
 #if X64WIN
   (void)size;  // If |size| is passed, free will fail.
   if (!VirtualFree(p, 0, MEM_RELEASE)) {
     error("VirtualFree %p %zu failed: 0x%x\n", p, size, GetLastError());
   }
-  ASAN_POISON_MEMORY_REGION(p, size);
 #else
   munmap(p, size);
-  ASAN_POISON_MEMORY_REGION(p, size);
 #endif
+  // The range is free to be mapped again by anything, e.g. a new thread's stack
+  // and TLS, or a file, so it must not be left poisoned from its use as a heap
+  // chunk.
+  ASAN_UNPOISON_MEMORY_REGION(p, size);
 }
@@ -47,6 +47,10 @@ def include_file(f, src):
                 continue
             if line.startswith('#include "khash.h"'):
                 continue
+            if line.startswith('#include "token_ids.h"'):
+                continue
+            if line.startswith('#include "build_hash.h"'):
+                continue
             if line.startswith('#include "dynasm/dasm_proto.h"'):
                 continue
             if line.startswith('#include "dynasm/dasm_x86.h"'):
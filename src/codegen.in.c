@@ -1508,6 +1508,7 @@ static void gen_expr(Node* node) {
       return;
     case ND_REFLECT_TYPE_PTR:
       ///| mov64 rax, node->rty;
+      C(embeds_context_addresses) = true;
       return;
     case ND_CAS:
     case ND_LOCKCE: {
@@ -2005,298 +2006,217 @@ static void gen_stmt(Node* node) {
 #if X64WIN
 
 // Assign offsets to local variables.
-static void assign_lvar_offsets(Obj* prog) {
-  for (Obj* fn = prog; fn; fn = fn->next) {
-    if (!fn->is_function || !fn->is_definition || !fn->is_live)
-      continue;
-
-    // outaf("--- %s\n", fn->name);
-
-    // The parameter home area starts at 16 above rbp:
-    //   ...
-    //   stack arg 2 (6th arg)
-    //   stack arg 1 (5th arg)
-    //   R9 home
-    //   R8 home
-    //   RDX home
-    //   RCX home
-    //   return address pushed by call instr
-    //   old RBP (for the called function)  <<< RBP after push rbp; mov rbp, rsp
-    //   ...
-    //   ... stack space used by called function
-    //   ...
-    //
-    // The top of the diagram is addr 0xffffffff.. and the bottom is 0.
-    // PUSH decrements RSP and then stores.
-    // So, "top" means the highest numbered address corresponding the to root
-    // function and bottom moves to the frames for the leaf-ward functions.
-    int top = 16;
-    int bottom = 0;
+static void assign_lvar_offsets(Obj* fn) {
+  // outaf("--- %s\n", fn->name);
+
+  // The parameter home area starts at 16 above rbp:
+  //   ...
+  //   stack arg 2 (6th arg)
+  //   stack arg 1 (5th arg)
+  //   R9 home
+  //   R8 home
+  //   RDX home
+  //   RCX home
+  //   return address pushed by call instr
+  //   old RBP (for the called function)  <<< RBP after push rbp; mov rbp, rsp
+  //   ...
+  //   ... stack space used by called function
+  //   ...
+  //
+  // The top of the diagram is addr 0xffffffff.. and the bottom is 0.
+  // PUSH decrements RSP and then stores.
+  // So, "top" means the highest numbered address corresponding the to root
+  // function and bottom moves to the frames for the leaf-ward functions.
+  int top = 16;
+  int bottom = 0;
 
-    int reg = 0;
+  int reg = 0;
 
-    // Assign offsets to pass-by-stack parameters and register homes.
-    for (Obj* var = fn->params; var; var = var->next) {
-      Type* ty = var->ty;
+  // Assign offsets to pass-by-stack parameters and register homes.
+  for (Obj* var = fn->params; var; var = var->next) {
+    Type* ty = var->ty;
 
-      switch (ty->kind) {
-        case TY_STRUCT:
-        case TY_UNION:
-          if (!type_passed_in_register(ty)) {
-            // If it's too big for a register, then the value we're getting is a
-            // pointer to a copy, rather than the actual value, so flag it as
-            // such and then either assign a register or stack slot for the
-            // reference.
-            // outaf("by ref %s\n", var->name);
-            // var->passed_by_reference = true;
-          }
-
-          // If the pointer to a referenced value or the value itself can be
-          // passed in a register then assign here.
-          if (reg++ < X64WIN_REG_MAX) {
-            var->offset = top;
-            // outaf("  assigned reg offset 0x%x\n", var->offset);
-            top += 8;
-            continue;
-          }
+    switch (ty->kind) {
+      case TY_STRUCT:
+      case TY_UNION:
+        if (!type_passed_in_register(ty)) {
+          // If it's too big for a register, then the value we're getting is a
+          // pointer to a copy, rather than the actual value, so flag it as
+          // such and then either assign a register or stack slot for the
+          // reference.
+          // outaf("by ref %s\n", var->name);
+          // var->passed_by_reference = true;
+        }
 
-          // Otherwise fall through to the stack slot assignment below.
-          break;
-        case TY_FLOAT:
-        case TY_DOUBLE:
-          if (reg++ < X64WIN_REG_MAX) {
-            var->offset = top;
-            top += 8;
-            continue;
-          }
-          break;
-        default:
-          if (reg++ < X64WIN_REG_MAX) {
-            var->offset = top;
-            top += 8;
-            // outaf("int reg %s at home 0x%x\n", var->name, var->offset);
-            continue;
-          }
-      }
+        // If the pointer to a referenced value or the value itself can be
+        // passed in a register then assign here.
+        if (reg++ < X64WIN_REG_MAX) {
+          var->offset = top;
+          // outaf("  assigned reg offset 0x%x\n", var->offset);
+          top += 8;
+          continue;
+        }
 
-      var->offset = top;
-      // outaf("int stack %s at stack 0x%x\n", var->name, var->offset);
-      top += MAX(8, var->ty->size);
+        // Otherwise fall through to the stack slot assignment below.
+        break;
+      case TY_FLOAT:
+      case TY_DOUBLE:
+        if (reg++ < X64WIN_REG_MAX) {
+          var->offset = top;
+          top += 8;
+          continue;
+        }
+        break;
+      default:
+        if (reg++ < X64WIN_REG_MAX) {
+          var->offset = top;
+          top += 8;
+          // outaf("int reg %s at home 0x%x\n", var->name, var->offset);
+          continue;
+        }
     }
 
-    // Assign offsets to local variables.
-    for (Obj* var = fn->locals; var; var = var->next) {
-      if (var->offset) {
-        continue;
-      }
-
-      int align =
-          (var->ty->kind == TY_ARRAY && var->ty->size >= 16) ? MAX(16, var->align) : var->align;
+    var->offset = top;
+    // outaf("int stack %s at stack 0x%x\n", var->name, var->offset);
+    top += MAX(8, var->ty->size);
+  }
 
-      bottom += var->ty->size;
-      bottom = (int)align_to_s(bottom, align);
-      var->offset = -bottom;
-      // outaf("local %s at -0x%x\n", var->name, -var->offset);
+  // Assign offsets to local variables.
+  for (Obj* var = fn->locals; var; var = var->next) {
+    if (var->offset) {
+      continue;
     }
 
-    fn->stack_size = (int)align_to_s(bottom, 16);
+    int align =
+        (var->ty->kind == TY_ARRAY && var->ty->size >= 16) ? MAX(16, var->align) : var->align;
+
+    bottom += var->ty->size;
+    bottom = (int)align_to_s(bottom, align);
+    var->offset = -bottom;
+    // outaf("local %s at -0x%x\n", var->name, -var->offset);
   }
+
+  fn->stack_size = (int)align_to_s(bottom, 16);
 }
 
 #else  // SysV
 
 // Assign offsets to local variables.
-static void assign_lvar_offsets(Obj* prog) {
-  for (Obj* fn = prog; fn; fn = fn->next) {
-    if (!fn->is_function)
-      continue;
+static void assign_lvar_offsets(Obj* fn) {
+  // If a function has many parameters, some parameters are
+  // inevitably passed by stack rather than by register.
+  // The first passed-by-stack parameter resides at RBP+16.
+  int top = 16;
+  int bottom = 0;
 
-    // If a function has many parameters, some parameters are
-    // inevitably passed by stack rather than by register.
-    // The first passed-by-stack parameter resides at RBP+16.
-    int top = 16;
-    int bottom = 0;
-
-    int gp = 0, fp = 0;
+  int gp = 0, fp = 0;
 
-    // Assign offsets to pass-by-stack parameters.
-    for (Obj* var = fn->params; var; var = var->next) {
-      Type* ty = var->ty;
+  // Assign offsets to pass-by-stack parameters.
+  for (Obj* var = fn->params; var; var = var->next) {
+    Type* ty = var->ty;
 
-      switch (ty->kind) {
-        case TY_STRUCT:
-        case TY_UNION:
-          if (ty->size <= 8) {
-            bool fp1 = has_flonum(ty, 0, 8, 0);
-            if (fp + fp1 < SYSV_FP_MAX && gp + !fp1 < SYSV_GP_MAX) {
-              fp = fp + fp1;
-              gp = gp + !fp1;
-              continue;
-            }
-          } else if (ty->size <= 16) {
-            bool fp1 = has_flonum(ty, 0, 8, 0);
-            bool fp2 = has_flonum(ty, 8, 16, 8);
-            if (fp + fp1 + fp2 < SYSV_FP_MAX && gp + !fp1 + !fp2 < SYSV_GP_MAX) {
-              fp = fp + fp1 + fp2;
-              gp = gp + !fp1 + !fp2;
-              continue;
-            }
-          }
-          break;
-        case TY_FLOAT:
-        case TY_DOUBLE:
-          if (fp++ < SYSV_FP_MAX)
+    switch (ty->kind) {
+      case TY_STRUCT:
+      case TY_UNION:
+        if (ty->size <= 8) {
+          bool fp1 = has_flonum(ty, 0, 8, 0);
+          if (fp + fp1 < SYSV_FP_MAX && gp + !fp1 < SYSV_GP_MAX) {
+            fp = fp + fp1;
+            gp = gp + !fp1;
             continue;
-          break;
-        case TY_LDOUBLE:
-          break;
-        default:
-          if (gp++ < SYSV_GP_MAX)
+          }
+        } else if (ty->size <= 16) {
+          bool fp1 = has_flonum(ty, 0, 8, 0);
+          bool fp2 = has_flonum(ty, 8, 16, 8);
+          if (fp + fp1 + fp2 < SYSV_FP_MAX && gp + !fp1 + !fp2 < SYSV_GP_MAX) {
+            fp = fp + fp1 + fp2;
+            gp = gp + !fp1 + !fp2;
             continue;
-      }
-
-      top = align_to_s(top, 8);
-      var->offset = top;
-      top += var->ty->size;
-    }
-
-    // Assign offsets to pass-by-register parameters and local variables.
-    for (Obj* var = fn->locals; var; var = var->next) {
-      if (var->offset)
-        continue;
-
-      // AMD64 System V ABI has a special alignment rule for an array of
-      // length at least 16 bytes. We need to align such array to at least
-      // 16-byte boundaries. See p.14 of
-      // https://github.com/hjl-tools/x86-psABI/wiki/x86-64-psABI-draft.pdf.
-      int align =
-          (var->ty->kind == TY_ARRAY && var->ty->size >= 16) ? MAX(16, var->align) : var->align;
-
-      bottom += var->ty->size;
-      bottom = align_to_s(bottom, align);
-      var->offset = -bottom;
+          }
+        }
+        break;
+      case TY_FLOAT:
+      case TY_DOUBLE:
+        if (fp++ < SYSV_FP_MAX)
+          continue;
+        break;
+      case TY_LDOUBLE:
+        break;
+      default:
+        if (gp++ < SYSV_GP_MAX)
+          continue;
     }
 
-    fn->stack_size = align_to_s(bottom, 16);
+    top = align_to_s(top, 8);
+    var->offset = top;
+    top += var->ty->size;
   }
-}
 
-#endif  // SysV
+  // Assign offsets to pass-by-register parameters and local variables.
+  for (Obj* var = fn->locals; var; var = var->next) {
+    if (var->offset)
+      continue;
 
-static void linkfixup_push(FileLinkData* fld, char* target, char* fixup, int addend) {
-  if (!fld->fixups) {
-    fld->fixups = calloc(8, sizeof(LinkFixup));
-    fld->fcap = 8;
-  }
+    // AMD64 System V ABI has a special alignment rule for an array of
+    // length at least 16 bytes. We need to align such array to at least
+    // 16-byte boundaries. See p.14 of
+    // https://github.com/hjl-tools/x86-psABI/wiki/x86-64-psABI-draft.pdf.
+    int align =
+        (var->ty->kind == TY_ARRAY && var->ty->size >= 16) ? MAX(16, var->align) : var->align;
 
-  if (fld->fcap == fld->flen) {
-    fld->fixups = realloc(fld->fixups, sizeof(LinkFixup) * fld->fcap * 2);
-    fld->fcap *= 2;
+    bottom += var->ty->size;
+    bottom = align_to_s(bottom, align);
+    var->offset = -bottom;
   }
 
-  fld->fixups[fld->flen++] = (LinkFixup){fixup, strdup(target), addend};
+  fn->stack_size = align_to_s(bottom, 16);
 }
 
-static void emit_data(Obj* prog) {
-  for (Obj* var = prog; var; var = var->next) {
-    // outaf("var->name %s %d %d %d %d\n", var->name, var->is_function, var->is_definition,
-    // var->is_static, var->is_tentative);
-    if (var->is_function)
-      continue;
+#endif  // SysV
 
-    if (!var->is_definition) {
+static void emit_data(CompiledUnit* unit, Obj* prog, char** init_buf) {
+  for (Obj* var = prog; var; var = var->next) {
+    if (var->is_function || !var->is_definition)
       continue;
-    }
 
     int align =
         (var->ty->kind == TY_ARRAY && var->ty->size >= 16) ? MAX(16, var->align) : var->align;
 
-    // - rodata, always free existing entry in either static/extern
-    // global_data, and then recreate and reinitialize
-    //
-    // - if writeable data has an entry, it shouldn't be recreated. the
-    // dyo version doesn't reprocess kTypeInitializerDataRelocation or
-    // kTypeInitializerCodeRelocation; that's possibly a bug, but it'll
-    // need some testing to get a case where it comes up.
-    //
-    // TODO: if it changes from static to extern, is it the same
-    // variable? currently they're separate, so a switch causes a
-    // reinit, a leak, and some confusion.
-    //
-    // can't easily make a large single data segment allocation for all
-    // data because 1) the rodata change size link-over-link (put in
-    // codeseg?); 2) wdata don't move or reinit, but new ones get added
-    // as code evolves and we can't blow away or move the old ones.
-    //
-    // for now, just continue with individual regular aligned_allocate
-    // for all data objects and maintain their addresses here.
-
-    UserContext* uc = user_context;
-    // bool was_freed = false;
-    size_t idx = var->is_static ? C(file_index) : uc->num_files;
-    void* prev = hashmap_get(&user_context->global_data[idx], var->name);
-    if (prev) {
-      if (var->is_rodata) {
-        aligned_free(prev);
-        // was_freed = true;
-      } else {
-        // data already created and initialized, don't reinit.
-        continue;
-      }
-    }
-
-    void* global_data = aligned_allocate(var->ty->size, align);
-    memset(global_data, 0, var->ty->size);
-
-    // TODO: Is this wrong (or above)? If writable |x| in one file
-    // already existed and |x| in another is added, then it'll be
-    // silently ignored. If it's rodata it'll be silently replaced here
-    // by getting thrown away above and then recreated.
-    // Need to figure out where/how to have a duplicate symbol check.
-#if 0
-      if (!was_freed) {
-        void* prev = hashmap_get(&uc->global_data[idx], strings.data[name_index]);
-        if (prev) {
-          outaf("duplicated symbol: %s\n", strings.data[name_index]);
-          goto fail;
-        }
-      }
-#endif
-    // TODO: intern
-    hashmap_put(&uc->global_data[idx], strdup(var->name), global_data);
-
-    char* fillp = global_data;
-    FileLinkData* fld = &uc->files[C(file_index)];
+    int data_index = unit->num_data++;
+    UnitData* ud = &unit->data[data_index];
+    ud->name = var->name;
+    ud->size = var->ty->size;
+    ud->align = align;
+    ud->is_static = var->is_static;
+    ud->is_rodata = var->is_rodata;
+    C(data_size) += var->ty->size;
+
+    // If no init_data, then it's .bss and cleared when installed.
+    if (!var->init_data)
+      continue;
 
     // .data or .tdata
-    if (var->init_data) {
-      Relocation* rel = var->rel;
-      int pos = 0;
-      while (pos < var->ty->size) {
-        if (rel && rel->offset == pos) {
-          assert(!(rel->string_label && rel->internal_code_label));  // Shouldn't be both.
-          assert(rel->string_label ||
-                 rel->internal_code_label);  // But should be at least one if we're here.
-
-          if (rel->string_label) {
-            linkfixup_push(fld, *rel->string_label, fillp, rel->addend);
-          } else {
-            int offset = dasm_getpclabel(&C(dynasm), *rel->internal_code_label);
-            *((uintptr_t*)fillp) = (uintptr_t)(fld->codeseg_base_address + offset + rel->addend);
-          }
-
-          rel = rel->next;
-          pos += 8;
-          fillp += 8;
-        } else {
-          *fillp++ = var->init_data[pos++];
-        }
+    ud->init = *init_buf;
+    memcpy(ud->init, var->init_data, var->ty->size);
+    *init_buf += var->ty->size;
+
+    for (Relocation* rel = var->rel; rel; rel = rel->next) {
+      assert(!(rel->string_label && rel->internal_code_label));  // Shouldn't be both.
+      assert(rel->string_label ||
+             rel->internal_code_label);  // But should be at least one if we're here.
+
+      UnitReloc* ur = &unit->relocs[unit->num_relocs++];
+      ur->data_index = data_index;
+      ur->offset = rel->offset;
+      // Zeroed here, and filled out when installed or linked.
+      memset(ud->init + rel->offset, 0, sizeof(uintptr_t));
+      if (rel->string_label) {
+        ur->name = *rel->string_label;
+        ur->addend = (int)rel->addend;
+      } else {
+        ur->addend = dasm_getpclabel(&C(dynasm), *rel->internal_code_label) + (int)rel->addend;
       }
-
-      continue;
     }
-
-    // If no init_data, then already allocated and cleared (.bss).
   }
 }
 
@@ -2340,134 +2260,103 @@ static void store_gp(int r, int offset, int sz) {
 extern int __chkstk(void);
 #endif
 
-static void emit_text(Obj* prog) {
-  // Preallocate the dasm labels so they can be used in functions out of order.
-  for (Obj* fn = prog; fn; fn = fn->next) {
-    if (!fn->is_function || !fn->is_definition || !fn->is_live)
-      continue;
-
-    fn->dasm_return_label = codegen_pclabel();
-    fn->dasm_entry_label = codegen_pclabel();
-  }
-
-  for (Obj* fn = prog; fn; fn = fn->next) {
-    if (!fn->is_function || !fn->is_definition || !fn->is_live)
-      continue;
+// Emits the code for a function definition. parse() calls this as soon as it
+// has parsed the body of a function that will always be emitted, so that the
+// body's nodes can be discarded before the next function is parsed (see
+// function()). The rest are emitted by codegen() once it's known which are
+// used.
+IMPLSTATIC void codegen_function(Obj* fn) {
+  uint64_t start = get_time_ns();
+  assign_lvar_offsets(fn);
 
-    ///|=>fn->dasm_entry_label:
+  ///|=>fn->dasm_entry_label:
 
-    C(current_fn) = fn;
+  C(current_fn) = fn;
 
-    // outaf("---- %s\n", fn->name);
+  // outaf("---- %s\n", fn->name);
 
-    // Prologue
-    ///| push rbp
-    ///| mov rbp, rsp
+  // Prologue
+  ///| push rbp
+  ///| mov rbp, rsp
 
 #if X64WIN
-    // Stack probe on Windows if necessary. The MSDN reference for __chkstk says
-    // it's only necessary beyond 8k for x64, but cl does it at 4k.
-    if (fn->stack_size >= 4096) {
-      ///| mov rax, fn->stack_size
-      int fixup_location = codegen_pclabel();
-      strintarray_push(&C(fixups), (StringInt){"__chkstk", fixup_location}, AL_Compile);
+  // Stack probe on Windows if necessary. The MSDN reference for __chkstk says
+  // it's only necessary beyond 8k for x64, but cl does it at 4k.
+  if (fn->stack_size >= 4096) {
+    ///| mov rax, fn->stack_size
+    int fixup_location = codegen_pclabel();
+    strintarray_push(&C(fixups), (StringInt){intern("__chkstk"), fixup_location}, AL_Compile);
 #ifdef _MSC_VER
 #pragma warning(push)
 #pragma warning(disable : 4310)  // dynasm casts the top and bottom of the 64bit arg
 #endif
-      ///|=>fixup_location:
-      ///| mov64 r10, 0xc0dec0dec0dec0de
+    ///|=>fixup_location:
+    ///| mov64 r10, 0xc0dec0dec0dec0de
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
-      ///| call r10
-      ///| sub rsp, rax
-    } else
+    ///| call r10
+    ///| sub rsp, rax
+  } else
 #endif
 
-    {
-      ///| sub rsp, fn->stack_size
-    }
-    ///| mov [rbp+fn->alloca_bottom->offset], rsp
+  {
+    ///| sub rsp, fn->stack_size
+  }
+  ///| mov [rbp+fn->alloca_bottom->offset], rsp
 
 #if !X64WIN
-    // Save arg registers if function is variadic
-    if (fn->va_area) {
-      int gp = 0, fp = 0;
-      for (Obj* var = fn->params; var; var = var->next) {
-        if (is_flonum(var->ty))
-          fp++;
-        else
-          gp++;
-      }
-
-      int off = fn->va_area->offset;
-
-      // va_elem
-      ///| mov dword [rbp+off], gp*8            // gp_offset
-      ///| mov dword [rbp+off+4], fp * 8 + 48   // fp_offset
-      ///| mov [rbp+off+8], rbp                 // overflow_arg_area
-      ///| add qword [rbp+off+8], 16
-      ///| mov [rbp+off+16], rbp                // reg_save_area
-      ///| add qword [rbp+off+16], off+24
-
-      // __reg_save_area__
-      ///| mov [rbp + off + 24], rdi
-      ///| mov [rbp + off + 32], rsi
-      ///| mov [rbp + off + 40], rdx
-      ///| mov [rbp + off + 48], rcx
-      ///| mov [rbp + off + 56], r8
-      ///| mov [rbp + off + 64], r9
-      ///| movsd qword [rbp + off + 72], xmm0
-      ///| movsd qword [rbp + off + 80], xmm1
-      ///| movsd qword [rbp + off + 88], xmm2
-      ///| movsd qword [rbp + off + 96], xmm3
-      ///| movsd qword [rbp + off + 104], xmm4
-      ///| movsd qword [rbp + off + 112], xmm5
-      ///| movsd qword [rbp + off + 120], xmm6
-      ///| movsd qword [rbp + off + 128], xmm7
+  // Save arg registers if function is variadic
+  if (fn->va_area) {
+    int gp = 0, fp = 0;
+    for (Obj* var = fn->params; var; var = var->next) {
+      if (is_flonum(var->ty))
+        fp++;
+      else
+        gp++;
     }
+
+    int off = fn->va_area->offset;
+
+    // va_elem
+    ///| mov dword [rbp+off], gp*8            // gp_offset
+    ///| mov dword [rbp+off+4], fp * 8 + 48   // fp_offset
+    ///| mov [rbp+off+8], rbp                 // overflow_arg_area
+    ///| add qword [rbp+off+8], 16
+    ///| mov [rbp+off+16], rbp                // reg_save_area
+    ///| add qword [rbp+off+16], off+24
+
+    // __reg_save_area__
+    ///| mov [rbp + off + 24], rdi
+    ///| mov [rbp + off + 32], rsi
+    ///| mov [rbp + off + 40], rdx
+    ///| mov [rbp + off + 48], rcx
+    ///| mov [rbp + off + 56], r8
+    ///| mov [rbp + off + 64], r9
+    ///| movsd qword [rbp + off + 72], xmm0
+    ///| movsd qword [rbp + off + 80], xmm1
+    ///| movsd qword [rbp + off + 88], xmm2
+    ///| movsd qword [rbp + off + 96], xmm3
+    ///| movsd qword [rbp + off + 104], xmm4
+    ///| movsd qword [rbp + off + 112], xmm5
+    ///| movsd qword [rbp + off + 120], xmm6
+    ///| movsd qword [rbp + off + 128], xmm7
+  }
 #endif
 
 #if X64WIN
-    // If variadic, we have to store all registers; floats will have been
-    // duplicated into the integer registers.
-    if (fn->ty->is_variadic) {
-      ///| mov [rbp + 16], CARG1
-      ///| mov [rbp + 24], CARG2
-      ///| mov [rbp + 32], CARG3
-      ///| mov [rbp + 40], CARG4
-    } else {
-      // Save passed-by-register arguments to the stack
-      int reg = 0;
-      for (Obj* var = fn->params; var; var = var->next) {
-        if (var->offset >= 16 + PARAMETER_SAVE_SIZE)
-          continue;
-
-        Type* ty = var->ty;
-
-        switch (ty->kind) {
-          case TY_STRUCT:
-          case TY_UNION:
-            // It's either small and so passed in a register, or isn't and then
-            // we're instead storing the pointer to the larger struct.
-            store_gp(reg++, var->offset, MIN(8, ty->size));
-            break;
-          case TY_FLOAT:
-          case TY_DOUBLE:
-            store_fp(reg++, var->offset, ty->size);
-            break;
-          default:
-            store_gp(reg++, var->offset, ty->size);
-            break;
-        }
-      }
-    }
-#else
+  // If variadic, we have to store all registers; floats will have been
+  // duplicated into the integer registers.
+  if (fn->ty->is_variadic) {
+    ///| mov [rbp + 16], CARG1
+    ///| mov [rbp + 24], CARG2
+    ///| mov [rbp + 32], CARG3
+    ///| mov [rbp + 40], CARG4
+  } else {
     // Save passed-by-register arguments to the stack
-    int gp = 0, fp = 0;
+    int reg = 0;
     for (Obj* var = fn->params; var; var = var->next) {
-      if (var->offset > 0)
+      if (var->offset >= 16 + PARAMETER_SAVE_SIZE)
         continue;
 
       Type* ty = var->ty;
@@ -2475,74 +2364,89 @@ static void emit_text(Obj* prog) {
       switch (ty->kind) {
         case TY_STRUCT:
         case TY_UNION:
-          assert(ty->size <= 16);
-          if (has_flonum(ty, 0, 8, 0))
-            store_fp(fp++, var->offset, MIN(8, ty->size));
-          else
-            store_gp(gp++, var->offset, MIN(8, ty->size));
-
-          if (ty->size > 8) {
-            if (has_flonum(ty, 8, 16, 0))
-              store_fp(fp++, var->offset + 8, ty->size - 8);
-            else
-              store_gp(gp++, var->offset + 8, ty->size - 8);
-          }
+          // It's either small and so passed in a register, or isn't and then
+          // we're instead storing the pointer to the larger struct.
+          store_gp(reg++, var->offset, MIN(8, ty->size));
           break;
         case TY_FLOAT:
         case TY_DOUBLE:
-          store_fp(fp++, var->offset, ty->size);
+          store_fp(reg++, var->offset, ty->size);
           break;
         default:
-          store_gp(gp++, var->offset, ty->size);
+          store_gp(reg++, var->offset, ty->size);
+          break;
       }
     }
-#endif
+  }
+#else
+  // Save passed-by-register arguments to the stack
+  int gp = 0, fp = 0;
+  for (Obj* var = fn->params; var; var = var->next) {
+    if (var->offset > 0)
+      continue;
 
-    // Emit code
-    gen_stmt(fn->body);
-    assert(C(depth) == 0);
+    Type* ty = var->ty;
 
-    // [https://www.sigbus.info/n1570#5.1.2.2.3p1] The C spec defines
-    // a special rule for the main function. Reaching the end of the
-    // main function is equivalent to returning 0, even though the
-    // behavior is undefined for the other functions.
-    if (strcmp(fn->name, "main") == 0) {
-      ///| mov rax, 0
+    switch (ty->kind) {
+      case TY_STRUCT:
+      case TY_UNION:
+        assert(ty->size <= 16);
+        if (has_flonum(ty, 0, 8, 0))
+          store_fp(fp++, var->offset, MIN(8, ty->size));
+        else
+          store_gp(gp++, var->offset, MIN(8, ty->size));
+
+        if (ty->size > 8) {
+          if (has_flonum(ty, 8, 16, 0))
+            store_fp(fp++, var->offset + 8, ty->size - 8);
+          else
+            store_gp(gp++, var->offset + 8, ty->size - 8);
+        }
+        break;
+      case TY_FLOAT:
+      case TY_DOUBLE:
+        store_fp(fp++, var->offset, ty->size);
+        break;
+      default:
+        store_gp(gp++, var->offset, ty->size);
     }
+  }
+#endif
 
-    // Epilogue
-    ///|=>fn->dasm_return_label:
-    ///| mov rsp, rbp
-    ///| pop rbp
-    ///| ret
+  // Emit code
+  gen_stmt(fn->body);
+  assert(C(depth) == 0);
+
+  // [https://www.sigbus.info/n1570#5.1.2.2.3p1] The C spec defines
+  // a special rule for the main function. Reaching the end of the
+  // main function is equivalent to returning 0, even though the
+  // behavior is undefined for the other functions.
+  if (strcmp(fn->name, "main") == 0) {
+    ///| mov rax, 0
   }
-}
 
-static void fill_out_text_exports(Obj* prog, char* codeseg_base_address) {
-  // per-file from any previous need to be cleared out for this round.
-  hashmap_clear_manual_key_owned_value_unowned(&user_context->exports[C(file_index)]);
+  // Epilogue
+  ///|=>fn->dasm_return_label:
+  ///| mov rsp, rbp
+  ///| pop rbp
+  ///| ret
 
+  C(time_ns) += get_time_ns() - start;
+}
+
+static void fill_out_text_exports(CompiledUnit* unit, Obj* prog) {
   for (Obj* fn = prog; fn; fn = fn->next) {
     if (!fn->is_function || !fn->is_definition || !fn->is_live)
       continue;
 
-    int offset = dasm_getpclabel(&C(dynasm), fn->dasm_entry_label);
-    size_t idx = fn->is_static ? C(file_index) : user_context->num_files;
-    hashmap_put(&user_context->exports[idx], strdup(fn->name), codeseg_base_address + offset);
+    UnitExport* ue = &unit->exports[unit->num_exports++];
+    ue->name = fn->name;
+    ue->offset = dasm_getpclabel(&C(dynasm), fn->dasm_entry_label);
+    ue->is_static = fn->is_static;
   }
 }
 
-IMPLSTATIC void free_link_fixups(FileLinkData* fld) {
-  for (int i = 0; i < fld->flen; ++i) {
-    free(fld->fixups[i].name);
-  }
-  free(fld->fixups);
-  fld->fixups = NULL;
-  fld->flen = 0;
-  fld->fcap = 0;
-}
-
-static void fill_out_fixups(FileLinkData* fld) {
+static void fill_out_fixups(CompiledUnit* unit) {
   for (int i = 0; i < C(fixups).len; ++i) {
     int offset = dasm_getpclabel(&C(dynasm), C(fixups).data[i].i);
     // +2 is a hack taking advantage of the fact that import fixups are always
@@ -2552,51 +2456,99 @@ static void fill_out_fixups(FileLinkData* fld) {
     // slapped into place.
     offset += 2;
 
-    char* fixup = fld->codeseg_base_address + offset;
-    linkfixup_push(fld, C(fixups).data[i].str, fixup, /*addend=*/0);
+    UnitReloc* ur = &unit->relocs[unit->num_relocs++];
+    ur->name = C(fixups).data[i].str;
+    ur->data_index = -1;
+    ur->offset = offset;
   }
 }
 
-IMPLSTATIC void codegen_init(void) {
-  dasm_init(&C(dynasm), DASM_MAXSECTION);
-  dasm_growpc(&C(dynasm), 1 << 16);  // Arbitrary number to avoid lots of reallocs of that array.
+// Allocates a CompiledUnit with enough room for everything that will be
+// written to it from |prog|.
+static CompiledUnit* alloc_compiled_unit(Obj* prog, size_t code_size) {
+  int num_exports = 0;
+  int num_data = 0;
+  int num_relocs = C(fixups).len;
+  size_t init_size = 0;
+  for (Obj* var = prog; var; var = var->next) {
+    if (var->is_function) {
+      if (var->is_definition && var->is_live)
+        ++num_exports;
+      continue;
+    }
+    if (!var->is_definition)
+      continue;
+    ++num_data;
+    if (var->init_data) {
+      init_size += var->ty->size;
+      for (Relocation* rel = var->rel; rel; rel = rel->next)
+        ++num_relocs;
+    }
+  }
 
-  C(numlabels) = 1;
+  return compiled_unit_alloc(num_exports, num_data, num_relocs, code_size, init_size);
+}
+
+// Allocates a unit and its arrays as a single block. The data initializers
+// follow the code.
+IMPLSTATIC CompiledUnit* compiled_unit_alloc(int num_exports,
+                                             int num_data,
+                                             int num_relocs,
+                                             size_t code_size,
+                                             size_t init_size) {
+  size_t total_size = sizeof(CompiledUnit) +                  //
+                      num_exports * sizeof(UnitExport) +      //
+                      num_data * sizeof(UnitData) +           //
+                      num_relocs * sizeof(UnitReloc) +        //
+                      code_size +                             //
+                      init_size;
+  char* d = calloc(1, total_size);
+  CompiledUnit* unit = (CompiledUnit*)d;
+  d += sizeof(CompiledUnit);
+  unit->exports = (UnitExport*)d;
+  d += num_exports * sizeof(UnitExport);
+  unit->data = (UnitData*)d;
+  d += num_data * sizeof(UnitData);
+  unit->relocs = (UnitReloc*)d;
+  d += num_relocs * sizeof(UnitReloc);
+  unit->code = d;
+  unit->code_size = code_size;
+  return unit;
 }
 
-IMPLSTATIC void codegen(Obj* prog, size_t file_index) {
-  C(file_index) = file_index;
+IMPLSTATIC void codegen_init(void) {
+  dasm_init(&C(dynasm), DASM_MAXSECTION);
+  dasm_growpc(&C(dynasm), 1 << 16);  // Arbitrary number to avoid lots of reallocs of that array.
 
-  void* globals[dynasm_globals_MAX + 1];
+  // Set up for encoding here rather than in codegen(), as parse() emits
+  // functions as it goes (see codegen_function()).
+  void** globals = bumpcalloc(dynasm_globals_MAX + 1, sizeof(void*), AL_Compile);
   dasm_setupglobal(&C(dynasm), globals, dynasm_globals_MAX + 1);
-
   dasm_setup(&C(dynasm), dynasm_actions);
 
-  assign_lvar_offsets(prog);
-  emit_text(prog);
-
-  size_t code_size;
-  dasm_link(&C(dynasm), &code_size);
+  C(numlabels) = 1;
+}
 
-  FileLinkData* fld = &user_context->files[C(file_index)];
-  if (fld->codeseg_base_address) {
-    free_executable_memory(fld->codeseg_base_address, fld->codeseg_size);
+IMPLSTATIC CompiledUnit* codegen(Obj* prog) {
+  // The functions that parse() didn't emit, that is, the "static inline" ones
+  // that turned out to be used.
+  for (Obj* fn = prog; fn; fn = fn->next) {
+    if (fn->is_function && fn->is_definition && fn->is_live && fn->body)
+      codegen_function(fn);
   }
-  // VirtualAlloc and mmap don't accept 0.
-  if (code_size == 0)
-    code_size = 1;
-  unsigned int page_sized = (unsigned int)align_to_u(code_size, get_page_size());
-  fld->codeseg_size = page_sized;
-  fld->codeseg_base_address = allocate_writable_memory(page_sized);
-  // outaf("code_size: %zu, page_sized: %zu\n", code_size, page_sized);
 
-  fill_out_text_exports(prog, fld->codeseg_base_address);
+  size_t code_size;
+  dasm_link(&C(dynasm), &code_size);
+  C(code_size) = code_size;
 
-  free_link_fixups(fld);
-  emit_data(prog);  // This needs to point into code for fixups, so has to go late-ish.
-  fill_out_fixups(fld);
+  CompiledUnit* unit = alloc_compiled_unit(prog, code_size);
+  unit->embeds_context_addresses = C(embeds_context_addresses);
+  fill_out_text_exports(unit, prog);
+  char* init_buf = unit->code + code_size;
+  emit_data(unit, prog, &init_buf);
+  fill_out_fixups(unit);
 
-  dasm_encode(&C(dynasm), fld->codeseg_base_address);
+  dasm_encode(&C(dynasm), unit->code);
 
   int check_result = dasm_checkstep(&C(dynasm), DASM_SECTION_MAIN);
   if (check_result != DASM_S_OK) {
@@ -2605,11 +2557,13 @@ IMPLSTATIC void codegen(Obj* prog, size_t file_index) {
   }
 
   codegen_free();
+  return unit;
 }
 
 // This can be called after a longjmp in update.
 IMPLSTATIC void codegen_free(void) {
   if (C(dynasm)) {
     dasm_free(&C(dynasm));
+    C(dynasm) = NULL;
   }
 }
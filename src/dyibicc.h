@@ -51,19 +51,23 @@
 #endif
 
 #include "libdyibicc.h"
+#include "token_ids.h"
 
 #ifdef _MSC_VER
 #define NORETURN __declspec(noreturn)
+#define THREAD_LOCAL __declspec(thread)
 #define strdup _strdup
 #include <io.h>
 #define isatty _isatty
 #define fileno _fileno
 #else
 #define NORETURN _Noreturn
+#define THREAD_LOCAL _Thread_local
 #include <unistd.h>
 #endif
 
 #if !X64WIN
+#include <pthread.h>
 #include <strings.h>
 #endif
 
@@ -89,13 +93,30 @@ typedef enum AllocLifetime {
   AL_Compile = 0,  // Must be 0 so that 0-initialized structs default to this storage.
   AL_Temp,
   AL_Link,
-  AL_UserContext,
+  AL_UserContext,  // Shared by all threads, so only allocate while holding UserContext.lock.
   NUM_BUMP_HEAPS,
   AL_Manual = NUM_BUMP_HEAPS,
 } AllocLifetime;
 
+// A growable bump heap. The AL_UserContext heap is owned by the UserContext,
+// and the others by the thread that's compiling or linking.
+typedef struct HeapChunk HeapChunk;
+typedef struct HeapData {
+  HeapChunk* first;
+  HeapChunk* current;
+  char* alloc_pointer;
+  char* alloc_end;
+  size_t chunk_size;   // Size of the next chunk to be mapped, grows geometrically.
+  size_t retain_size;  // Bytes of chunks kept mapped across alloc_reset().
+  size_t used;         // Bytes allocated since the last reset.
+  size_t peak;         // High-water mark of |used|, see alloc_take_peak().
+} HeapData;
+
 IMPLSTATIC void alloc_init(AllocLifetime lifetime);
 IMPLSTATIC void alloc_reset(AllocLifetime lifetime);
+IMPLSTATIC void alloc_release(AllocLifetime lifetime);
+IMPLSTATIC void alloc_set_retain_size(AllocLifetime lifetime, size_t size);
+IMPLSTATIC size_t alloc_take_peak(AllocLifetime lifetime);
 
 IMPLSTATIC void* bumpcalloc(size_t num, size_t size, AllocLifetime lifetime);
 IMPLSTATIC void* bumplamerealloc(void* old,
@@ -110,6 +131,8 @@ IMPLSTATIC void* allocate_writable_memory(size_t size);
 IMPLSTATIC bool make_memory_readwrite(void* m, size_t size);
 IMPLSTATIC bool make_memory_executable(void* m, size_t size);
 IMPLSTATIC void free_executable_memory(void* p, size_t size);
+IMPLSTATIC void* map_file_readonly(char* path, size_t* size);
+IMPLSTATIC void unmap_file(void* p, size_t size);
 
 //
 // util.c
@@ -149,17 +172,42 @@ typedef struct IntIntArray {
   int len;
 } IntIntArray;
 
+// A file that was read while compiling, and a hash of its contents.
+typedef struct FileHash {
+  char* path;  // Interned.
+  uint64_t hash;
+} FileHash;
+
+typedef struct FileHashArray {
+  FileHash* data;
+  int capacity;
+  int len;
+} FileHashArray;
+
+// A file's contents as loaded by load_file(), read-only and NUL-terminated.
+typedef struct LoadedFile LoadedFile;
+struct LoadedFile {
+  char* contents;
+  size_t size;       // Not including the terminator.
+  void* mapping;     // If the file is mapped, otherwise contents is from malloc().
+  LoadedFile* next;  // In tokenize__sources.
+};
+
 IMPLSTATIC char* bumpstrndup(const char* s, size_t n, AllocLifetime lifetime);
 IMPLSTATIC char* bumpstrdup(const char* s, AllocLifetime lifetime);
+IMPLSTATIC bool same_path(char* a, char* b);
 IMPLSTATIC char* dirname(char* s);
 IMPLSTATIC uint64_t align_to_u(uint64_t n, uint64_t align);
 IMPLSTATIC int64_t align_to_s(int64_t n, int64_t align);
 IMPLSTATIC unsigned int get_page_size(void);
+IMPLSTATIC uint64_t get_time_ns(void);
 IMPLSTATIC void strarray_push(StringArray* arr, char* s, AllocLifetime lifetime);
 IMPLSTATIC void strintarray_push(StringIntArray* arr, StringInt item, AllocLifetime lifetime);
+IMPLSTATIC void filehasharray_push(FileHashArray* arr, FileHash item, AllocLifetime lifetime);
 IMPLSTATIC char* format(AllocLifetime lifetime, char* fmt, ...)
     __attribute__((format(printf, 2, 3)));
-IMPLSTATIC char* read_file_wrap_user(char* path, AllocLifetime lifetime);
+IMPLSTATIC bool load_file(char* path, LoadedFile* lf);
+IMPLSTATIC void unload_file(LoadedFile* lf);
 IMPLSTATIC NORETURN void error(char* fmt, ...) __attribute__((format(printf, 1, 2)));
 IMPLSTATIC NORETURN void error_at(char* loc, char* fmt, ...) __attribute__((format(printf, 2, 3)));
 IMPLSTATIC NORETURN void error_tok(Token* tok, char* fmt, ...)
@@ -167,6 +215,30 @@ IMPLSTATIC NORETURN void error_tok(Token* tok, char* fmt, ...)
 IMPLSTATIC NORETURN void error_internal(char* file, int line, char* msg);
 IMPLSTATIC int outaf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
 IMPLSTATIC void warn_tok(Token* tok, char* fmt, ...) __attribute__((format(printf, 2, 3)));
+IMPLSTATIC void output_capture_begin(ByteArray* buf);
+IMPLSTATIC void output_capture_end(void);
+
+#if X64WIN
+typedef void* Mutex;    // An SRWLOCK, which is pointer-sized.
+typedef void* CondVar;  // A CONDITION_VARIABLE, which is pointer-sized.
+typedef void* Thread;   // A HANDLE.
+#else
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t CondVar;
+typedef pthread_t Thread;
+#endif
+
+IMPLSTATIC void mutex_init(Mutex* m);
+IMPLSTATIC void mutex_destroy(Mutex* m);
+IMPLSTATIC void mutex_lock(Mutex* m);
+IMPLSTATIC void mutex_unlock(Mutex* m);
+IMPLSTATIC void condvar_init(CondVar* cv);
+IMPLSTATIC void condvar_destroy(CondVar* cv);
+IMPLSTATIC void condvar_wait(CondVar* cv, Mutex* m);  // |m| must be locked.
+IMPLSTATIC void condvar_broadcast(CondVar* cv);
+IMPLSTATIC bool thread_start(Thread* t, void (*func)(void*), void* arg);
+IMPLSTATIC void thread_join(Thread t);
+IMPLSTATIC int get_num_processors(void);
 
 //
 // tokenize.c
@@ -181,48 +253,103 @@ typedef enum {
   TK_NUM,      // Numeric literals
   TK_PP_NUM,   // Preprocessing numbers
   TK_EOF,      // End-of-file markers
+  TK_LAZY,     // The rest of an included header, see tokenize_header()
 } TokenKind;
 
-typedef struct {
+typedef struct File {
   char* name;
   char* contents;
 
   // For #line directive
   char* display_name;
   int line_delta;
+
+  // Offsets of the start of each line, built the first time a token's line
+  // number is needed.
+  int* line_starts;
+  int num_lines;
+
+  // Logical lines that have a backslash-newline or a \u or \U in them are
+  // tokenized from a spliced copy, which is a File of its own so that its
+  // tokens have line numbers (see tokenize_filecontents()). |spliced| is the
+  // copy, and the copy's |parent| is the file it's from.
+  struct File* spliced;
+  struct File* parent;
 } File;
 
+// Files whose contents are in increasing address order, see token_file().
+typedef struct {
+  File** files;
+  int len;
+  int capacity;
+} FileRun;
+
+// Payload of a TK_NUM or TK_STR token.
+typedef struct {
+  int64_t val;       // If TK_NUM, its value
+  long double fval;  // If TK_NUM, its value
+  Type* ty;          // Type of the literal
+  char* str;         // String literal contents including terminating '\0'
+} TokenLiteral;
+
 // Token type
+//
+// There are a lot of these, and macro expansion copies them, so they're kept
+// to 32 bytes. The source file and line are found from |loc| when needed (see
+// token_file() and token_line_no()), literal payloads are in a TokenLiteral,
+// and tokens produced by macro expansion are followed by their hideset and
+// origin (see preprocess.c).
 typedef struct Token Token;
+typedef struct LazyTokens LazyTokens;
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4201)  // nameless union
+#pragma warning(disable : 4214)  // bool bit fields
+#endif
 struct Token {
-  TokenKind kind;    // Token kind
-  Token* next;       // Next token
-  int64_t val;       // If kind is TK_NUM, its value
-  long double fval;  // If kind is TK_NUM, its value
-  char* loc;         // Token location
-  int len;           // Token length
-  Type* ty;          // Used if TK_NUM or TK_STR
-  char* str;         // String literal contents including terminating '\0'
-
-  File* file;        // Source location
-  char* filename;    // Filename
-  int line_no;       // Line number
-  int line_delta;    // Line number
-  bool at_bol;       // True if this token is at beginning of line
-  bool has_space;    // True if this token follows a space character
-  Hideset* hideset;  // For macro expansion
-  Token* origin;     // If this is expanded from a macro, the original token
+  Token* next;           // Next token
+  char* loc;             // Token location
+  int len;               // Token length
+  uint8_t kind;          // TokenKind
+  bool at_bol : 1;       // True if this token is at beginning of line
+  bool has_space : 1;    // True if this token follows a space character
+  bool is_expanded : 1;  // True if allocated with a TokenExpansion after it
+  uint16_t id;           // TokenId: which keyword, punctuator, or special identifier, if any
+  union {
+    char* ident;        // Interned name, if TK_IDENT (or a keyword)
+    TokenLiteral* lit;  // If TK_NUM or TK_STR
+    LazyTokens* lazy;   // If TK_LAZY
+  };
 };
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
 
-IMPLSTATIC bool equal(Token* tok, char* op);
-IMPLSTATIC Token* skip(Token* tok, char* op);
-IMPLSTATIC bool consume(Token** rest, Token* tok, char* str);
+IMPLSTATIC bool equal(Token* tok, TokenId id);
+IMPLSTATIC Token* skip(Token* tok, TokenId id);
+IMPLSTATIC bool consume(Token** rest, Token* tok, TokenId id);
+IMPLSTATIC void convert_pp_token(Token* tok);
 IMPLSTATIC void convert_pp_tokens(Token* tok);
+IMPLSTATIC bool read_int_literal(char* loc, int len, int64_t* val, Type** ty);
 IMPLSTATIC File* new_file(char* name, char* contents);
+IMPLSTATIC void add_file(File* file);
 IMPLSTATIC Token* tokenize_string_literal(Token* tok, Type* basety);
 IMPLSTATIC Token* tokenize(File* file);
 IMPLSTATIC Token* tokenize_file(char* filename);
 IMPLSTATIC Token* tokenize_filecontents(char* path, char* contents);
+IMPLSTATIC Token* tokenize_header(char* path, Token* rest, char** include_guard);
+IMPLSTATIC void fill_lazy_tokens(Token* tok);
+IMPLSTATIC void skip_lazy_tokens(Token* tok);
+IMPLSTATIC TokenId word_token_id(char* p, int len);  // In token_ids.c, see gen_tokens.py.
+IMPLSTATIC int read_punct(char* p, TokenId* id);
+IMPLSTATIC char* token_id_spelling(TokenId id);
+IMPLSTATIC File* token_file(Token* tok);
+IMPLSTATIC int token_line_no(Token* tok);
+IMPLSTATIC File* file_at(char* loc);
+IMPLSTATIC int line_no_at(char* loc);
+IMPLSTATIC void tokenize_free(void);
+IMPLSTATIC void header_cache_begin_update(void);
+IMPLSTATIC void header_cache_free(void);
 
 #define unreachable() error_internal(__FILE__, __LINE__, "unreachable")
 #define ABORT(msg) error_internal(__FILE__, __LINE__, msg)
@@ -232,8 +359,8 @@ IMPLSTATIC Token* tokenize_filecontents(char* path, char* contents);
 //
 
 IMPLSTATIC char* search_include_paths(char* filename);
+IMPLSTATIC void include_cache_flush(void);
 IMPLSTATIC void init_macros(void);
-IMPLSTATIC void define_macro(char* name, char* buf);
 IMPLSTATIC void undef_macro(char* name);
 IMPLSTATIC Token* preprocess(Token* tok);
 
@@ -510,23 +637,37 @@ struct Member {
   int bit_width;
 };
 
-IMPLEXTERN Type* ty_void;
-IMPLEXTERN Type* ty_bool;
-
-IMPLEXTERN Type* ty_char;
-IMPLEXTERN Type* ty_short;
-IMPLEXTERN Type* ty_int;
-IMPLEXTERN Type* ty_long;
-
-IMPLEXTERN Type* ty_uchar;
-IMPLEXTERN Type* ty_ushort;
-IMPLEXTERN Type* ty_uint;
-IMPLEXTERN Type* ty_ulong;
-
-IMPLEXTERN Type* ty_float;
-IMPLEXTERN Type* ty_double;
-IMPLEXTERN Type* ty_ldouble;
-
+// The base types are per-thread because declarator() records the declared
+// name on the type it returns, which may be one of these.
+IMPLEXTERN THREAD_LOCAL Type ty_void_storage;
+#define ty_void (&ty_void_storage)
+IMPLEXTERN THREAD_LOCAL Type ty_bool_storage;
+#define ty_bool (&ty_bool_storage)
+
+IMPLEXTERN THREAD_LOCAL Type ty_char_storage;
+#define ty_char (&ty_char_storage)
+IMPLEXTERN THREAD_LOCAL Type ty_short_storage;
+#define ty_short (&ty_short_storage)
+IMPLEXTERN THREAD_LOCAL Type ty_int_storage;
+#define ty_int (&ty_int_storage)
+IMPLEXTERN THREAD_LOCAL Type ty_long_storage;
+#define ty_long (&ty_long_storage)
+
+IMPLEXTERN THREAD_LOCAL Type ty_uchar_storage;
+#define ty_uchar (&ty_uchar_storage)
+IMPLEXTERN THREAD_LOCAL Type ty_ushort_storage;
+#define ty_ushort (&ty_ushort_storage)
+IMPLEXTERN THREAD_LOCAL Type ty_uint_storage;
+#define ty_uint (&ty_uint_storage)
+IMPLEXTERN THREAD_LOCAL Type ty_ulong_storage;
+#define ty_ulong (&ty_ulong_storage)
+
+IMPLEXTERN THREAD_LOCAL Type ty_float_storage;
+#define ty_float (&ty_float_storage)
+IMPLEXTERN THREAD_LOCAL Type ty_double_storage;
+#define ty_double (&ty_double_storage)
+IMPLEXTERN THREAD_LOCAL Type ty_ldouble_storage;
+#define ty_ldouble (&ty_ldouble_storage)
 IMPLEXTERN Type* ty_typedesc;
 
 IMPLSTATIC bool is_integer(Type* ty);
@@ -541,18 +682,65 @@ IMPLSTATIC Type* array_of(Type* base, int size);
 IMPLSTATIC Type* vla_of(Type* base, Node* expr);
 IMPLSTATIC Type* enum_type(void);
 IMPLSTATIC Type* struct_type(void);
+IMPLSTATIC Type* get_common_type(Type* ty1, Type* ty2);
 IMPLSTATIC void add_type(Node* node);
 
 //
 // codegen.c
 //
-typedef struct CompileOutputs {
-  HashMap* codeseg_static_symbols;
-  HashMap* codeseg_global_symbols;
-} CompileOutputs;
+
+// The output of compiling a translation unit, in a form that doesn't depend on
+// where the code will be placed, or on any other unit. Units are produced on
+// compile threads and then installed and linked on the thread calling
+// dyibicc_update(). Each is a single malloc() block, including the code and
+// data initializers; symbol names are interned.
+typedef struct UnitExport {
+  char* name;
+  int offset;  // Function entry, relative to the start of the code.
+  bool is_static;
+} UnitExport;
+
+typedef struct UnitData {
+  char* name;
+  char* init;  // |size| bytes of initializer, or NULL for zero-fill.
+  int size;
+  int align;
+  bool is_static;
+  bool is_rodata;
+} UnitData;
+
+// A pointer-sized value to be written into the code (data_index == -1) or
+// into a data object when the unit is installed.
+typedef struct UnitReloc {
+  char* name;  // Symbol resolved at link time, or NULL for an address in the unit's code.
+  int data_index;
+  int offset;  // Of the value in the code or the data object.
+  int addend;  // Added to the symbol's address, or code offset if |name| is NULL.
+} UnitReloc;
+
+typedef struct CompiledUnit {
+  char* code;
+  size_t code_size;
+  UnitExport* exports;
+  int num_exports;
+  UnitData* data;
+  int num_data;
+  UnitReloc* relocs;
+  int num_relocs;
+
+  // The code holds addresses of data owned by the UserContext (reflection
+  // types), so the unit can't be used by another context or process.
+  bool embeds_context_addresses;
+} CompiledUnit;
 
 IMPLSTATIC void codegen_init(void);
-IMPLSTATIC void codegen(Obj* prog, size_t file_index);
+IMPLSTATIC void codegen_function(Obj* fn);
+IMPLSTATIC CompiledUnit* codegen(Obj* prog);
+IMPLSTATIC CompiledUnit* compiled_unit_alloc(int num_exports,
+                                             int num_data,
+                                             int num_relocs,
+                                             size_t code_size,
+                                             size_t init_size);
 IMPLSTATIC void codegen_free(void);
 IMPLSTATIC int codegen_pclabel(void);
 #if X64WIN
@@ -577,12 +765,15 @@ typedef struct {
   char* key;
   int keylen;
   void* val;
+  uint64_t hash;
 } HashEntry;
 
 struct HashMap {
   HashEntry* buckets;
+  uint8_t* ctrl;  // One per bucket, see hashmap.c.
   int capacity;
   int used;
+  int deleted;
   AllocLifetime alloc_lifetime;
 };
 
@@ -592,14 +783,41 @@ IMPLSTATIC void hashmap_put(HashMap* map, char* key, void* val);
 IMPLSTATIC void hashmap_put2(HashMap* map, char* key, int keylen, void* val);
 IMPLSTATIC void hashmap_delete(HashMap* map, char* key);
 IMPLSTATIC void hashmap_delete2(HashMap* map, char* key, int keylen);
-IMPLSTATIC void hashmap_clear_manual_key_owned_value_owned_aligned(HashMap* map);
-IMPLSTATIC void hashmap_clear_manual_key_owned_value_unowned(HashMap* map);
+IMPLSTATIC uint64_t hash_bytes(char* s, size_t len);
+IMPLSTATIC uint64_t hash_combine(uint64_t seed, uint64_t hash);
+IMPLSTATIC void* hashmap_get_interned(HashMap* map, char* key);
+IMPLSTATIC void hashmap_put_interned(HashMap* map, char* key, void* val);
+IMPLSTATIC char* intern(char* s);
+IMPLSTATIC char* intern2(char* s, int len);
+IMPLSTATIC void hashmap_clear_manual_key_unowned_value_owned_aligned(HashMap* map);
+IMPLSTATIC void hashmap_clear_manual_key_unowned_value_unowned(HashMap* map);
 
 //
 // link.c
 //
+IMPLSTATIC void link_install_unit(size_t file_index, CompiledUnit* unit);
 IMPLSTATIC bool link_all_files(void);
 
+//
+// dyo.c
+//
+// Increment when the layout of the cached unit files changes.
+#define DYO_VERSION 1
+
+IMPLSTATIC char* dyo_cache_path(char* cache_dir, char* source_name, AllocLifetime lifetime);
+IMPLSTATIC bool dyo_save(char* path,
+                         CompiledUnit* unit,
+                         FileHash* deps,
+                         int num_deps,
+                         uint64_t build_hash,
+                         uint64_t cache_key);
+IMPLSTATIC CompiledUnit* dyo_load(char* path,
+                                  uint64_t build_hash,
+                                  FileHash** deps,
+                                  int* num_deps,
+                                  uint64_t* cache_key);
+IMPLSTATIC void dyo_create_cache_dir(char* cache_dir);
+
 //
 // Entire compiler state in one struct and linker in a second for clearing, esp.
 // after longjmp. There should be no globals outside of these structures.
@@ -622,8 +840,7 @@ typedef struct LinkFixup {
   // The address to fix up.
   void* at;
 
-  // Name of the symbol at which the fixup should point.
-  // TODO: Intern pool for all the import/export/global names.
+  // Name of the symbol at which the fixup should point (interned).
   char* name;
 
   // Added to the address that |name| resolves to.
@@ -638,15 +855,41 @@ typedef struct FileLinkData {
   LinkFixup* fixups;
   int flen;
   int fcap;
+
+  // The most recent successful compile of the file, kept so that it can be
+  // installed again without recompiling if none of |cached_deps| (the file
+  // itself and everything it included) have changed. See main.c.
+  CompiledUnit* cached_unit;
+  FileHash* cached_deps;
+  int num_cached_deps;
+  uint64_t cache_key;
 } FileLinkData;
 
 IMPLSTATIC void free_link_fixups(FileLinkData* fld);
 
+typedef struct CachedHeader CachedHeader;
+typedef struct CompilePool CompilePool;
+
 typedef struct UserContext {
   DyibiccLoadFileContents load_file_contents;
   DyibiccFunctionLookupFn get_function_address;
   DyibiccOutputFn output_function;
   bool use_ansi_codes;
+  int num_compile_threads;
+  size_t compile_heap_retain_size;
+  char* cache_dir;  // NULL if compiled units aren't saved to disk.
+
+  // Taken by compile threads around use of the shared parts of the context:
+  // intern_pool, reflect_types, header_cache, the include caches, building
+  // base_macros, and the AL_UserContext heap.
+  Mutex lock;
+
+  HeapData heap;  // Backs AL_UserContext allocations.
+
+  // The compile threads, which are kept, along with their heaps, from one
+  // update to the next. Started by the first update that compiles more than
+  // one file, and stopped by dyibicc_free(). See main.c.
+  CompilePool* compile_pool;
 
   size_t num_include_paths;
   char** include_paths;
@@ -657,12 +900,44 @@ typedef struct UserContext {
   // This is an array of num_files+1; 0..num_files-1 correspond to static
   // globals in the files in FileLinkData, and global_data[num_files] is the
   // fully global (exported) symbols. These HashMaps are also special because
-  // they're lifetime == AL_Manual.
+  // they're lifetime == AL_Manual. Keys are interned.
   HashMap* global_data;
 
   HashMap* exports;
 
   HashMap reflect_types;
+
+  // All identifiers and symbol names, see intern().
+  HashMap intern_pool;
+
+  // Tokens of included files, shared by all translation units, see
+  // tokenize_header(). Keys are interned paths.
+  HashMap header_cache;
+  CachedHeader* cached_headers;      // Every entry, including replaced ones.
+  uint64_t header_cache_generation;  // Incremented at the start of each update.
+
+  // Which include path each #include'd name was first found on, and whether
+  // the other files that were looked for exist, kept for the life of the
+  // context so that each is only checked once (see search_include_paths()).
+  // Keys are interned. Cleared by dyibicc_flush_include_cache(), and after an
+  // update that fails, which may have been for a header that's since been
+  // added.
+  HashMap include_cache;
+  HashMap file_exists_cache;
+
+  // The predefined macros, which every translation unit's macros shadow (see
+  // init_macros()), and the File their tokens point into. Built by the first
+  // TU that needs them; NULL until then.
+  HashMap base_macros;
+  File* base_macros_file;
+
+  // While an update for a single changed file is compiling, the file and its
+  // new contents, which are used instead of loading it (see load_file()).
+  char* update_path;
+  char* update_contents;
+
+  DyibiccStats stats;
+  DyibiccFileStats* file_stats;  // num_files of these, pointed to by stats.files.
 } UserContext;
 
 typedef struct dasm_State dasm_State;
@@ -672,14 +947,21 @@ typedef struct CompilerState {
   File* tokenize__current_file;  // Input file
   bool tokenize__at_bol;         // True if the current position is at the beginning of a line
   bool tokenize__has_space;      // True if the current position follows a space character
-  HashMap tokenize__keyword_map;
+  FileRun* tokenize__file_runs;  // Every File of the TU, by contents, see token_file()
+  int tokenize__num_file_runs;
+  int tokenize__file_runs_capacity;
+  char* tokenize__end;           // End of the input while tokenize() is running, else NULL
+  LoadedFile* tokenize__sources;  // Files loaded for the TU, see tokenize_free()
+  size_t tokenize__num_tokens;
+  uint64_t tokenize__time_ns;
+  FileHashArray tokenize__loaded_files;  // Everything read for the TU, in order.
 
   // preprocess.c
   HashMap preprocess__macros;
+  HashMap preprocess__hidesets;  // Hideset names -> interned Hideset
   CondIncl* preprocess__cond_incl;
   HashMap preprocess__pragma_once;
   int preprocess__include_next_idx;
-  HashMap preprocess__include_path_cache;
   HashMap preprocess__include_guards;
   int preprocess__counter_macro_i;
 
@@ -698,16 +980,25 @@ typedef struct CompilerState {
                                 // statement. Otherwise, NULL.
   Obj* parse__builtin_alloca;
   int parse__unique_name_id;
-  HashMap parse__typename_map;
+  size_t parse__num_nodes;
+  size_t parse__num_objs;
+  AllocLifetime parse__node_lifetime;  // Where new nodes go, see function().
 
   // codegen.in.c
   int codegen__depth;
-  size_t codegen__file_index;
   dasm_State* codegen__dynasm;
   Obj* codegen__current_fn;
   int codegen__numlabels;
   StringIntArray codegen__fixups;
   IntIntArray codegen__pending_code_pclabels;
+  size_t codegen__code_size;
+  size_t codegen__data_size;
+  bool codegen__embeds_context_addresses;
+  uint64_t codegen__time_ns;  // In codegen_function(), which is mostly called during parse().
+
+  // hashmap.c
+  HashMap hashmap__intern_cache;  // Front for the context's intern_pool, see intern2().
+  bool hashmap__use_intern_cache;   // Set for the length of a compile_file().
 
   // main.c
   char* main__base_file;
@@ -718,7 +1009,9 @@ typedef struct LinkerState {
   HashMap link__runtime_function_map;
 } LinkerState;
 
-IMPLEXTERN UserContext* user_context;
-IMPLEXTERN jmp_buf toplevel_update_jmpbuf;
-IMPLEXTERN CompilerState compiler_state;
-IMPLEXTERN LinkerState linker_state;
+// The context that the current thread is compiling or linking for. Set by the
+// public entry points for their duration, and by compile threads.
+IMPLEXTERN THREAD_LOCAL UserContext* user_context;
+IMPLEXTERN THREAD_LOCAL jmp_buf toplevel_update_jmpbuf;
+IMPLEXTERN THREAD_LOCAL CompilerState compiler_state;
+IMPLEXTERN THREAD_LOCAL LinkerState linker_state;
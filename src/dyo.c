@@ -0,0 +1,356 @@
+// Saves and loads CompiledUnits to files in a cache directory, so that a new
+// process can install files that haven't changed without compiling them.
+//
+// The format is position independent: a header, followed by arrays of fixed
+// size records, the code, the data initializers, and a string table, all
+// referred to by offsets from the start of the file. Integers are in the
+// host's byte order (always little-endian for the x64 targets). Any file that
+// doesn't match what this build would write is ignored, and the source is
+// compiled as usual.
+
+#include "dyibicc.h"
+
+#if X64WIN
+#include <direct.h>
+#endif
+
+static const char dyo_magic[8] = {'d', 'y', 'i', 'b', 'i', 'c', 'c', 'U'};
+
+#define DYO_NO_NAME UINT32_MAX
+
+typedef struct DyoHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_deps;
+  uint64_t build_hash;
+  uint64_t cache_key;
+  uint32_t num_exports;
+  uint32_t num_data;
+  uint32_t num_relocs;
+  uint32_t strings_size;
+  uint64_t code_size;
+  uint64_t init_size;
+
+  // Offsets from the start of the file.
+  uint64_t deps_offset;
+  uint64_t exports_offset;
+  uint64_t data_offset;
+  uint64_t relocs_offset;
+  uint64_t code_offset;
+  uint64_t init_offset;
+  uint64_t strings_offset;
+} DyoHeader;
+
+// Names and paths are offsets into the string table.
+
+typedef struct DyoDep {
+  uint32_t path;
+  uint32_t padding;
+  uint64_t hash;
+} DyoDep;
+
+typedef struct DyoExport {
+  uint32_t name;
+  int32_t offset;
+  uint8_t is_static;
+  uint8_t padding[7];
+} DyoExport;
+
+typedef struct DyoData {
+  uint32_t name;
+  int32_t size;
+  int32_t align;
+  uint8_t is_static;
+  uint8_t is_rodata;
+  uint8_t has_init;
+  uint8_t padding;
+  uint64_t init;  // Offset into the data initializers.
+} DyoData;
+
+typedef struct DyoReloc {
+  uint32_t name;  // DYO_NO_NAME for an address in the unit's code.
+  int32_t data_index;
+  int32_t offset;
+  int32_t addend;
+} DyoReloc;
+
+// Gets the name of the cache file for the given source file.
+IMPLSTATIC char* dyo_cache_path(char* cache_dir, char* source_name, AllocLifetime lifetime) {
+  return format(lifetime, "%s/%016llx.dyo", cache_dir,
+                (unsigned long long)hash_bytes(source_name, strlen(source_name)));
+}
+
+static uint32_t add_string(ByteArray* strings, char* s) {
+  if (!s)
+    return DYO_NO_NAME;
+  int len = (int)strlen(s) + 1;
+  if (strings->len + len > strings->capacity) {
+    strings->capacity = MAX(strings->capacity * 2, strings->len + len);
+    strings->data = realloc(strings->data, strings->capacity);
+  }
+  uint32_t ret = strings->len;
+  memcpy(strings->data + strings->len, s, len);
+  strings->len += len;
+  return ret;
+}
+
+static size_t unit_init_size(CompiledUnit* unit) {
+  size_t size = 0;
+  for (int i = 0; i < unit->num_data; ++i) {
+    if (unit->data[i].init)
+      size += unit->data[i].size;
+  }
+  return size;
+}
+
+// Writes |unit| and the files it was compiled from to |path|. Returns false
+// on failure, which isn't reported as the cache is only an optimization.
+IMPLSTATIC bool dyo_save(char* path,
+                         CompiledUnit* unit,
+                         FileHash* deps,
+                         int num_deps,
+                         uint64_t build_hash,
+                         uint64_t cache_key) {
+  if (unit->embeds_context_addresses)
+    return false;
+
+  size_t init_size = unit_init_size(unit);
+  size_t records_size = num_deps * sizeof(DyoDep) + unit->num_exports * sizeof(DyoExport) +
+                        unit->num_data * sizeof(DyoData) + unit->num_relocs * sizeof(DyoReloc);
+  char* records = calloc(1, records_size + 1);
+  ByteArray strings = {0};
+
+  DyoHeader h = {0};
+  memcpy(h.magic, dyo_magic, sizeof(h.magic));
+  h.version = DYO_VERSION;
+  h.num_deps = num_deps;
+  h.build_hash = build_hash;
+  h.cache_key = cache_key;
+  h.num_exports = unit->num_exports;
+  h.num_data = unit->num_data;
+  h.num_relocs = unit->num_relocs;
+  h.code_size = unit->code_size;
+  h.init_size = init_size;
+
+  DyoDep* dd = (DyoDep*)records;
+  h.deps_offset = sizeof(DyoHeader);
+  for (int i = 0; i < num_deps; ++i) {
+    dd[i].path = add_string(&strings, deps[i].path);
+    dd[i].hash = deps[i].hash;
+  }
+
+  DyoExport* de = (DyoExport*)&dd[num_deps];
+  h.exports_offset = h.deps_offset + num_deps * sizeof(DyoDep);
+  for (int i = 0; i < unit->num_exports; ++i) {
+    de[i].name = add_string(&strings, unit->exports[i].name);
+    de[i].offset = unit->exports[i].offset;
+    de[i].is_static = unit->exports[i].is_static;
+  }
+
+  DyoData* dt = (DyoData*)&de[unit->num_exports];
+  h.data_offset = h.exports_offset + unit->num_exports * sizeof(DyoExport);
+  uint64_t init_offset = 0;
+  for (int i = 0; i < unit->num_data; ++i) {
+    UnitData* ud = &unit->data[i];
+    dt[i].name = add_string(&strings, ud->name);
+    dt[i].size = ud->size;
+    dt[i].align = ud->align;
+    dt[i].is_static = ud->is_static;
+    dt[i].is_rodata = ud->is_rodata;
+    dt[i].has_init = ud->init != NULL;
+    if (ud->init) {
+      dt[i].init = init_offset;
+      init_offset += ud->size;
+    }
+  }
+
+  DyoReloc* dr = (DyoReloc*)&dt[unit->num_data];
+  h.relocs_offset = h.data_offset + unit->num_data * sizeof(DyoData);
+  for (int i = 0; i < unit->num_relocs; ++i) {
+    UnitReloc* ur = &unit->relocs[i];
+    dr[i].name = add_string(&strings, ur->name);
+    dr[i].data_index = ur->data_index;
+    dr[i].offset = ur->offset;
+    dr[i].addend = ur->addend;
+  }
+
+  h.code_offset = h.relocs_offset + unit->num_relocs * sizeof(DyoReloc);
+  h.init_offset = h.code_offset + unit->code_size;
+  h.strings_offset = h.init_offset + init_size;
+  h.strings_size = strings.len;
+
+  // Written to a temporary and then renamed, so that another process never
+  // sees a partial file.
+  char* tmp_path = format(AL_Temp, "%s.%llx.tmp", path, (unsigned long long)get_time_ns());
+  FILE* fp = fopen(tmp_path, "wb");
+  bool ok = fp != NULL;
+  if (ok) {
+    ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    ok = ok && fwrite(records, 1, records_size, fp) == records_size;
+    ok = ok && fwrite(unit->code, 1, unit->code_size, fp) == unit->code_size;
+    for (int i = 0; ok && i < unit->num_data; ++i) {
+      UnitData* ud = &unit->data[i];
+      if (ud->init)
+        ok = fwrite(ud->init, 1, ud->size, fp) == (size_t)ud->size;
+    }
+    ok = ok && fwrite(strings.data, 1, strings.len, fp) == (size_t)strings.len;
+    ok = fclose(fp) == 0 && ok;
+  }
+  if (ok) {
+#if X64WIN
+    remove(path);  // rename() doesn't replace on Windows.
+#endif
+    ok = rename(tmp_path, path) == 0;
+  }
+  if (!ok)
+    remove(tmp_path);
+
+  free(records);
+  free(strings.data);
+  return ok;
+}
+
+static bool in_bounds(uint64_t offset, uint64_t size, uint64_t limit) {
+  return offset <= limit && size <= limit - offset;
+}
+
+// Checks that a string table offset refers to a terminated string.
+static char* get_string(char* strings, uint32_t size, uint32_t offset) {
+  if (offset >= size || !memchr(strings + offset, 0, size - offset))
+    return NULL;
+  return strings + offset;
+}
+
+// Loads a unit previously written by dyo_save() from |path|. Returns NULL if
+// there's no file, or it was written by a different build or is malformed.
+// Otherwise the unit and *deps are malloc()d, with names and paths interned.
+IMPLSTATIC CompiledUnit* dyo_load(char* path,
+                                  uint64_t build_hash,
+                                  FileHash** deps,
+                                  int* num_deps,
+                                  uint64_t* cache_key) {
+  FILE* fp = fopen(path, "rb");
+  if (!fp)
+    return NULL;
+  fseek(fp, 0, SEEK_END);
+  long file_size = ftell(fp);
+  rewind(fp);
+  if (file_size < (long)sizeof(DyoHeader)) {
+    fclose(fp);
+    return NULL;
+  }
+  char* buf = malloc(file_size);
+  bool read_ok = fread(buf, 1, file_size, fp) == (size_t)file_size;
+  fclose(fp);
+
+  CompiledUnit* unit = NULL;
+  FileHash* fh = NULL;
+  DyoHeader h;
+  memcpy(&h, buf, sizeof(h));
+  uint64_t size = (uint64_t)file_size;
+  if (!read_ok || memcmp(h.magic, dyo_magic, sizeof(h.magic)) != 0 || h.version != DYO_VERSION ||
+      h.build_hash != build_hash || h.num_deps == 0 || h.num_deps > INT_MAX ||
+      h.num_exports > INT_MAX || h.num_data > INT_MAX || h.num_relocs > INT_MAX ||
+      !in_bounds(h.deps_offset, h.num_deps * sizeof(DyoDep), size) ||
+      !in_bounds(h.exports_offset, h.num_exports * sizeof(DyoExport), size) ||
+      !in_bounds(h.data_offset, h.num_data * sizeof(DyoData), size) ||
+      !in_bounds(h.relocs_offset, h.num_relocs * sizeof(DyoReloc), size) ||
+      !in_bounds(h.code_offset, h.code_size, size) || !in_bounds(h.init_offset, h.init_size, size) ||
+      !in_bounds(h.strings_offset, h.strings_size, size)) {
+    goto fail;
+  }
+
+  char* strings = buf + h.strings_offset;
+  DyoDep* dd = (DyoDep*)(buf + h.deps_offset);
+  DyoExport* de = (DyoExport*)(buf + h.exports_offset);
+  DyoData* dt = (DyoData*)(buf + h.data_offset);
+  DyoReloc* dr = (DyoReloc*)(buf + h.relocs_offset);
+
+  fh = calloc(h.num_deps, sizeof(FileHash));
+  for (uint32_t i = 0; i < h.num_deps; ++i) {
+    char* dep_path = get_string(strings, h.strings_size, dd[i].path);
+    if (!dep_path)
+      goto fail;
+    fh[i].path = intern(dep_path);
+    fh[i].hash = dd[i].hash;
+  }
+
+  unit = compiled_unit_alloc(h.num_exports, h.num_data, h.num_relocs, h.code_size, h.init_size);
+  memcpy(unit->code, buf + h.code_offset, h.code_size);
+  char* init_buf = unit->code + h.code_size;
+  memcpy(init_buf, buf + h.init_offset, h.init_size);
+
+  for (uint32_t i = 0; i < h.num_exports; ++i) {
+    UnitExport* ue = &unit->exports[i];
+    ue->name = get_string(strings, h.strings_size, de[i].name);
+    if (!ue->name || de[i].offset < 0 || (uint64_t)de[i].offset >= h.code_size)
+      goto fail;
+    ue->name = intern(ue->name);
+    ue->offset = de[i].offset;
+    ue->is_static = de[i].is_static;
+  }
+  unit->num_exports = h.num_exports;
+
+  for (uint32_t i = 0; i < h.num_data; ++i) {
+    UnitData* ud = &unit->data[i];
+    ud->name = get_string(strings, h.strings_size, dt[i].name);
+    if (!ud->name || dt[i].size < 0 || dt[i].align <= 0)
+      goto fail;
+    if (dt[i].has_init) {
+      if (!in_bounds(dt[i].init, dt[i].size, h.init_size))
+        goto fail;
+      ud->init = init_buf + dt[i].init;
+    }
+    ud->name = intern(ud->name);
+    ud->size = dt[i].size;
+    ud->align = dt[i].align;
+    ud->is_static = dt[i].is_static;
+    ud->is_rodata = dt[i].is_rodata;
+  }
+  unit->num_data = h.num_data;
+
+  for (uint32_t i = 0; i < h.num_relocs; ++i) {
+    UnitReloc* ur = &unit->relocs[i];
+    // The target of a relocation has to be within the code or data object.
+    uint64_t limit;
+    if (dr[i].data_index == -1)
+      limit = h.code_size;
+    else if (dr[i].data_index >= 0 && (uint32_t)dr[i].data_index < h.num_data)
+      limit = unit->data[dr[i].data_index].size;
+    else
+      goto fail;
+    if (dr[i].offset < 0 || !in_bounds(dr[i].offset, sizeof(uintptr_t), limit))
+      goto fail;
+    if (dr[i].name != DYO_NO_NAME) {
+      ur->name = get_string(strings, h.strings_size, dr[i].name);
+      if (!ur->name)
+        goto fail;
+      ur->name = intern(ur->name);
+    }
+    ur->data_index = dr[i].data_index;
+    ur->offset = dr[i].offset;
+    ur->addend = dr[i].addend;
+  }
+  unit->num_relocs = h.num_relocs;
+
+  free(buf);
+  *deps = fh;
+  *num_deps = h.num_deps;
+  *cache_key = h.cache_key;
+  return unit;
+
+fail:
+  free(buf);
+  free(unit);
+  free(fh);
+  return NULL;
+}
+
+// Creates the cache directory if it doesn't already exist.
+IMPLSTATIC void dyo_create_cache_dir(char* cache_dir) {
+#if X64WIN
+  _mkdir(cache_dir);
+#else
+  mkdir(cache_dir, 0777);
+#endif
+}
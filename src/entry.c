@@ -1,7 +1,9 @@
 #include "dyibicc.h"
 
 static void usage(int status) {
-  printf("dyibicc [-E] [-e symbolname] [-I <path>] <file0> [<file1>...]\n");
+  printf(
+      "dyibicc [-E] [-e symbolname] [-I <path>] [-j<threads>] [--cache-dir=<dir>] [--stats] <file0> "
+      "[<file1>...]\n");
   exit(status);
 }
 
@@ -17,26 +19,37 @@ static bool take_arg(char* arg) {
   return false;
 }
 
-// Returns the contents of a given file. Doesn't support '-' for reading from
-// stdin.
-static bool read_file(const char* path, char** contents, size_t* size) {
-  FILE* fp = fopen(path, "rb");
-  if (!fp) {
-    return false;
+static void print_stats(const DyibiccStats* stats) {
+#define MS(ns) ((double)(ns) / 1e6)
+  fprintf(stderr, "%-32s %10s %10s %10s %10s %10s %10s %10s %10s\n", "file", "tokens", "nodes",
+          "tokenize", "preproc", "parse", "codegen", "code", "heap");
+  for (size_t i = 0; i < stats->num_files; ++i) {
+    const DyibiccFileStats* fs = &stats->files[i];
+    if (!fs->compiled)
+      continue;
+    fprintf(stderr, "%-32s %10zu %10zu %8.2fms %8.2fms %8.2fms %8.2fms %10zu %9zuk\n", fs->name,
+            fs->num_tokens, fs->num_nodes, MS(fs->tokenize_ns), MS(fs->preprocess_ns),
+            MS(fs->parse_ns), MS(fs->codegen_ns), fs->code_bytes, fs->compile_heap_peak / 1024);
   }
-
-  fseek(fp, 0, SEEK_END);
-  *size = ftell(fp);
-  rewind(fp);
-  *contents = malloc(*size);
-  fread(*contents, 1, *size, fp);
-  fclose(fp);
-  return true;
+  fprintf(stderr, "%-32s %10zu %10zu %8.2fms %8.2fms %8.2fms %8.2fms %10zu %9zuk\n", "total",
+          stats->num_tokens, stats->num_nodes, MS(stats->tokenize_ns), MS(stats->preprocess_ns),
+          MS(stats->parse_ns), MS(stats->codegen_ns), stats->code_bytes,
+          stats->compile_heap_peak / 1024);
+  fprintf(stderr, "link %.2fms, update %.2fms, %zu fixups, %zu data bytes, %zu files cached\n",
+          MS(stats->link_ns), MS(stats->total_ns), stats->num_fixups, stats->data_bytes,
+          stats->num_files_cached);
+  fprintf(stderr, "heap peaks: temp %zuk, link %zuk, user context %zuk\n",
+          stats->temp_heap_peak / 1024, stats->link_heap_peak / 1024,
+          stats->user_context_heap_peak / 1024);
+#undef MS
 }
 
 static void parse_args(int argc,
                        char** argv,
                        char** entry_point_override,
+                       bool* show_stats,
+                       int* num_threads,
+                       char** cache_dir,
                        StringArray* include_paths,
                        StringArray* input_paths) {
   for (int i = 1; i < argc; i++)
@@ -55,6 +68,23 @@ static void parse_args(int argc,
       continue;
     }
 
+    if (!strncmp(argv[i], "-j", 2)) {
+      *num_threads = atoi(argv[i] + 2);
+      if (*num_threads < 1)
+        error("invalid thread count: %s", argv[i]);
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--cache-dir=", 12)) {
+      *cache_dir = argv[i] + 12;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--stats")) {
+      *show_stats = true;
+      continue;
+    }
+
     if (!strcmp(argv[i], "--help"))
       usage(0);
 
@@ -81,7 +111,11 @@ int main(int argc, char** argv) {
   StringArray include_paths = {0};
   StringArray input_paths = {0};
   char* entry_point_override = "main";
-  parse_args(argc, argv, &entry_point_override, &include_paths, &input_paths);
+  bool show_stats = false;
+  int num_threads = -1;  // One per processor.
+  char* cache_dir = NULL;
+  parse_args(argc, argv, &entry_point_override, &show_stats, &num_threads, &cache_dir,
+             &include_paths, &input_paths);
   strarray_push(&include_paths, NULL, AL_Link);
   strarray_push(&input_paths, NULL, AL_Link);
 
@@ -89,9 +123,11 @@ int main(int argc, char** argv) {
       .include_paths = (const char**)include_paths.data,
       .files = (const char**)input_paths.data,
       .dyibicc_include_dir = "./include",
-      .load_file_contents = read_file,
+      .load_file_contents = NULL,
       .get_function_address = NULL,
       .output_function = NULL,
+      .cache_dir = cache_dir,
+      .num_compile_threads = num_threads,
       .use_ansi_codes = isatty(fileno(stdout)),
   };
 
@@ -101,7 +137,11 @@ int main(int argc, char** argv) {
 
   int result = 0;
 
-  if (dyibicc_update(ctx, NULL, NULL)) {
+  bool update_ok = dyibicc_update(ctx, NULL, NULL);
+  if (show_stats)
+    print_stats(dyibicc_get_stats(ctx));
+
+  if (update_ok) {
     void* entry_point = dyibicc_find_export(ctx, entry_point_override);
     if (entry_point) {
       int myargc = 1;
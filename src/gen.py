@@ -13,6 +13,7 @@ ROOT_DIR = os.path.normpath(
 FILELIST = [
     'type.c',
     'alloc.c',
+    'dyo.c',
     'entry.c',
     'hashmap.c',
     'link.c',
@@ -27,22 +28,25 @@ FILELIST = [
 CONFIGS = {
     'w': {
         'r': {
-            'COMPILE': 'cl /showIncludes /nologo /FS /Ox /GL /Zi /DNDEBUG /DIMPLSTATIC= /DIMPLEXTERN=extern /D_CRT_SECURE_NO_DEPRECATE /W4 /WX /I$root /c $in /Fo$out /Fddyibicc.pdb',
+            'COMPILE': 'cl /showIncludes /nologo /FS /Ox /GL /Zi /DNDEBUG /DIMPLSTATIC= /DIMPLEXTERN=extern /D_CRT_SECURE_NO_DEPRECATE /W4 /WX /I$root /I. /c $in /Fo$out /Fddyibicc.pdb',
             'LINK': 'link /nologo gdi32.lib user32.lib onecore.lib /LTCG /DEBUG /OPT:REF /OPT:ICF $in /out:$out',
             'ML': 'cl /nologo /wd4132 /wd4324 $in /link /out:$out',
             'TESTCEXE': 'cl /nologo /D_CRT_SECURE_NO_WARNINGS /Iembed /W4 /Wall /WX $in /link onecore.lib user32.lib /out:$out',
+            'BENCHCEXE': 'cl /nologo /O2 /D_CRT_SECURE_NO_WARNINGS /Iembed $in /link onecore.lib user32.lib /out:$out',
         },
         'd': {
-            'COMPILE': 'cl /showIncludes /nologo /FS /Od /Zi /D_DEBUG /DIMPLSTATIC= /DIMPLEXTERN=extern /D_CRT_SECURE_NO_DEPRECATE /W4 /WX /I$root /c $in /Fo:$out /Fddyibicc.pdb',
+            'COMPILE': 'cl /showIncludes /nologo /FS /Od /Zi /D_DEBUG /DIMPLSTATIC= /DIMPLEXTERN=extern /D_CRT_SECURE_NO_DEPRECATE /W4 /WX /I$root /I. /c $in /Fo:$out /Fddyibicc.pdb',
             'LINK': 'link /nologo gdi32.lib user32.lib onecore.lib /DEBUG $in /out:$out',
             'ML': 'cl /nologo /wd4132 /wd4324 $in /link /out:$out',
             'TESTCEXE': 'cl /nologo /D_CRT_SECURE_NO_WARNINGS /Iembed /W4 /Wall /WX $in /link onecore.lib user32.lib /out:$out',
+            'BENCHCEXE': 'cl /nologo /O2 /D_CRT_SECURE_NO_WARNINGS /Iembed $in /link onecore.lib user32.lib /out:$out',
         },
         'a': {
-            'COMPILE': 'cl /showIncludes /nologo /FS /Od /fsanitize=address /Zi /D_DEBUG /DIMPLSTATIC= /DIMPLEXTERN=extern /D_CRT_SECURE_NO_DEPRECATE /W4 /WX /I$root /c $in /Fo:$out /Fddyibicc.pdb',
+            'COMPILE': 'cl /showIncludes /nologo /FS /Od /fsanitize=address /Zi /D_DEBUG /DIMPLSTATIC= /DIMPLEXTERN=extern /D_CRT_SECURE_NO_DEPRECATE /W4 /WX /I$root /I. /c $in /Fo:$out /Fddyibicc.pdb',
             'LINK': 'link /nologo gdi32.lib user32.lib onecore.lib /DEBUG $in /out:$out',
             'ML': 'cl /nologo /wd4132 /wd4324 $in /link /out:$out',
             'TESTCEXE': 'cl /nologo /D_CRT_SECURE_NO_WARNINGS /Iembed /W4 /Wall /WX $in /link onecore.lib user32.lib /out:$out',
+            'BENCHCEXE': 'cl /nologo /O2 /D_CRT_SECURE_NO_WARNINGS /Iembed $in /link onecore.lib user32.lib /out:$out',
         },
         '__': {
             'exe_ext': '.exe',
@@ -51,22 +55,25 @@ CONFIGS = {
     },
     'l': {
         'd': {
-            'COMPILE': 'clang -std=c11 -MMD -MT $out -MF $out.d -g -O0 -fcolor-diagnostics -fno-common -Wall -Werror -Wno-switch -DNDEBUG -DIMPLSTATIC= -DIMPLEXTERN=extern -pthread -I$root -c $in -o $out',
+            'COMPILE': 'clang -std=c11 -MMD -MT $out -MF $out.d -g -O0 -fcolor-diagnostics -fno-common -Wall -Werror -Wno-switch -DNDEBUG -DIMPLSTATIC= -DIMPLEXTERN=extern -pthread -I$root -I. -c $in -o $out',
             'LINK': 'clang -o $out $in -pthread -lm -ldl -g',
             'ML': 'clang -o $out $in -lm',
-            'TESTCEXE': 'clang -Iembed -Wall -Wextra -Werror -ldl -o $out $in',
+            'TESTCEXE': 'clang -Iembed -Wall -Wextra -Werror -pthread -ldl -o $out $in',
+            'BENCHCEXE': 'clang -O2 -Iembed -Wall -Werror -o $out $in -pthread -lm -ldl',
         },
         'r': {
-            'COMPILE': 'clang -std=c11 -MMD -MT $out -MF $out.d -g -Oz -fcolor-diagnostics -fno-common -Wall -Werror -Wno-switch -D_DEBUG -DIMPLSTATIC= -DIMPLEXTERN=extern -pthread -c -I$root $in -o $out',
+            'COMPILE': 'clang -std=c11 -MMD -MT $out -MF $out.d -g -Oz -fcolor-diagnostics -fno-common -Wall -Werror -Wno-switch -D_DEBUG -DIMPLSTATIC= -DIMPLEXTERN=extern -pthread -c -I$root -I. $in -o $out',
             'LINK': 'clang -o $out $in -pthread -lm -ldl -g',
             'ML': 'clang -o $out $in -lm',
-            'TESTCEXE': 'clang -Iembed -Wall -Wextra -Werror -ldl -o $out $in',
+            'TESTCEXE': 'clang -Iembed -Wall -Wextra -Werror -pthread -ldl -o $out $in',
+            'BENCHCEXE': 'clang -O2 -Iembed -Wall -Werror -o $out $in -pthread -lm -ldl',
         },
         'a': {
-            'COMPILE': 'clang -std=c11 -MMD -MT $out -MF $out.d -g -O0 -fsanitize=address -fcolor-diagnostics -fno-common -Wall -Werror -Wno-switch -D_DEBUG -DIMPLSTATIC= -DIMPLEXTERN=extern -pthread -c -I$root $in -o $out',
+            'COMPILE': 'clang -std=c11 -MMD -MT $out -MF $out.d -g -O0 -fsanitize=address -fcolor-diagnostics -fno-common -Wall -Werror -Wno-switch -D_DEBUG -DIMPLSTATIC= -DIMPLEXTERN=extern -pthread -c -I$root -I. $in -o $out',
             'LINK': 'clang -fsanitize=address -o $out $in -pthread -lm -ldl -g',
             'ML': 'clang -o $out $in -lm',
-            'TESTCEXE': 'clang -Iembed -Wall -Wextra -Werror -ldl -fsanitize=address -o $out $in',
+            'TESTCEXE': 'clang -Iembed -Wall -Wextra -Werror -pthread -ldl -fsanitize=address -o $out $in',
+            'BENCHCEXE': 'clang -O2 -Iembed -Wall -Werror -o $out $in -pthread -lm -ldl',
         },
         '__': {
             'exe_ext': '',
@@ -109,7 +116,14 @@ def get_upd_tests():
     return tests
 
 
-def generate(platform, config, settings, cmdlines, tests, upd_tests):
+def get_benches():
+    benches = []
+    for bench in glob.glob(os.path.join('bench', '*.c')):
+        benches.append(bench.replace('\\', '/'))
+    return sorted(benches)
+
+
+def generate(platform, config, settings, cmdlines, tests, upd_tests, benches):
     root_dir = os.path.join('out', platform + config)
     if not os.path.isdir(root_dir):
         os.makedirs(root_dir)
@@ -143,12 +157,46 @@ def generate(platform, config, settings, cmdlines, tests, upd_tests):
         f.write('  command = ./minilua' + exe_ext + ' $root/dynasm/dynasm.lua -D SYSV -o $out $in\n')
         f.write('  description = DYNASM $out\n')
         f.write('\n')
+        f.write('rule gen_tokens\n')
+        f.write('  command = %s $root/gen_tokens.py .\n' % sys.executable)
+        f.write('  description = GEN $out\n')
+        f.write('  restat = 1\n')
+        f.write('\n')
+        f.write('rule gen_build_hash\n')
+        f.write('  command = %s $root/gen_build_hash.py . $in\n' % sys.executable)
+        f.write('  description = GEN $out\n')
+        f.write('  restat = 1\n')
+        f.write('\n')
         f.write('rule amalg\n')
         f.write('  command = %s $root/build_amalg.py embed $root $in\n' % sys.executable)
         f.write('\n')
 
         objs = []
 
+        # Keyword and punctuator ids, and their recognizers.
+        f.write('build token_ids.h token_ids.c: gen_tokens | $root/gen_tokens.py\n')
+        obj = 'token_ids' + obj_ext
+        f.write('build %s: cc token_ids.c || token_ids.h\n' % obj)
+        objs.append(obj)
+
+        # Identifies the compiler's sources, for the units it caches. Only main.c
+        # includes it.
+        compiler_srcs = ['$root/' + x for x in FILELIST] + [
+                '$root/dyibicc.h',
+                '$root/libdyibicc.h',
+                '$root/codegen.in.c',
+                '$root/khash.h',
+                '$root/gen_tokens.py',
+                '$root/dynasm/dasm_proto.h',
+                '$root/dynasm/dasm_x86.h',
+                '$root/dynasm/dynasm.lua',
+                '$root/dynasm/dasm_x64.lua',
+                '$root/dynasm/dasm_x86.lua',
+                '$root/../include/all/reflect.h',
+        ]
+        f.write('build build_hash.h: gen_build_hash %s | $root/gen_build_hash.py\n' %
+                ' '.join(compiler_srcs))
+
         # codegen required for both platforms (not just |platform|) to bundle
         # into amalgamated build.
         dynasmed_l = 'codegen.l.c'
@@ -158,15 +206,17 @@ def generate(platform, config, settings, cmdlines, tests, upd_tests):
         # But only the current one linked into the compiler binary.
         dynasmed = dynasmed_w if platform == 'w' else dynasmed_l
         obj = os.path.splitext(dynasmed)[0] + obj_ext
-        f.write('build %s: cc %s\n' % (obj, dynasmed))
+        f.write('build %s: cc %s || token_ids.h\n' % (obj, dynasmed))
         objs.append(obj)
 
         for src in FILELIST:
             obj = os.path.splitext(src)[0] + obj_ext
             objs.append(obj)
-            f.write('build %s: cc $root/%s\n' % (obj, src))
+            f.write('build %s: cc $root/%s || token_ids.h build_hash.h\n' % (obj, src))
 
         EXTRAS_FOR_AMALG = [
+                'token_ids.h',
+                'build_hash.h',
                 '$root/dyibicc.h',
                 '$root/../include/all/reflect.h',
                 '$root/khash.h',
@@ -175,7 +225,7 @@ def generate(platform, config, settings, cmdlines, tests, upd_tests):
         ]
         f.write('build embed/libdyibicc.c embed/libdyibicc.h embed/LICENSE: amalg %s %s | %s %s $root/build_amalg.py\n' %
                 (' '.join(EXTRAS_FOR_AMALG),
-                 ' '.join('$root/' + x for x in FILELIST if 'entry.c' not in x),
+                 ' '.join(['$root/' + x for x in FILELIST if 'entry.c' not in x] + ['token_ids.c']),
                  dynasmed_w,
                  dynasmed_l))
 
@@ -228,6 +278,26 @@ def generate(platform, config, settings, cmdlines, tests, upd_tests):
 
         f.write('\nbuild test: phony ' + ' '.join(alltests) + '\n')
 
+        f.write('\nrule benchcexe\n')
+        f.write('  command = ' + cmdlines['BENCHCEXE'] + '\n')
+        f.write('  description = BENCH_CC $out\n')
+        f.write('\n')
+
+        f.write('rule runbench\n')
+        f.write('  command = ./$in\n')
+        f.write('  description = BENCH $in\n')
+        f.write('  pool = console\n\n')
+
+        allbenches = []
+        for benchf in benches:
+            benchexe = 'bench_' + os.path.splitext(os.path.basename(benchf))[0] + exe_ext
+            f.write('build %s: benchcexe $root/../%s | embed/libdyibicc.c embed/libdyibicc.h '
+                    '$root/../bench/bench.h\n' % (benchexe, benchf))
+            f.write('build %s: runbench %s\n' % (benchf, benchexe))
+            allbenches.append(benchf)
+
+        f.write('\nbuild bench: phony ' + ' '.join(allbenches) + '\n')
+
         f.write('\ndefault dyibicc%s\n' % exe_ext)
 
         f.write('\nrule gen\n')
@@ -245,13 +315,14 @@ def main():
     os.chdir(ROOT_DIR)  # Necessary when regenerating manifest from ninja
     tests = get_tests()
     upd_tests = get_upd_tests()
+    benches = get_benches()
     for platform, pdata in CONFIGS.items():
         if (sys.platform == 'win32' and platform == 'w') or \
                 (sys.platform == 'linux' and platform == 'l'):
             for config, cmdlines in pdata.items():
                 if config == '__':
                     continue
-                generate(platform, config, pdata['__'], cmdlines, tests, upd_tests)
+                generate(platform, config, pdata['__'], cmdlines, tests, upd_tests, benches)
 
 
 if __name__ == '__main__':
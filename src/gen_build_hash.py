@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+
+# Generates build_hash.h, which identifies the compiler sources that a binary
+# was built from, so that units cached by a different compiler aren't used.
+# Only the contents of the files are hashed, not their paths or times, so
+# builds of the same sources agree.
+#
+# Usage: gen_build_hash.py <out_dir> <compiler sources...>
+
+import hashlib
+import os
+import sys
+
+
+def main():
+    out_dir = sys.argv[1]
+    h = hashlib.sha256()
+    for src in sys.argv[2:]:
+        with open(src, 'rb') as f:
+            h.update(f.read())
+
+    contents = '\n'.join([
+        '// Generated by gen_build_hash.py, do not edit.',
+        '#define DYIBICC_BUILD_HASH 0x%sULL' % h.hexdigest()[:16],
+        '',
+    ])
+
+    # Only touch the file when the hash changes, so that main.c isn't rebuilt
+    # for nothing.
+    path = os.path.join(out_dir, 'build_hash.h')
+    if os.path.exists(path):
+        with open(path, 'r') as f:
+            if f.read() == contents:
+                return 0
+    with open(path, 'w', newline='\n') as f:
+        f.write(contents)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
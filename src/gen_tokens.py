@@ -0,0 +1,191 @@
+#!/usr/bin/env python3
+
+# Generates token_ids.h and token_ids.c, which give each keyword, punctuator,
+# and identifier that the compiler checks for a small integer TokenId, and the
+# recognizers used by the tokenizer to assign them: a perfect hash for words
+# and a switch for punctuators.
+#
+# Usage: gen_tokens.py <out_dir>
+
+import os
+import sys
+
+# Keywords, in the order they're listed in the enum. Tokens with these
+# spellings are TK_KEYWORD rather than TK_IDENT (except where noted in
+# tokenize.c's is_keyword()).
+KEYWORDS = [
+    'return', 'if', 'else', 'for', 'while', 'int', 'sizeof', 'char', 'struct', 'union', 'short',
+    'long', 'void', 'typedef', '_Bool', 'enum', 'static', 'goto', 'break', 'continue', 'switch',
+    'case', 'default', 'extern', '_Alignof', '_Alignas', 'do', 'signed', 'unsigned', 'const',
+    'volatile', 'auto', 'register', 'restrict', '__restrict', '__restrict__', '_Noreturn', 'float',
+    'double', 'typeof', 'asm', '_Thread_local', '__thread', '_Atomic', '__attribute__', '__int64',
+]
+
+# Identifiers that have a special meaning to the preprocessor or parser, but
+# are otherwise ordinary identifiers.
+WORDS = [
+    'define', 'undef', 'include', 'include_next', 'ifdef', 'ifndef', 'elif', 'endif', 'line',
+    'pragma', 'error', 'defined', 'once', '__VA_ARGS__', '__VA_OPT__', 'inline', 'packed',
+    'aligned', '_Generic', '_ReflectTypeOf', '__builtin_types_compatible_p',
+    '__builtin_reg_class', '__builtin_compare_and_swap', '__builtin_atomic_exchange',
+    '_InterlockedCompareExchange',
+]
+
+PUNCTUATORS = [
+    ('<<=', 'SHL_ASSIGN'), ('>>=', 'SHR_ASSIGN'), ('...', 'ELLIPSIS'), ('==', 'EQ'), ('!=', 'NE'),
+    ('<=', 'LE'), ('>=', 'GE'), ('->', 'ARROW'), ('+=', 'ADD_ASSIGN'), ('-=', 'SUB_ASSIGN'),
+    ('*=', 'MUL_ASSIGN'), ('/=', 'DIV_ASSIGN'), ('++', 'INC'), ('--', 'DEC'), ('%=', 'MOD_ASSIGN'),
+    ('&=', 'AND_ASSIGN'), ('|=', 'OR_ASSIGN'), ('^=', 'XOR_ASSIGN'), ('&&', 'LOGAND'),
+    ('||', 'LOGOR'), ('<<', 'SHL'), ('>>', 'SHR'), ('##', 'HASHHASH'),
+    # Every other ASCII punctuation character is a punctuator on its own. (", ', $, and _ are
+    # never read as punctuators.)
+    ('!', 'NOT'), ('#', 'HASH'), ('%', 'MOD'), ('&', 'AND'), ('(', 'LPAREN'), (')', 'RPAREN'),
+    ('*', 'STAR'), ('+', 'PLUS'), (',', 'COMMA'), ('-', 'MINUS'), ('.', 'DOT'), ('/', 'SLASH'),
+    (':', 'COLON'), (';', 'SEMI'), ('<', 'LT'), ('=', 'ASSIGN'), ('>', 'GT'), ('?', 'QUESTION'),
+    ('@', 'AT'), ('[', 'LBRACKET'), ('\\', 'BACKSLASH'), (']', 'RBRACKET'), ('^', 'XOR'),
+    ('`', 'BACKTICK'), ('{', 'LBRACE'), ('|', 'OR'), ('}', 'RBRACE'), ('~', 'TILDE'),
+]
+
+
+def word_enum(prefix, word):
+    return prefix + word.upper()
+
+
+def c_char(c):
+    return "'\\\\'" if c == '\\' else "'\\''" if c == "'" else "'%s'" % c
+
+
+def word_hash(word, k1, k2, k3, mask):
+    b = word.encode('ascii')
+    n = len(b)
+    return (n + k1 * b[0] + k2 * b[n - 1] + k3 * b[n // 2]) & mask
+
+
+def find_perfect_hash(words):
+    for bits in range(7, 12):
+        mask = (1 << bits) - 1
+        for k1 in range(1, 32):
+            for k2 in range(1, 32):
+                for k3 in range(0, 32):
+                    slots = set()
+                    for w in words:
+                        h = word_hash(w, k1, k2, k3, mask)
+                        if h in slots:
+                            break
+                        slots.add(h)
+                    else:
+                        return k1, k2, k3, mask
+    raise Exception('no perfect hash found')
+
+
+def gen_punct_switch(out, entries, depth, indent):
+    # |entries| all share their first |depth| characters.
+    by_char = {}
+    for spelling, name in entries:
+        if len(spelling) > depth:
+            by_char.setdefault(spelling[depth], []).append((spelling, name))
+    terminal = [name for spelling, name in entries if len(spelling) == depth]
+    pad = '  ' * indent
+    if by_char:
+        out.append('%sswitch (p[%d]) {' % (pad, depth))
+        for c in sorted(by_char):
+            out.append('%s  case %s:' % (pad, c_char(c)))
+            gen_punct_switch(out, by_char[c], depth + 1, indent + 2)
+        out.append('%s}' % pad)
+    if terminal:
+        out.append('%s*id = PU_%s;' % (pad, terminal[0]))
+        out.append('%sreturn %d;' % (pad, depth))
+    elif depth == 0:
+        out.append('%sreturn 0;' % pad)
+    else:
+        out.append('%sbreak;' % pad)
+
+
+def main():
+    out_dir = sys.argv[1]
+
+    words = [(w, word_enum('KW_', w)) for w in KEYWORDS]
+    words += [(w, word_enum('ID_', w)) for w in WORDS]
+    k1, k2, k3, mask = find_perfect_hash([w for w, _ in words])
+
+    h = []
+    h.append('// Generated by gen_tokens.py, do not edit.')
+    h.append('')
+    h.append('#pragma once')
+    h.append('')
+    h.append('typedef enum TokenId {')
+    h.append('  TOKEN_ID_NONE,')
+    for w, e in words:
+        h.append('  %s,  // %s' % (e, w))
+    for spelling, name in PUNCTUATORS:
+        h.append('  PU_%s,  // "%s"' % (name, spelling.replace('\\', '\\\\')))
+    h.append('  NUM_TOKEN_IDS,')
+    h.append('')
+    h.append('  KW_FIRST = %s,' % words[0][1])
+    h.append('  KW_LAST = %s,' % word_enum('KW_', KEYWORDS[-1]))
+    h.append('} TokenId;')
+    h.append('')
+
+    c = []
+    c.append('// Generated by gen_tokens.py, do not edit.')
+    c.append('')
+    c.append('#include "dyibicc.h"')
+    c.append('')
+    c.append('typedef struct TokenIdWord {')
+    c.append('  char* word;')
+    c.append('  int len;')
+    c.append('  TokenId id;')
+    c.append('} TokenIdWord;')
+    c.append('')
+    c.append('static TokenIdWord token_id_words[%d] = {' % (mask + 1))
+    for w, e in sorted(words, key=lambda x: word_hash(x[0], k1, k2, k3, mask)):
+        c.append('    [%d] = {"%s", %d, %s},' % (word_hash(w, k1, k2, k3, mask), w, len(w), e))
+    c.append('};')
+    c.append('')
+    c.append('// Returns the id of the word [p, p + len), or TOKEN_ID_NONE if it isn\'t a')
+    c.append('// keyword or one of the other words that has one.')
+    c.append('IMPLSTATIC TokenId word_token_id(char* p, int len) {')
+    c.append('  unsigned char* u = (unsigned char*)p;')
+    c.append('  unsigned h = (unsigned)(len + %d * u[0] + %d * u[len - 1] + %d * u[len / 2]) & %d;' %
+             (k1, k2, k3, mask))
+    c.append('  TokenIdWord* w = &token_id_words[h];')
+    c.append('  if (w->len == len && memcmp(w->word, p, len) == 0)')
+    c.append('    return w->id;')
+    c.append('  return TOKEN_ID_NONE;')
+    c.append('}')
+    c.append('')
+    c.append('// Reads a punctuator token from p, and returns its length and id.')
+    c.append('IMPLSTATIC int read_punct(char* p, TokenId* id) {')
+    gen_punct_switch(c, PUNCTUATORS, 0, 1)
+    c.append('}')
+    c.append('')
+    c.append('static char* token_id_spellings[NUM_TOKEN_IDS] = {')
+    for w, e in words:
+        c.append('    [%s] = "%s",' % (e, w))
+    for spelling, name in PUNCTUATORS:
+        c.append('    [PU_%s] = "%s",' % (name, spelling.replace('\\', '\\\\')))
+    c.append('};')
+    c.append('')
+    c.append('// Returns the spelling of a token id, for diagnostics.')
+    c.append('IMPLSTATIC char* token_id_spelling(TokenId id) {')
+    c.append('  return token_id_spellings[id];')
+    c.append('}')
+    c.append('')
+
+    def write_if_changed(name, lines):
+        path = os.path.join(out_dir, name)
+        contents = '\n'.join(lines)
+        if os.path.exists(path):
+            with open(path, 'r') as f:
+                if f.read() == contents:
+                    return
+        with open(path, 'w', newline='\n') as f:
+            f.write(contents)
+
+    write_if_changed('token_ids.h', h)
+    write_if_changed('token_ids.c', c)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
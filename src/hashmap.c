@@ -1,118 +1,249 @@
-// This is an implementation of the open-addressing hash table.
+// This is an implementation of an open-addressing hash table in the style of
+// swisstable. Alongside the entries there's an array of one byte per slot
+// "control" bytes that are either empty, deleted, or the low 7 bits of the
+// entry's hash. Lookups probe a group of 16 control bytes at a time (with SSE2
+// when available) and only compare keys whose control byte matches. The full
+// hash is cached in each entry so that growing never rehashes keys.
 
 #include "dyibicc.h"
 
-// Initial hash bucket size
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define HASHMAP_SSE2 1
+#include <emmintrin.h>
+#else
+#define HASHMAP_SSE2 0
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// Slots are probed in aligned groups of this many.
+#define GROUP_SIZE 16
+
+// Initial hash bucket size, must be a power of two, at least GROUP_SIZE.
 #define INIT_SIZE 16
 
-// Rehash if the usage exceeds 70%.
-#define HIGH_WATERMARK 70
+// Rehash if the usage (including deleted slots) exceeds 7/8.
+#define MAX_LOAD_NUM 7
+#define MAX_LOAD_DEN 8
 
-// We'll keep the usage below 50% after rehashing.
-#define LOW_WATERMARK 50
+// Control byte values. Full slots have the top bit set, so that a zeroed
+// control array is entirely empty.
+#define CTRL_EMPTY 0x00
+#define CTRL_DELETED 0x01
+#define CTRL_FULL 0x80
+
+static uint64_t load64(char* p) {
+  uint64_t w;
+  memcpy(&w, p, 8);
+  return w;
+}
 
-// Represents a deleted hash entry
-#define TOMBSTONE ((void*)-1)
+static uint32_t load32(char* p) {
+  uint32_t w;
+  memcpy(&w, p, 4);
+  return w;
+}
 
-static uint64_t fnv_hash(char* s, int len) {
-  uint64_t hash = 0xcbf29ce484222325;
-  for (int i = 0; i < len; i++) {
-    hash *= 0x100000001b3;
-    hash ^= (unsigned char)s[i];
+static uint64_t hash_key(char* s, int len) {
+  // A word-at-a-time multiply/xorshift mix. The low bits are used for the
+  // control bytes and the high bits for picking a group, so both need to be
+  // well distributed, which plain FNV-1a's weren't.
+  uint64_t hash = 0x9e3779b97f4a7c15ULL ^ (uint64_t)len;
+  int n = len;
+  while (n > 8) {
+    hash = (hash ^ load64(s)) * 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 31;
+    s += 8;
+    n -= 8;
   }
+
+  // The final 1-8 bytes, read with (possibly overlapping) fixed size loads.
+  uint64_t w;
+  if (len >= 8)
+    w = load64(s + n - 8);
+  else if (n >= 4)
+    w = ((uint64_t)load32(s) << 32) | load32(s + n - 4);
+  else if (n > 0)
+    w = ((uint64_t)(unsigned char)s[0] << 16) | ((uint64_t)(unsigned char)s[n >> 1] << 8) |
+        (unsigned char)s[n - 1];
+  else
+    w = 0;
+  hash = (hash ^ w) * 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 31;
+  hash *= 0x94d049bb133111ebULL;
+  hash ^= hash >> 29;
   return hash;
 }
 
-// Make room for new entires in a given hashmap by removing
-// tombstones and possibly extending the bucket size.
-static void rehash(HashMap* map) {
-  // Compute the size of the new hashmap.
-  int nkeys = 0;
-  for (int i = 0; i < map->capacity; i++)
-    if (map->buckets[i].key && map->buckets[i].key != TOMBSTONE)
-      nkeys++;
+// Hashes arbitrary data such as file contents, rather than keys.
+IMPLSTATIC uint64_t hash_bytes(char* s, size_t len) {
+  uint64_t hash = 0;
+  do {
+    int n = (int)MIN(len, (size_t)1 << 30);
+    hash = hash_combine(hash, hash_key(s, n));
+    s += n;
+    len -= n;
+  } while (len);
+  return hash;
+}
+
+// Mixes |hash| into |seed|, the result depends on the order of combining.
+IMPLSTATIC uint64_t hash_combine(uint64_t seed, uint64_t hash) {
+  seed = (seed ^ (hash + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2))) * 0xbf58476d1ce4e5b9ULL;
+  return seed ^ (seed >> 31);
+}
+
+static uint8_t ctrl_for_hash(uint64_t hash) {
+  return (uint8_t)(CTRL_FULL | (hash & 0x7f));
+}
+
+// Returns a bitmask with bit i set if group[i] == byte.
+static unsigned group_match(uint8_t* group, uint8_t byte) {
+#if HASHMAP_SSE2
+  __m128i ctrl = _mm_loadu_si128((__m128i*)group);
+  return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte)));
+#else
+  unsigned mask = 0;
+  for (int i = 0; i < GROUP_SIZE; i++)
+    if (group[i] == byte)
+      mask |= 1u << i;
+  return mask;
+#endif
+}
+
+// Returns a bitmask with bit i set if group[i] is empty or deleted.
+static unsigned group_match_free(uint8_t* group) {
+#if HASHMAP_SSE2
+  // Full slots are the only ones with the top bit set.
+  __m128i ctrl = _mm_loadu_si128((__m128i*)group);
+  return (unsigned)_mm_movemask_epi8(ctrl) ^ 0xffff;
+#else
+  unsigned mask = 0;
+  for (int i = 0; i < GROUP_SIZE; i++)
+    if (!(group[i] & CTRL_FULL))
+      mask |= 1u << i;
+  return mask;
+#endif
+}
+
+static int lowest_bit(unsigned mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long idx;
+  _BitScanForward(&idx, mask);
+  return (int)idx;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+// Groups are visited in a triangular sequence (+1, +2, +3, ...) which visits
+// every group exactly once when the number of groups is a power of two.
+#define FOR_EACH_PROBE_GROUP(map, hash, base)                            \
+  for (size_t base##_mask_ = (size_t)(map)->capacity / GROUP_SIZE - 1,   \
+              base##_i_ = 0,                                             \
+              base = (size_t)((hash) >> 7) & base##_mask_;               \
+       base##_i_ <= base##_mask_;                                        \
+       ++base##_i_, base = (base + base##_i_) & base##_mask_)
+
+static void alloc_buckets(HashMap* map, int cap) {
+  assert(cap >= GROUP_SIZE && (cap & (cap - 1)) == 0);
+  // Entries and control bytes are a single allocation, control bytes last.
+  char* mem = bumpcalloc(1, cap * sizeof(HashEntry) + cap, map->alloc_lifetime);
+  map->buckets = (HashEntry*)mem;
+  map->ctrl = (uint8_t*)(mem + cap * sizeof(HashEntry));
+  map->capacity = cap;
+  map->used = 0;
+  map->deleted = 0;
+}
 
+// Place an entry known not to be in the map into the first free slot on its
+// probe sequence. Used when growing, so there's known to be room.
+static HashEntry* insert_new(HashMap* map, uint64_t hash) {
+  FOR_EACH_PROBE_GROUP(map, hash, g) {
+    uint8_t* group = &map->ctrl[g * GROUP_SIZE];
+    unsigned avail = group_match_free(group);
+    if (avail) {
+      int idx = (int)(g * GROUP_SIZE) + lowest_bit(avail);
+      if (map->ctrl[idx] == CTRL_DELETED)
+        map->deleted--;
+      map->ctrl[idx] = ctrl_for_hash(hash);
+      map->used++;
+      return &map->buckets[idx];
+    }
+  }
+  unreachable();
+}
+
+// Make room for new entires in a given hashmap by removing deleted slots and
+// possibly extending the bucket size.
+static void rehash(HashMap* map) {
   int cap = map->capacity;
-  while ((nkeys * 100) / cap >= LOW_WATERMARK)
+  while ((map->used + 1) * 2 >= cap)
     cap = cap * 2;
-  assert(cap > 0);
 
-  // Create a new hashmap and copy all key-values.
   HashMap map2 = {0};
-  map2.buckets = bumpcalloc(cap, sizeof(HashEntry), map->alloc_lifetime);
-  map2.capacity = cap;
   map2.alloc_lifetime = map->alloc_lifetime;
+  alloc_buckets(&map2, cap);
 
   for (int i = 0; i < map->capacity; i++) {
-    HashEntry* ent = &map->buckets[i];
-    if (ent->key && ent->key != TOMBSTONE) {
-      hashmap_put2(&map2, ent->key, ent->keylen, ent->val);
+    if (map->ctrl[i] & CTRL_FULL) {
+      HashEntry* ent = &map->buckets[i];
+      *insert_new(&map2, ent->hash) = *ent;
     }
   }
 
-  assert(map2.used == nkeys);
+  assert(map2.used == map->used);
   if (map->alloc_lifetime == AL_Manual) {
     alloc_free(map->buckets, map->alloc_lifetime);
   }
   *map = map2;
 }
 
-static bool match(HashEntry* ent, char* key, int keylen) {
-  return ent->key && ent->key != TOMBSTONE && ent->keylen == keylen &&
-         memcmp(ent->key, key, keylen) == 0;
+static bool match(HashEntry* ent, char* key, int keylen, uint64_t hash) {
+  if (ent->key == key)
+    return true;
+  return ent->hash == hash && ent->keylen == keylen && memcmp(ent->key, key, keylen) == 0;
 }
 
-static HashEntry* get_entry(HashMap* map, char* key, int keylen) {
+static HashEntry* get_entry(HashMap* map, char* key, int keylen, uint64_t hash) {
   if (!map->buckets)
     return NULL;
 
-  uint64_t hash = fnv_hash(key, keylen);
-
-  for (int i = 0; i < map->capacity; i++) {
-    HashEntry* ent = &map->buckets[(hash + i) % map->capacity];
-    if (match(ent, key, keylen))
-      return ent;
-    if (ent->key == NULL)
+  uint8_t h2 = ctrl_for_hash(hash);
+  FOR_EACH_PROBE_GROUP(map, hash, g) {
+    uint8_t* group = &map->ctrl[g * GROUP_SIZE];
+    for (unsigned m = group_match(group, h2); m; m &= m - 1) {
+      HashEntry* ent = &map->buckets[g * GROUP_SIZE + lowest_bit(m)];
+      if (match(ent, key, keylen, hash))
+        return ent;
+    }
+    if (group_match(group, CTRL_EMPTY))
       return NULL;
   }
-  unreachable();
+  return NULL;
 }
 
-static HashEntry* get_or_insert_entry(HashMap* map, char* key, int keylen) {
+static HashEntry* get_or_insert_entry(HashMap* map, char* key, int keylen, uint64_t hash) {
   if (!map->buckets) {
-    map->buckets = bumpcalloc(INIT_SIZE, sizeof(HashEntry), map->alloc_lifetime);
-    map->capacity = INIT_SIZE;
-  } else if ((map->used * 100) / map->capacity >= HIGH_WATERMARK) {
-    rehash(map);
-  }
-
-  uint64_t hash = fnv_hash(key, keylen);
-
-  for (int i = 0; i < map->capacity; i++) {
-    HashEntry* ent = &map->buckets[(hash + i) % map->capacity];
-
-    if (match(ent, key, keylen)) {
-      if (map->alloc_lifetime == AL_Manual) {
-        free(ent->key);
-      }
+    alloc_buckets(map, INIT_SIZE);
+  } else {
+    HashEntry* ent = get_entry(map, key, keylen, hash);
+    if (ent) {
       ent->key = key;
       return ent;
     }
+  }
 
-    if (ent->key == TOMBSTONE) {
-      ent->key = key;
-      ent->keylen = keylen;
-      return ent;
-    }
+  if ((map->used + map->deleted + 1) * MAX_LOAD_DEN > map->capacity * MAX_LOAD_NUM)
+    rehash(map);
 
-    if (ent->key == NULL) {
-      ent->key = key;
-      ent->keylen = keylen;
-      map->used++;
-      return ent;
-    }
-  }
-  unreachable();
+  HashEntry* ent = insert_new(map, hash);
+  ent->key = key;
+  ent->keylen = keylen;
+  ent->hash = hash;
+  return ent;
 }
 
 IMPLSTATIC void* hashmap_get(HashMap* map, char* key) {
@@ -120,7 +251,7 @@ IMPLSTATIC void* hashmap_get(HashMap* map, char* key) {
 }
 
 IMPLSTATIC void* hashmap_get2(HashMap* map, char* key, int keylen) {
-  HashEntry* ent = get_entry(map, key, keylen);
+  HashEntry* ent = get_entry(map, key, keylen, hash_key(key, keylen));
   return ent ? ent->val : NULL;
 }
 
@@ -129,7 +260,7 @@ IMPLSTATIC void hashmap_put(HashMap* map, char* key, void* val) {
 }
 
 IMPLSTATIC void hashmap_put2(HashMap* map, char* key, int keylen, void* val) {
-  HashEntry* ent = get_or_insert_entry(map, key, keylen);
+  HashEntry* ent = get_or_insert_entry(map, key, keylen, hash_key(key, keylen));
   ent->val = val;
 }
 
@@ -138,45 +269,116 @@ IMPLSTATIC void hashmap_delete(HashMap* map, char* key) {
 }
 
 IMPLSTATIC void hashmap_delete2(HashMap* map, char* key, int keylen) {
-  HashEntry* ent = get_entry(map, key, keylen);
+  HashEntry* ent = get_entry(map, key, keylen, hash_key(key, keylen));
+  if (!ent)
+    return;
+
+  int idx = (int)(ent - map->buckets);
+  uint8_t* group = &map->ctrl[idx & ~(GROUP_SIZE - 1)];
+  // If the group still has an empty slot, no probe sequence ever continued
+  // past it, so the slot can go straight back to empty rather than leaving a
+  // deleted marker.
+  if (group_match(group, CTRL_EMPTY)) {
+    map->ctrl[idx] = CTRL_EMPTY;
+  } else {
+    map->ctrl[idx] = CTRL_DELETED;
+    map->deleted++;
+  }
+  ent->key = NULL;
+  map->used--;
+}
+
+// Interned strings are stored with their length and hash immediately before
+// the characters, so lookups with an interned key never need to rehash it.
+typedef struct InternedString {
+  uint64_t hash;
+  int len;
+  char str[];
+} InternedString;
+
+static InternedString* interned_header(char* s) {
+  return (InternedString*)(s - offsetof(InternedString, str));
+}
+
+IMPLSTATIC void* hashmap_get_interned(HashMap* map, char* key) {
+  InternedString* is = interned_header(key);
+  HashEntry* ent = get_entry(map, key, is->len, is->hash);
+  return ent ? ent->val : NULL;
+}
+
+IMPLSTATIC void hashmap_put_interned(HashMap* map, char* key, void* val) {
+  InternedString* is = interned_header(key);
+  HashEntry* ent = get_or_insert_entry(map, key, is->len, is->hash);
+  ent->val = val;
+}
+
+// Returns the canonical copy of |s| in the context's intern pool. The result
+// lives as long as the context, and two interned strings are equal iff their
+// pointers are equal.
+IMPLSTATIC char* intern(char* s) {
+  return intern2(s, (int)strlen(s));
+}
+
+IMPLSTATIC char* intern2(char* s, int len) {
+  uint64_t hash = hash_key(s, len);
+
+  // The pool is shared by all compile threads, so each translation unit keeps
+  // its own map of the names it has already interned, and only takes the lock
+  // the first time it sees a name. The map is in AL_Compile, so outside of a
+  // compile (as when loading cached units), names go straight to the pool.
+  HashMap* cache =
+      compiler_state.hashmap__use_intern_cache ? &compiler_state.hashmap__intern_cache : NULL;
+  HashEntry* ent = cache ? get_entry(cache, s, len, hash) : NULL;
+  if (ent)
+    return ent->key;
+
+  UserContext* uc = user_context;
+  mutex_lock(&uc->lock);
+  char* ret;
+  ent = get_entry(&uc->intern_pool, s, len, hash);
   if (ent) {
-    if (map->alloc_lifetime == AL_Manual) {
-      free(ent->key);
-    }
-    ent->key = TOMBSTONE;
+    ret = ent->key;
+  } else {
+    InternedString* is =
+        bumpcalloc(1, sizeof(InternedString) + len + 1, uc->intern_pool.alloc_lifetime);
+    is->hash = hash;
+    is->len = len;
+    memcpy(is->str, s, len);
+    ret = is->str;
+    get_or_insert_entry(&uc->intern_pool, ret, len, hash)->val = ret;
   }
+  mutex_unlock(&uc->lock);
+
+  if (cache)
+    get_or_insert_entry(cache, ret, len, hash)->val = ret;
+  return ret;
 }
 
-// keys strdup'd with AL_Manual, and values that are the data segment
+// Keys are interned (owned by the pool), and values are the data segment
 // allocations allocated by aligned_allocate.
-IMPLSTATIC void hashmap_clear_manual_key_owned_value_owned_aligned(HashMap* map) {
+IMPLSTATIC void hashmap_clear_manual_key_unowned_value_owned_aligned(HashMap* map) {
   assert(map->alloc_lifetime == AL_Manual);
   for (int i = 0; i < map->capacity; i++) {
-    HashEntry* ent = &map->buckets[i];
-    if (ent->key && ent->key != TOMBSTONE) {
-      alloc_free(ent->key, map->alloc_lifetime);
-      aligned_free(ent->val);
+    if (map->ctrl[i] & CTRL_FULL) {
+      aligned_free(map->buckets[i].val);
     }
   }
   alloc_free(map->buckets, map->alloc_lifetime);
   map->buckets = NULL;
+  map->ctrl = NULL;
   map->used = 0;
+  map->deleted = 0;
   map->capacity = 0;
 }
 
-// keys strdup'd with AL_Manual, and values that point into the codeseg, so
-// aren't freed.
-IMPLSTATIC void hashmap_clear_manual_key_owned_value_unowned(HashMap* map) {
+// Keys are interned (owned by the pool), and values point into the codeseg,
+// so aren't freed.
+IMPLSTATIC void hashmap_clear_manual_key_unowned_value_unowned(HashMap* map) {
   assert(map->alloc_lifetime == AL_Manual);
-  for (int i = 0; i < map->capacity; i++) {
-    HashEntry* ent = &map->buckets[i];
-    if (ent->key && ent->key != TOMBSTONE) {
-      alloc_free(ent->key, map->alloc_lifetime);
-      // ent->val points into codeseg, not to be freed here.
-    }
-  }
   alloc_free(map->buckets, map->alloc_lifetime);
   map->buckets = NULL;
+  map->ctrl = NULL;
   map->used = 0;
+  map->deleted = 0;
   map->capacity = 0;
 }
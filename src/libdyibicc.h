@@ -3,6 +3,7 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 // ANSI escape code decoding expected if use_ansi_codes is set in
 // DyibiccEnviromentData.
@@ -38,7 +39,15 @@ typedef struct DyibiccEnviromentData {
   //
   // However! If a single file and contents are provided to update via
   // `dyibicc_update(ctx, "myfile.c", "...contents...")`, then the contents will
-  // be used directly and there will be no callback to this function.
+  // be used directly and there will be no callback to this function for that
+  // file (whether it's a .c file or a header).
+  //
+  // If num_compile_threads is greater than 1, this may be called from several
+  // threads at the same time.
+  //
+  // If NULL, files are loaded from disk, and mapped read-only rather than read
+  // where possible. Contents are never modified, including those passed to
+  // dyibicc_update().
   DyibiccLoadFileContents load_file_contents;
 
   // Should resolve a function by name, for symbols that aren't defined by code
@@ -49,27 +58,129 @@ typedef struct DyibiccEnviromentData {
   // vectored through this function.
   DyibiccOutputFn output_function;
 
+  // Number of bytes of each compile heap (the translation unit's, and the
+  // preprocessor's scratch heap) that are kept mapped between translation units
+  // and updates, to avoid repeatedly mapping and faulting in pages. Any memory
+  // used beyond this is returned to the OS after each translation unit. 0
+  // selects a default.
+  size_t compile_heap_retain_size;
+
+  // If non-NULL, a directory in which the compiled form of each file is saved,
+  // so that a later process can avoid recompiling files if neither they nor
+  // any of their includes have changed. The directory is created if
+  // necessary. Files using reflection aren't saved.
+  const char* cache_dir;
+
+  // Number of threads used to compile translation units when more than one
+  // file needs compiling in an update. Results (including error messages) are
+  // the same as for a serial compile. 0 or 1 compiles on the calling thread,
+  // and a negative value uses one thread per processor. The threads are started
+  // by the first update that needs them, and kept, along with their compile
+  // heaps, until dyibicc_free().
+  int num_compile_threads;
+
   // Are simple ANSI colours supported by |output_function|.
   bool use_ansi_codes;
-  bool padding[7];  // Avoid C4820 padding warning on MSVC /Wall.
+  bool padding[3];  // Avoid C4820 padding warning on MSVC /Wall.
 } DyibiccEnviromentData;
 
 typedef struct DyibiccContext DyibiccContext;
 
-// Sets up the environment for the compiler. There can currently only be a
-// single active DyibiccContext, despite the implication that there could be
-// multiple. See notes in the structure about how it should be filled out.
+// Sets up the environment for the compiler. See notes in the structure about
+// how it should be filled out. Contexts are independent of one another, and
+// different contexts may be used concurrently from different threads, but a
+// single context must only be used by one thread at a time.
 DyibiccContext* dyibicc_set_environment(DyibiccEnviromentData* env_data);
 
 // Called once on initializtion with a file == NULL and contents == NULL, and
 // subsequently whenever any file contents are updated and the running code
 // should be recompiled/relinked.
+//
+// |file| may be one of the .c files, or a header that they #include, named by
+// the path it was opened with: the include path or including file's directory
+// joined with the name in the #include (a leading "./" is ignored). Every .c
+// file that read |file| when it was last compiled is compiled again using
+// |contents| for it, and the results are linked. Other files are left as they
+// were.
 bool dyibicc_update(DyibiccContext* context, char* file, char* contents);
 
+// Where #include'd files were found, and which files don't exist, are
+// remembered for the life of the context. Call this before the next
+// dyibicc_update() after adding, removing, or renaming headers, so that they
+// are looked for again. (It isn't needed after an update that failed, nor when
+// headers have only been edited.)
+void dyibicc_flush_include_cache(DyibiccContext* context);
+
 // After a successful call to dyibicc_update(), retrieve the address of a
 // non-static function to call it. The returned function address cannot be
 // cached across dyibicc_update() calls.
 void* dyibicc_find_export(DyibiccContext* context, char* name);
 
+// Statistics for one of the .c files in the project, as of the most recent
+// dyibicc_update(). All times are in nanoseconds.
+typedef struct DyibiccFileStats {
+  const char* name;
+
+  // Whether the file was compiled during the most recent update. If not, the
+  // rest of the fields are zero.
+  bool compiled;
+
+  // Whether the file was included in the most recent update, but neither it
+  // nor anything it includes had changed since it was last compiled, so the
+  // previous result was reused.
+  bool cached;
+  bool padding[6];  // Avoid C4820 padding warning on MSVC /Wall.
+
+  uint64_t tokenize_ns;    // Time spent converting text to tokens, includes headers.
+  uint64_t preprocess_ns;  // Time spent in the preprocessor, excluding tokenize_ns.
+  uint64_t parse_ns;
+  uint64_t codegen_ns;
+
+  size_t num_tokens;  // Tokens produced by the tokenizer, including for uncached headers.
+  size_t num_nodes;   // AST nodes.
+  size_t num_objs;    // Variables and functions, local and global.
+  size_t num_fixups;  // Import and data relocations left for the linker.
+  size_t code_bytes;  // Size of generated code.
+  size_t data_bytes;  // Size of global data that was (re)initialized.
+
+  size_t compile_heap_peak;  // Bytes of compiler memory used by the file.
+} DyibiccFileStats;
+
+// Statistics for the most recent dyibicc_update(). The per-phase times,
+// counts, and sizes are totals over the |files| compiled.
+typedef struct DyibiccStats {
+  uint64_t total_ns;  // Wall time of the whole update.
+  uint64_t tokenize_ns;
+  uint64_t preprocess_ns;
+  uint64_t parse_ns;
+  uint64_t codegen_ns;
+  uint64_t link_ns;
+
+  size_t num_files_compiled;
+  size_t num_files_cached;  // Files that were unchanged, see DyibiccFileStats.cached.
+  size_t num_tokens;
+  size_t num_nodes;
+  size_t num_objs;
+  size_t num_fixups;
+  size_t code_bytes;
+  size_t data_bytes;
+
+  // High-water marks of the compiler's internal heaps during the update.
+  // compile_heap_peak is the largest of any single file, as that memory is
+  // reused for each file.
+  size_t compile_heap_peak;
+  size_t temp_heap_peak;
+  size_t link_heap_peak;
+  size_t user_context_heap_peak;
+
+  size_t num_files;
+  const DyibiccFileStats* files;  // One per file in DyibiccEnviromentData.files.
+} DyibiccStats;
+
+// Retrieve statistics about the most recent call to dyibicc_update(). The
+// returned pointer remains valid until the context is freed, but its contents
+// are overwritten by the next update.
+const DyibiccStats* dyibicc_get_stats(DyibiccContext* context);
+
 // Free all memory associated with the compiler context.
 void dyibicc_free(DyibiccContext* context);
@@ -341,6 +341,124 @@ static void* symbol_lookup(char* name) {
 #endif
 }
 
+static void linkfixup_push(FileLinkData* fld, char* target, char* fixup, int addend) {
+  if (!fld->fixups) {
+    fld->fixups = calloc(8, sizeof(LinkFixup));
+    fld->fcap = 8;
+  }
+
+  if (fld->fcap == fld->flen) {
+    fld->fixups = realloc(fld->fixups, sizeof(LinkFixup) * fld->fcap * 2);
+    fld->fcap *= 2;
+  }
+
+  fld->fixups[fld->flen++] = (LinkFixup){fixup, target, addend};
+}
+
+IMPLSTATIC void free_link_fixups(FileLinkData* fld) {
+  free(fld->fixups);
+  fld->fixups = NULL;
+  fld->flen = 0;
+  fld->fcap = 0;
+}
+
+// Places the code and data from a newly compiled |unit| into memory, and
+// registers its exports and fixups for link_all_files(). Units must be
+// installed in file order so that the results don't depend on which compile
+// thread finished first.
+IMPLSTATIC void link_install_unit(size_t file_index, CompiledUnit* unit) {
+  UserContext* uc = user_context;
+  FileLinkData* fld = &uc->files[file_index];
+
+  if (fld->codeseg_base_address) {
+    free_executable_memory(fld->codeseg_base_address, fld->codeseg_size);
+  }
+  // VirtualAlloc and mmap don't accept 0.
+  size_t code_size = unit->code_size ? unit->code_size : 1;
+  unsigned int page_sized = (unsigned int)align_to_u(code_size, get_page_size());
+  fld->codeseg_size = page_sized;
+  fld->codeseg_base_address = allocate_writable_memory(page_sized);
+  memcpy(fld->codeseg_base_address, unit->code, unit->code_size);
+
+  // per-file from any previous need to be cleared out for this round.
+  hashmap_clear_manual_key_unowned_value_unowned(&uc->exports[file_index]);
+  for (int i = 0; i < unit->num_exports; ++i) {
+    UnitExport* ue = &unit->exports[i];
+    size_t idx = ue->is_static ? file_index : uc->num_files;
+    hashmap_put_interned(&uc->exports[idx], ue->name, fld->codeseg_base_address + ue->offset);
+  }
+
+  free_link_fixups(fld);
+
+  // - rodata, always free existing entry in either static/extern
+  // global_data, and then recreate and reinitialize
+  //
+  // - if writeable data has an entry, it shouldn't be recreated. the
+  // dyo version doesn't reprocess kTypeInitializerDataRelocation or
+  // kTypeInitializerCodeRelocation; that's possibly a bug, but it'll
+  // need some testing to get a case where it comes up.
+  //
+  // TODO: if it changes from static to extern, is it the same
+  // variable? currently they're separate, so a switch causes a
+  // reinit, a leak, and some confusion.
+  //
+  // can't easily make a large single data segment allocation for all
+  // data because 1) the rodata change size link-over-link (put in
+  // codeseg?); 2) wdata don't move or reinit, but new ones get added
+  // as code evolves and we can't blow away or move the old ones.
+  //
+  // for now, just continue with individual regular aligned_allocate
+  // for all data objects and maintain their addresses here.
+  //
+  // TODO: Is this wrong? If writable |x| in one file already existed and
+  // |x| in another is added, then it'll be silently ignored. If it's rodata
+  // it'll be silently replaced here by getting thrown away above and then
+  // recreated. Need to figure out where/how to have a duplicate symbol
+  // check.
+  char** data_addresses = calloc(unit->num_data + 1, sizeof(char*));
+  for (int i = 0; i < unit->num_data; ++i) {
+    UnitData* ud = &unit->data[i];
+    size_t idx = ud->is_static ? file_index : uc->num_files;
+    void* prev = hashmap_get_interned(&uc->global_data[idx], ud->name);
+    if (prev) {
+      if (ud->is_rodata) {
+        aligned_free(prev);
+      } else {
+        // data already created and initialized, don't reinit.
+        continue;
+      }
+    }
+
+    char* global_data = aligned_allocate(ud->size, ud->align);
+    if (ud->init)
+      memcpy(global_data, ud->init, ud->size);
+    else
+      memset(global_data, 0, ud->size);
+    hashmap_put_interned(&uc->global_data[idx], ud->name, global_data);
+    data_addresses[i] = global_data;
+  }
+
+  for (int i = 0; i < unit->num_relocs; ++i) {
+    UnitReloc* ur = &unit->relocs[i];
+    char* at;
+    if (ur->data_index == -1) {
+      at = fld->codeseg_base_address + ur->offset;
+    } else {
+      if (!data_addresses[ur->data_index])
+        continue;
+      at = data_addresses[ur->data_index] + ur->offset;
+    }
+
+    if (ur->name) {
+      linkfixup_push(fld, ur->name, at, ur->addend);
+    } else {
+      *((uintptr_t*)at) = (uintptr_t)(fld->codeseg_base_address + ur->addend);
+    }
+  }
+
+  free(data_addresses);
+}
+
 IMPLSTATIC bool link_all_files(void) {
   // This is a hack to avoid disabling -Wunused-function, since these are in
   // khash.h and aren't instantiated.
@@ -366,13 +484,13 @@ IMPLSTATIC bool link_all_files(void) {
       char* name = fld->fixups[j].name;
       int addend = fld->fixups[j].addend;
 
-      void* target_address = hashmap_get(&uc->global_data[i], name);
+      void* target_address = hashmap_get_interned(&uc->global_data[i], name);
       if (!target_address) {
-        target_address = hashmap_get(&uc->exports[i], name);
+        target_address = hashmap_get_interned(&uc->exports[i], name);
         if (!target_address) {
-          target_address = hashmap_get(&uc->global_data[uc->num_files], name);
+          target_address = hashmap_get_interned(&uc->global_data[uc->num_files], name);
           if (!target_address) {
-            target_address = hashmap_get(&uc->exports[uc->num_files], name);
+            target_address = hashmap_get_interned(&uc->exports[uc->num_files], name);
             if (!target_address) {
               target_address = symbol_lookup(name);
               if (!target_address) {
@@ -49,11 +49,9 @@
 //
 // khash <-> swisstable:
 //
-//   Look into hashtable libs, khash is used in link.c now and it seems ok, but
-//   the interface isn't that pleasant. Possibly wrap and extern C a few common
-//   instantiations of absl's with a more pleasant interface (and that could
-//   replace hashmap.c too). Need to consider how they would/can integrate with
-//   bumpalloc.
+//   hashmap.c is now a swisstable-style table (SSE2 group probing, cached
+//   hashes) on top of bumpalloc lifetimes. khash is still included by link.c
+//   but unused, so it could be dropped.
 //
 // Debugger:
 //
@@ -108,21 +106,17 @@
 //
 // .dyo cache:
 //
-//   Based on compiler binary, "environment", and the contents of the .c file,
-//   make a hash-based cache of dyos so that recompile can only build the
-//   required files and relink while passing the whole module/program still.
-//   Since there's no -D or other flags, "enviroment" could either be a hash of
-//   all the files in the include search path, or alternatively hash after
-//   preprocessing, or probably track all files include and include all of the
-//   includes in the hash. Not overly important if total compile/link times
-//   remain fast.
+//   Done when DyibiccEnviromentData.cache_dir is set, see dyo.c. Units are
+//   keyed by the build of the compiler, and the contents of the .c file and
+//   every file it included. Units that embed reflection type addresses aren't
+//   saved; those would need the types to be serialized too.
 //
 // In-memory dyo:
 //
-//   Alternatively to caching, maybe just save to a memory structure. Might be a
-//   little faster for direct use, could still have a dump-dyo-from-mem for
-//   debugging purposes. Goes more with an always-live compiler host hooked to
-//   target.
+//   Done: each file's CompiledUnit is kept in its FileLinkData along with the
+//   hashes of every file that was read to compile it, and is installed again
+//   without compiling if none of them have changed. Could still have a
+//   dump-dyo-from-mem for debugging purposes.
 //
 // Consider merging some of the record types in dyo:
 //
@@ -145,6 +139,8 @@
 //
 #include "dyibicc.h"
 
+#include "build_hash.h"
+
 #if X64WIN
 #include <direct.h>
 #endif
@@ -172,21 +168,6 @@ static int default_output_fn(const char* fmt, va_list ap) {
   return ret;
 }
 
-static bool default_load_file_fn(const char* path, char** contents, size_t* size) {
-  FILE* fp = fopen(path, "rb");
-  if (!fp) {
-    return false;
-  }
-
-  fseek(fp, 0, SEEK_END);
-  *size = ftell(fp);
-  rewind(fp);
-  *contents = malloc(*size);
-  fread(*contents, 1, *size, fp);
-  fclose(fp);
-  return true;
-}
-
 DyibiccContext* dyibicc_set_environment(DyibiccEnviromentData* env_data) {
   alloc_init(AL_Temp);
 
@@ -239,6 +220,8 @@ DyibiccContext* dyibicc_set_environment(DyibiccEnviromentData* env_data) {
     ++num_files;
   }
 
+  size_t cache_dir_len = env_data->cache_dir ? strlen(env_data->cache_dir) + 1 : 0;
+
   size_t total_size =
       sizeof(UserContext) +                       // base structure
       (num_include_paths * sizeof(char*)) +       // array in base structure
@@ -246,21 +229,25 @@ DyibiccContext* dyibicc_set_environment(DyibiccEnviromentData* env_data) {
       (total_include_paths_len * sizeof(char)) +  // pointed to by include_paths
       (total_source_files_len * sizeof(char)) +   // pointed to by FileLinkData.source_name
       ((num_files + 1) * sizeof(HashMap)) +       // +1 beyond num_files for fully global dataseg
-      ((num_files + 1) * sizeof(HashMap))         // +1 beyond num_files for fully global exports
+      ((num_files + 1) * sizeof(HashMap)) +       // +1 beyond num_files for fully global exports
+      (num_files * sizeof(DyibiccFileStats)) +    // array in base structure
+      (cache_dir_len * sizeof(char))              // pointed to by cache_dir
       ;
 
   UserContext* data = calloc(1, total_size);
 
   data->load_file_contents = env_data->load_file_contents;
-  if (!data->load_file_contents) {
-    data->load_file_contents = default_load_file_fn;
-  }
   data->get_function_address = env_data->get_function_address;
   data->output_function = env_data->output_function;
   if (!data->output_function) {
     data->output_function = default_output_fn;
   }
   data->use_ansi_codes = env_data->use_ansi_codes;
+  data->num_compile_threads = env_data->num_compile_threads < 0
+                                  ? get_num_processors()
+                                  : MAX(env_data->num_compile_threads, 1);
+  data->compile_heap_retain_size = env_data->compile_heap_retain_size;
+  mutex_init(&data->lock);
 
   char* d = (char*)(&data[1]);
 
@@ -278,6 +265,9 @@ DyibiccContext* dyibicc_set_environment(DyibiccEnviromentData* env_data) {
   data->exports = (HashMap*)d;
   d += sizeof(HashMap) * (num_files + 1);
 
+  data->file_stats = (DyibiccFileStats*)d;
+  d += sizeof(DyibiccFileStats) * num_files;
+
   int i = 0;
   for (const char** p = env_data->include_paths; *p; ++p) {
     data->include_paths[i++] = d;
@@ -292,10 +282,19 @@ DyibiccContext* dyibicc_set_environment(DyibiccEnviromentData* env_data) {
 
   i = 0;
   for (const char** p = env_data->files; *p; ++p) {
-    FileLinkData* dld = &data->files[i++];
+    FileLinkData* dld = &data->files[i];
     dld->source_name = d;
     strcpy(dld->source_name, *p);
     d += strlen(*p) + 1;
+    data->file_stats[i].name = dld->source_name;
+    ++i;
+  }
+
+  if (env_data->cache_dir) {
+    data->cache_dir = d;
+    strcpy(d, env_data->cache_dir);
+    d += cache_dir_len;
+    dyo_create_cache_dir(data->cache_dir);
   }
 
   // These maps store an arbitrary number of symbols, and they must persist
@@ -306,97 +305,567 @@ DyibiccContext* dyibicc_set_environment(DyibiccEnviromentData* env_data) {
     data->exports[j].alloc_lifetime = AL_Manual;
   }
   data->reflect_types.alloc_lifetime = AL_UserContext;
+  data->intern_pool.alloc_lifetime = AL_UserContext;
+  data->header_cache.alloc_lifetime = AL_UserContext;
+  data->base_macros.alloc_lifetime = AL_UserContext;
+  data->include_cache.alloc_lifetime = AL_Manual;
+  data->file_exists_cache.alloc_lifetime = AL_Manual;
 
   if ((size_t)(d - (char*)data) != total_size) {
     ABORT("incorrect size calculation");
   }
 
-  user_context = data;
   alloc_reset(AL_Temp);
+
+  UserContext* prev_context = user_context;
+  user_context = data;
   alloc_init(AL_UserContext);
+  user_context = prev_context;
   return (DyibiccContext*)data;
 }
 
+static void compile_pool_stop(UserContext* ctx);
+
 void dyibicc_free(DyibiccContext* context) {
   UserContext* ctx = (UserContext*)context;
-  assert(ctx == user_context && "only one context currently supported");
+  compile_pool_stop(ctx);
+  UserContext* prev_context = user_context;
+  user_context = ctx;
   for (size_t i = 0; i < ctx->num_files + 1; ++i) {
-    hashmap_clear_manual_key_owned_value_owned_aligned(&ctx->global_data[i]);
-    hashmap_clear_manual_key_owned_value_unowned(&ctx->exports[i]);
+    hashmap_clear_manual_key_unowned_value_owned_aligned(&ctx->global_data[i]);
+    hashmap_clear_manual_key_unowned_value_unowned(&ctx->exports[i]);
   }
-  alloc_reset(AL_UserContext);
+  header_cache_free();
+  include_cache_flush();
+  alloc_release(AL_UserContext);
+  alloc_release(AL_Compile);
+  alloc_release(AL_Temp);
+  alloc_release(AL_Link);
 
   for (size_t i = 0; i < ctx->num_files; ++i) {
     free_link_fixups(&ctx->files[i]);
+    free(ctx->files[i].cached_unit);
+    free(ctx->files[i].cached_deps);
   }
+  mutex_destroy(&ctx->lock);
   free(ctx);
-  user_context = NULL;
+  user_context = prev_context == ctx ? NULL : prev_context;
 }
 
-bool dyibicc_update(DyibiccContext* context, char* filename, char* contents) {
+static void reset_stats(UserContext* ctx) {
+  memset(&ctx->stats, 0, sizeof(ctx->stats));
+  ctx->stats.num_files = ctx->num_files;
+  ctx->stats.files = ctx->file_stats;
+  for (size_t i = 0; i < ctx->num_files; ++i) {
+    const char* name = ctx->file_stats[i].name;
+    memset(&ctx->file_stats[i], 0, sizeof(DyibiccFileStats));
+    ctx->file_stats[i].name = name;
+  }
+}
+
+// Called after a file is compiled, but before the compile heap is reset. This
+// may be on a compile thread, so only touches the file's own stats.
+static void record_file_stats(UserContext* ctx,
+                              size_t file_index,
+                              CompiledUnit* unit,
+                              uint64_t start_time,
+                              uint64_t preprocessed_time,
+                              uint64_t parsed_time,
+                              uint64_t generated_time) {
+  DyibiccFileStats* fs = &ctx->file_stats[file_index];
+  fs->compiled = true;
+  fs->tokenize_ns = compiler_state.tokenize__time_ns;
+  fs->preprocess_ns = preprocessed_time - start_time - fs->tokenize_ns;
+  fs->parse_ns = parsed_time - preprocessed_time;
+  fs->codegen_ns = generated_time - parsed_time;
+  fs->num_tokens = compiler_state.tokenize__num_tokens;
+  fs->num_nodes = compiler_state.parse__num_nodes;
+  fs->num_objs = compiler_state.parse__num_objs;
+  fs->num_fixups = 0;
+  for (int i = 0; i < unit->num_relocs; ++i) {
+    if (unit->relocs[i].name)
+      fs->num_fixups++;
+  }
+  fs->code_bytes = compiler_state.codegen__code_size;
+  fs->data_bytes = compiler_state.codegen__data_size;
+  fs->compile_heap_peak = alloc_take_peak(AL_Compile);
+}
+
+static void accumulate_file_stats(UserContext* ctx, size_t file_index) {
+  DyibiccFileStats* fs = &ctx->file_stats[file_index];
+  DyibiccStats* s = &ctx->stats;
+  s->num_files_compiled++;
+  s->tokenize_ns += fs->tokenize_ns;
+  s->preprocess_ns += fs->preprocess_ns;
+  s->parse_ns += fs->parse_ns;
+  s->codegen_ns += fs->codegen_ns;
+  s->num_tokens += fs->num_tokens;
+  s->num_nodes += fs->num_nodes;
+  s->num_objs += fs->num_objs;
+  s->num_fixups += fs->num_fixups;
+  s->code_bytes += fs->code_bytes;
+  s->data_bytes += fs->data_bytes;
+  s->compile_heap_peak = MAX(s->compile_heap_peak, fs->compile_heap_peak);
+}
+
+typedef struct CompileJob {
+  size_t file_index;
+  CompiledUnit* unit;  // NULL if not compiled, or compilation failed.
+  bool from_cache;     // |unit| is the file's cached_unit, rather than newly compiled.
+  FileHash* deps;      // Files read to compile |unit|, the first is the .c file.
+  int num_deps;
+  ByteArray output;  // Diagnostics, if captured on a compile thread.
+} CompileJob;
+
+// Identifies the compiler that produced a cached unit: the sources it was built
+// from (see gen_build_hash.py), and the format it was saved in.
+static uint64_t compiler_build_hash(void) {
+  return hash_combine(DYIBICC_BUILD_HASH, DYO_VERSION);
+}
+
+static uint64_t compute_cache_key(FileHash* deps, int num_deps) {
+  uint64_t key = compiler_build_hash();
+  for (int i = 0; i < num_deps; ++i) {
+    key = hash_combine(key, hash_bytes(deps[i].path, strlen(deps[i].path)));
+    key = hash_combine(key, deps[i].hash);
+  }
+  return key;
+}
+
+// Gets the hash of the current contents of |path|, remembering it in |hashes|
+// so that headers shared by several files are only loaded once per update.
+// Returns false if the file can't be loaded.
+static bool current_file_hash(char* path, HashMap* hashes, uint64_t* hash) {
+  void* prev = hashmap_get_interned(hashes, path);
+  if (prev) {
+    *hash = (uint64_t)(uintptr_t)prev;
+    return true;
+  }
+
+  LoadedFile lf;
+  if (!load_file(path, &lf))
+    return false;
+  // Only the text up to a nul is compiled, see tokenize_filecontents().
+  *hash = hash_bytes(lf.contents, strlen(lf.contents));
+  unload_file(&lf);
+  hashmap_put_interned(hashes, path, (void*)(uintptr_t)*hash);
+  return true;
+}
+
+// Returns whether the file's cached unit was compiled from exactly the files
+// that would be read to compile it now, in which case it can be installed
+// again as-is.
+//
+// Only files that were read are checked, so a header newly added to an earlier
+// include path, that would shadow one that was used, isn't noticed.
+static bool cached_unit_is_current(FileLinkData* dld, HashMap* hashes) {
+  if (!dld->cached_unit)
+    return false;
+
+  for (int i = 0; i < dld->num_cached_deps; ++i) {
+    FileHash* dep = &dld->cached_deps[i];
+    uint64_t hash;
+    if (!current_file_hash(dep->path, hashes, &hash) || hash != dep->hash)
+      return false;
+  }
+  return compute_cache_key(dld->cached_deps, dld->num_cached_deps) == dld->cache_key;
+}
+
+// Replaces the file's cached unit with a newly compiled one, and saves it to
+// the cache directory if there is one.
+static void update_cached_unit(UserContext* ctx, FileLinkData* dld, CompileJob* job) {
+  free(dld->cached_unit);
+  free(dld->cached_deps);
+  dld->cached_unit = job->unit;
+  dld->cached_deps = job->deps;
+  dld->num_cached_deps = job->num_deps;
+  dld->cache_key = compute_cache_key(job->deps, job->num_deps);
+  job->unit = NULL;
+  job->deps = NULL;
+
+  if (ctx->cache_dir) {
+    dyo_save(dyo_cache_path(ctx->cache_dir, dld->source_name, AL_Temp), dld->cached_unit,
+             dld->cached_deps, dld->num_cached_deps, compiler_build_hash(), dld->cache_key);
+  }
+}
+
+// Loads the file's unit from the cache directory, if it was saved by a
+// previous process (or context). Whether it's still current is checked as for
+// a unit that was compiled in this process.
+static void load_cached_unit(UserContext* ctx, FileLinkData* dld) {
+  dld->cached_unit =
+      dyo_load(dyo_cache_path(ctx->cache_dir, dld->source_name, AL_Temp), compiler_build_hash(),
+               &dld->cached_deps, &dld->num_cached_deps, &dld->cache_key);
+}
+
+// Whether a file has to be compiled again when |path| has changed: it's the
+// file itself, or it read |path| the last time it was compiled.
+static bool file_depends_on(FileLinkData* dld, char* path) {
+  if (same_path(dld->source_name, path))
+    return true;
+  for (int i = 0; i < dld->num_cached_deps; ++i) {
+    if (same_path(dld->cached_deps[i].path, path))
+      return true;
+  }
+  return false;
+}
+
+// Compiles one translation unit on the current thread, filling out |job|'s
+// unit and deps. Returns false if there was an error, which has already been
+// reported.
+static bool compile_file(UserContext* ctx, CompileJob* job) {
   if (setjmp(toplevel_update_jmpbuf) != 0) {
     codegen_free();
+    tokenize_free();
     alloc_reset(AL_Compile);
     alloc_reset(AL_Temp);
-    alloc_reset(AL_Link);
-    memset(&compiler_state, 0, sizeof(compiler_state));
-    memset(&linker_state, 0, sizeof(linker_state));
     return false;
   }
 
-  UserContext* ctx = (UserContext*)context;
-  bool link_result = true;
+  size_t file_index = job->file_index;
+  FileLinkData* dld = &ctx->files[file_index];
+
+  alloc_init(AL_Compile);
+  alloc_take_peak(AL_Compile);
+  compiler_state.hashmap__use_intern_cache = true;
+  uint64_t start_time = get_time_ns();
+
+  init_macros();
+  C(base_file) = dld->source_name;
+  Token* tok = tokenize_file(C(base_file));
+  if (!tok)
+    error("%s: %s", C(base_file), strerror(errno));
+  tok = preprocess(tok);
+  alloc_reset(AL_Temp);  // The preprocessor's working memory, see preprocess.c.
+  uint64_t preprocessed_time = get_time_ns();
+
+  codegen_init();  // Initializes dynasm so that parse() can emit functions.
+
+  Obj* prog = parse(tok);
+  // Most functions are generated by parse(), see function(), so that's counted
+  // as codegen time.
+  uint64_t parsed_time = get_time_ns() - compiler_state.codegen__time_ns;
+  CompiledUnit* unit = codegen(prog);
+  uint64_t generated_time = get_time_ns();
+
+  record_file_stats(ctx, file_index, unit, start_time, preprocessed_time, parsed_time,
+                    generated_time);
+
+  FileHashArray* loaded = &compiler_state.tokenize__loaded_files;
+  job->unit = unit;
+  job->num_deps = loaded->len;
+  job->deps = malloc(sizeof(FileHash) * loaded->len);
+  memcpy(job->deps, loaded->data, sizeof(FileHash) * loaded->len);
+
+  tokenize_free();
+  alloc_reset(AL_Compile);
+  return true;
+}
 
-  assert(ctx == user_context && "only one context currently supported");
+typedef struct CompileQueue {
+  UserContext* ctx;
+  CompileJob* jobs;
+  size_t num_jobs;
+  size_t num_to_compile;  // Jobs that aren't from_cache.
+  Mutex lock;  // Guards the fields below.
+  size_t next_job;
+  size_t first_failure;  // Jobs after this one aren't used, so needn't be compiled.
+  size_t temp_heap_peak;
+} CompileQueue;
+
+// Takes jobs from the queue in order until it's empty, or there's been a
+// failure in an earlier job.
+static void run_compile_jobs(CompileQueue* q, bool capture_output) {
+  for (;;) {
+    mutex_lock(&q->lock);
+    size_t i = q->next_job++;
+    bool done = i >= q->num_jobs || i > q->first_failure;
+    mutex_unlock(&q->lock);
+    if (done)
+      break;
+
+    CompileJob* job = &q->jobs[i];
+    if (job->from_cache)
+      continue;
+    if (capture_output)
+      output_capture_begin(&job->output);
+    bool ok = compile_file(q->ctx, job);
+    if (capture_output)
+      output_capture_end();
+
+    if (!ok) {
+      mutex_lock(&q->lock);
+      q->first_failure = MIN(q->first_failure, i);
+      mutex_unlock(&q->lock);
+    }
+  }
+}
 
-  bool compiled_any = false;
-  {
-    for (size_t i = 0; i < ctx->num_files; ++i) {
-      FileLinkData* dld = &ctx->files[i];
+// A compile thread, which waits for each update's queue in turn.
+typedef struct CompileWorker {
+  CompilePool* pool;
+  Thread thread;
+  uint64_t generation;  // Of the last queue this worker took.
+} CompileWorker;
+
+// The compile threads of a context. They're kept between updates so that
+// neither the threads nor their AL_Compile and AL_Temp heaps, which are
+// thread-local, have to be set up again for each one.
+struct CompilePool {
+  UserContext* ctx;
+  Mutex lock;           // Guards the fields below.
+  CondVar queued;       // Broadcast when there's a new |queue|, or on stopping.
+  CondVar finished;     // Broadcast when |num_busy| gets to 0.
+  CompileQueue* queue;  // The current update's, or NULL between updates.
+  uint64_t generation;  // Incremented for each queue, so that each worker takes it once.
+  int num_busy;         // Workers that haven't finished with |queue|.
+  bool stopping;
+  int num_workers;         // Only used by the thread calling update().
+  CompileWorker* workers;  // num_compile_threads of these.
+};
+
+static void compile_thread_main(void* arg) {
+  CompileWorker* w = arg;
+  CompilePool* pool = w->pool;
+  user_context = pool->ctx;
+  alloc_set_retain_size(AL_Compile, pool->ctx->compile_heap_retain_size);
+  alloc_set_retain_size(AL_Temp, pool->ctx->compile_heap_retain_size);
+
+  mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->stopping && pool->generation == w->generation)
+      condvar_wait(&pool->queued, &pool->lock);
+    if (pool->stopping)
+      break;
+    w->generation = pool->generation;
+    CompileQueue* q = pool->queue;
+    mutex_unlock(&pool->lock);
+
+    run_compile_jobs(q, /*capture_output=*/true);
+
+    // Not in MAX(), which would take it twice.
+    size_t temp_heap_peak = alloc_take_peak(AL_Temp);
+    mutex_lock(&q->lock);
+    q->temp_heap_peak = MAX(q->temp_heap_peak, temp_heap_peak);
+    mutex_unlock(&q->lock);
+
+    mutex_lock(&pool->lock);
+    if (--pool->num_busy == 0)
+      condvar_broadcast(&pool->finished);
+  }
+  mutex_unlock(&pool->lock);
 
-      if (filename && strcmp(dld->source_name, filename) != 0) {
-        // If a specific update is provided, we only compile that one.
-        continue;
-      }
+  // The heaps belong to this thread, so have to be returned before it exits.
+  alloc_release(AL_Compile);
+  alloc_release(AL_Temp);
+}
 
-      {
-        alloc_init(AL_Compile);
+// Starts compile threads until there are |num_threads|, creating the pool if
+// this is the first update to need one. Returns how many are running.
+static int compile_pool_grow(UserContext* ctx, int num_threads) {
+  CompilePool* pool = ctx->compile_pool;
+  if (!pool) {
+    pool = calloc(1, sizeof(CompilePool));
+    pool->ctx = ctx;
+    mutex_init(&pool->lock);
+    condvar_init(&pool->queued);
+    condvar_init(&pool->finished);
+    pool->workers = calloc(ctx->num_compile_threads, sizeof(CompileWorker));
+    ctx->compile_pool = pool;
+  }
 
-        init_macros();
-        C(base_file) = dld->source_name;
-        Token* tok;
-        if (filename) {
-          tok = tokenize_filecontents(filename, contents);
-        } else {
-          tok = tokenize_file(C(base_file));
-        }
-        if (!tok)
-          error("%s: %s", C(base_file), strerror(errno));
-        tok = preprocess(tok);
+  while (pool->num_workers < num_threads) {
+    CompileWorker* w = &pool->workers[pool->num_workers];
+    w->pool = pool;
+    // Only this thread changes the generation, so it can be read unlocked.
+    w->generation = pool->generation;
+    if (!thread_start(&w->thread, compile_thread_main, w))
+      break;
+    ++pool->num_workers;
+  }
+  return pool->num_workers;
+}
 
-        codegen_init();  // Initializes dynasm so that parse() can assign labels.
+static void compile_pool_stop(UserContext* ctx) {
+  CompilePool* pool = ctx->compile_pool;
+  if (!pool)
+    return;
+
+  mutex_lock(&pool->lock);
+  pool->stopping = true;
+  condvar_broadcast(&pool->queued);
+  mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->num_workers; ++i) {
+    thread_join(pool->workers[i].thread);
+  }
 
-        Obj* prog = parse(tok);
-        codegen(prog, i);
+  condvar_destroy(&pool->queued);
+  condvar_destroy(&pool->finished);
+  mutex_destroy(&pool->lock);
+  free(pool->workers);
+  free(pool);
+  ctx->compile_pool = NULL;
+}
 
-        compiled_any = true;
+// Compiles all the jobs, on the context's compile threads if there's more than
+// one job and the context allows it. Every running thread takes the queue,
+// including any beyond the number of jobs, which just find it empty.
+static void compile_all(CompileQueue* q) {
+  int num_threads = (int)MIN((size_t)q->ctx->num_compile_threads, q->num_to_compile);
+  if (num_threads <= 1 || compile_pool_grow(q->ctx, num_threads) == 0) {
+    run_compile_jobs(q, /*capture_output=*/false);
+    return;
+  }
 
-        alloc_reset(AL_Compile);
-      }
-    }
+  CompilePool* pool = q->ctx->compile_pool;
+  mutex_lock(&pool->lock);
+  pool->queue = q;
+  pool->generation++;
+  pool->num_busy = pool->num_workers;
+  condvar_broadcast(&pool->queued);
+  while (pool->num_busy > 0)
+    condvar_wait(&pool->finished, &pool->lock);
+  pool->queue = NULL;
+  mutex_unlock(&pool->lock);
+}
 
-    if (compiled_any) {
-      alloc_init(AL_Link);
+static bool update(UserContext* ctx, char* filename, char* contents) {
+  bool link_result = true;
+
+  uint64_t update_start_time = get_time_ns();
+  reset_stats(ctx);
+  alloc_take_peak(AL_Temp);
+  alloc_take_peak(AL_Link);
+  alloc_take_peak(AL_UserContext);
+  alloc_set_retain_size(AL_Compile, ctx->compile_heap_retain_size);
+  alloc_set_retain_size(AL_Temp, ctx->compile_heap_retain_size);
+  header_cache_begin_update();
+
+  CompileQueue queue = {0};
+  queue.ctx = ctx;
+  queue.jobs = calloc(ctx->num_files, sizeof(CompileJob));
+  queue.first_failure = SIZE_MAX;
+  mutex_init(&queue.lock);
+
+  // If a single file was changed, whether a .c file or a header, the new
+  // contents are used in place of loading it (see load_file()), and only the
+  // files that read it last time need compiling. Files without a unit haven't
+  // compiled yet (or failed to), so which files they read isn't known, and
+  // they're always compiled.
+  ctx->update_path = filename;
+  ctx->update_contents = contents;
+  for (size_t i = 0; i < ctx->num_files; ++i) {
+    FileLinkData* dld = &ctx->files[i];
+    if (!dld->cached_unit && ctx->cache_dir)
+      load_cached_unit(ctx, dld);
+    if (filename && dld->cached_unit && !file_depends_on(dld, filename))
+      continue;
 
-      link_result = link_all_files();
+    queue.jobs[queue.num_jobs++].file_index = i;
+  }
 
+  // Files that haven't changed, nor have any of their includes, don't need to
+  // be compiled again.
+  HashMap file_hashes = {0};
+  file_hashes.alloc_lifetime = AL_Manual;
+  for (size_t i = 0; i < queue.num_jobs; ++i) {
+    CompileJob* job = &queue.jobs[i];
+    FileLinkData* dld = &ctx->files[job->file_index];
+    if (cached_unit_is_current(dld, &file_hashes)) {
+      job->unit = dld->cached_unit;
+      job->from_cache = true;
+    } else {
+      queue.num_to_compile++;
+    }
+  }
+  hashmap_clear_manual_key_unowned_value_unowned(&file_hashes);
+
+  compile_all(&queue);
+  ctx->update_path = NULL;
+  ctx->update_contents = NULL;
+
+  // Install in file order, stopping at the first failure so that the outcome
+  // is the same as compiling serially.
+  bool installed_any = false;
+  bool failed = false;
+  for (size_t i = 0; i < queue.num_jobs; ++i) {
+    CompileJob* job = &queue.jobs[i];
+    FileLinkData* dld = &ctx->files[job->file_index];
+    if (!failed) {
+      if (job->output.len)
+        outaf("%.*s", job->output.len, job->output.data);
+      if (job->unit) {
+        link_install_unit(job->file_index, job->unit);
+        if (job->from_cache) {
+          ctx->file_stats[job->file_index].cached = true;
+          ctx->stats.num_files_cached++;
+        } else {
+          accumulate_file_stats(ctx, job->file_index);
+          update_cached_unit(ctx, dld, job);
+        }
+        installed_any = true;
+      } else {
+        failed = true;
+      }
+    }
+    if (!job->from_cache)
+      free(job->unit);
+    free(job->deps);
+    free(job->output.data);
+  }
+  free(queue.jobs);
+  mutex_destroy(&queue.lock);
+
+  if (failed) {
+    include_cache_flush();
+    link_result = false;
+  } else if (installed_any) {
+    if (setjmp(toplevel_update_jmpbuf) != 0) {
       alloc_reset(AL_Link);
+      memset(&linker_state, 0, sizeof(linker_state));
+      return false;
     }
+
+    alloc_init(AL_Link);
+
+    uint64_t link_start_time = get_time_ns();
+    link_result = link_all_files();
+    ctx->stats.link_ns = get_time_ns() - link_start_time;
+
+    alloc_reset(AL_Link);
   }
 
+  size_t temp_heap_peak = alloc_take_peak(AL_Temp);
+  ctx->stats.temp_heap_peak = MAX(temp_heap_peak, queue.temp_heap_peak);
+  ctx->stats.link_heap_peak = alloc_take_peak(AL_Link);
+  ctx->stats.user_context_heap_peak = alloc_take_peak(AL_UserContext);
+  ctx->stats.total_ns = get_time_ns() - update_start_time;
+
   return link_result;
 }
 
+bool dyibicc_update(DyibiccContext* context, char* filename, char* contents) {
+  // Contexts are independent, so the current one is per-thread, and any other
+  // context that this thread is in the middle of using is restored after.
+  UserContext* prev_context = user_context;
+  user_context = (UserContext*)context;
+  bool result = update(user_context, filename, contents);
+  user_context = prev_context;
+  return result;
+}
+
+void dyibicc_flush_include_cache(DyibiccContext* context) {
+  UserContext* prev_context = user_context;
+  user_context = (UserContext*)context;
+  include_cache_flush();
+  user_context = prev_context;
+}
+
+const DyibiccStats* dyibicc_get_stats(DyibiccContext* context) {
+  UserContext* ctx = (UserContext*)context;
+  return &ctx->stats;
+}
+
 void* dyibicc_find_export(DyibiccContext* context, char* name) {
   UserContext* ctx = (UserContext*)context;
   return hashmap_get(&ctx->exports[ctx->num_files], name);
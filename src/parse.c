@@ -140,7 +140,7 @@ static void leave_scope(void) {
 // Find a variable by name.
 static VarScope* find_var(Token* tok) {
   for (Scope* sc = C(scope); sc; sc = sc->next) {
-    VarScope* sc2 = hashmap_get2(&sc->vars, tok->loc, tok->len);
+    VarScope* sc2 = hashmap_get_interned(&sc->vars, tok->ident);
     if (sc2)
       return sc2;
   }
@@ -149,7 +149,7 @@ static VarScope* find_var(Token* tok) {
 
 static Type* find_tag(Token* tok) {
   for (Scope* sc = C(scope); sc; sc = sc->next) {
-    Type* ty = hashmap_get2(&sc->tags, tok->loc, tok->len);
+    Type* ty = hashmap_get_interned(&sc->tags, tok->ident);
     if (ty)
       return ty;
   }
@@ -157,7 +157,8 @@ static Type* find_tag(Token* tok) {
 }
 
 static Node* new_node(NodeKind kind, Token* tok) {
-  Node* node = bumpcalloc(1, sizeof(Node), AL_Compile);
+  Node* node = bumpcalloc(1, sizeof(Node), C(node_lifetime));
+  C(num_nodes)++;
   node->kind = kind;
   node->tok = tok;
   return node;
@@ -217,7 +218,8 @@ static Node* new_reflect_type_ptr(_ReflectType* rty, Token* tok) {
 IMPLSTATIC Node* new_cast(Node* expr, Type* ty) {
   add_type(expr);
 
-  Node* node = bumpcalloc(1, sizeof(Node), AL_Compile);
+  Node* node = bumpcalloc(1, sizeof(Node), C(node_lifetime));
+  C(num_nodes)++;
   node->kind = ND_CAST;
   node->tok = expr->tok;
   node->lhs = expr;
@@ -225,9 +227,10 @@ IMPLSTATIC Node* new_cast(Node* expr, Type* ty) {
   return node;
 }
 
+// |name| must be interned.
 static VarScope* push_scope(char* name) {
   VarScope* sc = bumpcalloc(1, sizeof(VarScope), AL_Compile);
-  hashmap_put(&C(scope)->vars, name, sc);
+  hashmap_put_interned(&C(scope)->vars, name, sc);
   return sc;
 }
 
@@ -273,10 +276,13 @@ static Initializer* new_initializer(Type* ty, bool is_flexible) {
 
 static Obj* new_var(char* name, Type* ty) {
   Obj* var = bumpcalloc(1, sizeof(Obj), AL_Compile);
+  C(num_objs)++;
   var->name = name;
   var->ty = ty;
   var->align = ty->align;
-  push_scope(name)->var = var;
+  // Unnamed temporaries can't be referred to, so aren't added to the scope.
+  if (*name)
+    push_scope(name)->var = var;
   return var;
 }
 
@@ -298,7 +304,7 @@ static Obj* new_gvar(char* name, Type* ty) {
 }
 
 static char* new_unique_name(void) {
-  return format(AL_Compile, "L..%d", C(unique_name_id)++);
+  return intern(format(AL_Temp, "L..%d", C(unique_name_id)++));
 }
 
 static Obj* new_anon_gvar(Type* ty) {
@@ -315,7 +321,7 @@ static Obj* new_string_literal(char* p, Type* ty) {
 static char* get_ident(Token* tok) {
   if (tok->kind != TK_IDENT)
     error_tok(tok, "expected an identifier");
-  return bumpstrndup(tok->loc, tok->len, AL_Compile);
+  return tok->ident;
 }
 
 static Type* find_typedef(Token* tok) {
@@ -328,7 +334,7 @@ static Type* find_typedef(Token* tok) {
 }
 
 static void push_tag_scope(Token* tok, Type* ty) {
-  hashmap_put2(&C(scope)->tags, tok->loc, tok->len, ty);
+  hashmap_put_interned(&C(scope)->tags, tok->ident, ty);
 }
 
 // declspec = ("void" | "_Bool" | "char" | "short" | "int" | "long"
@@ -379,18 +385,18 @@ static Type* declspec(Token** rest, Token* tok, VarAttr* attr) {
 
   while (is_typename(tok)) {
     // Handle storage class specifiers.
-    if (equal(tok, "typedef") || equal(tok, "static") || equal(tok, "extern") ||
-        equal(tok, "inline") || equal(tok, "_Thread_local") || equal(tok, "__thread")) {
+    if (equal(tok, KW_TYPEDEF) || equal(tok, KW_STATIC) || equal(tok, KW_EXTERN) ||
+        equal(tok, ID_INLINE) || equal(tok, KW__THREAD_LOCAL) || equal(tok, KW___THREAD)) {
       if (!attr)
         error_tok(tok, "storage class specifier is not allowed in this context");
 
-      if (equal(tok, "typedef"))
+      if (equal(tok, KW_TYPEDEF))
         attr->is_typedef = true;
-      else if (equal(tok, "static"))
+      else if (equal(tok, KW_STATIC))
         attr->is_static = true;
-      else if (equal(tok, "extern"))
+      else if (equal(tok, KW_EXTERN))
         attr->is_extern = true;
-      else if (equal(tok, "inline"))
+      else if (equal(tok, ID_INLINE))
         attr->is_inline = true;
       else
         attr->is_tls = true;
@@ -405,49 +411,49 @@ static Type* declspec(Token** rest, Token* tok, VarAttr* attr) {
     }
 
     // These keywords are recognized but ignored.
-    if (consume(&tok, tok, "const") || consume(&tok, tok, "volatile") ||
-        consume(&tok, tok, "auto") || consume(&tok, tok, "register") ||
-        consume(&tok, tok, "restrict") || consume(&tok, tok, "__restrict") ||
-        consume(&tok, tok, "__restrict__") || consume(&tok, tok, "_Noreturn"))
+    if (consume(&tok, tok, KW_CONST) || consume(&tok, tok, KW_VOLATILE) ||
+        consume(&tok, tok, KW_AUTO) || consume(&tok, tok, KW_REGISTER) ||
+        consume(&tok, tok, KW_RESTRICT) || consume(&tok, tok, KW___RESTRICT) ||
+        consume(&tok, tok, KW___RESTRICT__) || consume(&tok, tok, KW__NORETURN))
       continue;
 
-    if (equal(tok, "_Atomic")) {
+    if (equal(tok, KW__ATOMIC)) {
       tok = tok->next;
-      if (equal(tok, "(")) {
+      if (equal(tok, PU_LPAREN)) {
         ty = typename(&tok, tok->next);
-        tok = skip(tok, ")");
+        tok = skip(tok, PU_RPAREN);
       }
       is_atomic = true;
       continue;
     }
 
-    if (equal(tok, "_Alignas")) {
+    if (equal(tok, KW__ALIGNAS)) {
       if (!attr)
         error_tok(tok, "_Alignas is not allowed in this context");
-      tok = skip(tok->next, "(");
+      tok = skip(tok->next, PU_LPAREN);
 
       if (is_typename(tok))
         attr->align = typename(&tok, tok)->align;
       else
         attr->align = (int)const_expr(&tok, tok);
-      tok = skip(tok, ")");
+      tok = skip(tok, PU_RPAREN);
       continue;
     }
 
     // Handle user-defined types.
     Type* ty2 = find_typedef(tok);
-    if (equal(tok, "struct") || equal(tok, "union") || equal(tok, "enum") || equal(tok, "typeof") ||
-        ty2) {
+    if (equal(tok, KW_STRUCT) || equal(tok, KW_UNION) || equal(tok, KW_ENUM) ||
+        equal(tok, KW_TYPEOF) || ty2) {
       if (counter)
         break;
 
-      if (equal(tok, "struct")) {
+      if (equal(tok, KW_STRUCT)) {
         ty = struct_decl(&tok, tok->next);
-      } else if (equal(tok, "union")) {
+      } else if (equal(tok, KW_UNION)) {
         ty = union_decl(&tok, tok->next);
-      } else if (equal(tok, "enum")) {
+      } else if (equal(tok, KW_ENUM)) {
         ty = enum_specifier(&tok, tok->next);
-      } else if (equal(tok, "typeof")) {
+      } else if (equal(tok, KW_TYPEOF)) {
         ty = typeof_specifier(&tok, tok->next);
       } else {
         ty = ty2;
@@ -459,32 +465,45 @@ static Type* declspec(Token** rest, Token* tok, VarAttr* attr) {
     }
 
     // Handle built-in types.
-    if (equal(tok, "void"))
-      counter += VOID;
-    else if (equal(tok, "_Bool"))
-      counter += BOOL;
-    else if (equal(tok, "char"))
-      counter += CHAR;
-    else if (equal(tok, "short"))
-      counter += SHORT;
-    else if (equal(tok, "int"))
-      counter += INT;
-    else if (equal(tok, "long"))
-      counter += LONG;
+    switch (tok->id) {
+      case KW_VOID:
+        counter += VOID;
+        break;
+      case KW__BOOL:
+        counter += BOOL;
+        break;
+      case KW_CHAR:
+        counter += CHAR;
+        break;
+      case KW_SHORT:
+        counter += SHORT;
+        break;
+      case KW_INT:
+        counter += INT;
+        break;
+      case KW_LONG:
+        counter += LONG;
+        break;
 #if X64WIN
-    else if (equal(tok, "__int64"))
-      counter += INT64;
+      case KW___INT64:
+        counter += INT64;
+        break;
 #endif
-    else if (equal(tok, "float"))
-      counter += FLOAT;
-    else if (equal(tok, "double"))
-      counter += DOUBLE;
-    else if (equal(tok, "signed"))
-      counter |= SIGNED;
-    else if (equal(tok, "unsigned"))
-      counter |= UNSIGNED;
-    else
-      unreachable();
+      case KW_FLOAT:
+        counter += FLOAT;
+        break;
+      case KW_DOUBLE:
+        counter += DOUBLE;
+        break;
+      case KW_SIGNED:
+        counter |= SIGNED;
+        break;
+      case KW_UNSIGNED:
+        counter |= UNSIGNED;
+        break;
+      default:
+        unreachable();
+    }
 
     switch (counter) {
       case VOID:
@@ -594,7 +613,7 @@ static Type* declspec(Token** rest, Token* tok, VarAttr* attr) {
 // func-params = ("void" | param ("," param)* ("," "...")?)? ")"
 // param       = declspec declarator
 static Type* func_params(Token** rest, Token* tok, Type* ty) {
-  if (equal(tok, "void") && equal(tok->next, ")")) {
+  if (equal(tok, KW_VOID) && equal(tok->next, PU_RPAREN)) {
     *rest = tok->next->next;
     return func_type(ty);
   }
@@ -603,14 +622,14 @@ static Type* func_params(Token** rest, Token* tok, Type* ty) {
   Type* cur = &head;
   bool is_variadic = false;
 
-  while (!equal(tok, ")")) {
+  while (!equal(tok, PU_RPAREN)) {
     if (cur != &head)
-      tok = skip(tok, ",");
+      tok = skip(tok, PU_COMMA);
 
-    if (equal(tok, "...")) {
+    if (equal(tok, PU_ELLIPSIS)) {
       is_variadic = true;
       tok = tok->next;
-      skip(tok, ")");
+      skip(tok, PU_RPAREN);
       break;
     }
 
@@ -646,16 +665,16 @@ static Type* func_params(Token** rest, Token* tok, Type* ty) {
 
 // array-dimensions = ("static" | "restrict")* const-expr? "]" type-suffix
 static Type* array_dimensions(Token** rest, Token* tok, Type* ty) {
-  while (equal(tok, "static") || equal(tok, "restrict"))
+  while (equal(tok, KW_STATIC) || equal(tok, KW_RESTRICT))
     tok = tok->next;
 
-  if (equal(tok, "]")) {
+  if (equal(tok, PU_RBRACKET)) {
     ty = type_suffix(rest, tok->next, ty);
     return array_of(ty, -1);
   }
 
   Node* expr = conditional(&tok, tok);
-  tok = skip(tok, "]");
+  tok = skip(tok, PU_RBRACKET);
   ty = type_suffix(rest, tok, ty);
 
   if (ty->kind == TY_VLA || !is_const_expr(expr))
@@ -667,10 +686,10 @@ static Type* array_dimensions(Token** rest, Token* tok, Type* ty) {
 //             | "[" array-dimensions
 //             | ε
 static Type* type_suffix(Token** rest, Token* tok, Type* ty) {
-  if (equal(tok, "("))
+  if (equal(tok, PU_LPAREN))
     return func_params(rest, tok->next, ty);
 
-  if (equal(tok, "["))
+  if (equal(tok, PU_LBRACKET))
     return array_dimensions(rest, tok->next, ty);
 
   *rest = tok;
@@ -679,10 +698,10 @@ static Type* type_suffix(Token** rest, Token* tok, Type* ty) {
 
 // pointers = ("*" ("const" | "volatile" | "restrict")*)*
 static Type* pointers(Token** rest, Token* tok, Type* ty) {
-  while (consume(&tok, tok, "*")) {
+  while (consume(&tok, tok, PU_STAR)) {
     ty = pointer_to(ty);
-    while (equal(tok, "const") || equal(tok, "volatile") || equal(tok, "restrict") ||
-           equal(tok, "__restrict") || equal(tok, "__restrict__"))
+    while (equal(tok, KW_CONST) || equal(tok, KW_VOLATILE) || equal(tok, KW_RESTRICT) ||
+           equal(tok, KW___RESTRICT) || equal(tok, KW___RESTRICT__))
       tok = tok->next;
   }
   *rest = tok;
@@ -693,11 +712,11 @@ static Type* pointers(Token** rest, Token* tok, Type* ty) {
 static Type* declarator(Token** rest, Token* tok, Type* ty) {
   ty = pointers(&tok, tok, ty);
 
-  if (equal(tok, "(")) {
+  if (equal(tok, PU_LPAREN)) {
     Token* start = tok;
     Type dummy = {0};
     declarator(&tok, start->next, &dummy);
-    tok = skip(tok, ")");
+    tok = skip(tok, PU_RPAREN);
     ty = type_suffix(rest, tok, ty);
     return declarator(&tok, start->next, ty);
   }
@@ -720,11 +739,11 @@ static Type* declarator(Token** rest, Token* tok, Type* ty) {
 static Type* abstract_declarator(Token** rest, Token* tok, Type* ty) {
   ty = pointers(&tok, tok, ty);
 
-  if (equal(tok, "(")) {
+  if (equal(tok, PU_LPAREN)) {
     Token* start = tok;
     Type dummy = {0};
     abstract_declarator(&tok, start->next, &dummy);
-    tok = skip(tok, ")");
+    tok = skip(tok, PU_RPAREN);
     ty = type_suffix(rest, tok, ty);
     return abstract_declarator(&tok, start->next, ty);
   }
@@ -739,16 +758,16 @@ static Type* typename(Token** rest, Token* tok) {
 }
 
 static bool is_end(Token* tok) {
-  return equal(tok, "}") || (equal(tok, ",") && equal(tok->next, "}"));
+  return equal(tok, PU_RBRACE) || (equal(tok, PU_COMMA) && equal(tok->next, PU_RBRACE));
 }
 
 static bool consume_end(Token** rest, Token* tok) {
-  if (equal(tok, "}")) {
+  if (equal(tok, PU_RBRACE)) {
     *rest = tok->next;
     return true;
   }
 
-  if (equal(tok, ",") && equal(tok->next, "}")) {
+  if (equal(tok, PU_COMMA) && equal(tok->next, PU_RBRACE)) {
     *rest = tok->next->next;
     return true;
   }
@@ -770,7 +789,7 @@ static Type* enum_specifier(Token** rest, Token* tok) {
     tok = tok->next;
   }
 
-  if (tag && !equal(tok, "{")) {
+  if (tag && !equal(tok, PU_LBRACE)) {
     Type* ty2 = find_tag(tag);
     if (!ty2)
       error_tok(tag, "unknown enum type");
@@ -780,19 +799,19 @@ static Type* enum_specifier(Token** rest, Token* tok) {
     return ty2;
   }
 
-  tok = skip(tok, "{");
+  tok = skip(tok, PU_LBRACE);
 
   // Read an enum-list.
   int i = 0;
   int val = 0;
   while (!consume_end(rest, tok)) {
     if (i++ > 0)
-      tok = skip(tok, ",");
+      tok = skip(tok, PU_COMMA);
 
     char* name = get_ident(tok);
     tok = tok->next;
 
-    if (equal(tok, "="))
+    if (equal(tok, PU_ASSIGN))
       val = (int)const_expr(&tok, tok->next);
 
     VarScope* sc = push_scope(name);
@@ -807,7 +826,7 @@ static Type* enum_specifier(Token** rest, Token* tok) {
 
 // typeof-specifier = "(" (expr | typename) ")"
 static Type* typeof_specifier(Token** rest, Token* tok) {
-  tok = skip(tok, "(");
+  tok = skip(tok, PU_LPAREN);
 
   Type* ty;
   if (is_typename(tok)) {
@@ -817,7 +836,7 @@ static Type* typeof_specifier(Token** rest, Token* tok) {
     add_type(node);
     ty = node->ty;
   }
-  *rest = skip(tok, ")");
+  *rest = skip(tok, PU_RPAREN);
   return ty;
 }
 
@@ -857,9 +876,9 @@ static Node* declaration(Token** rest, Token* tok, Type* basety, VarAttr* attr)
   Node* cur = &head;
   int i = 0;
 
-  while (!equal(tok, ";")) {
+  while (!equal(tok, PU_SEMI)) {
     if (i++ > 0)
-      tok = skip(tok, ",");
+      tok = skip(tok, PU_COMMA);
 
     Type* ty = declarator(&tok, tok, basety);
     if (ty->kind == TY_VOID)
@@ -871,7 +890,7 @@ static Node* declaration(Token** rest, Token* tok, Type* basety, VarAttr* attr)
       // static local variable
       Obj* var = new_anon_gvar(ty);
       push_scope(get_ident(ty->name))->var = var;
-      if (equal(tok, "="))
+      if (equal(tok, PU_ASSIGN))
         gvar_initializer(&tok, tok->next, var);
       continue;
     }
@@ -882,7 +901,7 @@ static Node* declaration(Token** rest, Token* tok, Type* basety, VarAttr* attr)
     cur = cur->next = new_unary(ND_EXPR_STMT, compute_vla_size(ty, tok), tok);
 
     if (ty->kind == TY_VLA) {
-      if (equal(tok, "="))
+      if (equal(tok, PU_ASSIGN))
         error_tok(tok, "variable-sized object may not be initialized");
 
       // Variable length arrays (VLAs) are translated to alloca() calls.
@@ -901,7 +920,7 @@ static Node* declaration(Token** rest, Token* tok, Type* basety, VarAttr* attr)
     if (attr && attr->align)
       var->align = attr->align;
 
-    if (equal(tok, "=")) {
+    if (equal(tok, PU_ASSIGN)) {
       Node* expr = lvar_initializer(&tok, tok->next, var);
       cur = cur->next = new_unary(ND_EXPR_STMT, expr, tok);
     }
@@ -919,9 +938,9 @@ static Node* declaration(Token** rest, Token* tok, Type* basety, VarAttr* attr)
 }
 
 static Token* skip_excess_element(Token* tok) {
-  if (equal(tok, "{")) {
+  if (equal(tok, PU_LBRACE)) {
     tok = skip_excess_element(tok->next);
-    return skip(tok, "}");
+    return skip(tok, PU_RBRACE);
   }
 
   assign(&tok, tok);
@@ -931,25 +950,25 @@ static Token* skip_excess_element(Token* tok) {
 // string-initializer = string-literal
 static void string_initializer(Token** rest, Token* tok, Initializer* init) {
   if (init->is_flexible)
-    *init = *new_initializer(array_of(init->ty->base, tok->ty->array_len), false);
+    *init = *new_initializer(array_of(init->ty->base, tok->lit->ty->array_len), false);
 
-  int len = MIN(init->ty->array_len, tok->ty->array_len);
+  int len = MIN(init->ty->array_len, tok->lit->ty->array_len);
 
   switch (init->ty->base->size) {
     case 1: {
-      char* str = tok->str;
+      char* str = tok->lit->str;
       for (int i = 0; i < len; i++)
         init->children[i]->expr = new_num(str[i], tok);
       break;
     }
     case 2: {
-      uint16_t* str = (uint16_t*)tok->str;
+      uint16_t* str = (uint16_t*)tok->lit->str;
       for (int i = 0; i < len; i++)
         init->children[i]->expr = new_num(str[i], tok);
       break;
     }
     case 4: {
-      uint32_t* str = (uint32_t*)tok->str;
+      uint32_t* str = (uint32_t*)tok->lit->str;
       for (int i = 0; i < len; i++)
         init->children[i]->expr = new_num(str[i], tok);
       break;
@@ -991,7 +1010,7 @@ static void array_designator(Token** rest, Token* tok, Type* ty, int* begin, int
   if (*begin >= ty->array_len)
     error_tok(tok, "array designator index exceeds array bounds");
 
-  if (equal(tok, "...")) {
+  if (equal(tok, PU_ELLIPSIS)) {
     *end = (int)const_expr(&tok, tok->next);
     if (*end >= ty->array_len)
       error_tok(tok, "array designator index exceeds array bounds");
@@ -1001,13 +1020,13 @@ static void array_designator(Token** rest, Token* tok, Type* ty, int* begin, int
     *end = *begin;
   }
 
-  *rest = skip(tok, "]");
+  *rest = skip(tok, PU_RBRACKET);
 }
 
 // struct-designator = "." ident
 static Member* struct_designator(Token** rest, Token* tok, Type* ty) {
   Token* start = tok;
-  tok = skip(tok, ".");
+  tok = skip(tok, PU_DOT);
   if (tok->kind != TK_IDENT)
     error_tok(tok, "expected a field designator");
 
@@ -1035,7 +1054,7 @@ static Member* struct_designator(Token** rest, Token* tok, Type* ty) {
 
 // designation = ("[" const-expr "]" | "." ident)* "="? initializer
 static void designation(Token** rest, Token* tok, Initializer* init) {
-  if (equal(tok, "[")) {
+  if (equal(tok, PU_LBRACKET)) {
     if (init->ty->kind != TY_ARRAY)
       error_tok(tok, "array index in non-array initializer");
 
@@ -1049,7 +1068,7 @@ static void designation(Token** rest, Token* tok, Initializer* init) {
     return;
   }
 
-  if (equal(tok, ".") && init->ty->kind == TY_STRUCT) {
+  if (equal(tok, PU_DOT) && init->ty->kind == TY_STRUCT) {
     Member* mem = struct_designator(&tok, tok, init->ty);
     designation(&tok, tok, init->children[mem->idx]);
     init->expr = NULL;
@@ -1057,17 +1076,17 @@ static void designation(Token** rest, Token* tok, Initializer* init) {
     return;
   }
 
-  if (equal(tok, ".") && init->ty->kind == TY_UNION) {
+  if (equal(tok, PU_DOT) && init->ty->kind == TY_UNION) {
     Member* mem = struct_designator(&tok, tok, init->ty);
     init->mem = mem;
     designation(rest, tok, init->children[mem->idx]);
     return;
   }
 
-  if (equal(tok, "."))
+  if (equal(tok, PU_DOT))
     error_tok(tok, "field name not in struct or union initializer");
 
-  if (equal(tok, "="))
+  if (equal(tok, PU_ASSIGN))
     tok = tok->next;
   initializer2(rest, tok, init);
 }
@@ -1083,14 +1102,14 @@ static int count_array_init_elements(Token* tok, Type* ty) {
 
   while (!consume_end(&tok, tok)) {
     if (!first)
-      tok = skip(tok, ",");
+      tok = skip(tok, PU_COMMA);
     first = false;
 
-    if (equal(tok, "[")) {
+    if (equal(tok, PU_LBRACKET)) {
       i = (int)const_expr(&tok, tok->next);
-      if (equal(tok, "..."))
+      if (equal(tok, PU_ELLIPSIS))
         i = (int)const_expr(&tok, tok->next);
-      tok = skip(tok, "]");
+      tok = skip(tok, PU_RBRACKET);
       designation(&tok, tok, dummy);
     } else {
       initializer2(&tok, tok, dummy);
@@ -1104,7 +1123,7 @@ static int count_array_init_elements(Token* tok, Type* ty) {
 
 // array-initializer1 = "{" initializer ("," initializer)* ","? "}"
 static void array_initializer1(Token** rest, Token* tok, Initializer* init) {
-  tok = skip(tok, "{");
+  tok = skip(tok, PU_LBRACE);
 
   if (init->is_flexible) {
     int len = count_array_init_elements(tok, init->ty);
@@ -1120,10 +1139,10 @@ static void array_initializer1(Token** rest, Token* tok, Initializer* init) {
 
   for (int i = 0; !consume_end(rest, tok); i++) {
     if (!first)
-      tok = skip(tok, ",");
+      tok = skip(tok, PU_COMMA);
     first = false;
 
-    if (equal(tok, "[")) {
+    if (equal(tok, PU_LBRACKET)) {
       int begin, end;
       array_designator(&tok, tok, init->ty, &begin, &end);
 
@@ -1152,9 +1171,9 @@ static void array_initializer2(Token** rest, Token* tok, Initializer* init, int
   for (; i < init->ty->array_len && !is_end(tok); i++) {
     Token* start = tok;
     if (i > 0)
-      tok = skip(tok, ",");
+      tok = skip(tok, PU_COMMA);
 
-    if (equal(tok, "[") || equal(tok, ".")) {
+    if (equal(tok, PU_LBRACKET) || equal(tok, PU_DOT)) {
       *rest = start;
       return;
     }
@@ -1166,17 +1185,17 @@ static void array_initializer2(Token** rest, Token* tok, Initializer* init, int
 
 // struct-initializer1 = "{" initializer ("," initializer)* ","? "}"
 static void struct_initializer1(Token** rest, Token* tok, Initializer* init) {
-  tok = skip(tok, "{");
+  tok = skip(tok, PU_LBRACE);
 
   Member* mem = init->ty->members;
   bool first = true;
 
   while (!consume_end(rest, tok)) {
     if (!first)
-      tok = skip(tok, ",");
+      tok = skip(tok, PU_COMMA);
     first = false;
 
-    if (equal(tok, ".")) {
+    if (equal(tok, PU_DOT)) {
       mem = struct_designator(&tok, tok, init->ty);
       designation(&tok, tok, init->children[mem->idx]);
       mem = mem->next;
@@ -1200,10 +1219,10 @@ static void struct_initializer2(Token** rest, Token* tok, Initializer* init, Mem
     Token* start = tok;
 
     if (!first)
-      tok = skip(tok, ",");
+      tok = skip(tok, PU_COMMA);
     first = false;
 
-    if (equal(tok, "[") || equal(tok, ".")) {
+    if (equal(tok, PU_LBRACKET) || equal(tok, PU_DOT)) {
       *rest = start;
       return;
     }
@@ -1217,20 +1236,20 @@ static void union_initializer(Token** rest, Token* tok, Initializer* init) {
   // Unlike structs, union initializers take only one initializer,
   // and that initializes the first union member by default.
   // You can initialize other member using a designated initializer.
-  if (equal(tok, "{") && equal(tok->next, ".")) {
+  if (equal(tok, PU_LBRACE) && equal(tok->next, PU_DOT)) {
     Member* mem = struct_designator(&tok, tok->next, init->ty);
     init->mem = mem;
     designation(&tok, tok, init->children[mem->idx]);
-    *rest = skip(tok, "}");
+    *rest = skip(tok, PU_RBRACE);
     return;
   }
 
   init->mem = init->ty->members;
 
-  if (equal(tok, "{")) {
+  if (equal(tok, PU_LBRACE)) {
     initializer2(&tok, tok->next, init->children[0]);
-    consume(&tok, tok, ",");
-    *rest = skip(tok, "}");
+    consume(&tok, tok, PU_COMMA);
+    *rest = skip(tok, PU_RBRACE);
   } else {
     initializer2(rest, tok, init->children[0]);
   }
@@ -1246,12 +1265,12 @@ static void initializer2(Token** rest, Token* tok, Initializer* init) {
   }
 
   if (init->ty->kind == TY_ARRAY) {
-    if (equal(tok, "{")) {
+    if (equal(tok, PU_LBRACE)) {
       if (init->ty->base->kind == TY_CHAR && tok->next->kind == TK_STR) {
         // A string initializer for a char array can be surrounded by braces.
         // E.g. `char str[] = {"foo"};`.
         initializer2(&tok, tok->next, init);
-        *rest = skip(tok, "}");
+        *rest = skip(tok, PU_RBRACE);
         return;
       }
       array_initializer1(rest, tok, init);
@@ -1262,7 +1281,7 @@ static void initializer2(Token** rest, Token* tok, Initializer* init) {
   }
 
   if (init->ty->kind == TY_STRUCT) {
-    if (equal(tok, "{")) {
+    if (equal(tok, PU_LBRACE)) {
       struct_initializer1(rest, tok, init);
       return;
     }
@@ -1286,11 +1305,11 @@ static void initializer2(Token** rest, Token* tok, Initializer* init) {
     return;
   }
 
-  if (equal(tok, "{")) {
+  if (equal(tok, PU_LBRACE)) {
     // An initializer for a scalar variable can be surrounded by
     // braces. E.g. `int x = {3};`. Handle that case.
     initializer2(&tok, tok->next, init);
-    *rest = skip(tok, "}");
+    *rest = skip(tok, PU_RBRACE);
     return;
   }
 
@@ -1519,48 +1538,44 @@ static void gvar_initializer(Token** rest, Token* tok, Obj* var) {
 
 // Returns true if a given token represents a type.
 static bool is_typename(Token* tok) {
-  if (C(typename_map).capacity == 0) {
-    static char* kw[] = {
-      "void",
-      "_Bool",
-      "char",
-      "short",
-      "int",
-      "long",
-      "struct",
-      "union",
-      "typedef",
-      "enum",
-      "static",
-      "extern",
-      "_Alignas",
-      "signed",
-      "unsigned",
-      "const",
-      "volatile",
-      "auto",
-      "register",
-      "restrict",
-      "__restrict",
-      "__restrict__",
-      "_Noreturn",
-      "float",
-      "double",
-      "typeof",
-      "inline",
-      "_Thread_local",
-      "__thread",
-      "_Atomic",
+  switch (tok->id) {
+    case KW_VOID:
+    case KW__BOOL:
+    case KW_CHAR:
+    case KW_SHORT:
+    case KW_INT:
+    case KW_LONG:
+    case KW_STRUCT:
+    case KW_UNION:
+    case KW_TYPEDEF:
+    case KW_ENUM:
+    case KW_STATIC:
+    case KW_EXTERN:
+    case KW__ALIGNAS:
+    case KW_SIGNED:
+    case KW_UNSIGNED:
+    case KW_CONST:
+    case KW_VOLATILE:
+    case KW_AUTO:
+    case KW_REGISTER:
+    case KW_RESTRICT:
+    case KW___RESTRICT:
+    case KW___RESTRICT__:
+    case KW__NORETURN:
+    case KW_FLOAT:
+    case KW_DOUBLE:
+    case KW_TYPEOF:
+    case ID_INLINE:
+    case KW__THREAD_LOCAL:
+    case KW___THREAD:
+    case KW__ATOMIC:
 #if X64WIN
-      "__int64",
+    case KW___INT64:
 #endif
-    };
-
-    for (size_t i = 0; i < sizeof(kw) / sizeof(*kw); i++)
-      hashmap_put(&C(typename_map), kw[i], (void*)1);
+      return true;
+    default:
+      return find_typedef(tok) != NULL;
   }
-
-  return hashmap_get2(&C(typename_map), tok->loc, tok->len) || find_typedef(tok);
 }
 
 // asm-stmt = "asm" ("volatile" | "inline")* "(" string-literal ")"
@@ -1568,14 +1583,14 @@ static Node* asm_stmt(Token** rest, Token* tok) {
   Node* node = new_node(ND_ASM, tok);
   tok = tok->next;
 
-  while (equal(tok, "volatile") || equal(tok, "inline"))
+  while (equal(tok, KW_VOLATILE) || equal(tok, ID_INLINE))
     tok = tok->next;
 
-  tok = skip(tok, "(");
-  if (tok->kind != TK_STR || tok->ty->base->kind != TY_CHAR)
+  tok = skip(tok, PU_LPAREN);
+  if (tok->kind != TK_STR || tok->lit->ty->base->kind != TY_CHAR)
     error_tok(tok, "expected string literal");
-  node->asm_str = tok->str;
-  *rest = skip(tok->next, ")");
+  node->asm_str = tok->lit->str;
+  *rest = skip(tok->next, PU_RPAREN);
   return node;
 }
 
@@ -1595,13 +1610,13 @@ static Node* asm_stmt(Token** rest, Token* tok) {
 //      | "{" compound-stmt
 //      | expr-stmt
 static Node* stmt(Token** rest, Token* tok) {
-  if (equal(tok, "return")) {
+  if (equal(tok, KW_RETURN)) {
     Node* node = new_node(ND_RETURN, tok);
-    if (consume(rest, tok->next, ";"))
+    if (consume(rest, tok->next, PU_SEMI))
       return node;
 
     Node* exp = expr(&tok, tok->next);
-    *rest = skip(tok, ";");
+    *rest = skip(tok, PU_SEMI);
 
     add_type(exp);
     Type* ty = C(current_fn)->ty->return_ty;
@@ -1612,23 +1627,23 @@ static Node* stmt(Token** rest, Token* tok) {
     return node;
   }
 
-  if (equal(tok, "if")) {
+  if (equal(tok, KW_IF)) {
     Node* node = new_node(ND_IF, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok->next, PU_LPAREN);
     node->cond = expr(&tok, tok);
-    tok = skip(tok, ")");
+    tok = skip(tok, PU_RPAREN);
     node->then = stmt(&tok, tok);
-    if (equal(tok, "else"))
+    if (equal(tok, KW_ELSE))
       node->els = stmt(&tok, tok->next);
     *rest = tok;
     return node;
   }
 
-  if (equal(tok, "switch")) {
+  if (equal(tok, KW_SWITCH)) {
     Node* node = new_node(ND_SWITCH, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok->next, PU_LPAREN);
     node->cond = expr(&tok, tok);
-    tok = skip(tok, ")");
+    tok = skip(tok, PU_RPAREN);
 
     Node* sw = C(current_switch);
     C(current_switch) = node;
@@ -1645,7 +1660,7 @@ static Node* stmt(Token** rest, Token* tok) {
     return node;
   }
 
-  if (equal(tok, "case")) {
+  if (equal(tok, KW_CASE)) {
     if (!C(current_switch))
       error_tok(tok, "stray case");
 
@@ -1653,7 +1668,7 @@ static Node* stmt(Token** rest, Token* tok) {
     int begin = (int)const_expr(&tok, tok->next);
     int end;
 
-    if (equal(tok, "...")) {
+    if (equal(tok, PU_ELLIPSIS)) {
       // [GNU] Case ranges, e.g. "case 1 ... 5:"
       end = (int)const_expr(&tok, tok->next);
       if (end < begin)
@@ -1662,7 +1677,7 @@ static Node* stmt(Token** rest, Token* tok) {
       end = begin;
     }
 
-    tok = skip(tok, ":");
+    tok = skip(tok, PU_COLON);
     node->label = new_unique_name();
     node->pc_label = codegen_pclabel();
     node->lhs = stmt(rest, tok);
@@ -1673,12 +1688,12 @@ static Node* stmt(Token** rest, Token* tok) {
     return node;
   }
 
-  if (equal(tok, "default")) {
+  if (equal(tok, KW_DEFAULT)) {
     if (!C(current_switch))
       error_tok(tok, "stray default");
 
     Node* node = new_node(ND_CASE, tok);
-    tok = skip(tok->next, ":");
+    tok = skip(tok->next, PU_COLON);
     node->label = new_unique_name();
     node->pc_label = codegen_pclabel();
     node->lhs = stmt(rest, tok);
@@ -1686,9 +1701,9 @@ static Node* stmt(Token** rest, Token* tok) {
     return node;
   }
 
-  if (equal(tok, "for")) {
+  if (equal(tok, KW_FOR)) {
     Node* node = new_node(ND_FOR, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok->next, PU_LPAREN);
 
     enter_scope();
 
@@ -1704,13 +1719,13 @@ static Node* stmt(Token** rest, Token* tok) {
       node->init = expr_stmt(&tok, tok);
     }
 
-    if (!equal(tok, ";"))
+    if (!equal(tok, PU_SEMI))
       node->cond = expr(&tok, tok);
-    tok = skip(tok, ";");
+    tok = skip(tok, PU_SEMI);
 
-    if (!equal(tok, ")"))
+    if (!equal(tok, PU_RPAREN))
       node->inc = expr(&tok, tok);
-    tok = skip(tok, ")");
+    tok = skip(tok, PU_RPAREN);
 
     node->then = stmt(rest, tok);
 
@@ -1722,11 +1737,11 @@ static Node* stmt(Token** rest, Token* tok) {
     return node;
   }
 
-  if (equal(tok, "while")) {
+  if (equal(tok, KW_WHILE)) {
     Node* node = new_node(ND_FOR, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok->next, PU_LPAREN);
     node->cond = expr(&tok, tok);
-    tok = skip(tok, ")");
+    tok = skip(tok, PU_RPAREN);
 
     int brk_pc = C(brk_pc_label);
     int cont_pc = C(cont_pc_label);
@@ -1740,7 +1755,7 @@ static Node* stmt(Token** rest, Token* tok) {
     return node;
   }
 
-  if (equal(tok, "do")) {
+  if (equal(tok, KW_DO)) {
     Node* node = new_node(ND_DO, tok);
 
     int brk_pc = C(brk_pc_label);
@@ -1753,23 +1768,23 @@ static Node* stmt(Token** rest, Token* tok) {
     C(brk_pc_label) = brk_pc;
     C(cont_pc_label) = cont_pc;
 
-    tok = skip(tok, "while");
-    tok = skip(tok, "(");
+    tok = skip(tok, KW_WHILE);
+    tok = skip(tok, PU_LPAREN);
     node->cond = expr(&tok, tok);
-    tok = skip(tok, ")");
-    *rest = skip(tok, ";");
+    tok = skip(tok, PU_RPAREN);
+    *rest = skip(tok, PU_SEMI);
     return node;
   }
 
-  if (equal(tok, "asm"))
+  if (equal(tok, KW_ASM))
     return asm_stmt(rest, tok);
 
-  if (equal(tok, "goto")) {
-    if (equal(tok->next, "*")) {
+  if (equal(tok, KW_GOTO)) {
+    if (equal(tok->next, PU_STAR)) {
       // [GNU] `goto *ptr` jumps to the address specified by `ptr`.
       Node* node = new_node(ND_GOTO_EXPR, tok);
       node->lhs = expr(&tok, tok->next->next);
-      *rest = skip(tok, ";");
+      *rest = skip(tok, PU_SEMI);
       return node;
     }
 
@@ -1777,29 +1792,29 @@ static Node* stmt(Token** rest, Token* tok) {
     node->label = get_ident(tok->next);
     node->goto_next = C(gotos);
     C(gotos) = node;
-    *rest = skip(tok->next->next, ";");
+    *rest = skip(tok->next->next, PU_SEMI);
     return node;
   }
 
-  if (equal(tok, "break")) {
+  if (equal(tok, KW_BREAK)) {
     if (!C(brk_pc_label))
       error_tok(tok, "stray break");
     Node* node = new_node(ND_GOTO, tok);
     node->pc_label = C(brk_pc_label);
-    *rest = skip(tok->next, ";");
+    *rest = skip(tok->next, PU_SEMI);
     return node;
   }
 
-  if (equal(tok, "continue")) {
+  if (equal(tok, KW_CONTINUE)) {
     if (!C(cont_pc_label))
       error_tok(tok, "stray continue");
     Node* node = new_node(ND_GOTO, tok);
     node->pc_label = C(cont_pc_label);
-    *rest = skip(tok->next, ";");
+    *rest = skip(tok->next, PU_SEMI);
     return node;
   }
 
-  if (tok->kind == TK_IDENT && equal(tok->next, ":")) {
+  if (tok->kind == TK_IDENT && equal(tok->next, PU_COLON)) {
     Node* node = new_node(ND_LABEL, tok);
     node->label = bumpstrndup(tok->loc, tok->len, AL_Compile);
     node->pc_label = codegen_pclabel();
@@ -1809,7 +1824,7 @@ static Node* stmt(Token** rest, Token* tok) {
     return node;
   }
 
-  if (equal(tok, "{"))
+  if (equal(tok, PU_LBRACE))
     return compound_stmt(rest, tok->next);
 
   return expr_stmt(rest, tok);
@@ -1823,8 +1838,8 @@ static Node* compound_stmt(Token** rest, Token* tok) {
 
   enter_scope();
 
-  while (!equal(tok, "}")) {
-    if (is_typename(tok) && !equal(tok->next, ":")) {
+  while (!equal(tok, PU_RBRACE)) {
+    if (is_typename(tok) && !equal(tok->next, PU_COLON)) {
       VarAttr attr = {0};
       Type* basety = declspec(&tok, tok, &attr);
 
@@ -1859,14 +1874,14 @@ static Node* compound_stmt(Token** rest, Token* tok) {
 
 // expr-stmt = expr? ";"
 static Node* expr_stmt(Token** rest, Token* tok) {
-  if (equal(tok, ";")) {
+  if (equal(tok, PU_SEMI)) {
     *rest = tok->next;
     return new_node(ND_BLOCK, tok);
   }
 
   Node* node = new_node(ND_EXPR_STMT, tok);
   node->lhs = expr(&tok, tok);
-  *rest = skip(tok, ";");
+  *rest = skip(tok, PU_SEMI);
   return node;
 }
 
@@ -1874,7 +1889,7 @@ static Node* expr_stmt(Token** rest, Token* tok) {
 static Node* expr(Token** rest, Token* tok) {
   Node* node = assign(&tok, tok);
 
-  if (equal(tok, ","))
+  if (equal(tok, PU_COMMA))
     return new_binary(ND_COMMA, node, expr(rest, tok->next), tok);
 
   *rest = tok;
@@ -1932,7 +1947,7 @@ static int64_t eval2(Node* node, char*** label, int** pclabel) {
       return eval(node->lhs) != eval(node->rhs);
     case ND_LT:
       if (node->lhs->ty->is_unsigned)
-        return (int64_t)(uint64_t)eval(node->lhs) < eval(node->rhs);
+        return (int64_t)((uint64_t)eval(node->lhs) < (uint64_t)eval(node->rhs));
       return eval(node->lhs) < eval(node->rhs);
     case ND_LE:
       if (node->lhs->ty->is_unsigned)
@@ -2198,37 +2213,37 @@ static Node* to_assign(Node* binary) {
 static Node* assign(Token** rest, Token* tok) {
   Node* node = conditional(&tok, tok);
 
-  if (equal(tok, "="))
+  if (equal(tok, PU_ASSIGN))
     return new_binary(ND_ASSIGN, node, assign(rest, tok->next), tok);
 
-  if (equal(tok, "+="))
+  if (equal(tok, PU_ADD_ASSIGN))
     return to_assign(new_add(node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "-="))
+  if (equal(tok, PU_SUB_ASSIGN))
     return to_assign(new_sub(node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "*="))
+  if (equal(tok, PU_MUL_ASSIGN))
     return to_assign(new_binary(ND_MUL, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "/="))
+  if (equal(tok, PU_DIV_ASSIGN))
     return to_assign(new_binary(ND_DIV, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "%="))
+  if (equal(tok, PU_MOD_ASSIGN))
     return to_assign(new_binary(ND_MOD, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "&="))
+  if (equal(tok, PU_AND_ASSIGN))
     return to_assign(new_binary(ND_BITAND, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "|="))
+  if (equal(tok, PU_OR_ASSIGN))
     return to_assign(new_binary(ND_BITOR, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "^="))
+  if (equal(tok, PU_XOR_ASSIGN))
     return to_assign(new_binary(ND_BITXOR, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "<<="))
+  if (equal(tok, PU_SHL_ASSIGN))
     return to_assign(new_binary(ND_SHL, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, ">>="))
+  if (equal(tok, PU_SHR_ASSIGN))
     return to_assign(new_binary(ND_SHR, node, assign(rest, tok->next), tok));
 
   *rest = tok;
@@ -2239,12 +2254,12 @@ static Node* assign(Token** rest, Token* tok) {
 static Node* conditional(Token** rest, Token* tok) {
   Node* cond = logor(&tok, tok);
 
-  if (!equal(tok, "?")) {
+  if (!equal(tok, PU_QUESTION)) {
     *rest = tok;
     return cond;
   }
 
-  if (equal(tok->next, ":")) {
+  if (equal(tok->next, PU_COLON)) {
     // [GNU] Compile `a ?: b` as `tmp = a, tmp ? tmp : b`.
     add_type(cond);
     Obj* var = new_lvar("", cond->ty);
@@ -2259,7 +2274,7 @@ static Node* conditional(Token** rest, Token* tok) {
   Node* node = new_node(ND_COND, tok);
   node->cond = cond;
   node->then = expr(&tok, tok->next);
-  tok = skip(tok, ":");
+  tok = skip(tok, PU_COLON);
   node->els = conditional(rest, tok);
   return node;
 }
@@ -2267,7 +2282,7 @@ static Node* conditional(Token** rest, Token* tok) {
 // logor = logand ("||" logand)*
 static Node* logor(Token** rest, Token* tok) {
   Node* node = logand(&tok, tok);
-  while (equal(tok, "||")) {
+  while (equal(tok, PU_LOGOR)) {
     Token* start = tok;
     node = new_binary(ND_LOGOR, node, logand(&tok, tok->next), start);
   }
@@ -2278,7 +2293,7 @@ static Node* logor(Token** rest, Token* tok) {
 // logand = bitor ("&&" bitor)*
 static Node* logand(Token** rest, Token* tok) {
   Node* node = bitor (&tok, tok);
-  while (equal(tok, "&&")) {
+  while (equal(tok, PU_LOGAND)) {
     Token* start = tok;
     node = new_binary(ND_LOGAND, node, bitor (&tok, tok->next), start);
   }
@@ -2289,7 +2304,7 @@ static Node* logand(Token** rest, Token* tok) {
 // bitor = bitxor ("|" bitxor)*
 static Node* bitor (Token * *rest, Token* tok) {
   Node* node = bitxor(&tok, tok);
-  while (equal(tok, "|")) {
+  while (equal(tok, PU_OR)) {
     Token* start = tok;
     node = new_binary(ND_BITOR, node, bitxor(&tok, tok->next), start);
   }
@@ -2300,7 +2315,7 @@ static Node* bitor (Token * *rest, Token* tok) {
 // bitxor = bitand ("^" bitand)*
 static Node* bitxor(Token** rest, Token* tok) {
   Node* node = bitand(&tok, tok);
-  while (equal(tok, "^")) {
+  while (equal(tok, PU_XOR)) {
     Token* start = tok;
     node = new_binary(ND_BITXOR, node, bitand(&tok, tok->next), start);
   }
@@ -2311,7 +2326,7 @@ static Node* bitxor(Token** rest, Token* tok) {
 // bitand = equality ("&" equality)*
 static Node*bitand(Token** rest, Token* tok) {
   Node* node = equality(&tok, tok);
-  while (equal(tok, "&")) {
+  while (equal(tok, PU_AND)) {
     Token* start = tok;
     node = new_binary(ND_BITAND, node, equality(&tok, tok->next), start);
   }
@@ -2326,12 +2341,12 @@ static Node* equality(Token** rest, Token* tok) {
   for (;;) {
     Token* start = tok;
 
-    if (equal(tok, "==")) {
+    if (equal(tok, PU_EQ)) {
       node = new_binary(ND_EQ, node, relational(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, "!=")) {
+    if (equal(tok, PU_NE)) {
       node = new_binary(ND_NE, node, relational(&tok, tok->next), start);
       continue;
     }
@@ -2348,22 +2363,22 @@ static Node* relational(Token** rest, Token* tok) {
   for (;;) {
     Token* start = tok;
 
-    if (equal(tok, "<")) {
+    if (equal(tok, PU_LT)) {
       node = new_binary(ND_LT, node, shift(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, "<=")) {
+    if (equal(tok, PU_LE)) {
       node = new_binary(ND_LE, node, shift(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, ">")) {
+    if (equal(tok, PU_GT)) {
       node = new_binary(ND_LT, shift(&tok, tok->next), node, start);
       continue;
     }
 
-    if (equal(tok, ">=")) {
+    if (equal(tok, PU_GE)) {
       node = new_binary(ND_LE, shift(&tok, tok->next), node, start);
       continue;
     }
@@ -2380,12 +2395,12 @@ static Node* shift(Token** rest, Token* tok) {
   for (;;) {
     Token* start = tok;
 
-    if (equal(tok, "<<")) {
+    if (equal(tok, PU_SHL)) {
       node = new_binary(ND_SHL, node, add(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, ">>")) {
+    if (equal(tok, PU_SHR)) {
       node = new_binary(ND_SHR, node, add(&tok, tok->next), start);
       continue;
     }
@@ -2481,12 +2496,12 @@ static Node* add(Token** rest, Token* tok) {
   for (;;) {
     Token* start = tok;
 
-    if (equal(tok, "+")) {
+    if (equal(tok, PU_PLUS)) {
       node = new_add(node, mul(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, "-")) {
+    if (equal(tok, PU_MINUS)) {
       node = new_sub(node, mul(&tok, tok->next), start);
       continue;
     }
@@ -2503,17 +2518,17 @@ static Node* mul(Token** rest, Token* tok) {
   for (;;) {
     Token* start = tok;
 
-    if (equal(tok, "*")) {
+    if (equal(tok, PU_STAR)) {
       node = new_binary(ND_MUL, node, cast(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, "/")) {
+    if (equal(tok, PU_SLASH)) {
       node = new_binary(ND_DIV, node, cast(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, "%")) {
+    if (equal(tok, PU_MOD)) {
       node = new_binary(ND_MOD, node, cast(&tok, tok->next), start);
       continue;
     }
@@ -2525,13 +2540,13 @@ static Node* mul(Token** rest, Token* tok) {
 
 // cast = "(" type-name ")" cast | unary
 static Node* cast(Token** rest, Token* tok) {
-  if (equal(tok, "(") && is_typename(tok->next)) {
+  if (equal(tok, PU_LPAREN) && is_typename(tok->next)) {
     Token* start = tok;
     Type* ty = typename(&tok, tok->next);
-    tok = skip(tok, ")");
+    tok = skip(tok, PU_RPAREN);
 
     // compound literal
-    if (equal(tok, "{"))
+    if (equal(tok, PU_LBRACE))
       return unary(rest, start);
 
     // type cast
@@ -2548,13 +2563,13 @@ static Node* cast(Token** rest, Token* tok) {
 //       | "&&" ident
 //       | postfix
 static Node* unary(Token** rest, Token* tok) {
-  if (equal(tok, "+"))
+  if (equal(tok, PU_PLUS))
     return cast(rest, tok->next);
 
-  if (equal(tok, "-"))
+  if (equal(tok, PU_MINUS))
     return new_unary(ND_NEG, cast(rest, tok->next), tok);
 
-  if (equal(tok, "&")) {
+  if (equal(tok, PU_AND)) {
     Node* lhs = cast(rest, tok->next);
     add_type(lhs);
     if (lhs->kind == ND_MEMBER && lhs->member->is_bitfield)
@@ -2562,7 +2577,7 @@ static Node* unary(Token** rest, Token* tok) {
     return new_unary(ND_ADDR, lhs, tok);
   }
 
-  if (equal(tok, "*")) {
+  if (equal(tok, PU_STAR)) {
     // [https://www.sigbus.info/n1570#6.5.3.2p4] This is an oddity
     // in the C spec, but dereferencing a function shouldn't do
     // anything. If foo is a function, `*foo`, `**foo` or `*****foo`
@@ -2574,23 +2589,28 @@ static Node* unary(Token** rest, Token* tok) {
     return new_unary(ND_DEREF, node, tok);
   }
 
-  if (equal(tok, "!"))
+  if (equal(tok, PU_NOT))
     return new_unary(ND_NOT, cast(rest, tok->next), tok);
 
-  if (equal(tok, "~"))
+  if (equal(tok, PU_TILDE))
     return new_unary(ND_BITNOT, cast(rest, tok->next), tok);
 
   // Read ++i as i+=1
-  if (equal(tok, "++"))
+  if (equal(tok, PU_INC))
     return to_assign(new_add(unary(rest, tok->next), new_num(1, tok), tok));
 
   // Read --i as i-=1
-  if (equal(tok, "--"))
+  if (equal(tok, PU_DEC))
     return to_assign(new_sub(unary(rest, tok->next), new_num(1, tok), tok));
 
   // [GNU] labels-as-values
-  if (equal(tok, "&&")) {
+  if (equal(tok, PU_LOGAND)) {
+    // Not with the rest of the function's nodes, as a static initializer keeps
+    // a pointer to its pc_label until the unit's data is emitted (see eval2()).
+    AllocLifetime lifetime = C(node_lifetime);
+    C(node_lifetime) = AL_Compile;
     Node* node = new_node(ND_LABEL_VAL, tok);
+    C(node_lifetime) = lifetime;
     node->label = get_ident(tok->next);
     node->goto_next = C(gotos);
     C(gotos) = node;
@@ -2607,13 +2627,13 @@ static void struct_members(Token** rest, Token* tok, Type* ty) {
   Member* cur = &head;
   int idx = 0;
 
-  while (!equal(tok, "}")) {
+  while (!equal(tok, PU_RBRACE)) {
     VarAttr attr = {0};
     Type* basety = declspec(&tok, tok, &attr);
     bool first = true;
 
     // Anonymous struct member
-    if ((basety->kind == TY_STRUCT || basety->kind == TY_UNION) && consume(&tok, tok, ";")) {
+    if ((basety->kind == TY_STRUCT || basety->kind == TY_UNION) && consume(&tok, tok, PU_SEMI)) {
       Member* mem = bumpcalloc(1, sizeof(Member), AL_Compile);
       mem->ty = basety;
       mem->idx = idx++;
@@ -2623,9 +2643,9 @@ static void struct_members(Token** rest, Token* tok, Type* ty) {
     }
 
     // Regular struct members
-    while (!consume(&tok, tok, ";")) {
+    while (!consume(&tok, tok, PU_SEMI)) {
       if (!first)
-        tok = skip(tok, ",");
+        tok = skip(tok, PU_COMMA);
       first = false;
 
       Member* mem = bumpcalloc(1, sizeof(Member), AL_Compile);
@@ -2634,7 +2654,7 @@ static void struct_members(Token** rest, Token* tok, Type* ty) {
       mem->idx = idx++;
       mem->align = attr.align ? attr.align : mem->ty->align;
 
-      if (consume(&tok, tok, ":")) {
+      if (consume(&tok, tok, PU_COLON)) {
         mem->is_bitfield = true;
         mem->bit_width = (int)const_expr(&tok, tok);
       }
@@ -2657,33 +2677,33 @@ static void struct_members(Token** rest, Token* tok, Type* ty) {
 
 // attribute = ("__attribute__" "(" "(" "packed" ")" ")")*
 static Token* attribute_list(Token* tok, Type* ty) {
-  while (consume(&tok, tok, "__attribute__")) {
-    tok = skip(tok, "(");
-    tok = skip(tok, "(");
+  while (consume(&tok, tok, KW___ATTRIBUTE__)) {
+    tok = skip(tok, PU_LPAREN);
+    tok = skip(tok, PU_LPAREN);
 
     bool first = true;
 
-    while (!consume(&tok, tok, ")")) {
+    while (!consume(&tok, tok, PU_RPAREN)) {
       if (!first)
-        tok = skip(tok, ",");
+        tok = skip(tok, PU_COMMA);
       first = false;
 
-      if (consume(&tok, tok, "packed")) {
+      if (consume(&tok, tok, ID_PACKED)) {
         ty->is_packed = true;
         continue;
       }
 
-      if (consume(&tok, tok, "aligned")) {
-        tok = skip(tok, "(");
+      if (consume(&tok, tok, ID_ALIGNED)) {
+        tok = skip(tok, PU_LPAREN);
         ty->align = (int)const_expr(&tok, tok);
-        tok = skip(tok, ")");
+        tok = skip(tok, PU_RPAREN);
         continue;
       }
 
       error_tok(tok, "unknown attribute");
     }
 
-    tok = skip(tok, ")");
+    tok = skip(tok, PU_RPAREN);
   }
 
   return tok;
@@ -2701,7 +2721,7 @@ static Type* struct_union_decl(Token** rest, Token* tok) {
     tok = tok->next;
   }
 
-  if (tag && !equal(tok, "{")) {
+  if (tag && !equal(tok, PU_LBRACE)) {
     *rest = tok;
 
     Type* ty2 = find_tag(tag);
@@ -2713,7 +2733,7 @@ static Type* struct_union_decl(Token** rest, Token* tok) {
     return ty;
   }
 
-  tok = skip(tok, "{");
+  tok = skip(tok, PU_LBRACE);
 
   // Construct a struct object.
   struct_members(&tok, tok, ty);
@@ -2724,7 +2744,7 @@ static Type* struct_union_decl(Token** rest, Token* tok) {
   if (tag) {
     // If this is a redefinition, overwrite a previous type.
     // Otherwise, register the struct type.
-    Type* ty2 = hashmap_get2(&C(scope)->tags, tag->loc, tag->len);
+    Type* ty2 = hashmap_get_interned(&C(scope)->tags, tag->ident);
     if (ty2) {
       if (ty2->size >= 0)
         error_tok(tag, "redefinition of type");
@@ -2868,11 +2888,11 @@ static Node* new_inc_dec(Node* node, Token* tok, int addend) {
 //              | "++"
 //              | "--"
 static Node* postfix(Token** rest, Token* tok) {
-  if (equal(tok, "(") && is_typename(tok->next)) {
+  if (equal(tok, PU_LPAREN) && is_typename(tok->next)) {
     // Compound literal
     Token* start = tok;
     Type* ty = typename(&tok, tok->next);
-    tok = skip(tok, ")");
+    tok = skip(tok, PU_RPAREN);
 
     if (C(scope)->next == NULL) {
       Obj* var = new_anon_gvar(ty);
@@ -2889,27 +2909,27 @@ static Node* postfix(Token** rest, Token* tok) {
   Node* node = primary(&tok, tok);
 
   for (;;) {
-    if (equal(tok, "(")) {
+    if (equal(tok, PU_LPAREN)) {
       node = funcall(&tok, tok->next, node);
       continue;
     }
 
-    if (equal(tok, "[")) {
+    if (equal(tok, PU_LBRACKET)) {
       // x[y] is short for *(x+y)
       Token* start = tok;
       Node* idx = expr(&tok, tok->next);
-      tok = skip(tok, "]");
+      tok = skip(tok, PU_RBRACKET);
       node = new_unary(ND_DEREF, new_add(node, idx, start), start);
       continue;
     }
 
-    if (equal(tok, ".")) {
+    if (equal(tok, PU_DOT)) {
       node = struct_ref(node, tok->next);
       tok = tok->next->next;
       continue;
     }
 
-    if (equal(tok, "->")) {
+    if (equal(tok, PU_ARROW)) {
       // x->y is short for (*x).y
       node = new_unary(ND_DEREF, node, tok);
       node = struct_ref(node, tok->next);
@@ -2917,13 +2937,13 @@ static Node* postfix(Token** rest, Token* tok) {
       continue;
     }
 
-    if (equal(tok, "++")) {
+    if (equal(tok, PU_INC)) {
       node = new_inc_dec(node, tok, 1);
       tok = tok->next;
       continue;
     }
 
-    if (equal(tok, "--")) {
+    if (equal(tok, PU_DEC)) {
       node = new_inc_dec(node, tok, -1);
       tok = tok->next;
       continue;
@@ -2947,9 +2967,9 @@ static Node* funcall(Token** rest, Token* tok, Node* fn) {
   Node head = {0};
   Node* cur = &head;
 
-  while (!equal(tok, ")")) {
+  while (!equal(tok, PU_RPAREN)) {
     if (cur != &head)
-      tok = skip(tok, ",");
+      tok = skip(tok, PU_COMMA);
 
     Node* arg = assign(&tok, tok);
     add_type(arg);
@@ -2973,7 +2993,7 @@ static Node* funcall(Token** rest, Token* tok, Node* fn) {
   if (param_ty)
     error_tok(tok, "too few arguments");
 
-  *rest = skip(tok, ")");
+  *rest = skip(tok, PU_RPAREN);
 
   Node* node = new_unary(ND_FUNCALL, fn, tok);
   node->func_ty = ty;
@@ -2993,7 +3013,7 @@ static Node* funcall(Token** rest, Token* tok, Node* fn) {
 //               | "default" ":" assign
 static Node* generic_selection(Token** rest, Token* tok) {
   Token* start = tok;
-  tok = skip(tok, "(");
+  tok = skip(tok, PU_LPAREN);
 
   Node* ctrl = assign(&tok, tok);
   add_type(ctrl);
@@ -3006,11 +3026,11 @@ static Node* generic_selection(Token** rest, Token* tok) {
 
   Node* ret = NULL;
 
-  while (!consume(rest, tok, ")")) {
-    tok = skip(tok, ",");
+  while (!consume(rest, tok, PU_RPAREN)) {
+    tok = skip(tok, PU_COMMA);
 
-    if (equal(tok, "default")) {
-      tok = skip(tok->next, ":");
+    if (equal(tok, KW_DEFAULT)) {
+      tok = skip(tok->next, PU_COLON);
       Node* node = assign(&tok, tok);
       if (!ret)
         ret = node;
@@ -3018,7 +3038,7 @@ static Node* generic_selection(Token** rest, Token* tok) {
     }
 
     Type* t2 = typename(&tok, tok);
-    tok = skip(tok, ":");
+    tok = skip(tok, PU_COLON);
     Node* node = assign(&tok, tok);
     if (is_compatible(t1, t2))
       ret = node;
@@ -3216,7 +3236,7 @@ static char* build_reflect_user_name(Type* ty) {
   return format(AL_Compile, "%s%s", left, right);
 }
 
-static _ReflectType* get_reflect_type(Type* ty) {
+static _ReflectType* get_reflect_type_locked(Type* ty) {
   char* mangled = build_reflect_mangled_name(ty);
   void* prev = hashmap_get(&user_context->reflect_types, mangled);
   if (prev) {
@@ -3234,14 +3254,14 @@ static _ReflectType* get_reflect_type(Type* ty) {
     rtype.name = get_reflect_builtin_user_name_impl(ty);
   } else if (ty->kind == TY_PTR) {
     rtype.name = bumpstrdup(build_reflect_user_name(ty), AL_UserContext);
-    rtype.ptr.base = get_reflect_type(ty->base);
+    rtype.ptr.base = get_reflect_type_locked(ty->base);
   } else if (ty->kind == TY_ARRAY) {
     rtype.name = bumpstrdup(build_reflect_user_name(ty), AL_UserContext);
-    rtype.arr.base = get_reflect_type(ty->base);
+    rtype.arr.base = get_reflect_type_locked(ty->base);
     rtype.arr.len = ty->array_len;
   } else if (ty->kind == TY_FUNC) {
     rtype.name = bumpstrdup(build_reflect_user_name(ty), AL_UserContext);
-    rtype.func.return_ty = get_reflect_type(ty->return_ty);
+    rtype.func.return_ty = get_reflect_type_locked(ty->return_ty);
     rtype.func.num_params = 0;
     for (Type* param = ty->params; param; param = param->next) {
       rtype.func.num_params++;
@@ -3252,7 +3272,7 @@ static _ReflectType* get_reflect_type(Type* ty) {
     memcpy(rtp, &rtype, sizeof(rtype));
     int i = 0;
     for (Type* param = ty->params; param; param = param->next) {
-      rtp->func.params[i++] = get_reflect_type(param);
+      rtp->func.params[i++] = get_reflect_type_locked(param);
     }
     hashmap_put(&user_context->reflect_types, bumpstrdup(mangled, AL_UserContext), rtp);
     return rtp;
@@ -3270,7 +3290,7 @@ static _ReflectType* get_reflect_type(Type* ty) {
     int i = 0;
     for (Member* mem = ty->members; mem; mem = mem->next) {
       _ReflectTypeMember* rtm = &rtp->su.members[i++];
-      rtm->type = get_reflect_type(mem->ty);
+      rtm->type = get_reflect_type_locked(mem->ty);
       rtm->name = bumpstrndup(mem->name->loc, mem->name->len, AL_UserContext);
       rtm->align = mem->align;
       rtm->offset = mem->offset;
@@ -3291,6 +3311,14 @@ static _ReflectType* get_reflect_type(Type* ty) {
   return p;
 }
 
+// Reflection types are shared by all compile threads in the context.
+static _ReflectType* get_reflect_type(Type* ty) {
+  mutex_lock(&user_context->lock);
+  _ReflectType* ret = get_reflect_type_locked(ty);
+  mutex_unlock(&user_context->lock);
+  return ret;
+}
+
 // primary = "(" "{" stmt+ "}" ")"
 //         | "(" expr ")"
 //         | "sizeof" "(" type-name ")"
@@ -3306,23 +3334,23 @@ static _ReflectType* get_reflect_type(Type* ty) {
 static Node* primary(Token** rest, Token* tok) {
   Token* start = tok;
 
-  if (equal(tok, "(") && equal(tok->next, "{")) {
+  if (equal(tok, PU_LPAREN) && equal(tok->next, PU_LBRACE)) {
     // This is a GNU statement expresssion.
     Node* node = new_node(ND_STMT_EXPR, tok);
     node->body = compound_stmt(&tok, tok->next->next)->body;
-    *rest = skip(tok, ")");
+    *rest = skip(tok, PU_RPAREN);
     return node;
   }
 
-  if (equal(tok, "(")) {
+  if (equal(tok, PU_LPAREN)) {
     Node* node = expr(&tok, tok->next);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, PU_RPAREN);
     return node;
   }
 
-  if (equal(tok, "sizeof") && equal(tok->next, "(") && is_typename(tok->next->next)) {
+  if (equal(tok, KW_SIZEOF) && equal(tok->next, PU_LPAREN) && is_typename(tok->next->next)) {
     Type* ty = typename(&tok, tok->next->next);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, PU_RPAREN);
 
     if (ty->kind == TY_VLA) {
       if (ty->vla_size)
@@ -3336,8 +3364,8 @@ static Node* primary(Token** rest, Token* tok) {
     return new_ulong(ty->size, start);
   }
 
-  if (equal(tok, "_ReflectTypeOf") && equal(tok->next, "(")) {
-    tok = skip(tok->next, "(");
+  if (equal(tok, ID__REFLECTTYPEOF) && equal(tok->next, PU_LPAREN)) {
+    tok = skip(tok->next, PU_LPAREN);
 
     Type* ty;
     if (is_typename(tok)) {
@@ -3347,13 +3375,13 @@ static Node* primary(Token** rest, Token* tok) {
       add_type(node);
       ty = node->ty;
     }
-    *rest = skip(tok, ")");
+    *rest = skip(tok, PU_RPAREN);
     Node* ret = new_reflect_type_ptr(get_reflect_type(ty), tok);
     ret->ty = pointer_to(ty_void);
     return ret;
   }
 
-  if (equal(tok, "sizeof")) {
+  if (equal(tok, KW_SIZEOF)) {
     Node* node = unary(rest, tok->next);
     add_type(node);
     if (node->ty->kind == TY_VLA)
@@ -3361,34 +3389,34 @@ static Node* primary(Token** rest, Token* tok) {
     return new_ulong(node->ty->size, tok);
   }
 
-  if (equal(tok, "_Alignof") && equal(tok->next, "(") && is_typename(tok->next->next)) {
+  if (equal(tok, KW__ALIGNOF) && equal(tok->next, PU_LPAREN) && is_typename(tok->next->next)) {
     Type* ty = typename(&tok, tok->next->next);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, PU_RPAREN);
     return new_ulong(ty->align, tok);
   }
 
-  if (equal(tok, "_Alignof")) {
+  if (equal(tok, KW__ALIGNOF)) {
     Node* node = unary(rest, tok->next);
     add_type(node);
     return new_ulong(node->ty->align, tok);
   }
 
-  if (equal(tok, "_Generic"))
+  if (equal(tok, ID__GENERIC))
     return generic_selection(rest, tok->next);
 
-  if (equal(tok, "__builtin_types_compatible_p")) {
-    tok = skip(tok->next, "(");
+  if (equal(tok, ID___BUILTIN_TYPES_COMPATIBLE_P)) {
+    tok = skip(tok->next, PU_LPAREN);
     Type* t1 = typename(&tok, tok);
-    tok = skip(tok, ",");
+    tok = skip(tok, PU_COMMA);
     Type* t2 = typename(&tok, tok);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, PU_RPAREN);
     return new_num(is_compatible(t1, t2), start);
   }
 
-  if (equal(tok, "__builtin_reg_class")) {
-    tok = skip(tok->next, "(");
+  if (equal(tok, ID___BUILTIN_REG_CLASS)) {
+    tok = skip(tok->next, PU_LPAREN);
     Type* ty = typename(&tok, tok);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, PU_RPAREN);
 
     if (is_integer(ty) || ty->kind == TY_PTR)
       return new_num(0, start);
@@ -3397,37 +3425,37 @@ static Node* primary(Token** rest, Token* tok) {
     return new_num(2, start);
   }
 
-  if (equal(tok, "__builtin_compare_and_swap")) {
+  if (equal(tok, ID___BUILTIN_COMPARE_AND_SWAP)) {
     Node* node = new_node(ND_CAS, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok->next, PU_LPAREN);
     node->cas_addr = assign(&tok, tok);
-    tok = skip(tok, ",");
+    tok = skip(tok, PU_COMMA);
     node->cas_old = assign(&tok, tok);
-    tok = skip(tok, ",");
+    tok = skip(tok, PU_COMMA);
     node->cas_new = assign(&tok, tok);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, PU_RPAREN);
     return node;
   }
 
-  if (equal(tok, "_InterlockedCompareExchange")) {
+  if (equal(tok, ID__INTERLOCKEDCOMPAREEXCHANGE)) {
     Node* node = new_node(ND_LOCKCE, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok->next, PU_LPAREN);
     node->cas_addr = assign(&tok, tok);
-    tok = skip(tok, ",");
+    tok = skip(tok, PU_COMMA);
     node->cas_new = assign(&tok, tok);
-    tok = skip(tok, ",");
+    tok = skip(tok, PU_COMMA);
     node->cas_old = assign(&tok, tok);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, PU_RPAREN);
     return node;
   }
 
-  if (equal(tok, "__builtin_atomic_exchange")) {
+  if (equal(tok, ID___BUILTIN_ATOMIC_EXCHANGE)) {
     Node* node = new_node(ND_EXCH, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok->next, PU_LPAREN);
     node->lhs = assign(&tok, tok);
-    tok = skip(tok, ",");
+    tok = skip(tok, PU_COMMA);
     node->rhs = assign(&tok, tok);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, PU_RPAREN);
     return node;
   }
 
@@ -3451,27 +3479,27 @@ static Node* primary(Token** rest, Token* tok) {
         return new_num(sc->enum_val, tok);
     }
 
-    if (equal(tok->next, "("))
+    if (equal(tok->next, PU_LPAREN))
       error_tok(tok, "implicit declaration of a function");
     error_tok(tok, "undefined variable");
   }
 
   if (tok->kind == TK_STR) {
-    Obj* var = new_string_literal(tok->str, tok->ty);
+    Obj* var = new_string_literal(tok->lit->str, tok->lit->ty);
     *rest = tok->next;
     return new_var_node(var, tok);
   }
 
   if (tok->kind == TK_NUM) {
     Node* node;
-    if (is_flonum(tok->ty)) {
+    if (is_flonum(tok->lit->ty)) {
       node = new_node(ND_NUM, tok);
-      node->fval = tok->fval;
+      node->fval = tok->lit->fval;
     } else {
-      node = new_num(tok->val, tok);
+      node = new_num(tok->lit->val, tok);
     }
 
-    node->ty = tok->ty;
+    node->ty = tok->lit->ty;
     *rest = tok->next;
     return node;
   }
@@ -3482,9 +3510,9 @@ static Node* primary(Token** rest, Token* tok) {
 static Token* parse_typedef(Token* tok, Type* basety) {
   bool first = true;
 
-  while (!consume(&tok, tok, ";")) {
+  while (!consume(&tok, tok, PU_SEMI)) {
     if (!first)
-      tok = skip(tok, ",");
+      tok = skip(tok, PU_COMMA);
     first = false;
 
     Type* ty = declarator(&tok, tok, basety);
@@ -3537,7 +3565,7 @@ static Obj* find_func(char* name) {
   while (sc->next)
     sc = sc->next;
 
-  VarScope* sc2 = hashmap_get(&sc->vars, name);
+  VarScope* sc2 = hashmap_get_interned(&sc->vars, name);
   if (sc2 && sc2->var && sc2->var->is_function)
     return sc2->var;
   return NULL;
@@ -3566,24 +3594,28 @@ static Token* function(Token* tok, Type* basety, VarAttr* attr) {
     // Redeclaration
     if (!fn->is_function)
       error_tok(tok, "redeclared as a different kind of symbol");
-    if (fn->is_definition && equal(tok, "{"))
+    if (fn->is_definition && equal(tok, PU_LBRACE))
       error_tok(tok, "redefinition of %s", name_str);
     if (!fn->is_static && attr->is_static)
       error_tok(tok, "static declaration follows a non-static declaration");
-    fn->is_definition = fn->is_definition || equal(tok, "{");
+    fn->is_definition = fn->is_definition || equal(tok, PU_LBRACE);
   } else {
     fn = new_gvar(name_str, ty);
     fn->is_function = true;
-    fn->is_definition = equal(tok, "{");
+    fn->is_definition = equal(tok, PU_LBRACE);
     fn->is_static = attr->is_static || (attr->is_inline && !attr->is_extern);
     fn->is_inline = attr->is_inline;
   }
 
   fn->is_root = !(fn->is_static && fn->is_inline);
 
-  if (consume(&tok, tok, ";"))
+  if (consume(&tok, tok, PU_SEMI))
     return tok;
 
+  // Assigned here for the body, and the functions that follow, to refer to.
+  fn->dasm_entry_label = codegen_pclabel();
+  fn->dasm_return_label = codegen_pclabel();
+
   C(current_fn) = fn;
   C(locals) = NULL;
   enter_scope();
@@ -3606,35 +3638,49 @@ static Token* function(Token* tok, Type* basety, VarAttr* attr) {
 
 #if !X64WIN
   if (ty->is_variadic)
-    fn->va_area = new_lvar("__va_area__", array_of(ty_char, 136));
+    fn->va_area = new_lvar(intern("__va_area__"), array_of(ty_char, 136));
 #endif
-  fn->alloca_bottom = new_lvar("__alloca_size__", pointer_to(ty_char));
+  fn->alloca_bottom = new_lvar(intern("__alloca_size__"), pointer_to(ty_char));
 
-  tok = skip(tok, "{");
+  tok = skip(tok, PU_LBRACE);
 
   // [https://www.sigbus.info/n1570#6.4.2.2p1] "__func__" is
   // automatically defined as a local variable containing the
   // current function name.
-  push_scope("__func__")->var =
+  push_scope(intern("__func__"))->var =
       new_string_literal(fn->name, array_of(ty_char, (int)strlen(fn->name) + 1));
 
   // [GNU] __FUNCTION__ is yet another name of __func__.
-  push_scope("__FUNCTION__")->var =
+  push_scope(intern("__FUNCTION__"))->var =
       new_string_literal(fn->name, array_of(ty_char, (int)strlen(fn->name) + 1));
 
+  // A function that's always emitted is generated as soon as it's parsed, so
+  // only one body's nodes are in memory at a time: they're in AL_Temp, which is
+  // reset once the function's code has been emitted. The nodes of a "static
+  // inline" function are kept until the end of the unit, when it's known
+  // whether it's used.
+  if (fn->is_root)
+    C(node_lifetime) = AL_Temp;
   fn->body = compound_stmt(&tok, tok);
   fn->locals = C(locals);
   leave_scope();
   resolve_goto_labels();
+
+  if (fn->is_root) {
+    codegen_function(fn);
+    fn->body = NULL;
+    C(node_lifetime) = AL_Compile;
+    alloc_reset(AL_Temp);
+  }
   return tok;
 }
 
 static Token* global_variable(Token* tok, Type* basety, VarAttr* attr) {
   bool first = true;
 
-  while (!consume(&tok, tok, ";")) {
+  while (!consume(&tok, tok, PU_SEMI)) {
     if (!first)
-      tok = skip(tok, ",");
+      tok = skip(tok, PU_COMMA);
     first = false;
 
     Type* ty = declarator(&tok, tok, basety);
@@ -3648,7 +3694,7 @@ static Token* global_variable(Token* tok, Type* basety, VarAttr* attr) {
     if (attr->align)
       var->align = attr->align;
 
-    if (equal(tok, "="))
+    if (equal(tok, PU_ASSIGN))
       gvar_initializer(&tok, tok->next, var);
     else if (!attr->is_extern && !attr->is_tls)
       var->is_tentative = true;
@@ -3659,7 +3705,7 @@ static Token* global_variable(Token* tok, Type* basety, VarAttr* attr) {
 // Lookahead tokens and returns true if a given token is a start
 // of a function definition or declaration.
 static bool is_function(Token* tok) {
-  if (equal(tok, ";"))
+  if (equal(tok, PU_SEMI))
     return false;
 
   Type dummy = {0};
@@ -3697,7 +3743,7 @@ static void scan_globals(void) {
 static void declare_builtin_functions(void) {
   Type* ty = func_type(pointer_to(ty_void));
   ty->params = copy_type(ty_int);
-  C(builtin_alloca) = new_gvar("alloca", ty);
+  C(builtin_alloca) = new_gvar(intern("alloca"), ty);
   C(builtin_alloca)->is_definition = false;
 }
 
@@ -3709,7 +3755,7 @@ IMPLSTATIC Obj* parse(Token* tok) {
   C(globals) = NULL;
 
   while (tok->kind != TK_EOF) {
-    // logerr("%s:%d\n", tok->filename, tok->line_no);
+    // logerr("%s:%d\n", token_file(tok)->name, token_line_no(tok));
     VarAttr attr = {0};
     Type* basety = declspec(&tok, tok, &attr);
 
@@ -21,6 +21,11 @@
 // written by Dave Prossor, which is used as a basis for the
 // standard's wording:
 // https://github.com/rui314/chibicc/wiki/cpp.algo.pdf
+//
+// The tokens are in AL_Compile, as any of them may end up in the output. The
+// rest of what the preprocessor allocates, the macros, hidesets, arguments and
+// the #if stack, is garbage by the time it's done, so it's in AL_Temp, which
+// the caller resets before parsing.
 
 #include "dyibicc.h"
 
@@ -32,12 +37,19 @@ struct MacroParam {
   char* name;
 };
 
+// An argument of a function-like macro invocation. Its tokens are the ones in
+// the invocation, [begin, end), which aren't copied. It's macro-expanded the
+// first time a parameter that isn't an operand of # or ## uses it, and the
+// result is shared by the rest of them.
 typedef struct MacroArg MacroArg;
 struct MacroArg {
   MacroArg* next;
-  char* name;
+  char* name;  // Interned
   bool is_va_args;
-  Token* tok;
+  Token* begin;
+  Token* end;
+  Token* expanded;  // [expanded, expanded_end), or NULL if not expanded yet
+  Token* expanded_end;
 };
 
 typedef Token* macro_handler_fn(Token*);
@@ -60,17 +72,21 @@ struct CondIncl {
   bool included;
 };
 
+// Hidesets are interned: each distinct set is allocated once per translation
+// unit (see C(hidesets)), so tokens share them and sets can be compared by
+// pointer. The empty set is NULL. The names are interned macro names, sorted
+// by address, so union and intersection are merges.
 typedef struct Hideset Hideset;
 struct Hideset {
-  Hideset* next;
-  char* name;
+  int len;
+  char* names[];
 };
 
 static Token* preprocess2(Token* tok);
 static Macro* find_macro(Token* tok);
 
 static bool is_hash(Token* tok) {
-  return tok->at_bol && equal(tok, "#");
+  return tok->at_bol && equal(tok, PU_HASH);
 }
 
 // Some preprocessor directives such as #include allow extraneous
@@ -84,87 +100,196 @@ static Token* skip_line(Token* tok) {
   return tok;
 }
 
+// Tokens produced by macro expansion are allocated with this after them, so
+// that the rest don't need room for it.
+typedef struct TokenExpansion {
+  Hideset* hideset;  // For macro expansion
+  Token* origin;     // The macro token this was expanded from
+} TokenExpansion;
+
+static TokenExpansion* token_expansion(Token* tok) {
+  return tok->is_expanded ? (TokenExpansion*)(tok + 1) : NULL;
+}
+
+static Hideset* token_hideset(Token* tok) {
+  return tok->is_expanded ? token_expansion(tok)->hideset : NULL;
+}
+
+static Token* token_origin(Token* tok) {
+  return tok->is_expanded ? token_expansion(tok)->origin : NULL;
+}
+
 static Token* copy_token(Token* tok) {
-  Token* t = bumpcalloc(1, sizeof(Token), AL_Compile);
-  *t = *tok;
+  size_t size = sizeof(Token) + (tok->is_expanded ? sizeof(TokenExpansion) : 0);
+  Token* t = bumpcalloc(1, size, AL_Compile);
+  memcpy(t, tok, size);
+  t->next = NULL;
+  return t;
+}
+
+// Copies a token, with room for a hideset and origin.
+static Token* copy_token_expanded(Token* tok) {
+  Token* t = bumpcalloc(1, sizeof(Token) + sizeof(TokenExpansion), AL_Compile);
+  memcpy(t, tok, sizeof(Token) + (tok->is_expanded ? sizeof(TokenExpansion) : 0));
   t->next = NULL;
+  t->is_expanded = true;
   return t;
 }
 
 static Token* new_eof(Token* tok) {
   Token* t = copy_token(tok);
   t->kind = TK_EOF;
+  t->id = TOKEN_ID_NONE;
   t->len = 0;
   return t;
 }
 
-static Hideset* new_hideset(char* name) {
-  Hideset* hs = bumpcalloc(1, sizeof(Hideset), AL_Compile);
-  hs->name = name;
+// Returns the interned hideset of the sorted names.
+static Hideset* intern_hideset(char** names, int len) {
+  if (len == 0)
+    return NULL;
+  int keylen = len * (int)sizeof(char*);
+  Hideset* hs = hashmap_get2(&C(hidesets), (char*)names, keylen);
+  if (hs)
+    return hs;
+  hs = bumpcalloc(1, sizeof(Hideset) + keylen, AL_Temp);
+  hs->len = len;
+  memcpy(hs->names, names, keylen);
+  hashmap_put2(&C(hidesets), (char*)hs->names, keylen, hs);
   return hs;
 }
 
-static Hideset* hideset_union(Hideset* hs1, Hideset* hs2) {
-  Hideset head = {0};
-  Hideset* cur = &head;
+static Hideset* new_hideset(char* name) {
+  return intern_hideset(&name, 1);
+}
 
-  for (; hs1; hs1 = hs1->next)
-    cur = cur->next = new_hideset(hs1->name);
-  cur->next = hs2;
-  return head.next;
+static int hideset_len(Hideset* hs) {
+  return hs ? hs->len : 0;
 }
 
-static bool hideset_contains(Hideset* hs, char* s, int len) {
-  for (; hs; hs = hs->next)
-    if (strlen(hs->name) == (size_t)len && !strncmp(hs->name, s, len))
+// Scratch space for merging two hidesets of these lengths.
+static char** hideset_buf(char** buf, int buf_len, int len) {
+  return len <= buf_len ? buf : bumpcalloc(len, sizeof(char*), AL_Temp);
+}
+
+static Hideset* hideset_union(Hideset* hs1, Hideset* hs2) {
+  if (!hs1 || hs1 == hs2)
+    return hs2;
+  if (!hs2)
+    return hs1;
+
+  char* buf[64];
+  char** names = hideset_buf(buf, 64, hs1->len + hs2->len);
+  int i = 0, j = 0, n = 0;
+  while (i < hs1->len && j < hs2->len) {
+    if (hs1->names[i] == hs2->names[j]) {
+      names[n++] = hs1->names[i++];
+      j++;
+    } else if ((uintptr_t)hs1->names[i] < (uintptr_t)hs2->names[j]) {
+      names[n++] = hs1->names[i++];
+    } else {
+      names[n++] = hs2->names[j++];
+    }
+  }
+  while (i < hs1->len)
+    names[n++] = hs1->names[i++];
+  while (j < hs2->len)
+    names[n++] = hs2->names[j++];
+  return intern_hideset(names, n);
+}
+
+static bool hideset_contains(Hideset* hs, char* name) {
+  int lo = 0;
+  int hi = hideset_len(hs);
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (hs->names[mid] == name)
       return true;
+    if ((uintptr_t)hs->names[mid] < (uintptr_t)name)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
   return false;
 }
 
 static Hideset* hideset_intersection(Hideset* hs1, Hideset* hs2) {
-  Hideset head = {0};
-  Hideset* cur = &head;
-
-  for (; hs1; hs1 = hs1->next)
-    if (hideset_contains(hs2, hs1->name, (int)strlen(hs1->name)))
-      cur = cur->next = new_hideset(hs1->name);
-  return head.next;
+  if (!hs1 || !hs2)
+    return NULL;
+  if (hs1 == hs2)
+    return hs1;
+
+  char* buf[64];
+  char** names = hideset_buf(buf, 64, MIN(hs1->len, hs2->len));
+  int i = 0, j = 0, n = 0;
+  while (i < hs1->len && j < hs2->len) {
+    if (hs1->names[i] == hs2->names[j]) {
+      names[n++] = hs1->names[i++];
+      j++;
+    } else if ((uintptr_t)hs1->names[i] < (uintptr_t)hs2->names[j]) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+  return intern_hideset(names, n);
 }
 
-static Token* add_hideset(Token* tok, Hideset* hs) {
-  Token head = {0};
-  Token* cur = &head;
+// The tokens of a macro expansion, as they're made. Each one is copied once,
+// straight from the macro body or argument, with the hideset and origin of
+// the expansion.
+typedef struct Expansion {
+  Token head;
+  Token* cur;
+  Hideset* hideset;
+  Token* origin;
+
+  // Runs of tokens usually have the same hideset, so the last union is
+  // reused.
+  Hideset* last;
+  Hideset* last_union;
+} Expansion;
+
+static void expansion_init(Expansion* e, Hideset* hs, Token* origin) {
+  memset(e, 0, sizeof(*e));
+  e->cur = &e->head;
+  e->hideset = hs;
+  e->origin = origin;
+  e->last_union = hs;
+}
 
-  for (; tok; tok = tok->next) {
-    Token* t = copy_token(tok);
-    t->hideset = hideset_union(t->hideset, hs);
-    cur = cur->next = t;
+static void expansion_add(Expansion* e, Token* tok) {
+  Token* t = copy_token_expanded(tok);
+  Hideset* hs = token_hideset(tok);
+  if (hs != e->last) {
+    e->last = hs;
+    e->last_union = hideset_union(hs, e->hideset);
   }
-  return head.next;
+  token_expansion(t)->hideset = e->last_union;
+  token_expansion(t)->origin = e->origin;
+  e->cur = e->cur->next = t;
 }
 
-// Append tok2 to the end of tok1.
-static Token* append(Token* tok1, Token* tok2) {
-  if (tok1->kind == TK_EOF)
-    return tok2;
-
-  Token head = {0};
-  Token* cur = &head;
-
-  for (; tok1->kind != TK_EOF; tok1 = tok1->next)
-    cur = cur->next = copy_token(tok1);
-  cur->next = tok2;
-  return head.next;
+// Links the expansion to the tokens that follow it, and returns it.
+static Token* expansion_finish(Expansion* e, Token* rest) {
+  e->cur->next = rest;
+  return e->head.next;
 }
 
+// A TK_LAZY token met while skipping follows a conditional line of the group
+// being skipped, so it goes straight to the group's next branch.
 static Token* skip_cond_incl2(Token* tok) {
   while (tok->kind != TK_EOF) {
+    if (tok->kind == TK_LAZY) {
+      skip_lazy_tokens(tok);
+      continue;
+    }
     if (is_hash(tok) &&
-        (equal(tok->next, "if") || equal(tok->next, "ifdef") || equal(tok->next, "ifndef"))) {
+        (equal(tok->next, KW_IF) || equal(tok->next, ID_IFDEF) || equal(tok->next, ID_IFNDEF))) {
       tok = skip_cond_incl2(tok->next->next);
       continue;
     }
-    if (is_hash(tok) && equal(tok->next, "endif"))
+    if (is_hash(tok) && equal(tok->next, ID_ENDIF))
       return tok->next->next;
     tok = tok->next;
   }
@@ -175,14 +300,18 @@ static Token* skip_cond_incl2(Token* tok) {
 // Nested `#if` and `#endif` are skipped.
 static Token* skip_cond_incl(Token* tok) {
   while (tok->kind != TK_EOF) {
+    if (tok->kind == TK_LAZY) {
+      skip_lazy_tokens(tok);
+      continue;
+    }
     if (is_hash(tok) &&
-        (equal(tok->next, "if") || equal(tok->next, "ifdef") || equal(tok->next, "ifndef"))) {
+        (equal(tok->next, KW_IF) || equal(tok->next, ID_IFDEF) || equal(tok->next, ID_IFNDEF))) {
       tok = skip_cond_incl2(tok->next->next);
       continue;
     }
 
     if (is_hash(tok) &&
-        (equal(tok->next, "elif") || equal(tok->next, "else") || equal(tok->next, "endif")))
+        (equal(tok->next, ID_ELIF) || equal(tok->next, KW_ELSE) || equal(tok->next, ID_ENDIF)))
       break;
     tok = tok->next;
   }
@@ -213,7 +342,7 @@ static char* quote_string(char* str) {
 
 static Token* new_str_token(char* str, Token* tmpl) {
   char* buf = quote_string(str);
-  return tokenize(new_file(tmpl->file->name, buf));
+  return tokenize(new_file(token_file(tmpl)->name, buf));
 }
 
 // Copy all tokens until the next newline, terminate them with
@@ -233,7 +362,7 @@ static Token* copy_line(Token** rest, Token* tok) {
 
 static Token* new_num_token(int val, Token* tmpl) {
   char* buf = format(AL_Compile, "%d\n", val);
-  return tokenize(new_file(tmpl->file->name, buf));
+  return tokenize(new_file(token_file(tmpl)->name, buf));
 }
 
 static Token* read_const_expr(Token** rest, Token* tok) {
@@ -245,9 +374,9 @@ static Token* read_const_expr(Token** rest, Token* tok) {
   while (tok->kind != TK_EOF) {
     // "defined(foo)" or "defined foo" becomes "1" if macro "foo"
     // is defined. Otherwise "0".
-    if (equal(tok, "defined")) {
+    if (equal(tok, ID_DEFINED)) {
       Token* start = tok;
-      bool has_paren = consume(&tok, tok->next, "(");
+      bool has_paren = consume(&tok, tok->next, PU_LPAREN);
 
       if (tok->kind != TK_IDENT)
         error_tok(start, "macro name must be an identifier");
@@ -255,7 +384,7 @@ static Token* read_const_expr(Token** rest, Token* tok) {
       tok = tok->next;
 
       if (has_paren)
-        tok = skip(tok, ")");
+        tok = skip(tok, PU_RPAREN);
 
       cur = cur->next = new_num_token(m ? 1 : 0, start);
       continue;
@@ -269,6 +398,266 @@ static Token* read_const_expr(Token** rest, Token* tok) {
   return head.next;
 }
 
+//
+// Expressions in #if and #elif are evaluated directly from their tokens, with
+// the types and results that const_expr() gives them, and without building
+// Nodes. The few that it doesn't handle (floating point constants, the comma
+// operator, GNU ?:, and anything invalid) are left to const_expr().
+//
+
+typedef struct {
+  int64_t val;
+  Type* ty;  // int, unsigned int, long, or unsigned long
+} PPValue;
+
+typedef struct {
+  Token* tok;
+  bool failed;  // The expression is one for const_expr()
+} PPEval;
+
+static PPValue pp_conditional(PPEval* e, bool live);
+
+// As an implicit cast to ty.
+static int64_t pp_convert(int64_t val, Type* ty) {
+  if (ty->size == 4)
+    return ty->is_unsigned ? (int64_t)(uint32_t)val : (int64_t)(int32_t)val;
+  return val;
+}
+
+// Identifiers left after macro expansion are 0. Character literals are already
+// TK_NUM.
+static PPValue pp_primary(PPEval* e, bool live) {
+  Token* tok = e->tok;
+  PPValue v = {0, ty_int};
+
+  if (equal(tok, PU_LPAREN)) {
+    e->tok = tok->next;
+    v = pp_conditional(e, live);
+    if (!equal(e->tok, PU_RPAREN))
+      e->failed = true;
+    else
+      e->tok = e->tok->next;
+    return v;
+  }
+
+  if (tok->kind == TK_IDENT ||
+      (tok->kind == TK_PP_NUM && read_int_literal(tok->loc, tok->len, &v.val, &v.ty))) {
+    e->tok = tok->next;
+    return v;
+  }
+
+  if (tok->kind == TK_NUM && is_integer(tok->lit->ty)) {
+    v.val = tok->lit->val;
+    if (tok->lit->ty->size >= 4)
+      v.ty = tok->lit->ty;
+    e->tok = tok->next;
+    return v;
+  }
+
+  e->failed = true;
+  return v;
+}
+
+static PPValue pp_unary(PPEval* e, bool live) {
+  Token* tok = e->tok;
+  if (!equal(tok, PU_PLUS) && !equal(tok, PU_MINUS) && !equal(tok, PU_TILDE) &&
+      !equal(tok, PU_NOT))
+    return pp_primary(e, live);
+
+  e->tok = tok->next;
+  PPValue v = pp_unary(e, live);
+  if (equal(tok, PU_MINUS)) {
+    v.ty = get_common_type(ty_int, v.ty);
+    v.val = (int64_t)(0 - (uint64_t)pp_convert(v.val, v.ty));
+  } else if (equal(tok, PU_TILDE)) {
+    v.val = ~v.val;
+  } else if (equal(tok, PU_NOT)) {
+    v.val = !v.val;
+    v.ty = ty_int;
+  }
+  return v;
+}
+
+// Returns how tightly a binary operator binds, or 0 if tok isn't one.
+static int pp_binary_prec(Token* tok) {
+  switch (tok->id) {
+    case PU_STAR:
+    case PU_SLASH:
+    case PU_MOD:
+      return 10;
+    case PU_PLUS:
+    case PU_MINUS:
+      return 9;
+    case PU_SHL:
+    case PU_SHR:
+      return 8;
+    case PU_LT:
+    case PU_LE:
+    case PU_GT:
+    case PU_GE:
+      return 7;
+    case PU_EQ:
+    case PU_NE:
+      return 6;
+    case PU_AND:
+      return 5;
+    case PU_XOR:
+      return 4;
+    case PU_OR:
+      return 3;
+    case PU_LOGAND:
+      return 2;
+    case PU_LOGOR:
+      return 1;
+  }
+  return 0;
+}
+
+// The operands of arithmetic, bitwise, and comparison operators are converted
+// to a common type, but, as in eval(), the results aren't truncated to it.
+// Operands that aren't |live| are only there for their types.
+static PPValue pp_binary_op(Token* op, PPValue lhs, PPValue rhs, bool live) {
+  PPValue v = {0, ty_int};
+  if (equal(op, PU_LOGAND) || equal(op, PU_LOGOR)) {
+    v.val = equal(op, PU_LOGAND) ? lhs.val && rhs.val : lhs.val || rhs.val;
+    return v;
+  }
+
+  if (equal(op, PU_SHL) || equal(op, PU_SHR)) {
+    int shift = (int)(rhs.val & 63);
+    v.ty = lhs.ty;
+    if (equal(op, PU_SHL))
+      v.val = (int64_t)((uint64_t)lhs.val << shift);
+    else if (lhs.ty->is_unsigned && lhs.ty->size == 8)
+      v.val = (int64_t)((uint64_t)lhs.val >> shift);
+    else
+      v.val = lhs.val >> shift;
+    return v;
+  }
+
+  Type* ty = get_common_type(lhs.ty, rhs.ty);
+  int64_t a = pp_convert(lhs.val, ty);
+  int64_t b = pp_convert(rhs.val, ty);
+  bool less = ty->is_unsigned ? (uint64_t)a < (uint64_t)b : a < b;
+  bool greater = ty->is_unsigned ? (uint64_t)a > (uint64_t)b : a > b;
+  v.ty = ty;
+
+  switch (op->id) {
+    case PU_STAR:
+      v.val = (int64_t)((uint64_t)a * (uint64_t)b);
+      return v;
+    case PU_SLASH:
+    case PU_MOD: {
+      if (!live)
+        return v;
+      if (b == 0)
+        error_tok(op, "division by zero");
+      bool div = equal(op, PU_SLASH);
+      if (ty->is_unsigned)
+        v.val = (int64_t)(div ? (uint64_t)a / (uint64_t)b : (uint64_t)a % (uint64_t)b);
+      else if (b == -1)
+        v.val = div ? (int64_t)(0 - (uint64_t)a) : 0;
+      else
+        v.val = div ? a / b : a % b;
+      return v;
+    }
+    case PU_PLUS:
+      v.val = (int64_t)((uint64_t)a + (uint64_t)b);
+      return v;
+    case PU_MINUS:
+      v.val = (int64_t)((uint64_t)a - (uint64_t)b);
+      return v;
+    case PU_AND:
+      v.val = a & b;
+      return v;
+    case PU_XOR:
+      v.val = a ^ b;
+      return v;
+    case PU_OR:
+      v.val = a | b;
+      return v;
+  }
+
+  v.ty = ty_int;
+  switch (op->id) {
+    case PU_LT:
+      v.val = less;
+      break;
+    case PU_LE:
+      v.val = !greater;
+      break;
+    case PU_GT:
+      v.val = greater;
+      break;
+    case PU_GE:
+      v.val = !less;
+      break;
+    case PU_EQ:
+      v.val = a == b;
+      break;
+    case PU_NE:
+      v.val = a != b;
+      break;
+  }
+  return v;
+}
+
+// Operators of at least min_prec, by precedence climbing. The right operand of
+// && or || isn't evaluated if the left one decides the result.
+static PPValue pp_binary(PPEval* e, int min_prec, bool live) {
+  PPValue lhs = pp_unary(e, live);
+  for (;;) {
+    Token* op = e->tok;
+    int prec = pp_binary_prec(op);
+    if (e->failed || prec < min_prec)
+      return lhs;
+
+    bool rhs_live = live;
+    if (equal(op, PU_LOGAND))
+      rhs_live = live && lhs.val;
+    else if (equal(op, PU_LOGOR))
+      rhs_live = live && !lhs.val;
+
+    e->tok = op->next;
+    PPValue rhs = pp_binary(e, prec + 1, rhs_live);
+    lhs = pp_binary_op(op, lhs, rhs, live);
+  }
+}
+
+static PPValue pp_conditional(PPEval* e, bool live) {
+  PPValue cond = pp_binary(e, 1, live);
+  if (e->failed || !equal(e->tok, PU_QUESTION))
+    return cond;
+
+  e->tok = e->tok->next;
+  if (equal(e->tok, PU_COLON)) {
+    e->failed = true;  // [GNU] a ?: b
+    return cond;
+  }
+
+  PPValue then = pp_conditional(e, live && cond.val);
+  if (e->failed || !equal(e->tok, PU_COLON)) {
+    e->failed = true;
+    return cond;
+  }
+  e->tok = e->tok->next;
+  PPValue els = pp_conditional(e, live && !cond.val);
+
+  Type* ty = get_common_type(then.ty, els.ty);
+  PPValue v = {pp_convert(cond.val ? then.val : els.val, ty), ty};
+  return v;
+}
+
+// Returns false if the expression has to be evaluated by const_expr().
+static bool eval_pp_expr(Token* tok, long* val) {
+  PPEval e = {tok};
+  PPValue v = pp_conditional(&e, true);
+  if (e.failed || e.tok->kind != TK_EOF)
+    return false;
+  *val = (long)v.val;
+  return true;
+}
+
 // Read and evaluate a constant expression.
 static long eval_const_expr(Token** rest, Token* tok) {
   Token* start = tok;
@@ -278,6 +667,10 @@ static long eval_const_expr(Token** rest, Token* tok) {
   if (expr->kind == TK_EOF)
     error_tok(start, "no expression");
 
+  long val;
+  if (eval_pp_expr(expr, &val))
+    return val;
+
   // [https://www.sigbus.info/n1570#6.10.1p4] The standard requires
   // we replace remaining non-macro identifiers with "0" before
   // evaluating a constant expression. For example, `#if foo` is
@@ -294,14 +687,14 @@ static long eval_const_expr(Token** rest, Token* tok) {
   convert_pp_tokens(expr);
 
   Token* rest2;
-  long val = (long)const_expr(&rest2, expr);
+  val = (long)const_expr(&rest2, expr);
   if (rest2->kind != TK_EOF)
     error_tok(rest2, "extra token");
   return val;
 }
 
 static CondIncl* push_cond_incl(Token* tok, bool included) {
-  CondIncl* ci = bumpcalloc(1, sizeof(CondIncl), AL_Compile);
+  CondIncl* ci = bumpcalloc(1, sizeof(CondIncl), AL_Temp);
   ci->next = C(cond_incl);
   ci->ctx = IN_THEN;
   ci->tok = tok;
@@ -310,15 +703,26 @@ static CondIncl* push_cond_incl(Token* tok, bool included) {
   return ci;
 }
 
+// Put in C(macros) by #undef of a predefined macro, to hide the one in the
+// context's base_macros.
+static Macro undefined_macro;
+
+static Macro* lookup_macro(char* name) {
+  Macro* m = hashmap_get_interned(&C(macros), name);
+  if (!m)
+    m = hashmap_get_interned(&user_context->base_macros, name);
+  return m == &undefined_macro ? NULL : m;
+}
+
 static Macro* find_macro(Token* tok) {
   if (tok->kind != TK_IDENT)
     return NULL;
-  return hashmap_get2(&C(macros), tok->loc, tok->len);
+  return lookup_macro(tok->ident);
 }
 
 static Macro* add_macro(char* name, bool is_objlike, Token* body) {
-  Macro* m = bumpcalloc(1, sizeof(Macro), AL_Compile);
-  m->name = name;
+  Macro* m = bumpcalloc(1, sizeof(Macro), AL_Temp);
+  m->name = intern(name);
   m->is_objlike = is_objlike;
   m->body = body;
   hashmap_put(&C(macros), name, m);
@@ -329,27 +733,27 @@ static MacroParam* read_macro_params(Token** rest, Token* tok, char** va_args_na
   MacroParam head = {0};
   MacroParam* cur = &head;
 
-  while (!equal(tok, ")")) {
+  while (!equal(tok, PU_RPAREN)) {
     if (cur != &head)
-      tok = skip(tok, ",");
+      tok = skip(tok, PU_COMMA);
 
-    if (equal(tok, "...")) {
-      *va_args_name = "__VA_ARGS__";
-      *rest = skip(tok->next, ")");
+    if (equal(tok, PU_ELLIPSIS)) {
+      *va_args_name = intern("__VA_ARGS__");
+      *rest = skip(tok->next, PU_RPAREN);
       return head.next;
     }
 
     if (tok->kind != TK_IDENT)
       error_tok(tok, "expected an identifier");
 
-    if (equal(tok->next, "...")) {
-      *va_args_name = bumpstrndup(tok->loc, tok->len, AL_Compile);
-      *rest = skip(tok->next->next, ")");
+    if (equal(tok->next, PU_ELLIPSIS)) {
+      *va_args_name = tok->ident;
+      *rest = skip(tok->next->next, PU_RPAREN);
       return head.next;
     }
 
-    MacroParam* m = bumpcalloc(1, sizeof(MacroParam), AL_Compile);
-    m->name = bumpstrndup(tok->loc, tok->len, AL_Compile);
+    MacroParam* m = bumpcalloc(1, sizeof(MacroParam), AL_Temp);
+    m->name = tok->ident;
     cur = cur->next = m;
     tok = tok->next;
   }
@@ -358,13 +762,13 @@ static MacroParam* read_macro_params(Token** rest, Token* tok, char** va_args_na
   return head.next;
 }
 
-static void read_macro_definition(Token** rest, Token* tok) {
+static Macro* read_macro_definition(Token** rest, Token* tok) {
   if (tok->kind != TK_IDENT)
     error_tok(tok, "macro name must be an identifier");
-  char* name = bumpstrndup(tok->loc, tok->len, AL_Compile);
+  char* name = tok->ident;
   tok = tok->next;
 
-  if (!tok->has_space && equal(tok, "(")) {
+  if (!tok->has_space && equal(tok, PU_LPAREN)) {
     // Function-like macro
     char* va_args_name = NULL;
     MacroParam* params = read_macro_params(&tok, tok->next, &va_args_name);
@@ -372,39 +776,38 @@ static void read_macro_definition(Token** rest, Token* tok) {
     Macro* m = add_macro(name, false, copy_line(rest, tok));
     m->params = params;
     m->va_args_name = va_args_name;
-  } else {
-    // Object-like macro
-    add_macro(name, true, copy_line(rest, tok));
+    return m;
   }
+
+  // Object-like macro
+  return add_macro(name, true, copy_line(rest, tok));
 }
 
 static MacroArg* read_macro_arg_one(Token** rest, Token* tok, bool read_rest) {
-  Token head = {0};
-  Token* cur = &head;
+  MacroArg* arg = bumpcalloc(1, sizeof(MacroArg), AL_Temp);
+  arg->begin = tok;
   int level = 0;
 
   for (;;) {
-    if (level == 0 && equal(tok, ")"))
+    if (tok->kind == TK_LAZY)
+      fill_lazy_tokens(tok);
+    if (level == 0 && equal(tok, PU_RPAREN))
       break;
-    if (level == 0 && !read_rest && equal(tok, ","))
+    if (level == 0 && !read_rest && equal(tok, PU_COMMA))
       break;
 
     if (tok->kind == TK_EOF)
       error_tok(tok, "premature end of input");
 
-    if (equal(tok, "("))
+    if (equal(tok, PU_LPAREN))
       level++;
-    else if (equal(tok, ")"))
+    else if (equal(tok, PU_RPAREN))
       level--;
 
-    cur = cur->next = copy_token(tok);
     tok = tok->next;
   }
 
-  cur->next = new_eof(tok);
-
-  MacroArg* arg = bumpcalloc(1, sizeof(MacroArg), AL_Compile);
-  arg->tok = head.next;
+  arg->end = tok;
   *rest = tok;
   return arg;
 }
@@ -419,41 +822,70 @@ static MacroArg* read_macro_args(Token** rest, Token* tok, MacroParam* params, c
   MacroParam* pp = params;
   for (; pp; pp = pp->next) {
     if (cur != &head)
-      tok = skip(tok, ",");
+      tok = skip(tok, PU_COMMA);
     cur = cur->next = read_macro_arg_one(&tok, tok, false);
     cur->name = pp->name;
   }
 
   if (va_args_name) {
     MacroArg* arg;
-    if (equal(tok, ")")) {
-      arg = bumpcalloc(1, sizeof(MacroArg), AL_Compile);
-      arg->tok = new_eof(tok);
+    if (equal(tok, PU_RPAREN)) {
+      arg = bumpcalloc(1, sizeof(MacroArg), AL_Temp);
+      arg->begin = arg->end = tok;
     } else {
       if (pp != params)
-        tok = skip(tok, ",");
+        tok = skip(tok, PU_COMMA);
       arg = read_macro_arg_one(&tok, tok, true);
     }
     arg->name = va_args_name;
-    ;
     arg->is_va_args = true;
     cur = cur->next = arg;
   } else if (pp) {
     error_tok(start, "too many arguments");
   }
 
-  skip(tok, ")");
+  skip(tok, PU_RPAREN);
   *rest = tok;
   return head.next;
 }
 
 static MacroArg* find_arg(MacroArg* args, Token* tok) {
+  if (tok->kind != TK_IDENT)
+    return NULL;
   for (MacroArg* ap = args; ap; ap = ap->next)
-    if ((size_t)tok->len == strlen(ap->name) && !strncmp(tok->loc, ap->name, tok->len))
+    if (ap->name == tok->ident)
       return ap;
   return NULL;
 }
 
+// Returns the argument after macro expansion, which ends at *end. Arguments
+// that don't have anything for preprocess2() to do are used as they are,
+// rather than copied for it.
+static Token* expand_arg(MacroArg* arg, Token** end) {
+  if (!arg->expanded) {
+    bool needs_expansion = false;
+    for (Token* t = arg->begin; t != arg->end && !needs_expansion; t = t->next)
+      needs_expansion = is_hash(t) || find_macro(t);
+
+    if (needs_expansion) {
+      // preprocess2() links the tokens it returns together, so it's given a
+      // copy.
+      Token head = {0};
+      Token* cur = &head;
+      for (Token* t = arg->begin; t != arg->end; t = t->next)
+        cur = cur->next = copy_token(t);
+      Token* eof = cur->next = new_eof(arg->end);
+      arg->expanded = preprocess2(head.next);
+      arg->expanded_end = eof;
+    } else {
+      arg->expanded = arg->begin;
+      arg->expanded_end = arg->end;
+    }
+  }
+  *end = arg->expanded_end;
+  return arg->expanded;
+}
+
 // Concatenates all tokens in `tok` and returns a new string.
 static char* join_tokens(Token* tok, Token* end) {
   // Compute the length of the resulting token.
@@ -480,11 +912,11 @@ static char* join_tokens(Token* tok, Token* end) {
 
 // Concatenates all tokens in `arg` and returns a new string token.
 // This function is used for the stringizing operator (#).
-static Token* stringize(Token* hash, Token* arg) {
+static Token* stringize(Token* hash, MacroArg* arg) {
   // Create a new string token. We need to set some value to its
   // source location for error reporting function, so we use a macro
   // name token as a template.
-  char* s = join_tokens(arg, NULL);
+  char* s = join_tokens(arg->begin, arg->end);
   return new_str_token(s, hash);
 }
 
@@ -494,7 +926,7 @@ static Token* paste(Token* lhs, Token* rhs) {
   char* buf = format(AL_Compile, "%.*s%.*s", lhs->len, lhs->loc, rhs->len, rhs->loc);
 
   // Tokenize the resulting string.
-  Token* tok = tokenize(new_file(lhs->file->name, buf));
+  Token* tok = tokenize(new_file(token_file(lhs)->name, buf));
   if (tok->next->kind != TK_EOF)
     error_tok(lhs, "pasting forms '%s', an invalid token", buf);
   return tok;
@@ -503,22 +935,28 @@ static Token* paste(Token* lhs, Token* rhs) {
 static bool has_varargs(MacroArg* args) {
   for (MacroArg* ap = args; ap; ap = ap->next)
     if (!strcmp(ap->name, "__VA_ARGS__"))
-      return ap->tok->kind != TK_EOF;
+      return ap->begin != ap->end;
   return false;
 }
 
-// Replace func-like macro parameters with given arguments.
-static Token* subst(Token* tok, MacroArg* args) {
-  Token head = {0};
-  Token* cur = &head;
+// Replaces the last token of an expansion with it pasted together with rhs.
+static void expansion_paste(Expansion* e, Token* rhs) {
+  Token* t = paste(e->cur, rhs);
+  *e->cur = *t;
+  e->cur->is_expanded = true;
+  token_expansion(e->cur)->hideset = e->hideset;
+  token_expansion(e->cur)->origin = e->origin;
+}
 
+// Replace func-like macro parameters with given arguments.
+static void subst(Expansion* e, Token* tok, MacroArg* args) {
   while (tok->kind != TK_EOF) {
     // "#" followed by a parameter is replaced with stringized actuals.
-    if (equal(tok, "#")) {
+    if (equal(tok, PU_HASH)) {
       MacroArg* arg = find_arg(args, tok->next);
       if (!arg)
         error_tok(tok->next, "'#' is not followed by a macro parameter");
-      cur = cur->next = stringize(tok, arg->tok);
+      expansion_add(e, stringize(tok, arg));
       tok = tok->next->next;
       continue;
     }
@@ -526,21 +964,21 @@ static Token* subst(Token* tok, MacroArg* args) {
     // [GNU] If __VA_ARG__ is empty, `,##__VA_ARGS__` is expanded
     // to the empty token list. Otherwise, its expaned to `,` and
     // __VA_ARGS__.
-    if (equal(tok, ",") && equal(tok->next, "##")) {
+    if (equal(tok, PU_COMMA) && equal(tok->next, PU_HASHHASH)) {
       MacroArg* arg = find_arg(args, tok->next->next);
       if (arg && arg->is_va_args) {
-        if (arg->tok->kind == TK_EOF) {
+        if (arg->begin == arg->end) {
           tok = tok->next->next->next;
         } else {
-          cur = cur->next = copy_token(tok);
+          expansion_add(e, tok);
           tok = tok->next->next;
         }
         continue;
       }
     }
 
-    if (equal(tok, "##")) {
-      if (cur == &head)
+    if (equal(tok, PU_HASHHASH)) {
+      if (e->cur == &e->head)
         error_tok(tok, "'##' cannot appear at start of macro expansion");
 
       if (tok->next->kind == TK_EOF)
@@ -548,85 +986,105 @@ static Token* subst(Token* tok, MacroArg* args) {
 
       MacroArg* arg = find_arg(args, tok->next);
       if (arg) {
-        if (arg->tok->kind != TK_EOF) {
-          *cur = *paste(cur, arg->tok);
-          for (Token* t = arg->tok->next; t->kind != TK_EOF; t = t->next)
-            cur = cur->next = copy_token(t);
+        if (arg->begin != arg->end) {
+          expansion_paste(e, arg->begin);
+          for (Token* t = arg->begin->next; t != arg->end; t = t->next)
+            expansion_add(e, t);
         }
         tok = tok->next->next;
         continue;
       }
 
-      *cur = *paste(cur, tok->next);
+      expansion_paste(e, tok->next);
       tok = tok->next->next;
       continue;
     }
 
     MacroArg* arg = find_arg(args, tok);
 
-    if (arg && equal(tok->next, "##")) {
+    if (arg && equal(tok->next, PU_HASHHASH)) {
       Token* rhs = tok->next->next;
 
-      if (arg->tok->kind == TK_EOF) {
+      if (arg->begin == arg->end) {
         MacroArg* arg2 = find_arg(args, rhs);
         if (arg2) {
-          for (Token* t = arg2->tok; t->kind != TK_EOF; t = t->next)
-            cur = cur->next = copy_token(t);
+          for (Token* t = arg2->begin; t != arg2->end; t = t->next)
+            expansion_add(e, t);
         } else {
-          cur = cur->next = copy_token(rhs);
+          expansion_add(e, rhs);
         }
         tok = rhs->next;
         continue;
       }
 
-      for (Token* t = arg->tok; t->kind != TK_EOF; t = t->next)
-        cur = cur->next = copy_token(t);
+      for (Token* t = arg->begin; t != arg->end; t = t->next)
+        expansion_add(e, t);
       tok = tok->next;
       continue;
     }
 
     // If __VA_ARG__ is empty, __VA_OPT__(x) is expanded to the
     // empty token list. Otherwise, __VA_OPT__(x) is expanded to x.
-    if (equal(tok, "__VA_OPT__") && equal(tok->next, "(")) {
+    if (equal(tok, ID___VA_OPT__) && equal(tok->next, PU_LPAREN)) {
       MacroArg* arg2 = read_macro_arg_one(&tok, tok->next->next, true);
       if (has_varargs(args))
-        for (Token* t = arg2->tok; t->kind != TK_EOF; t = t->next)
-          cur = cur->next = t;
-      tok = skip(tok, ")");
+        for (Token* t = arg2->begin; t != arg2->end; t = t->next)
+          expansion_add(e, t);
+      tok = skip(tok, PU_RPAREN);
       continue;
     }
 
     // Handle a macro token. Macro arguments are completely macro-expanded
     // before they are substituted into a macro body.
     if (arg) {
-      Token* t = preprocess2(arg->tok);
-      t->at_bol = tok->at_bol;
-      t->has_space = tok->has_space;
-      for (; t->kind != TK_EOF; t = t->next)
-        cur = cur->next = copy_token(t);
+      Token* prev = e->cur;
+      Token* end;
+      for (Token* t = expand_arg(arg, &end); t != end; t = t->next)
+        expansion_add(e, t);
+      if (e->cur != prev) {
+        prev->next->at_bol = tok->at_bol;
+        prev->next->has_space = tok->has_space;
+      }
       tok = tok->next;
       continue;
     }
 
     // Handle a non-macro token.
-    cur = cur->next = copy_token(tok);
+    expansion_add(e, tok);
     tok = tok->next;
     continue;
   }
-
-  cur->next = tok;
-  return head.next;
 }
 
-static bool file_exists(char* path) {
+static bool path_exists(char* path) {
   struct stat st;
   return !stat(path, &st);
 }
 
+#define FILE_FOUND ((void*)1)
+#define FILE_MISSING ((void*)2)
+
+// Whether a file exists, remembered in the context's file_exists_cache.
+static bool file_exists(char* path) {
+  UserContext* uc = user_context;
+  char* key = intern(path);
+  mutex_lock(&uc->lock);
+  void* known = hashmap_get_interned(&uc->file_exists_cache, key);
+  mutex_unlock(&uc->lock);
+  if (known)
+    return known == FILE_FOUND;
+
+  bool exists = path_exists(path);
+  mutex_lock(&uc->lock);
+  hashmap_put_interned(&uc->file_exists_cache, key, exists ? FILE_FOUND : FILE_MISSING);
+  mutex_unlock(&uc->lock);
+  return exists;
+}
+
 // If tok is a macro, expand it and return true.
 // Otherwise, do nothing and return false.
 static bool expand_macro(Token** rest, Token* tok) {
-  if (hideset_contains(tok->hideset, tok->loc, tok->len))
+  if (tok->kind != TK_IDENT || hideset_contains(token_hideset(tok), tok->ident))
     return false;
 
   Macro* m = find_macro(tok);
@@ -642,11 +1100,11 @@ static bool expand_macro(Token** rest, Token* tok) {
 
   // Object-like macro application
   if (m->is_objlike) {
-    Hideset* hs = hideset_union(tok->hideset, new_hideset(m->name));
-    Token* body = add_hideset(m->body, hs);
-    for (Token* t = body; t->kind != TK_EOF; t = t->next)
-      t->origin = tok;
-    *rest = append(body, tok->next);
+    Expansion e;
+    expansion_init(&e, hideset_union(token_hideset(tok), new_hideset(m->name)), tok);
+    for (Token* t = m->body; t->kind != TK_EOF; t = t->next)
+      expansion_add(&e, t);
+    *rest = expansion_finish(&e, tok->next);
     (*rest)->at_bol = tok->at_bol;
     (*rest)->has_space = tok->has_space;
     return true;
@@ -654,7 +1112,7 @@ static bool expand_macro(Token** rest, Token* tok) {
 
   // If a funclike macro token is not followed by an argument list,
   // treat it as a normal identifier.
-  if (!equal(tok->next, "("))
+  if (!equal(tok->next, PU_LPAREN))
     return false;
 
   // Function-like macro application
@@ -667,37 +1125,51 @@ static bool expand_macro(Token** rest, Token* tok) {
   // for the new tokens should be. We take the interesection of the
   // macro token and the closing parenthesis and use it as a new hideset
   // as explained in the Dave Prossor's algorithm.
-  Hideset* hs = hideset_intersection(macro_token->hideset, rparen->hideset);
+  Hideset* hs = hideset_intersection(token_hideset(macro_token), token_hideset(rparen));
   hs = hideset_union(hs, new_hideset(m->name));
 
-  Token* body = subst(m->body, args);
-  body = add_hideset(body, hs);
-  for (Token* t = body; t->kind != TK_EOF; t = t->next)
-    t->origin = macro_token;
-  *rest = append(body, tok->next);
+  Expansion e;
+  expansion_init(&e, hs, macro_token);
+  subst(&e, m->body, args);
+  *rest = expansion_finish(&e, rparen->next);
   (*rest)->at_bol = macro_token->at_bol;
   (*rest)->has_space = macro_token->has_space;
   return true;
 }
 
+// Searches the include paths for a file. The index of the path it's found on
+// (or num_include_paths, if none) is kept in the context's include_cache, plus
+// one so that it isn't NULL, so the paths before it aren't checked again.
 IMPLSTATIC char* search_include_paths(char* filename) {
   if (filename[0] == '/')
     return filename;
 
-  char* cached = hashmap_get(&C(include_path_cache), filename);
-  if (cached)
-    return cached;
+  UserContext* uc = user_context;
+  char* key = intern(filename);
+  mutex_lock(&uc->lock);
+  int i = (int)(uintptr_t)hashmap_get_interned(&uc->include_cache, key) - 1;
+  mutex_unlock(&uc->lock);
 
-  // Search a file from the include paths.
-  for (int i = 0; i < (int)user_context->num_include_paths; i++) {
-    char* path = format(AL_Compile, "%s/%s", user_context->include_paths[i], filename);
-    if (!file_exists(path))
-      continue;
-    hashmap_put(&C(include_path_cache), filename, path);
-    C(include_next_idx) = i + 1;
-    return path;
+  if (i < 0) {
+    for (i = 0; i < (int)uc->num_include_paths; i++) {
+      if (path_exists(format(AL_Compile, "%s/%s", uc->include_paths[i], filename)))
+        break;
+    }
+    mutex_lock(&uc->lock);
+    hashmap_put_interned(&uc->include_cache, key, (void*)(uintptr_t)(i + 1));
+    mutex_unlock(&uc->lock);
   }
-  return NULL;
+
+  if (i == (int)uc->num_include_paths)
+    return NULL;
+  C(include_next_idx) = i + 1;
+  return format(AL_Compile, "%s/%s", uc->include_paths[i], filename);
+}
+
+// Forgets everything in the include caches. Called when no compile is running.
+IMPLSTATIC void include_cache_flush(void) {
+  hashmap_clear_manual_key_unowned_value_unowned(&user_context->include_cache);
+  hashmap_clear_manual_key_unowned_value_unowned(&user_context->file_exists_cache);
 }
 
 static char* search_include_next(char* filename) {
@@ -725,13 +1197,13 @@ static char* read_include_filename(Token** rest, Token* tok, bool* is_dquote) {
   }
 
   // Pattern 2: #include <foo.h>
-  if (equal(tok, "<")) {
+  if (equal(tok, PU_LT)) {
     // Reconstruct a filename from a sequence of tokens between
     // "<" and ">".
     Token* start = tok;
 
     // Find closing ">".
-    for (; !equal(tok, ">"); tok = tok->next)
+    for (; !equal(tok, PU_GT); tok = tok->next)
       if (tok->at_bol || tok->kind == TK_EOF)
         error_tok(tok, "expected '>'");
 
@@ -751,45 +1223,6 @@ static char* read_include_filename(Token** rest, Token* tok, bool* is_dquote) {
   error_tok(tok, "expected a filename");
 }
 
-// Detect the following "include guard" pattern.
-//
-//   #ifndef FOO_H
-//   #define FOO_H
-//   ...
-//   #endif
-static char* detect_include_guard(Token* tok) {
-  // Detect the first two lines.
-  if (!is_hash(tok) || !equal(tok->next, "ifndef"))
-    return NULL;
-  tok = tok->next->next;
-
-  if (tok->kind != TK_IDENT)
-    return NULL;
-
-  char* macro = bumpstrndup(tok->loc, tok->len, AL_Compile);
-  tok = tok->next;
-
-  if (!is_hash(tok) || !equal(tok->next, "define") || !equal(tok->next->next, macro))
-    return NULL;
-
-  // Read until the end of the file.
-  while (tok->kind != TK_EOF) {
-    if (!is_hash(tok)) {
-      tok = tok->next;
-      continue;
-    }
-
-    if (equal(tok->next, "endif") && tok->next->next->kind == TK_EOF)
-      return macro;
-
-    if (equal(tok, "if") || equal(tok, "ifdef") || equal(tok, "ifndef"))
-      tok = skip_cond_incl(tok->next);
-    else
-      tok = tok->next;
-  }
-  return NULL;
-}
-
 static Token* include_file(Token* tok, char* path, Token* filename_tok) {
   // Check for "#pragma once"
   if (hashmap_get(&C(pragma_once), path))
@@ -799,28 +1232,28 @@ static Token* include_file(Token* tok, char* path, Token* filename_tok) {
   // by the usual #ifndef ... #endif pattern, we may be able to
   // skip the file without opening it.
   char* guard_name = hashmap_get(&C(include_guards), path);
-  if (guard_name && hashmap_get(&C(macros), guard_name))
+  if (guard_name && lookup_macro(guard_name))
     return tok;
 
-  Token* tok2 = tokenize_file(path);
+  Token* tok2 = tokenize_header(path, tok, &guard_name);
   if (!tok2)
     error_tok(filename_tok, "%s: cannot open file: %s", path, strerror(errno));
 
-  guard_name = detect_include_guard(tok2);
   if (guard_name)
     hashmap_put(&C(include_guards), path, guard_name);
-
-  return append(tok2, tok);
+  return tok2;
 }
 
 // Read #line arguments
 static void read_line_marker(Token** rest, Token* tok) {
   Token* start = tok;
-  tok = preprocess(copy_line(rest, tok));
+  tok = preprocess2(copy_line(rest, tok));
+  convert_pp_tokens(tok);
 
-  if (tok->kind != TK_NUM || tok->ty->kind != TY_INT)
+  if (tok->kind != TK_NUM || tok->lit->ty->kind != TY_INT)
     error_tok(tok, "invalid line marker");
-  start->file->line_delta = (int)(tok->val - start->line_no);
+  File* file = token_file(start);
+  file->line_delta = (int)(tok->lit->val - token_line_no(start));
 
   tok = tok->next;
   if (tok->kind == TK_EOF)
@@ -828,7 +1261,7 @@ static void read_line_marker(Token** rest, Token* tok) {
 
   if (tok->kind != TK_STR)
     error_tok(tok, "filename expected");
-  start->file->display_name = tok->str;
+  file->display_name = tok->lit->str;
 }
 
 // Visit all tokens in `tok` while evaluating preprocessing
@@ -838,14 +1271,18 @@ static Token* preprocess2(Token* tok) {
   Token* cur = &head;
 
   while (tok->kind != TK_EOF) {
+    // The rest of a header, after a conditional line that wasn't skipped.
+    if (tok->kind == TK_LAZY) {
+      fill_lazy_tokens(tok);
+      continue;
+    }
+
     // If it is a macro, expand it.
     if (expand_macro(&tok, tok))
       continue;
 
     // Pass through if it is not a "#".
     if (!is_hash(tok)) {
-      tok->line_delta = tok->file->line_delta;
-      tok->filename = tok->file->display_name;
       cur = cur->next = tok;
       tok = tok->next;
       continue;
@@ -854,13 +1291,13 @@ static Token* preprocess2(Token* tok) {
     Token* start = tok;
     tok = tok->next;
 
-    if (equal(tok, "include")) {
+    if (equal(tok, ID_INCLUDE)) {
       bool is_dquote;
       char* filename = read_include_filename(&tok, tok->next, &is_dquote);
 
       if (filename[0] != '/' && is_dquote) {
-        char* path = format(AL_Compile, "%s/%s", dirname(bumpstrdup(start->file->name, AL_Compile)),
-                            filename);
+        char* dir = dirname(bumpstrdup(token_file(start)->name, AL_Compile));
+        char* path = format(AL_Compile, "%s/%s", dir, filename);
         if (file_exists(path)) {
           tok = include_file(tok, path, start->next->next);
           continue;
@@ -872,7 +1309,7 @@ static Token* preprocess2(Token* tok) {
       continue;
     }
 
-    if (equal(tok, "include_next")) {
+    if (equal(tok, ID_INCLUDE_NEXT)) {
       bool ignore;
       char* filename = read_include_filename(&tok, tok->next, &ignore);
       char* path = search_include_next(filename);
@@ -880,21 +1317,21 @@ static Token* preprocess2(Token* tok) {
       continue;
     }
 
-    if (equal(tok, "define")) {
+    if (equal(tok, ID_DEFINE)) {
       read_macro_definition(&tok, tok->next);
       continue;
     }
 
-    if (equal(tok, "undef")) {
+    if (equal(tok, ID_UNDEF)) {
       tok = tok->next;
       if (tok->kind != TK_IDENT)
         error_tok(tok, "macro name must be an identifier");
-      undef_macro(bumpstrndup(tok->loc, tok->len, AL_Compile));
+      undef_macro(tok->ident);
       tok = skip_line(tok->next);
       continue;
     }
 
-    if (equal(tok, "if")) {
+    if (equal(tok, KW_IF)) {
       long val = eval_const_expr(&tok, tok);
       push_cond_incl(start, val);
       if (!val)
@@ -902,7 +1339,7 @@ static Token* preprocess2(Token* tok) {
       continue;
     }
 
-    if (equal(tok, "ifdef")) {
+    if (equal(tok, ID_IFDEF)) {
       bool defined = find_macro(tok->next);
       push_cond_incl(tok, defined);
       tok = skip_line(tok->next->next);
@@ -911,7 +1348,7 @@ static Token* preprocess2(Token* tok) {
       continue;
     }
 
-    if (equal(tok, "ifndef")) {
+    if (equal(tok, ID_IFNDEF)) {
       bool defined = find_macro(tok->next);
       push_cond_incl(tok, !defined);
       tok = skip_line(tok->next->next);
@@ -920,7 +1357,7 @@ static Token* preprocess2(Token* tok) {
       continue;
     }
 
-    if (equal(tok, "elif")) {
+    if (equal(tok, ID_ELIF)) {
       if (!C(cond_incl) || C(cond_incl)->ctx == IN_ELSE)
         error_tok(start, "stray #elif");
       C(cond_incl)->ctx = IN_ELIF;
@@ -932,7 +1369,7 @@ static Token* preprocess2(Token* tok) {
       continue;
     }
 
-    if (equal(tok, "else")) {
+    if (equal(tok, KW_ELSE)) {
       if (!C(cond_incl) || C(cond_incl)->ctx == IN_ELSE)
         error_tok(start, "stray #else");
       C(cond_incl)->ctx = IN_ELSE;
@@ -943,7 +1380,7 @@ static Token* preprocess2(Token* tok) {
       continue;
     }
 
-    if (equal(tok, "endif")) {
+    if (equal(tok, ID_ENDIF)) {
       if (!C(cond_incl))
         error_tok(start, "stray #endif");
       C(cond_incl) = C(cond_incl)->next;
@@ -951,7 +1388,7 @@ static Token* preprocess2(Token* tok) {
       continue;
     }
 
-    if (equal(tok, "line")) {
+    if (equal(tok, ID_LINE)) {
       read_line_marker(&tok, tok->next);
       continue;
     }
@@ -961,20 +1398,20 @@ static Token* preprocess2(Token* tok) {
       continue;
     }
 
-    if (equal(tok, "pragma") && equal(tok->next, "once")) {
-      hashmap_put(&C(pragma_once), tok->file->name, (void*)1);
+    if (equal(tok, ID_PRAGMA) && equal(tok->next, ID_ONCE)) {
+      hashmap_put(&C(pragma_once), token_file(tok)->name, (void*)1);
       tok = skip_line(tok->next->next);
       continue;
     }
 
-    if (equal(tok, "pragma")) {
+    if (equal(tok, ID_PRAGMA)) {
       do {
         tok = tok->next;
       } while (!tok->at_bol);
       continue;
     }
 
-    if (equal(tok, "error"))
+    if (equal(tok, ID_ERROR))
       error_tok(tok, "error");
 
     // `#`-only line is legal. It's called a null directive.
@@ -988,19 +1425,11 @@ static Token* preprocess2(Token* tok) {
   return head.next;
 }
 
-IMPLSTATIC void define_macro(char* name, char* buf) {
-  Token* tok = tokenize(new_file("<built-in>", buf));
-  add_macro(name, true, tok);
-}
-
 IMPLSTATIC void undef_macro(char* name) {
-  hashmap_delete(&C(macros), name);
-}
-
-IMPLSTATIC void define_function_macro(char* buf) {
-  Token* tok = tokenize(new_file("<built-in>", buf));
-  Token* rest = tok;
-  read_macro_definition(&rest, tok);
+  if (hashmap_get_interned(&user_context->base_macros, name))
+    hashmap_put_interned(&C(macros), name, &undefined_macro);
+  else
+    hashmap_delete(&C(macros), name);
 }
 
 static Macro* add_builtin(char* name, macro_handler_fn* fn) {
@@ -1010,15 +1439,15 @@ static Macro* add_builtin(char* name, macro_handler_fn* fn) {
 }
 
 static Token* file_macro(Token* tmpl) {
-  while (tmpl->origin)
-    tmpl = tmpl->origin;
-  return new_str_token(tmpl->file->display_name, tmpl);
+  while (token_origin(tmpl))
+    tmpl = token_origin(tmpl);
+  return new_str_token(token_file(tmpl)->display_name, tmpl);
 }
 
 static Token* line_macro(Token* tmpl) {
-  while (tmpl->origin)
-    tmpl = tmpl->origin;
-  int i = tmpl->line_no + tmpl->file->line_delta;
+  while (token_origin(tmpl))
+    tmpl = token_origin(tmpl);
+  int i = token_line_no(tmpl) + token_file(tmpl)->line_delta;
   return new_num_token(i, tmpl);
 }
 
@@ -1038,105 +1467,200 @@ static Token* base_file_macro(Token* tmpl) {
   return new_str_token(compiler_state.main__base_file, tmpl);
 }
 
-// __DATE__ is expanded to the current date, e.g. "May 17 2020".
-static char* format_date(struct tm* tm) {
-  (void)tm;
-  return "\"May 02 1977\"";
+// __DATE__ is expanded to the current date, e.g. "May 17 2020". The date and
+// time are pinned for reproducible output.
+static Token* date_macro(Token* tmpl) {
+  return new_str_token("May 02 1977", tmpl);
 }
 
 // __TIME__ is expanded to the current time, e.g. "13:34:03".
-static char* format_time(struct tm* tm) {
-  (void)tm;
-  return "\"01:23:45\"";
+static Token* time_macro(Token* tmpl) {
+  return new_str_token("01:23:45", tmpl);
 }
 
-IMPLSTATIC void init_macros(void) {
-  // Define predefined macros
-  define_macro("_LP64", "1");
-  define_macro("__C99_MACRO_WITH_VA_ARGS", "1");
-  define_macro("__LP64__", "1");
-  define_macro("__SIZEOF_DOUBLE__", "8");
-  define_macro("__SIZEOF_FLOAT__", "4");
-  define_macro("__SIZEOF_INT__", "4");
-  define_macro("__SIZEOF_LONG_LONG__", "8");
-  define_macro("__SIZEOF_POINTER__", "8");
-  define_macro("__SIZEOF_PTRDIFF_T__", "8");
-  define_macro("__SIZEOF_SHORT__", "2");
-  define_macro("__SIZEOF_SIZE_T__", "8");
-  define_macro("__SIZE_TYPE__", "unsigned long");
-  define_macro("__STDC_HOSTED__", "1");
-  define_macro("__STDC_NO_COMPLEX__", "1");
-  define_macro("__STDC_UTF_16__", "1");
-  define_macro("__STDC_UTF_32__", "1");
-  define_macro("__STDC_VERSION__", "201112L");
-  define_macro("__STDC__", "1");
-  define_macro("__USER_LABEL_PREFIX__", "");
-  define_macro("__alignof__", "_Alignof");
-  define_macro("__amd64", "1");
-  define_macro("__amd64__", "1");
-  define_macro("__const__", "const");
-  define_macro("__dyibicc__", "1");
-  define_macro("__inline__", "inline");
-  define_macro("__signed__", "signed");
-  define_macro("__typeof__", "typeof");
-  define_macro("__volatile__", "volatile");
-  define_macro("__x86_64", "1");
-  define_macro("__x86_64__", "1");
+// The predefined macros that have a body, as they'd be written after #define.
+static char* predefined_macros[] = {
+    "_LP64 1",
+    "__C99_MACRO_WITH_VA_ARGS 1",
+    "__LP64__ 1",
+    "__SIZEOF_DOUBLE__ 8",
+    "__SIZEOF_FLOAT__ 4",
+    "__SIZEOF_INT__ 4",
+    "__SIZEOF_LONG_LONG__ 8",
+    "__SIZEOF_POINTER__ 8",
+    "__SIZEOF_PTRDIFF_T__ 8",
+    "__SIZEOF_SHORT__ 2",
+    "__SIZEOF_SIZE_T__ 8",
+    "__SIZE_TYPE__ unsigned long",
+    "__STDC_HOSTED__ 1",
+    "__STDC_NO_COMPLEX__ 1",
+    "__STDC_UTF_16__ 1",
+    "__STDC_UTF_32__ 1",
+    "__STDC_VERSION__ 201112L",
+    "__STDC__ 1",
+    "__USER_LABEL_PREFIX__",
+    "__alignof__ _Alignof",
+    "__amd64 1",
+    "__amd64__ 1",
+    "__const__ const",
+    "__dyibicc__ 1",
+    "__inline__ inline",
+    "__signed__ signed",
+    "__typeof__ typeof",
+    "__volatile__ volatile",
+    "__x86_64 1",
+    "__x86_64__ 1",
 #if X64WIN
-  define_macro("__SIZEOF_LONG__", "4");
-  define_macro("__SIZEOF_LONG_DOUBLE__", "8");
-  define_macro("__cdecl", "");
-  define_macro("__stdcall", "");
-  define_macro("__inline", "");
-  define_macro("__forceinline", "");
-  define_macro("__unaligned", "");
-  define_macro("__alignof", "_Alignof");
-  define_macro("__int8", "char");
-  define_macro("__int16", "short");
-  define_macro("__int32", "int");
-  define_macro("__ptr32", "");  // Possibly wrong and needs to truncate?
-  define_macro("__ptr64", "");
-  define_macro("_M_X64", "100");
-  define_macro("_M_AMD64", "100");
-  define_macro("_AMD64_", "1");
-  define_macro("_WIN32", "1");
-  define_macro("WIN32", "1");
-  define_macro("_WIN64", "1");
-  // Without this, structs like OVERLAPPED don't use anon unions, so most user
-  // code will break.
-  define_macro("_MSC_EXTENSIONS", "1");
-  // VS2008, arbitrarily. Has to be defined to something as a lot of code uses
-  // it to indicate "is_windows", and 2008 was one of my favourites.
-  define_macro("_MSC_VER", "1500");
-  define_macro("_NO_CRT_STDIO_INLINE", "1");
-  define_macro("_CRT_DECLARE_NONSTDC_NAMES", "1");
-  define_macro("__WINT_TYPE__", "unsigned short");
-  define_function_macro("__pragma(_)\n");
-  define_function_macro("__declspec(_)\n");
+    "__SIZEOF_LONG__ 4",
+    "__SIZEOF_LONG_DOUBLE__ 8",
+    "__cdecl",
+    "__stdcall",
+    "__inline",
+    "__forceinline",
+    "__unaligned",
+    "__alignof _Alignof",
+    "__int8 char",
+    "__int16 short",
+    "__int32 int",
+    "__ptr32",  // Possibly wrong and needs to truncate?
+    "__ptr64",
+    "_M_X64 100",
+    "_M_AMD64 100",
+    "_AMD64_ 1",
+    "_WIN32 1",
+    "WIN32 1",
+    "_WIN64 1",
+    // Without this, structs like OVERLAPPED don't use anon unions, so most user
+    // code will break.
+    "_MSC_EXTENSIONS 1",
+    // VS2008, arbitrarily. Has to be defined to something as a lot of code uses
+    // it to indicate "is_windows", and 2008 was one of my favourites.
+    "_MSC_VER 1500",
+    "_NO_CRT_STDIO_INLINE 1",
+    "_CRT_DECLARE_NONSTDC_NAMES 1",
+    "__WINT_TYPE__ unsigned short",
+    "__pragma(_)",
+    "__declspec(_)",
 #else
-  define_macro("__SIZEOF_LONG__", "8");
-  define_macro("__SIZEOF_LONG_DOUBLE__", "16");
-  define_macro("__ELF__", "1");
-  define_macro("linux", "1");
-  define_macro("unix", "1");
-  define_macro("__unix", "1");
-  define_macro("__unix__", "1");
-  define_macro("__linux", "1");
-  define_macro("__linux__", "1");
-  define_macro("__gnu_linux__", "1");
-  (void)define_function_macro;
+    "__SIZEOF_LONG__ 8",
+    "__SIZEOF_LONG_DOUBLE__ 16",
+    "__ELF__ 1",
+    "linux 1",
+    "unix 1",
+    "__unix 1",
+    "__unix__ 1",
+    "__linux 1",
+    "__linux__ 1",
+    "__gnu_linux__ 1",
 #endif
+};
 
-  add_builtin("__FILE__", file_macro);
-  add_builtin("__LINE__", line_macro);
-  add_builtin("__COUNTER__", counter_macro);
-  add_builtin("__TIMESTAMP__", timestamp_macro);
-  add_builtin("__BASE_FILE__", base_file_macro);
+static struct {
+  char* name;
+  macro_handler_fn* fn;
+} builtin_macros[] = {
+    {"__FILE__", file_macro},
+    {"__LINE__", line_macro},
+    {"__COUNTER__", counter_macro},
+    {"__TIMESTAMP__", timestamp_macro},
+    {"__BASE_FILE__", base_file_macro},
+    {"__DATE__", date_macro},
+    {"__TIME__", time_macro},
+};
 
-  time_t now = time(NULL);
-  struct tm* tm = localtime(&now);
-  define_macro("__DATE__", format_date(tm));
-  define_macro("__TIME__", format_time(tm));
+// Copies a body read while building the base layer to the context's heap, where
+// its tokens point into |contents|, the base File's copy of |from|.
+static Token* copy_base_body(Token* body, char* from, char* contents) {
+  int n = 1;
+  for (Token* t = body; t->kind != TK_EOF; t = t->next)
+    ++n;
+  Token* toks = bumpcalloc(n, sizeof(Token), AL_UserContext);
+  Token* t = body;
+  for (int i = 0; i < n; ++i, t = t->next) {
+    assert(t->kind != TK_STR && t->kind != TK_NUM && !t->is_expanded);
+    toks[i] = *t;
+    toks[i].next = i + 1 < n ? &toks[i + 1] : NULL;
+    toks[i].loc = contents + (t->loc - from);
+  }
+  return toks;
+}
+
+static MacroParam* copy_base_params(MacroParam* params) {
+  MacroParam head = {0};
+  MacroParam* cur = &head;
+  for (MacroParam* mp = params; mp; mp = mp->next) {
+    cur = cur->next = bumpcalloc(1, sizeof(MacroParam), AL_UserContext);
+    cur->name = mp->name;
+  }
+  return head.next;
+}
+
+// Builds the context's predefined macros, the base layer under every
+// translation unit's C(macros). They're read like a file of #defines, and then
+// copied out of this TU's heap into the context's, along with the File their
+// tokens point into. Another thread may build them at the same time, in which
+// case the first to finish is kept.
+static File* build_base_macros(void) {
+  int num_macros = (int)(sizeof(predefined_macros) / sizeof(predefined_macros[0]));
+  size_t size = 1;
+  for (int i = 0; i < num_macros; ++i)
+    size += strlen(predefined_macros[i]) + 1;
+  char* buf = bumpcalloc(1, size, AL_Compile);
+  char* p = buf;
+  for (int i = 0; i < num_macros; ++i)
+    p += sprintf(p, "%s\n", predefined_macros[i]);
+
+  File* file = new_file("<built-in>", buf);
+  Token* tok = tokenize(file);
+  int num_builtins = (int)(sizeof(builtin_macros) / sizeof(builtin_macros[0]));
+  Macro** macros = bumpcalloc(num_macros + num_builtins, sizeof(Macro*), AL_Compile);
+  int n = 0;
+  while (tok->kind != TK_EOF)
+    macros[n++] = read_macro_definition(&tok, tok);
+  for (int i = 0; i < num_builtins; ++i)
+    macros[n++] = add_builtin(builtin_macros[i].name, builtin_macros[i].fn);
+  line_no_at(buf);  // Fills in line_starts, so that nothing writes to the copy.
+  C(macros) = (HashMap){0};
+
+  UserContext* uc = user_context;
+  mutex_lock(&uc->lock);
+  File* base = uc->base_macros_file;
+  if (!base) {
+    base = bumpcalloc(1, sizeof(File), AL_UserContext);
+    *base = *file;
+    base->contents = bumpcalloc(1, size, AL_UserContext);
+    memcpy(base->contents, buf, size);
+    base->line_starts = bumpcalloc(file->num_lines, sizeof(int), AL_UserContext);
+    memcpy(base->line_starts, file->line_starts, file->num_lines * sizeof(int));
+
+    for (int i = 0; i < n; ++i) {
+      Macro* m = bumpcalloc(1, sizeof(Macro), AL_UserContext);
+      *m = *macros[i];
+      m->params = copy_base_params(m->params);
+      if (m->body)
+        m->body = copy_base_body(m->body, buf, base->contents);
+      hashmap_put_interned(&uc->base_macros, m->name, m);
+    }
+    uc->base_macros_file = base;
+  }
+  mutex_unlock(&uc->lock);
+  return base;
+}
+
+// Starts the translation unit with only the predefined macros, which are
+// shared with the other TUs rather than defined again for each of them. The TU
+// defines its own in C(macros), shadowing those, and #undef of a predefined one
+// puts undefined_macro in its place.
+IMPLSTATIC void init_macros(void) {
+  UserContext* uc = user_context;
+  mutex_lock(&uc->lock);
+  File* base = uc->base_macros_file;
+  mutex_unlock(&uc->lock);
+  if (!base)
+    base = build_base_macros();
+  add_file(base);
+  C(macros).alloc_lifetime = AL_Temp;
+  C(hidesets).alloc_lifetime = AL_Temp;
 }
 
 typedef enum {
@@ -1164,80 +1688,69 @@ static StringKind get_string_kind(Token* tok) {
   unreachable();
 }
 
-// Concatenate adjacent string literals into a single string literal
-// as per the C spec.
-static void join_adjacent_string_literals(Token* tok) {
-  // First pass: If regular string literals are adjacent to wide
-  // string literals, regular string literals are converted to a wide
-  // type before concatenation. In this pass, we do the conversion.
-  for (Token* tok1 = tok; tok1->kind != TK_EOF;) {
-    if (tok1->kind != TK_STR || tok1->next->kind != TK_STR) {
-      tok1 = tok1->next;
-      continue;
+// Concatenates the string literals from |tok| up to the next token that isn't
+// one into |tok|, as per the C spec, and makes that token the next one.
+static void join_string_literals(Token* tok) {
+  // If regular string literals are adjacent to wide string literals, regular
+  // string literals are converted to a wide type before concatenation.
+  StringKind kind = get_string_kind(tok);
+  Type* basety = tok->lit->ty->base;
+
+  for (Token* t = tok->next; t->kind == TK_STR; t = t->next) {
+    StringKind k = get_string_kind(t);
+    if (kind == STR_NONE) {
+      kind = k;
+      basety = t->lit->ty->base;
+    } else if (k != STR_NONE && kind != k) {
+      error_tok(t, "unsupported non-standard concatenation of string literals");
     }
-
-    StringKind kind = get_string_kind(tok1);
-    Type* basety = tok1->ty->base;
-
-    for (Token* t = tok1->next; t->kind == TK_STR; t = t->next) {
-      StringKind k = get_string_kind(t);
-      if (kind == STR_NONE) {
-        kind = k;
-        basety = t->ty->base;
-      } else if (k != STR_NONE && kind != k) {
-        error_tok(t, "unsupported non-standard concatenation of string literals");
-      }
-    }
-
-    if (basety->size > 1)
-      for (Token* t = tok1; t->kind == TK_STR; t = t->next)
-        if (t->ty->base->size == 1)
-          *t = *tokenize_string_literal(t, basety);
-
-    while (tok1->kind == TK_STR)
-      tok1 = tok1->next;
   }
 
-  // Second pass: concatenate adjacent string literals.
-  for (Token* tok1 = tok; tok1->kind != TK_EOF;) {
-    if (tok1->kind != TK_STR || tok1->next->kind != TK_STR) {
-      tok1 = tok1->next;
-      continue;
-    }
+  if (basety->size > 1)
+    for (Token* t = tok; t->kind == TK_STR; t = t->next)
+      if (t->lit->ty->base->size == 1)
+        *t = *tokenize_string_literal(t, basety);
 
-    Token* tok2 = tok1->next;
-    while (tok2->kind == TK_STR)
-      tok2 = tok2->next;
+  Token* end = tok->next;
+  while (end->kind == TK_STR)
+    end = end->next;
 
-    int len = tok1->ty->array_len;
-    for (Token* t = tok1->next; t != tok2; t = t->next)
-      len = len + t->ty->array_len - 1;
+  int len = tok->lit->ty->array_len;
+  for (Token* t = tok->next; t != end; t = t->next)
+    len = len + t->lit->ty->array_len - 1;
 
-    char* buf = bumpcalloc(tok1->ty->base->size, len, AL_Compile);
+  char* buf = bumpcalloc(tok->lit->ty->base->size, len, AL_Compile);
 
-    int i = 0;
-    for (Token* t = tok1; t != tok2; t = t->next) {
-      memcpy(buf + i, t->str, t->ty->size);
-      i = i + t->ty->size - t->ty->base->size;
-    }
-
-    *tok1 = *copy_token(tok1);
-    tok1->ty = array_of(tok1->ty->base, len);
-    tok1->str = buf;
-    tok1->next = tok2;
-    tok1 = tok2;
+  int i = 0;
+  for (Token* t = tok; t != end; t = t->next) {
+    memcpy(buf + i, t->lit->str, t->lit->ty->size);
+    i = i + t->lit->ty->size - t->lit->ty->base->size;
   }
+
+  // The literal may be shared with other copies of the token.
+  TokenLiteral* lit = bumpcalloc(1, sizeof(TokenLiteral), AL_Compile);
+  lit->ty = array_of(tok->lit->ty->base, len);
+  lit->str = buf;
+  tok->lit = lit;
+  tok->next = end;
 }
 
-// Entry point function of the preprocessor.
+// Entry point function of the preprocessor. The output is converted for the
+// parser and adjacent string literals are joined in one pass, looking ahead only
+// as far as the end of each run of string literals.
 IMPLSTATIC Token* preprocess(Token* tok) {
   tok = preprocess2(tok);
   if (C(cond_incl))
     error_tok(C(cond_incl)->tok, "unterminated conditional directive");
-  convert_pp_tokens(tok);
-  join_adjacent_string_literals(tok);
 
-  for (Token* t = tok; t; t = t->next)
-    t->line_no += t->line_delta;
+  for (Token* t = tok; t->kind != TK_EOF; t = t->next) {
+    if (t->kind == TK_STR && t->next->kind == TK_STR)
+      join_string_literals(t);
+    convert_pp_token(t);
+  }
+
+  // Their entries are in AL_Temp.
+  C(macros) = (HashMap){0};
+  C(hidesets) = (HashMap){0};
   return tok;
 }
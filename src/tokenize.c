@@ -4,22 +4,34 @@
 #define strncasecmp _strnicmp
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define TOKENIZE_SSE2 1
+#include <emmintrin.h>
+#else
+#define TOKENIZE_SSE2 0
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
 #define C(x) compiler_state.tokenize__##x
 
-// Consumes the current token if it matches `op`.
-IMPLSTATIC bool equal(Token* tok, char* op) {
-  return strncmp(tok->loc, op, tok->len) == 0 && op[tok->len] == '\0';
+// Returns true if the current token is the keyword, punctuator, or word `id`.
+IMPLSTATIC bool equal(Token* tok, TokenId id) {
+  return tok->id == id;
 }
 
-// Ensure that the current token is `op`.
-IMPLSTATIC Token* skip(Token* tok, char* op) {
-  if (!equal(tok, op))
-    error_tok(tok, "expected '%s'", op);
+// Ensure that the current token is `id`.
+IMPLSTATIC Token* skip(Token* tok, TokenId id) {
+  if (tok->id != id)
+    error_tok(tok, "expected '%s'", token_id_spelling(id));
   return tok->next;
 }
 
-IMPLSTATIC bool consume(Token** rest, Token* tok, char* str) {
-  if (equal(tok, str)) {
+// Consumes the current token if it is `id`.
+IMPLSTATIC bool consume(Token** rest, Token* tok, TokenId id) {
+  if (tok->id == id) {
     *rest = tok->next;
     return true;
   }
@@ -30,18 +42,138 @@ IMPLSTATIC bool consume(Token** rest, Token* tok, char* str) {
 // Create a new token.
 static Token* new_token(TokenKind kind, char* start, char* end) {
   Token* tok = bumpcalloc(1, sizeof(Token), AL_Compile);
-  tok->kind = kind;
+  tok->kind = (uint8_t)kind;
   tok->loc = start;
   tok->len = (int)(end - start);
-  tok->file = C(current_file);
-  tok->filename = C(current_file)->display_name;
   tok->at_bol = C(at_bol);
   tok->has_space = C(has_space);
 
   C(at_bol) = C(has_space) = false;
+  C(num_tokens)++;
   return tok;
 }
 
+// Gives a TK_NUM or TK_STR token its payload.
+static TokenLiteral* new_literal(Token* tok) {
+  tok->lit = bumpcalloc(1, sizeof(TokenLiteral), AL_Compile);
+  return tok->lit;
+}
+
+//
+// Scanning helpers for the common long runs: blanks, comments, identifiers,
+// and string literal bodies. With SSE2 they classify 16 bytes at a time while
+// the 16 bytes are before the end of the input (see tokenize__end), and
+// finish a byte at a time. Both ways stop at the same place.
+//
+
+static bool is_ascii_ident2(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+         c == '_' || c == '$';
+}
+
+#if TOKENIZE_SSE2
+static bool can_load16(char* p) {
+  return C(end) && C(end) - p >= 16;
+}
+
+static __m128i load16(char* p) {
+  return _mm_loadu_si128((__m128i*)p);
+}
+
+static unsigned match16(__m128i v, char c) {
+  return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+// Bytes in [lo, hi]. Bytes >= 0x80 compare as negative, so are never in an
+// ASCII range.
+static __m128i in_range16(__m128i v, char lo, char hi) {
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((char)(lo - 1))),
+                       _mm_cmplt_epi8(v, _mm_set1_epi8((char)(hi + 1))));
+}
+
+static int first_bit(unsigned mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long idx;
+  _BitScanForward(&idx, mask);
+  return (int)idx;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+// Skips spaces and tabs.
+static char* skip_blanks(char* p) {
+#if TOKENIZE_SSE2
+  while (can_load16(p)) {
+    __m128i v = load16(p);
+    unsigned blank = match16(v, ' ') | match16(v, '\t');
+    if (blank != 0xffff)
+      return p + first_bit(~blank);
+    p += 16;
+  }
+#endif
+  while (*p == ' ' || *p == '\t')
+    p++;
+  return p;
+}
+
+// Returns the end of a line comment, the following newline or the end of the
+// input.
+static char* line_comment_end(char* p) {
+#if TOKENIZE_SSE2
+  while (can_load16(p)) {
+    unsigned nl = match16(load16(p), '\n');
+    if (nl)
+      return p + first_bit(nl);
+    p += 16;
+  }
+#endif
+  while (*p != '\n' && *p)
+    p++;
+  return p;
+}
+
+// Returns the closing "*/" of a block comment that starts at p, or NULL if it
+// isn't closed.
+static char* block_comment_end(char* p) {
+#if TOKENIZE_SSE2
+  while (can_load16(p)) {
+    for (unsigned star = match16(load16(p), '*'); star; star &= star - 1) {
+      int i = first_bit(star);
+      if (p[i + 1] == '/')
+        return p + i;
+    }
+    p += 16;
+  }
+#endif
+  for (; *p; p++) {
+    if (p[0] == '*' && p[1] == '/')
+      return p;
+  }
+  return NULL;
+}
+
+// Skips the ASCII characters that may continue an identifier.
+static char* skip_ascii_ident(char* p) {
+#if TOKENIZE_SSE2
+  while (can_load16(p)) {
+    __m128i v = load16(p);
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i ident = _mm_or_si128(in_range16(lower, 'a', 'z'), in_range16(v, '0', '9'));
+    ident = _mm_or_si128(ident, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    ident = _mm_or_si128(ident, _mm_cmpeq_epi8(v, _mm_set1_epi8('$')));
+    unsigned mask = (unsigned)_mm_movemask_epi8(ident);
+    if (mask != 0xffff)
+      return p + first_bit(~mask);
+    p += 16;
+  }
+#endif
+  while (is_ascii_ident2(*p))
+    p++;
+  return p;
+}
+
 static bool startswith(char* p, char* q) {
   return strncmp(p, q, strlen(q)) == 0;
 }
@@ -50,10 +182,20 @@ static bool startswith(char* p, char* q) {
 // If p does not point to a valid identifier, 0 is returned.
 static int read_ident(char* start) {
   char* p = start;
-  uint32_t c = decode_utf8(&p, p);
+  uint32_t c;
 
-  if (!is_ident1(c))
-    return 0;
+  // Most identifiers are all ASCII, and don't need decode_utf8().
+  if ((unsigned char)*p < 0x80) {
+    if (!is_ascii_ident2(*p) || (*p >= '0' && *p <= '9'))
+      return 0;
+    p = skip_ascii_ident(p + 1);
+    if ((unsigned char)*p < 0x80)
+      return (int)(p - start);
+  } else {
+    c = decode_utf8(&p, p);
+    if (!is_ident1(c))
+      return 0;
+  }
 
   for (;;) {
     char* q;
@@ -72,79 +214,12 @@ static int from_hex(char c) {
   return c - 'A' + 10;
 }
 
-// Read a punctuator token from p and returns its length.
-static int read_punct(char* p) {
-  static char* kw[] = {
-      "<<=", ">>=", "...", "==", "!=", "<=", ">=", "->", "+=", "-=", "*=", "/=",
-      "++",  "--",  "%=",  "&=", "|=", "^=", "&&", "||", "<<", ">>", "##",
-  };
-
-  for (size_t i = 0; i < sizeof(kw) / sizeof(*kw); i++)
-    if (startswith(p, kw[i]))
-      return (int)strlen(kw[i]);
-
-  return ispunct(*p) ? 1 : 0;
-}
-
 static bool is_keyword(Token* tok) {
-  if (C(keyword_map).capacity == 0) {
-    static char* kw[] = {
-      "return",
-      "if",
-      "else",
-      "for",
-      "while",
-      "int",
-      "sizeof",
-      "char",
-      "struct",
-      "union",
-      "short",
-      "long",
-      "void",
-      "typedef",
-      "_Bool",
-      "enum",
-      "static",
-      "goto",
-      "break",
-      "continue",
-      "switch",
-      "case",
-      "default",
-      "extern",
-      "_Alignof",
-      "_Alignas",
-      "do",
-      "signed",
-      "unsigned",
-      "const",
-      "volatile",
-      "auto",
-      "register",
-      "restrict",
-      "__restrict",
-      "__restrict__",
-      "_Noreturn",
-      "float",
-      "double",
-      "typeof",
-      "asm",
-      "_Thread_local",
-      "__thread",
-      "_Atomic",
-      "__attribute__",
-
-#if X64WIN
-      "__int64",
+#if !X64WIN
+  if (tok->id == KW___INT64)
+    return false;
 #endif
-    };
-
-    for (size_t i = 0; i < sizeof(kw) / sizeof(*kw); i++)
-      hashmap_put(&C(keyword_map), kw[i], (void*)1);
-  }
-
-  return hashmap_get2(&C(keyword_map), tok->loc, tok->len);
+  return tok->id >= KW_FIRST && tok->id <= KW_LAST;
 }
 
 static int read_escaped_char(char** new_pos, char* p) {
@@ -212,6 +287,20 @@ static int read_escaped_char(char** new_pos, char* p) {
 // Find a closing double-quote.
 static char* string_literal_end(char* p) {
   char* start = p;
+#if TOKENIZE_SSE2
+  while (can_load16(p)) {
+    __m128i v = load16(p);
+    unsigned stop = match16(v, '"') | match16(v, '\\') | match16(v, '\n');
+    if (!stop) {
+      p += 16;
+      continue;
+    }
+    p += first_bit(stop);
+    if (*p != '\\')
+      break;
+    p += 2;
+  }
+#endif
   for (; *p != '"'; p++) {
     if (*p == '\n' || *p == '\0')
       error_at(start, "unclosed string literal");
@@ -234,8 +323,9 @@ static Token* read_string_literal(char* start, char* quote) {
   }
 
   Token* tok = new_token(TK_STR, start, end + 1);
-  tok->ty = array_of(ty_char, len + 1);
-  tok->str = buf;
+  TokenLiteral* lit = new_literal(tok);
+  lit->ty = array_of(ty_char, len + 1);
+  lit->str = buf;
   return tok;
 }
 
@@ -270,8 +360,9 @@ static Token* read_utf16_string_literal(char* start, char* quote) {
   }
 
   Token* tok = new_token(TK_STR, start, end + 1);
-  tok->ty = array_of(ty_ushort, len + 1);
-  tok->str = (char*)buf;
+  TokenLiteral* lit = new_literal(tok);
+  lit->ty = array_of(ty_ushort, len + 1);
+  lit->str = (char*)buf;
   return tok;
 }
 
@@ -292,8 +383,9 @@ static Token* read_utf32_string_literal(char* start, char* quote, Type* ty) {
   }
 
   Token* tok = new_token(TK_STR, start, end + 1);
-  tok->ty = array_of(ty, len + 1);
-  tok->str = (char*)buf;
+  TokenLiteral* lit = new_literal(tok);
+  lit->ty = array_of(ty, len + 1);
+  lit->str = (char*)buf;
   return tok;
 }
 
@@ -313,13 +405,16 @@ static Token* read_char_literal(char* start, char* quote, Type* ty) {
     error_at(p, "unclosed char literal");
 
   Token* tok = new_token(TK_NUM, start, end + 1);
-  tok->val = c;
-  tok->ty = ty;
+  TokenLiteral* lit = new_literal(tok);
+  lit->val = c;
+  lit->ty = ty;
   return tok;
 }
 
-static bool convert_pp_int(Token* tok) {
-  char* p = tok->loc;
+// Reads the integer constant [loc, loc + len) and infers its type. Returns false
+// if it isn't one, which for a pp-number means it's a floating point constant.
+IMPLSTATIC bool read_int_literal(char* loc, int len, int64_t* val_out, Type** ty_out) {
+  char* p = loc;
 
   // Read a binary, octal, decimal or hexadecimal number.
   int base = 10;
@@ -358,7 +453,7 @@ static bool convert_pp_int(Token* tok) {
     u = true;
   }
 
-  if (p != tok->loc + tok->len)
+  if (p != loc + len)
     return false;
 
   // Infer a type.
@@ -389,9 +484,21 @@ static bool convert_pp_int(Token* tok) {
       ty = ty_int;
   }
 
+  *val_out = val;
+  *ty_out = ty;
+  return true;
+}
+
+static bool convert_pp_int(Token* tok) {
+  int64_t val;
+  Type* ty;
+  if (!read_int_literal(tok->loc, tok->len, &val, &ty))
+    return false;
+
   tok->kind = TK_NUM;
-  tok->val = val;
-  tok->ty = ty;
+  TokenLiteral* lit = new_literal(tok);
+  lit->val = val;
+  lit->ty = ty;
   return true;
 }
 
@@ -426,32 +533,21 @@ static void convert_pp_number(Token* tok) {
     error_tok(tok, "invalid numeric constant");
 
   tok->kind = TK_NUM;
-  tok->fval = val;
-  tok->ty = ty;
+  TokenLiteral* lit = new_literal(tok);
+  lit->fval = val;
+  lit->ty = ty;
 }
 
-IMPLSTATIC void convert_pp_tokens(Token* tok) {
-  for (Token* t = tok; t->kind != TK_EOF; t = t->next) {
-    if (t->kind == TK_IDENT && is_keyword(t))
-      t->kind = TK_KEYWORD;
-    else if (t->kind == TK_PP_NUM)
-      convert_pp_number(t);
-  }
+IMPLSTATIC void convert_pp_token(Token* tok) {
+  if (tok->kind == TK_IDENT && is_keyword(tok))
+    tok->kind = TK_KEYWORD;
+  else if (tok->kind == TK_PP_NUM)
+    convert_pp_number(tok);
 }
 
-// Initialize line info for all tokens.
-static void add_line_numbers(Token* tok) {
-  char* p = C(current_file)->contents;
-  int n = 1;
-
-  do {
-    if (p == tok->loc) {
-      tok->line_no = n;
-      tok = tok->next;
-    }
-    if (*p == '\n')
-      n++;
-  } while (*p++);
+IMPLSTATIC void convert_pp_tokens(Token* tok) {
+  for (Token* t = tok; t->kind != TK_EOF; t = t->next)
+    convert_pp_token(t);
 }
 
 Token* tokenize_string_literal(Token* tok, Type* basety) {
@@ -464,30 +560,104 @@ Token* tokenize_string_literal(Token* tok, Type* basety) {
   return t;
 }
 
-// Tokenize a given string and returns new tokens.
-Token* tokenize(File* file) {
+// A logical line that has a backslash-newline or a \u or \U escape in it, and
+// is tokenized from a spliced copy rather than from the file.
+typedef struct SplicedLine {
+  char* start;     // Start of its first physical line in the file.
+  char* end;       // The newline that ends it in the file, or the end of the file.
+  int line_no;     // Of |start|.
+  char* copy;      // The spliced line in the copy.
+  char* copy_end;  // The newline after it in the copy.
+} SplicedLine;
+
+// Where tokenize_spliced() is in a file with spliced lines: it reads the file
+// up to the next spliced line, then that line's copy, then the file again from
+// the end of the line.
+typedef struct SpliceCursor {
+  SplicedLine* lines;
+  int num_lines;
+  int i;  // The next spliced line, or the one whose copy is being read.
+  bool in_copy;
+  char* file_end;  // For tokenize__end in each part.
+  char* copy_end;
+} SpliceCursor;
+
+// Returns where the part of the input being read ends, or NULL if it's the
+// rest of the file.
+static char* splice_part_end(SpliceCursor* sc) {
+  if (sc->in_copy)
+    return sc->lines[sc->i].copy_end;
+  return sc->i < sc->num_lines ? sc->lines[sc->i].start : NULL;
+}
+
+// Moves on to the next part of the input, and returns where it starts.
+static char* splice_next_part(SpliceCursor* sc) {
+  SplicedLine* line = &sc->lines[sc->i];
+  sc->in_copy = !sc->in_copy;
+  if (sc->in_copy) {
+    C(end) = sc->copy_end;
+    return line->copy;
+  }
+  C(end) = sc->file_end;
+  sc->i++;
+  return line->end;
+}
+
+// Returns the end of a block comment that isn't closed in the part of the
+// input that it starts in, having moved on to the part that it's closed in.
+// Every part ends in a newline, so "*/" is never split between two.
+static char* spliced_block_comment_end(SpliceCursor* sc) {
+  while (splice_part_end(sc)) {
+    char* p = splice_next_part(sc);
+    char* end = splice_part_end(sc);
+    char* q = block_comment_end(p);
+    if (q && (!end || q < end))
+      return q;
+  }
+  return NULL;
+}
+
+// Tokenizes a file, reading the lines in |lines| from its spliced copy.
+static Token* tokenize_spliced(File* file, SplicedLine* lines, int num_lines) {
+  uint64_t start_time = get_time_ns();
   C(current_file) = file;
 
   char* p = file->contents;
   Token head = {0};
   Token* cur = &head;
 
+  C(end) = p + strlen(p);
   C(at_bol) = true;
   C(has_space) = false;
 
+  SpliceCursor sc = {lines, num_lines, 0, false, C(end), NULL};
+  if (file->spliced)
+    sc.copy_end = file->spliced->contents + strlen(file->spliced->contents);
+  char* part_end = splice_part_end(&sc);
+
   while (*p) {
+    // Move between the file and the copies of its spliced lines. Every token
+    // ends before the newline that ends a part.
+    if (p == part_end) {
+      p = splice_next_part(&sc);
+      part_end = splice_part_end(&sc);
+      continue;
+    }
+
     // Skip line comments.
     if (p[0] == '/' && p[1] == '/') {
-      p += 2;
-      while (*p != '\n')
-        p++;
+      p = line_comment_end(p + 2);
       C(has_space) = true;
       continue;
     }
 
     // Skip block comments.
     if (p[0] == '/' && p[1] == '*') {
-      char* q = strstr(p + 2, "*/");
+      char* q = block_comment_end(p + 2);
+      if (part_end && (!q || q >= part_end)) {
+        q = spliced_block_comment_end(&sc);
+        part_end = splice_part_end(&sc);
+      }
       if (!q)
         error_at(p, "unclosed block comment");
       p = q + 2;
@@ -505,7 +675,7 @@ Token* tokenize(File* file) {
 
     // Skip whitespace characters.
     if (isspace((unsigned char)*p)) {
-      p++;
+      p = skip_blanks(p + 1);
       C(has_space) = true;
       continue;
     }
@@ -563,7 +733,7 @@ Token* tokenize(File* file) {
     // Character literal
     if (*p == '\'') {
       cur = cur->next = read_char_literal(p, p, ty_int);
-      cur->val = (char)cur->val;
+      cur->lit->val = (char)cur->lit->val;
       p += cur->len;
       continue;
     }
@@ -571,7 +741,7 @@ Token* tokenize(File* file) {
     // UTF-16 character literal
     if (startswith(p, "u'")) {
       cur = cur->next = read_char_literal(p, p + 1, ty_ushort);
-      cur->val &= 0xffff;
+      cur->lit->val &= 0xffff;
       p += cur->len;
       continue;
     }
@@ -594,14 +764,18 @@ Token* tokenize(File* file) {
     int ident_len = read_ident(p);
     if (ident_len) {
       cur = cur->next = new_token(TK_IDENT, p, p + ident_len);
+      cur->ident = intern2(p, ident_len);
+      cur->id = (uint16_t)word_token_id(p, ident_len);
       p += cur->len;
       continue;
     }
 
     // Punctuators
-    int punct_len = read_punct(p);
+    TokenId punct_id;
+    int punct_len = read_punct(p, &punct_id);
     if (punct_len) {
       cur = cur->next = new_token(TK_PUNCT, p, p + punct_len);
+      cur->id = (uint16_t)punct_id;
       p += cur->len;
       continue;
     }
@@ -610,62 +784,202 @@ Token* tokenize(File* file) {
   }
 
   cur = cur->next = new_token(TK_EOF, p, p);
-  add_line_numbers(head.next);
+  C(end) = NULL;
+  C(time_ns) += get_time_ns() - start_time;
   return head.next;
 }
 
+// Tokenize a given string and returns new tokens.
+Token* tokenize(File* file) {
+  return tokenize_spliced(file, NULL, 0);
+}
+
+// Every file of the TU is kept in C(file_runs), so that token_file() can find
+// the one a token points into. Each run is a list of files sorted by contents,
+// and the runs are sorted by the contents of their first file. Heap chunks
+// hand out increasing addresses, so a new file almost always goes at the end
+// of the run before it; a run is only split when a file's contents land in the
+// middle of it. (Keeping a single sorted array instead means moving most of it
+// each time a new chunk is mapped below the previous ones.)
+
+static void file_run_push(FileRun* run, File* file) {
+  if (run->len == run->capacity) {
+    int capacity = run->capacity ? run->capacity * 2 : 16;
+    run->files = bumplamerealloc(run->files, sizeof(File*) * run->capacity,
+                                 sizeof(File*) * capacity, AL_Compile);
+    run->capacity = capacity;
+  }
+  run->files[run->len++] = file;
+}
+
+// Inserts an empty run at index i. This may move the other runs.
+static FileRun* insert_file_run(int i) {
+  if (C(num_file_runs) == C(file_runs_capacity)) {
+    int capacity = C(file_runs_capacity) ? C(file_runs_capacity) * 2 : 16;
+    C(file_runs) = bumplamerealloc(C(file_runs), sizeof(FileRun) * C(file_runs_capacity),
+                                   sizeof(FileRun) * capacity, AL_Compile);
+    C(file_runs_capacity) = capacity;
+  }
+  memmove(&C(file_runs)[i + 1], &C(file_runs)[i], sizeof(FileRun) * (C(num_file_runs) - i));
+  C(num_file_runs)++;
+  memset(&C(file_runs)[i], 0, sizeof(FileRun));
+  return &C(file_runs)[i];
+}
+
+// Returns the index of the last run whose first file starts at or before p, or
+// -1 if there isn't one.
+static int find_file_run(char* p) {
+  int lo = -1;
+  int hi = C(num_file_runs);
+  while (hi - lo > 1) {
+    int mid = (lo + hi) / 2;
+    if (C(file_runs)[mid].files[0]->contents <= p)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Returns the index of the last file in the run that starts at or before p.
+static int find_in_file_run(FileRun* run, char* p) {
+  int lo = 0;
+  int hi = run->len;
+  while (hi - lo > 1) {
+    int mid = (lo + hi) / 2;
+    if (run->files[mid]->contents <= p)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// A header that's included again from the header cache has the same contents
+// as before, and the newer File takes the older one's place. Files that aren't
+// allocated by the TU, like the predefined macros' (see init_macros()), are
+// added directly.
+IMPLSTATIC void add_file(File* file) {
+  int r = find_file_run(file->contents);
+  if (r < 0) {
+    file_run_push(insert_file_run(0), file);
+    return;
+  }
+
+  FileRun* run = &C(file_runs)[r];
+  int i = find_in_file_run(run, file->contents);
+  if (run->files[i]->contents == file->contents) {
+    run->files[i] = file;
+    return;
+  }
+
+  if (i + 1 < run->len) {
+    FileRun* tail = insert_file_run(r + 1);
+    run = &C(file_runs)[r];
+    for (int j = i + 1; j < run->len; ++j)
+      file_run_push(tail, run->files[j]);
+    run->len = i + 1;
+  }
+  file_run_push(run, file);
+}
+
 IMPLSTATIC File* new_file(char* name, char* contents) {
   File* file = bumpcalloc(1, sizeof(File), AL_Compile);
   file->name = name;
   file->display_name = name;
   file->contents = contents;
+  add_file(file);
   return file;
 }
 
-// Replaces \r or \r\n with \n.
-static void canonicalize_newline(char* p) {
-  int i = 0, j = 0;
+// Returns the file whose contents loc points into, which is a spliced copy if
+// loc is in a spliced line (see tokenize_filecontents()).
+IMPLSTATIC File* file_at(char* loc) {
+  FileRun* run = &C(file_runs)[find_file_run(loc)];
+  return run->files[find_in_file_run(run, loc)];
+}
 
-  while (p[i]) {
-    if (p[i] == '\r' && p[i + 1] == '\n') {
-      i += 2;
-      p[j++] = '\n';
-    } else if (p[i] == '\r') {
-      i++;
-      p[j++] = '\n';
-    } else {
-      p[j++] = p[i++];
+// Returns the file that a token is from.
+IMPLSTATIC File* token_file(Token* tok) {
+  File* file = file_at(tok->loc);
+  return file->parent ? file->parent : file;
+}
+
+// Returns the physical line number of a location in one of the TU's files.
+IMPLSTATIC int line_no_at(char* loc) {
+  File* file = file_at(loc);
+  if (!file->line_starts) {
+    int n = 1;
+    for (char* p = file->contents; (p = strchr(p, '\n')); p++)
+      n++;
+    file->line_starts = bumpcalloc(n, sizeof(int), AL_Compile);
+    file->num_lines = 0;
+    char* p = file->contents;
+    for (;;) {
+      file->line_starts[file->num_lines++] = (int)(p - file->contents);
+      p = strchr(p, '\n');
+      if (!p)
+        break;
+      p++;
     }
   }
 
-  p[j] = '\0';
+  // The last line that starts at or before loc.
+  int offset = (int)(loc - file->contents);
+  int lo = 0;
+  int hi = file->num_lines;
+  while (hi - lo > 1) {
+    int mid = (lo + hi) / 2;
+    if (file->line_starts[mid] <= offset)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo + 1;
+}
+
+// Returns the physical line number of a token.
+IMPLSTATIC int token_line_no(Token* tok) {
+  return line_no_at(tok->loc);
 }
 
-// Removes backslashes followed by a newline.
-static void remove_backslash_newline(char* p) {
-  int i = 0, j = 0;
+// Replaces \r or \r\n with \n, and removes backslashes followed by a newline,
+// in a single pass. Returns whether the result has any \u or \U escapes, that
+// need convert_universal_chars().
+static bool splice_lines(char* p) {
+  // The text before the first \r or backslash doesn't move.
+  char* start = p;
+  p += strcspn(p, "\r\\");
+  char* q = p;
 
   // We want to keep the number of newline characters so that
   // the logical line number matches the physical one.
   // This counter maintain the number of newlines we have removed.
   int n = 0;
+  bool has_ucn = false;
 
-  while (p[i]) {
-    if (p[i] == '\\' && p[i + 1] == '\n') {
-      i += 2;
+  while (*p) {
+    char c = *p;
+    if (c == '\\' && (p[1] == '\n' || p[1] == '\r')) {
+      p += (p[1] == '\r' && p[2] == '\n') ? 3 : 2;
       n++;
-    } else if (p[i] == '\n') {
-      p[j++] = p[i++];
+    } else if (c == '\n' || c == '\r') {
+      p += (c == '\r' && p[1] == '\n') ? 2 : 1;
+      *q++ = '\n';
       for (; n > 0; n--)
-        p[j++] = '\n';
+        *q++ = '\n';
     } else {
-      p[j++] = p[i++];
+      if ((c == 'u' || c == 'U') && q > start && q[-1] == '\\')
+        has_ucn = true;
+      *q++ = c;
+      p++;
     }
   }
 
   for (; n > 0; n--)
-    p[j++] = '\n';
-  p[j] = '\0';
+    *q++ = '\n';
+  *q = '\0';
+  return has_ucn;
 }
 
 static uint32_t read_universal_char(char* p, int len) {
@@ -710,7 +1024,95 @@ static void convert_universal_chars(char* p) {
   *q = '\0';
 }
 
+// Collects the logical lines that have to be spliced, from the first
+// backslash in text, p, on. Returns the number of them.
+static int find_spliced_lines(char* text, char* p, SplicedLine** lines) {
+  SplicedLine* arr = NULL;
+  int len = 0;
+  int capacity = 0;
+  int line_no = 1;
+  char* counted = text;
+
+  while ((p = strchr(p, '\\'))) {
+    if (p[1] != '\n' && p[1] != 'u' && p[1] != 'U') {
+      p++;
+      continue;
+    }
+
+    char* start = p;
+    while (start > text && start[-1] != '\n')
+      start--;
+    for (char* nl; (nl = memchr(counted, '\n', start - counted)); counted = nl + 1)
+      line_no++;
+    counted = start;
+
+    char* end = p;
+    do {
+      end = strchr(end + 1, '\n');
+    } while (end && end[-1] == '\\');
+    if (!end)
+      end = p + strlen(p);
+
+    if (len == capacity) {
+      int new_capacity = capacity ? capacity * 2 : 16;
+      arr = bumplamerealloc(arr, sizeof(SplicedLine) * capacity,
+                            sizeof(SplicedLine) * new_capacity, AL_Compile);
+      capacity = new_capacity;
+    }
+    arr[len++] = (SplicedLine){start, end, line_no};
+
+    if (!*end)
+      break;
+    p = end + 1;
+  }
+
+  *lines = arr;
+  return len;
+}
+
+// Makes the spliced copy of a file's lines. Each line is put on the line of
+// the copy that it starts on in the file, so that its tokens have the right
+// line numbers, and is followed by a newline.
+static void splice_copy(File* file, SplicedLine* lines, int num_lines) {
+  size_t size = lines[num_lines - 1].line_no + 1;
+  for (int i = 0; i < num_lines; ++i)
+    size += lines[i].end - lines[i].start;
+
+  char* buf = bumpcalloc(1, size, AL_Compile);
+  char* q = buf;
+  int line_no = 1;
+  for (int i = 0; i < num_lines; ++i) {
+    SplicedLine* line = &lines[i];
+    for (; line_no < line->line_no; ++line_no)
+      *q++ = '\n';
+
+    line->copy = q;
+    for (char* p = line->start; p < line->end; ++p) {
+      if (p[0] == '\\' && p[1] == '\n')
+        p++;
+      else
+        *q++ = *p;
+    }
+    *q = '\0';
+    convert_universal_chars(line->copy);
+    line->copy_end = q = line->copy + strlen(line->copy);
+  }
+  *q = '\n';
+
+  File* copy = new_file(file->name, buf);
+  copy->parent = file;
+  file->spliced = copy;
+}
+
+// The contents aren't modified, so can be a mapped file: logical lines that
+// have to be spliced are tokenized from a copy of just those lines. Text with
+// \r line endings is copied and spliced as a whole.
 Token* tokenize_filecontents(char* path, char* p) {
+  // Every file that goes into the translation unit is recorded, so that the
+  // compiled result can be reused as long as none of them change.
+  filehasharray_push(&C(loaded_files), (FileHash){intern(path), hash_bytes(p, strlen(p))},
+                     AL_Compile);
+
   // UTF-8 texts may start with a 3-byte "BOM" marker sequence.
   // If exists, just skip them because they are useless bytes.
   // (It is actually not recommended to add BOM markers to UTF-8
@@ -718,17 +1120,454 @@ Token* tokenize_filecontents(char* path, char* p) {
   if (!memcmp(p, "\xef\xbb\xbf", 3))
     p += 3;
 
-  canonicalize_newline(p);
-  remove_backslash_newline(p);
-  convert_universal_chars(p);
+  char* first = p + strcspn(p, "\r\\");
+  if (!*first)
+    return tokenize(new_file(path, p));
 
+  if (*first == '\r' || strchr(first, '\r')) {
+    p = bumpstrdup(p, AL_Compile);
+    if (splice_lines(p))
+      convert_universal_chars(p);
+    return tokenize(new_file(path, p));
+  }
+
+  SplicedLine* lines;
+  int num_lines = find_spliced_lines(p, first, &lines);
   File* file = new_file(path, p);
-  return tokenize(file);
+  if (num_lines)
+    splice_copy(file, lines, num_lines);
+  return tokenize_spliced(file, lines, num_lines);
+}
+
+// Keeps a loaded file until the end of the compile, for the translation
+// unit's tokens to point into, and returns its contents.
+static char* keep_source(LoadedFile* lf) {
+  LoadedFile* kept = bumpcalloc(1, sizeof(LoadedFile), AL_Compile);
+  *kept = *lf;
+  kept->next = C(sources);
+  C(sources) = kept;
+  return kept->contents;
+}
+
+// Unloads the files that the translation unit was tokenized from. Called at
+// the end of a compile, before AL_Compile is reset.
+IMPLSTATIC void tokenize_free(void) {
+  for (LoadedFile* lf = C(sources); lf;) {
+    LoadedFile* next = lf->next;
+    unload_file(lf);
+    lf = next;
+  }
+  C(sources) = NULL;
 }
 
 Token* tokenize_file(char* path) {
-  char* p = read_file_wrap_user(path, AL_Compile);
-  if (!p)
+  LoadedFile lf;
+  if (!load_file(path, &lf))
+    return NULL;
+  return tokenize_filecontents(path, keep_source(&lf));
+}
+
+// A #if, #ifdef, #ifndef, #elif or #else line in a cached header. Tokens are
+// copied into a translation unit up to the end of the next one of these, and
+// from there only once the preprocessor gets past it. If it skips the group
+// instead, it goes straight to |skip_to| without the tokens in between being
+// copied or looked at.
+typedef struct CachedCond {
+  int line_end;  // Index of the first token of the next line.
+  int skip_to;   // Index of the `#` that skip_cond_incl() would stop at.
+} CachedCond;
+
+// A header's tokens as produced by tokenize_filecontents(), kept for the life
+// of the context so that other translation units (and later updates, if the
+// file hasn't changed) don't have to read and tokenize it again.
+//
+// The base types are per-thread, so instead of a Type the literal tokens
+// record which base type they had in |literal_types|, and string literals
+// their length in |val|. Everything is in a single allocation that's
+// read-only once created.
+struct CachedHeader {
+  CachedHeader* next;      // In UserContext.cached_headers.
+  uint64_t hash;           // Of the file as read, as recorded in loaded_files.
+  uint64_t checked;        // Generation in which |hash| was last found current.
+  bool replaced;           // Freed at the start of the next update.
+  int num_tokens;          // Including the final TK_EOF.
+  int num_literals;        // Tokens that have a TokenLiteral.
+  int num_conds;           // Entries in |conds|.
+  Token* tokens;           // next isn't set, and lit points into |literals|.
+  TokenLiteral* literals;  // ty isn't set.
+  uint8_t* literal_types;  // One per literal.
+  CachedCond* conds;       // In order.
+  char* include_guard;     // Interned, or NULL.
+  char* contents;          // After canonicalization, that tokens point into.
+  char* spliced;           // The copy of its spliced lines, or NULL.
+};
+
+// Where a TK_LAZY token stands in for the rest of a cached header, in one
+// include of it.
+struct LazyTokens {
+  CachedHeader* ch;
+  int start;    // Index of the first token it stands for.
+  int skip_to;  // Of the conditional line it follows.
+  Token* rest;  // Follows the header.
+};
+
+enum { LT_Char, LT_UShort, LT_Int, LT_UInt };
+
+static uint8_t literal_type_of(Type* ty) {
+  if (ty == ty_char)
+    return LT_Char;
+  if (ty == ty_ushort)
+    return LT_UShort;
+  if (ty == ty_int)
+    return LT_Int;
+  if (ty == ty_uint)
+    return LT_UInt;
+  unreachable();
+}
+
+static Type* literal_type(uint8_t lt) {
+  switch (lt) {
+    case LT_Char:
+      return ty_char;
+    case LT_UShort:
+      return ty_ushort;
+    case LT_Int:
+      return ty_int;
+    case LT_UInt:
+      return ty_uint;
+  }
+  unreachable();
+}
+
+// A `#` that starts a line that CachedCond records.
+static bool is_cond_hash(Token* tok) {
+  if (!tok->at_bol || !equal(tok, PU_HASH))
+    return false;
+  TokenId id = tok->next->id;
+  return id == KW_IF || id == ID_IFDEF || id == ID_IFNDEF || id == ID_ELIF || id == KW_ELSE;
+}
+
+// Fills in |conds|, following conditional groups as skip_cond_incl() does. A
+// group that isn't closed in the header is skipped to its end, and from there
+// the preprocessor goes on skipping what follows the header.
+static void find_conds(CachedHeader* ch) {
+  Token* toks = ch->tokens;
+  int eof = ch->num_tokens - 1;
+
+  // The last branch line of each open group, with a group for the lines that
+  // aren't in one.
+  int* open = malloc((ch->num_conds + 1) * sizeof(int));
+  int depth = 1;
+  open[0] = -1;
+  int n = 0;
+  for (int i = 0; i < eof; ++i) {
+    Token* t = &toks[i];
+    if (!t->at_bol || !equal(t, PU_HASH))
+      continue;
+    TokenId id = toks[i + 1].id;
+    bool opens = id == KW_IF || id == ID_IFDEF || id == ID_IFNDEF;
+    bool branch = id == ID_ELIF || id == KW_ELSE;
+    if ((branch || id == ID_ENDIF) && open[depth - 1] >= 0)
+      ch->conds[open[depth - 1]].skip_to = i;
+    if (id == ID_ENDIF) {
+      if (depth > 1)
+        --depth;
+      else
+        open[0] = -1;
+    }
+    if (!opens && !branch)
+      continue;
+
+    int line_end = i + 1;
+    while (line_end < eof && !toks[line_end].at_bol)
+      ++line_end;
+    ch->conds[n] = (CachedCond){line_end, eof};
+    if (opens)
+      open[depth++] = n;
+    else
+      open[depth - 1] = n;
+    ++n;
+  }
+  assert(n == ch->num_conds);
+  free(open);
+}
+
+// Returns the macro that guards the whole header, as in
+//
+//   #ifndef FOO_H
+//   #define FOO_H
+//   ...
+//   #endif
+//
+// so that later includes can skip it without opening it, or NULL.
+static char* find_include_guard(CachedHeader* ch) {
+  Token* t = ch->tokens;
+  int eof = ch->num_tokens - 1;
+  if (ch->num_conds == 0 || ch->conds[0].line_end != 3 || !equal(&t[1], ID_IFNDEF) ||
+      t[2].kind != TK_IDENT)
+    return NULL;
+  if (eof < 6 || !t[3].at_bol || !equal(&t[3], PU_HASH) || !equal(&t[4], ID_DEFINE) ||
+      t[5].kind != TK_IDENT || t[5].ident != t[2].ident)
     return NULL;
-  return tokenize_filecontents(path, p);
+  if (ch->conds[0].skip_to != eof - 2 || !equal(&t[eof - 1], ID_ENDIF))
+    return NULL;
+  return t[2].ident;
+}
+
+static CachedHeader* cached_header_new(Token* tok, uint64_t hash) {
+  File* file = C(current_file);
+  char* contents = file->contents;
+  size_t contents_size = strlen(contents) + 1;
+  char* spliced = file->spliced ? file->spliced->contents : NULL;
+  size_t spliced_size = spliced ? strlen(spliced) + 1 : 0;
+
+  int num_tokens = 0;
+  int num_literals = 0;
+  int num_conds = 0;
+  size_t strs_size = 0;
+  for (Token* t = tok;; t = t->next) {
+    ++num_tokens;
+    if (t->kind == TK_STR)
+      strs_size += align_to_u(t->lit->ty->size, 8);
+    if (t->kind == TK_STR || t->kind == TK_NUM)
+      ++num_literals;
+    if (t->kind == TK_EOF)
+      break;
+    if (is_cond_hash(t))
+      ++num_conds;
+  }
+
+  // The literals come first, as they need the most alignment (see BUMP_ALIGNMENT).
+  size_t header_size = align_to_u(sizeof(CachedHeader), 16);
+  CachedHeader* ch = malloc(header_size + num_literals * sizeof(TokenLiteral) +
+                            num_tokens * sizeof(Token) + num_conds * sizeof(CachedCond) +
+                            strs_size + num_literals + contents_size + spliced_size);
+  memset(ch, 0, sizeof(CachedHeader));
+  ch->hash = hash;
+  ch->num_tokens = num_tokens;
+  ch->num_literals = num_literals;
+  ch->num_conds = num_conds;
+  ch->literals = (TokenLiteral*)((char*)ch + header_size);
+  ch->tokens = (Token*)(ch->literals + num_literals);
+  ch->conds = (CachedCond*)(ch->tokens + num_tokens);
+  char* strs = (char*)(ch->conds + num_conds);
+  ch->literal_types = (uint8_t*)(strs + strs_size);
+  ch->contents = (char*)(ch->literal_types + num_literals);
+  memcpy(ch->contents, contents, contents_size);
+  if (spliced) {
+    ch->spliced = ch->contents + contents_size;
+    memcpy(ch->spliced, spliced, spliced_size);
+  }
+
+  int i = 0;
+  int j = 0;
+  for (Token* t = tok;; t = t->next, ++i) {
+    Token* ct = &ch->tokens[i];
+    *ct = *t;
+    ct->next = NULL;
+    if (t->loc >= contents && t->loc < contents + contents_size)
+      ct->loc = ch->contents + (t->loc - contents);
+    else
+      ct->loc = ch->spliced + (t->loc - spliced);
+    if (t->kind == TK_STR || t->kind == TK_NUM) {
+      TokenLiteral* lit = &ch->literals[j];
+      *lit = *t->lit;
+      lit->ty = NULL;
+      ct->lit = lit;
+      if (t->kind == TK_STR) {
+        ch->literal_types[j] = literal_type_of(t->lit->ty->base);
+        lit->val = t->lit->ty->array_len;
+        lit->str = strs;
+        memcpy(strs, t->lit->str, t->lit->ty->size);
+        strs += align_to_u(t->lit->ty->size, 8);
+      } else {
+        ch->literal_types[j] = literal_type_of(t->lit->ty);
+      }
+      ++j;
+    }
+    if (t->kind == TK_EOF)
+      break;
+  }
+  find_conds(ch);
+  ch->include_guard = find_include_guard(ch);
+  return ch;
+}
+
+static Token* new_lazy_tokens(CachedHeader* ch, int start, int skip_to, Token* rest) {
+  LazyTokens* lazy = bumpcalloc(1, sizeof(LazyTokens), AL_Temp);
+  lazy->ch = ch;
+  lazy->start = start;
+  lazy->skip_to = skip_to;
+  lazy->rest = rest;
+
+  // Looking past the end of the directive line before it, as for a missing
+  // macro name, stays on it.
+  Token* tok = bumpcalloc(1, sizeof(Token), AL_Compile);
+  tok->kind = TK_LAZY;
+  tok->loc = ch->tokens[start].loc;
+  tok->at_bol = true;
+  tok->lazy = lazy;
+  tok->next = tok;
+  return tok;
+}
+
+static void copy_cached_token(Token* t, CachedHeader* ch, int i) {
+  *t = ch->tokens[i];
+  if (t->kind == TK_STR || t->kind == TK_NUM) {
+    int j = (int)(t->lit - ch->literals);
+    TokenLiteral* lit = bumpcalloc(1, sizeof(TokenLiteral), AL_Compile);
+    *lit = *t->lit;
+    if (t->kind == TK_STR) {
+      lit->ty = array_of(literal_type(ch->literal_types[j]), (int)lit->val);
+      lit->val = 0;
+    } else {
+      lit->ty = literal_type(ch->literal_types[j]);
+    }
+    t->lit = lit;
+  }
+}
+
+// Replaces the TK_LAZY token |tok| with the header's tokens from |start| up to
+// the end of the next conditional line, followed by another TK_LAZY for the
+// rest. It's replaced in place so that the token before it doesn't need to be
+// known.
+static void lazy_tokens_from(Token* tok, int start) {
+  uint64_t start_time = get_time_ns();
+  LazyTokens* lazy = tok->lazy;
+  CachedHeader* ch = lazy->ch;
+  int eof = ch->num_tokens - 1;
+  if (start == eof) {
+    *tok = *lazy->rest;
+    C(time_ns) += get_time_ns() - start_time;
+    return;
+  }
+
+  // The first conditional line that ends after |start|.
+  int lo = 0;
+  int hi = ch->num_conds;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (ch->conds[mid].line_end <= start)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  int end = eof;
+  Token* after = lazy->rest;
+  if (lo < ch->num_conds) {
+    end = ch->conds[lo].line_end;
+    after = new_lazy_tokens(ch, end, ch->conds[lo].skip_to, lazy->rest);
+  }
+
+  Token* toks = bumpcalloc(end - start - 1, sizeof(Token), AL_Compile);
+  Token* cur = tok;
+  copy_cached_token(cur, ch, start);
+  for (int i = start + 1; i < end; ++i) {
+    Token* t = &toks[i - start - 1];
+    copy_cached_token(t, ch, i);
+    cur = cur->next = t;
+  }
+  cur->next = after;
+  C(time_ns) += get_time_ns() - start_time;
+}
+
+// Replaces a TK_LAZY token with the tokens it stands for.
+IMPLSTATIC void fill_lazy_tokens(Token* tok) {
+  lazy_tokens_from(tok, tok->lazy->start);
+}
+
+// Replaces a TK_LAZY token with the tokens from where skip_cond_incl() would
+// stop, skipping the rest of the group of the conditional line before it.
+IMPLSTATIC void skip_lazy_tokens(Token* tok) {
+  lazy_tokens_from(tok, tok->lazy->skip_to);
+}
+
+// Returns the tokens of an included file followed by |rest|, tokenizing it or
+// reusing its tokens from an earlier translation unit. The file is still read
+// the first time it's included in each update to check that it hasn't changed,
+// but not again after that. Returns NULL if the file can't be read.
+//
+// Only the tokens up to the end of the first conditional line are copied into
+// this translation unit, see CachedCond. Sets |include_guard| to the macro that
+// guards the whole file, if there's one.
+IMPLSTATIC Token* tokenize_header(char* path, Token* rest, char** include_guard) {
+  UserContext* uc = user_context;
+  char* key = intern(path);
+
+  mutex_lock(&uc->lock);
+  CachedHeader* ch = hashmap_get_interned(&uc->header_cache, key);
+  bool checked = ch && ch->checked == uc->header_cache_generation;
+  mutex_unlock(&uc->lock);
+
+  bool tokenized = false;
+  if (!checked) {
+    LoadedFile lf;
+    if (!load_file(path, &lf))
+      return NULL;
+    uint64_t hash = hash_bytes(lf.contents, strlen(lf.contents));
+    if (!ch || ch->hash != hash) {
+      Token* tok = tokenize_filecontents(path, keep_source(&lf));
+      CachedHeader* fresh = cached_header_new(tok, hash);
+
+      // Another thread may still be using the entry being replaced, so it's
+      // only freed once this update is done.
+      mutex_lock(&uc->lock);
+      CachedHeader* old = hashmap_get_interned(&uc->header_cache, key);
+      if (old)
+        old->replaced = true;
+      fresh->checked = uc->header_cache_generation;
+      fresh->next = uc->cached_headers;
+      uc->cached_headers = fresh;
+      hashmap_put_interned(&uc->header_cache, key, fresh);
+      mutex_unlock(&uc->lock);
+      ch = fresh;
+      tokenized = true;
+    } else {
+      unload_file(&lf);
+      mutex_lock(&uc->lock);
+      ch->checked = uc->header_cache_generation;
+      mutex_unlock(&uc->lock);
+    }
+  }
+
+  if (!tokenized)
+    filehasharray_push(&C(loaded_files), (FileHash){key, ch->hash}, AL_Compile);
+  File* file = new_file(path, ch->contents);
+  if (ch->spliced) {
+    file->spliced = new_file(path, ch->spliced);
+    file->spliced->parent = file;
+  }
+  *include_guard = ch->include_guard;
+  if (ch->num_tokens == 1)
+    return rest;
+  Token* tok = new_lazy_tokens(ch, 0, ch->num_tokens - 1, rest);
+  fill_lazy_tokens(tok);
+  return tok;
+}
+
+// Frees entries that were replaced during the previous update, and requires
+// the rest to be checked again before they're used. Called on the main thread
+// before any compiles are started.
+IMPLSTATIC void header_cache_begin_update(void) {
+  UserContext* uc = user_context;
+  CachedHeader** link = &uc->cached_headers;
+  while (*link) {
+    CachedHeader* ch = *link;
+    if (ch->replaced) {
+      *link = ch->next;
+      free(ch);
+    } else {
+      link = &ch->next;
+    }
+  }
+  ++uc->header_cache_generation;
+}
+
+IMPLSTATIC void header_cache_free(void) {
+  UserContext* uc = user_context;
+  while (uc->cached_headers) {
+    CachedHeader* next = uc->cached_headers->next;
+    free(uc->cached_headers);
+    uc->cached_headers = next;
+  }
 }
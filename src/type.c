@@ -1,24 +1,24 @@
 #include "dyibicc.h"
 
-IMPLSTATIC Type* ty_void = &(Type){TY_VOID, 1, 1};
-IMPLSTATIC Type* ty_bool = &(Type){TY_BOOL, 1, 1};
+IMPLSTATIC THREAD_LOCAL Type ty_void_storage = {TY_VOID, 1, 1};
+IMPLSTATIC THREAD_LOCAL Type ty_bool_storage = {TY_BOOL, 1, 1};
 
-IMPLSTATIC Type* ty_char = &(Type){TY_CHAR, 1, 1};
-IMPLSTATIC Type* ty_short = &(Type){TY_SHORT, 2, 2};
-IMPLSTATIC Type* ty_int = &(Type){TY_INT, 4, 4};
-IMPLSTATIC Type* ty_long = &(Type){TY_LONG, 8, 8};
+IMPLSTATIC THREAD_LOCAL Type ty_char_storage = {TY_CHAR, 1, 1};
+IMPLSTATIC THREAD_LOCAL Type ty_short_storage = {TY_SHORT, 2, 2};
+IMPLSTATIC THREAD_LOCAL Type ty_int_storage = {TY_INT, 4, 4};
+IMPLSTATIC THREAD_LOCAL Type ty_long_storage = {TY_LONG, 8, 8};
 
-IMPLSTATIC Type* ty_uchar = &(Type){TY_CHAR, 1, 1, true};
-IMPLSTATIC Type* ty_ushort = &(Type){TY_SHORT, 2, 2, true};
-IMPLSTATIC Type* ty_uint = &(Type){TY_INT, 4, 4, true};
-IMPLSTATIC Type* ty_ulong = &(Type){TY_LONG, 8, 8, true};
+IMPLSTATIC THREAD_LOCAL Type ty_uchar_storage = {TY_CHAR, 1, 1, true};
+IMPLSTATIC THREAD_LOCAL Type ty_ushort_storage = {TY_SHORT, 2, 2, true};
+IMPLSTATIC THREAD_LOCAL Type ty_uint_storage = {TY_INT, 4, 4, true};
+IMPLSTATIC THREAD_LOCAL Type ty_ulong_storage = {TY_LONG, 8, 8, true};
 
-IMPLSTATIC Type* ty_float = &(Type){TY_FLOAT, 4, 4};
-IMPLSTATIC Type* ty_double = &(Type){TY_DOUBLE, 8, 8};
+IMPLSTATIC THREAD_LOCAL Type ty_float_storage = {TY_FLOAT, 4, 4};
+IMPLSTATIC THREAD_LOCAL Type ty_double_storage = {TY_DOUBLE, 8, 8};
 #if X64WIN
-IMPLSTATIC Type* ty_ldouble = &(Type){TY_LDOUBLE, 8, 8};
+IMPLSTATIC THREAD_LOCAL Type ty_ldouble_storage = {TY_LDOUBLE, 8, 8};
 #else
-IMPLSTATIC Type* ty_ldouble = &(Type){TY_LDOUBLE, 16, 16};
+IMPLSTATIC THREAD_LOCAL Type ty_ldouble_storage = {TY_LDOUBLE, 16, 16};
 #endif
 
 static Type* new_type(TypeKind kind, int size, int align) {
@@ -139,7 +139,7 @@ IMPLSTATIC Type* struct_type(void) {
   return new_type(TY_STRUCT, 0, 1);
 }
 
-static Type* get_common_type(Type* ty1, Type* ty2) {
+IMPLSTATIC Type* get_common_type(Type* ty1, Type* ty2) {
   if (ty1->base)
     return pointer_to(ty1->base);
 
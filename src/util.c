@@ -27,6 +27,16 @@ IMPLSTATIC char* bumpstrdup(const char* s, AllocLifetime lifetime) {
   return d;
 }
 
+// Whether two paths name the same file, as far as can be told without going
+// to the file system: they're the same other than for leading "./"s.
+IMPLSTATIC bool same_path(char* a, char* b) {
+  while (a[0] == '.' && (a[1] == '/' || a[1] == '\\'))
+    a += 2;
+  while (b[0] == '.' && (b[1] == '/' || b[1] == '\\'))
+    b += 2;
+  return strcmp(a, b) == 0;
+}
+
 IMPLSTATIC char* dirname(char* s) {
   size_t i;
   if (!s || !*s)
@@ -65,6 +75,136 @@ IMPLSTATIC unsigned int get_page_size(void) {
 #endif
 }
 
+// Returns a monotonic timestamp in nanoseconds, for measuring intervals.
+IMPLSTATIC uint64_t get_time_ns(void) {
+#if X64WIN
+  LARGE_INTEGER freq, now;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+IMPLSTATIC int get_num_processors(void) {
+#if X64WIN
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+  return (int)system_info.dwNumberOfProcessors;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+#endif
+}
+
+IMPLSTATIC void mutex_init(Mutex* m) {
+#if X64WIN
+  InitializeSRWLock((PSRWLOCK)m);
+#else
+  pthread_mutex_init(m, NULL);
+#endif
+}
+
+IMPLSTATIC void mutex_destroy(Mutex* m) {
+#if X64WIN
+  (void)m;  // SRWLOCKs don't need to be destroyed.
+#else
+  pthread_mutex_destroy(m);
+#endif
+}
+
+IMPLSTATIC void mutex_lock(Mutex* m) {
+#if X64WIN
+  AcquireSRWLockExclusive((PSRWLOCK)m);
+#else
+  pthread_mutex_lock(m);
+#endif
+}
+
+IMPLSTATIC void mutex_unlock(Mutex* m) {
+#if X64WIN
+  ReleaseSRWLockExclusive((PSRWLOCK)m);
+#else
+  pthread_mutex_unlock(m);
+#endif
+}
+
+IMPLSTATIC void condvar_init(CondVar* cv) {
+#if X64WIN
+  InitializeConditionVariable((PCONDITION_VARIABLE)cv);
+#else
+  pthread_cond_init(cv, NULL);
+#endif
+}
+
+IMPLSTATIC void condvar_destroy(CondVar* cv) {
+#if X64WIN
+  (void)cv;  // CONDITION_VARIABLEs don't need to be destroyed.
+#else
+  pthread_cond_destroy(cv);
+#endif
+}
+
+IMPLSTATIC void condvar_wait(CondVar* cv, Mutex* m) {
+#if X64WIN
+  SleepConditionVariableSRW((PCONDITION_VARIABLE)cv, (PSRWLOCK)m, INFINITE, 0);
+#else
+  pthread_cond_wait(cv, m);
+#endif
+}
+
+IMPLSTATIC void condvar_broadcast(CondVar* cv) {
+#if X64WIN
+  WakeAllConditionVariable((PCONDITION_VARIABLE)cv);
+#else
+  pthread_cond_broadcast(cv);
+#endif
+}
+
+typedef struct ThreadStart {
+  void (*func)(void*);
+  void* arg;
+} ThreadStart;
+
+#if X64WIN
+static DWORD WINAPI thread_trampoline(LPVOID param) {
+#else
+static void* thread_trampoline(void* param) {
+#endif
+  ThreadStart start = *(ThreadStart*)param;
+  free(param);
+  start.func(start.arg);
+  return 0;
+}
+
+IMPLSTATIC bool thread_start(Thread* t, void (*func)(void*), void* arg) {
+  ThreadStart* start = malloc(sizeof(ThreadStart));
+  start->func = func;
+  start->arg = arg;
+#if X64WIN
+  *t = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+  if (*t)
+    return true;
+#else
+  if (pthread_create(t, NULL, thread_trampoline, start) == 0)
+    return true;
+#endif
+  free(start);
+  return false;
+}
+
+IMPLSTATIC void thread_join(Thread t) {
+#if X64WIN
+  WaitForSingleObject(t, INFINITE);
+  CloseHandle(t);
+#else
+  pthread_join(t, NULL);
+#endif
+}
+
 IMPLSTATIC void strarray_push(StringArray* arr, char* s, AllocLifetime lifetime) {
   if (!arr->data) {
     arr->data = bumpcalloc(8, sizeof(char*), lifetime);
@@ -99,19 +239,82 @@ IMPLSTATIC void strintarray_push(StringIntArray* arr, StringInt item, AllocLifet
   arr->data[arr->len++] = item;
 }
 
-// Returns the contents of a given file. Doesn't support '-' for reading from
-// stdin.
-IMPLSTATIC char* read_file_wrap_user(char* path, AllocLifetime lifetime) {
-  char* contents;
-  size_t size;
-  if (!user_context->load_file_contents(path, &contents, &size))
-    return NULL;
+IMPLSTATIC void filehasharray_push(FileHashArray* arr, FileHash item, AllocLifetime lifetime) {
+  if (!arr->data) {
+    arr->data = bumpcalloc(8, sizeof(FileHash), lifetime);
+    arr->capacity = 8;
+  }
+
+  if (arr->capacity == arr->len) {
+    arr->data = bumplamerealloc(arr->data, sizeof(FileHash) * arr->capacity,
+                                sizeof(FileHash) * arr->capacity * 2, lifetime);
+    arr->capacity *= 2;
+  }
 
-  char* buf = bumpcalloc(1, size + 1, lifetime);  // TODO: doesn't really need a calloc
-  memcpy(buf, contents, size);
-  free(contents);
-  buf[size] = 0;
-  return buf;
+  arr->data[arr->len++] = item;
+}
+
+// Loads the contents of a given file, NUL-terminated, which are to be treated
+// as read-only. The file being updated by dyibicc_update() has the contents
+// that were passed to it. Otherwise, unless the embedder supplied
+// load_file_contents, files are mapped rather than read where possible.
+// Doesn't support '-' for reading from stdin.
+IMPLSTATIC bool load_file(char* path, LoadedFile* lf) {
+  memset(lf, 0, sizeof(*lf));
+  if (user_context->update_contents && same_path(path, user_context->update_path)) {
+    lf->size = strlen(user_context->update_contents);
+    lf->contents = malloc(lf->size + 1);
+    if (!lf->contents)
+      return false;
+    memcpy(lf->contents, user_context->update_contents, lf->size + 1);
+    return true;
+  }
+
+  if (user_context->load_file_contents) {
+    char* contents;
+    size_t size;
+    if (!user_context->load_file_contents(path, &contents, &size))
+      return false;
+    lf->contents = realloc(contents, size + 1);
+    if (!lf->contents) {
+      free(contents);
+      return false;
+    }
+    lf->contents[size] = 0;
+    lf->size = size;
+    return true;
+  }
+
+  lf->mapping = map_file_readonly(path, &lf->size);
+  if (lf->mapping) {
+    lf->contents = lf->mapping;
+    return true;
+  }
+
+  FILE* fp = fopen(path, "rb");
+  if (!fp)
+    return false;
+  // ftell() fails for a stream that can't seek, such as a pipe.
+  long size = fseek(fp, 0, SEEK_END) == 0 ? ftell(fp) : -1;
+  if (size >= 0)
+    lf->contents = malloc(size + 1);
+  if (!lf->contents) {
+    fclose(fp);
+    return false;
+  }
+  rewind(fp);
+  lf->size = fread(lf->contents, 1, size, fp);
+  lf->contents[lf->size] = 0;
+  fclose(fp);
+  return true;
+}
+
+IMPLSTATIC void unload_file(LoadedFile* lf) {
+  if (lf->mapping)
+    unmap_file(lf->mapping, lf->size);
+  else
+    free(lf->contents);
+  memset(lf, 0, sizeof(*lf));
 }
 
 // Takes a printf-style format string and returns a formatted string.
@@ -125,10 +328,43 @@ IMPLSTATIC char* format(AllocLifetime lifetime, char* fmt, ...) {
   return bumpstrdup(buf, lifetime);
 }
 
+// When set, output from this thread is appended here instead of being passed
+// to the output function. Used to keep diagnostics from parallel compiles in
+// file order.
+static THREAD_LOCAL ByteArray* output_capture;
+
+IMPLSTATIC void output_capture_begin(ByteArray* buf) {
+  output_capture = buf;
+}
+
+IMPLSTATIC void output_capture_end(void) {
+  output_capture = NULL;
+}
+
+static int vouta(const char* fmt, va_list ap) {
+  if (!output_capture)
+    return user_context->output_function(fmt, ap);
+
+  ByteArray* buf = output_capture;
+  va_list ap2;
+  va_copy(ap2, ap);
+  int len = vsnprintf(NULL, 0, fmt, ap2);
+  va_end(ap2);
+  if (len < 0)
+    return len;
+  if (buf->len + len + 1 > buf->capacity) {
+    buf->capacity = MAX(buf->capacity * 2, buf->len + len + 1);
+    buf->data = realloc(buf->data, buf->capacity);
+  }
+  vsnprintf(buf->data + buf->len, len + 1, fmt, ap);
+  buf->len += len;
+  return len;
+}
+
 IMPLSTATIC int outaf(const char* fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  int ret = user_context->output_function(fmt, ap);
+  int ret = vouta(fmt, ap);
   va_end(ap);
   return ret;
 }
@@ -173,38 +409,40 @@ static void verror_at(char* filename, char* input, int line_no, char* loc, char*
   else
     outaf("^ error: ");
 
-  user_context->output_function(fmt, ap);
+  vouta(fmt, ap);
 
   outaf("\n");
   if (user_context->use_ansi_codes)
     outaf("%s", ANSI_RESET);
 }
 
-IMPLSTATIC void error_at(char* loc, char* fmt, ...) {
-  File* cf = compiler_state.tokenize__current_file;
-
-  int line_no = 1;
-  for (char* p = cf->contents; p < loc; p++)
-    if (*p == '\n')
-      line_no++;
+// Reports a message at a location in one of the TU's files. The line shown
+// is from the buffer it's in, which is a spliced copy for a line that has
+// been spliced (see tokenize_filecontents()).
+static void verror_loc(char* loc, char* fmt, va_list ap) {
+  File* file = file_at(loc);
+  char* name = file->parent ? file->parent->name : file->name;
+  verror_at(name, file->contents, line_no_at(loc), loc, fmt, ap);
+}
 
+IMPLSTATIC void error_at(char* loc, char* fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  verror_at(cf->name, cf->contents, line_no, loc, fmt, ap);
+  verror_loc(loc, fmt, ap);
   longjmp(toplevel_update_jmpbuf, 1);
 }
 
 IMPLSTATIC void error_tok(Token* tok, char* fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  verror_at(tok->file->name, tok->file->contents, tok->line_no, tok->loc, fmt, ap);
+  verror_loc(tok->loc, fmt, ap);
   longjmp(toplevel_update_jmpbuf, 1);
 }
 
 IMPLSTATIC void warn_tok(Token* tok, char* fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  verror_at(tok->file->name, tok->file->contents, tok->line_no, tok->loc, fmt, ap);
+  verror_loc(tok->loc, fmt, ap);
   va_end(ap);
 }
 
@@ -215,7 +453,7 @@ IMPLSTATIC void error(char* fmt, ...) {
   if (!user_context || !user_context->output_function) {
     vfprintf(stderr, fmt, ap);
   } else {
-    user_context->output_function(fmt, ap);
+    vouta(fmt, ap);
     outaf("\n");
   }
   longjmp(toplevel_update_jmpbuf, 1);
@@ -53,6 +53,14 @@ _Bool bool_fn_sub(_Bool x) { return x - 1; }
 
 static int static_fn(void) { return 3; }
 
+static int later_fn(int x);
+static inline int later_inline_fn(int x);
+int call_later_fns(void) { return later_fn(1) + later_inline_fn(2); }
+void *later_fn_before(void) { return later_fn; }
+static int later_fn(int x) { return x * 10; }
+static inline int later_inline_fn(int x) { return x * 100; }
+void *later_fn_after(void) { return later_fn; }
+
 int param_decay(int x[]) { return x[0]; }
 
 int counter() {
@@ -269,6 +277,8 @@ int main() {
   ASSERT(1, bool_fn_sub(0));
 
   ASSERT(3, static_fn());
+  ASSERT(210, call_later_fns());
+  ASSERT(1, later_fn_before() == later_fn_after());
 
   ASSERT(3, ({ int x[2]; x[0]=3; param_decay(x); }));
 
@@ -0,0 +1,296 @@
+#include "test.h"
+
+// #if expressions are evaluated by eval_pp_expr(), or by const_expr() for the
+// ones that it leaves to it. Either way, each must have the value that the
+// parser gives the same expression in a global initializer, which is
+// evaluated as const_expr() does. The set covers each kind of literal, the
+// usual arithmetic conversions between them, operators whose result isn't
+// truncated to its type, and short-circuited operands that would otherwise
+// divide by zero.
+
+#if (0) != (0)
+#error "0"
+#endif
+long case0 = (0) == (0);
+
+#if (1) != (1)
+#error "1"
+#endif
+long case1 = (1) == (1);
+
+// Not valid C, so only the preprocessor evaluates it.
+#if (undefined_name) != (0)
+#error "undefined_name"
+#endif
+
+#if (-1 < 0) != (1)
+#error "-1 < 0"
+#endif
+long case2 = (-1 < 0) == (1);
+
+#if (-1 < 0u) != (0)
+#error "-1 < 0u"
+#endif
+long case3 = (-1 < 0u) == (0);
+
+#if (-1L < 0u) != (1)
+#error "-1L < 0u"
+#endif
+long case4 = (-1L < 0u) == (1);
+
+#if (-1 > 0xffffffff) != (0)
+#error "-1 > 0xffffffff"
+#endif
+long case5 = (-1 > 0xffffffff) == (0);
+
+#if (18446744073709551615UL > 0xffffffff) != (1)
+#error "18446744073709551615UL > 0xffffffff"
+#endif
+long case6 = (18446744073709551615UL > 0xffffffff) == (1);
+
+#if (0xffffffffffffffff == -1) != (1)
+#error "0xffffffffffffffff == -1"
+#endif
+long case7 = (0xffffffffffffffff == -1) == (1);
+
+#if (0x7fffffff + 1 < 0) != (1)
+#error "0x7fffffff + 1 < 0"
+#endif
+long case8 = (0x7fffffff + 1 < 0) == (1);
+
+#if (2147483647 + 1) != (2147483648)
+#error "2147483647 + 1"
+#endif
+long case9 = (2147483647 + 1) == (2147483648);
+
+#if ((2147483647 + 1) > 0) != (0)
+#error "(2147483647 + 1) > 0"
+#endif
+long case10 = ((2147483647 + 1) > 0) == (0);
+
+#if (0x80000000 * 2) != (4294967296)
+#error "0x80000000 * 2"
+#endif
+long case11 = (0x80000000 * 2) == (4294967296);
+
+#if ((0x80000000 * 2) == 0) != (1)
+#error "(0x80000000 * 2) == 0"
+#endif
+long case12 = ((0x80000000 * 2) == 0) == (1);
+
+#if (-0x80000000) != (-2147483648)
+#error "-0x80000000"
+#endif
+long case13 = (-0x80000000) == (-2147483648);
+
+#if (-2147483648 < 0) != (1)
+#error "-2147483648 < 0"
+#endif
+long case14 = (-2147483648 < 0) == (1);
+
+#if (~0u == 0xffffffff) != (1)
+#error "~0u == 0xffffffff"
+#endif
+long case15 = (~0u == 0xffffffff) == (1);
+
+#if (~0u >> 31) != (-1)
+#error "~0u >> 31"
+#endif
+long case16 = (~0u >> 31) == (-1);
+
+#if (-1 >> 63) != (-1)
+#error "-1 >> 63"
+#endif
+long case17 = (-1 >> 63) == (-1);
+
+#if (-1ul >> 63) != (1)
+#error "-1ul >> 63"
+#endif
+long case18 = (-1ul >> 63) == (1);
+
+#if (1 << 31) != (2147483648)
+#error "1 << 31"
+#endif
+long case19 = (1 << 31) == (2147483648);
+
+#if ((1 << 31) < 0) != (1)
+#error "(1 << 31) < 0"
+#endif
+long case20 = ((1 << 31) < 0) == (1);
+
+#if (1u << 40) != (1099511627776)
+#error "1u << 40"
+#endif
+long case21 = (1u << 40) == (1099511627776);
+
+#if (7 / 2) != (3)
+#error "7 / 2"
+#endif
+long case22 = (7 / 2) == (3);
+
+#if (-7 / 2) != (-3)
+#error "-7 / 2"
+#endif
+long case23 = (-7 / 2) == (-3);
+
+#if (-7 % 3) != (-1)
+#error "-7 % 3"
+#endif
+long case24 = (-7 % 3) == (-1);
+
+#if (-7 / 2u) != (2147483644)
+#error "-7 / 2u"
+#endif
+long case25 = (-7 / 2u) == (2147483644);
+
+#if (0xffffffffffffffff / 2) != (9223372036854775807)
+#error "0xffffffffffffffff / 2"
+#endif
+long case26 = (0xffffffffffffffff / 2) == (9223372036854775807);
+
+#if (1 ? -1 : 0u) != (4294967295)
+#error "1 ? -1 : 0u"
+#endif
+long case27 = (1 ? -1 : 0u) == (4294967295);
+
+#if ((1 ? -1 : 0u) > 0) != (1)
+#error "(1 ? -1 : 0u) > 0"
+#endif
+long case28 = ((1 ? -1 : 0u) > 0) == (1);
+
+#if (0 ? 1 : 2L) != (2)
+#error "0 ? 1 : 2L"
+#endif
+long case29 = (0 ? 1 : 2L) == (2);
+
+#if (1 ? 2 : 1 / 0) != (2)
+#error "1 ? 2 : 1 / 0"
+#endif
+long case30 = (1 ? 2 : 1 / 0) == (2);
+
+#if (0 && 1 / 0) != (0)
+#error "0 && 1 / 0"
+#endif
+long case31 = (0 && 1 / 0) == (0);
+
+#if (1 || 1 % 0) != (1)
+#error "1 || 1 % 0"
+#endif
+long case32 = (1 || 1 % 0) == (1);
+
+#if (!0 + !5) != (1)
+#error "!0 + !5"
+#endif
+long case33 = (!0 + !5) == (1);
+
+#if ('a' == 97) != (1)
+#error "'a' == 97"
+#endif
+long case34 = ('a' == 97) == (1);
+
+#if ('\377' < 0) != (1)
+#error "'\\377' < 0"
+#endif
+long case35 = ('\377' < 0) == (1);
+
+#if (u'x' + 1) != (121)
+#error "u'x' + 1"
+#endif
+long case36 = (u'x' + 1) == (121);
+
+#if (U'y' - 'y') != (0)
+#error "U'y' - 'y'"
+#endif
+long case37 = (U'y' - 'y') == (0);
+
+#if (L'z' == 'z') != (1)
+#error "L'z' == 'z'"
+#endif
+long case38 = (L'z' == 'z') == (1);
+
+#if (010 + 0x10 + 0b10) != (26)
+#error "010 + 0x10 + 0b10"
+#endif
+long case39 = (010 + 0x10 + 0b10) == (26);
+
+#if (10ll * 10ull) != (100)
+#error "10ll * 10ull"
+#endif
+long case40 = (10ll * 10ull) == (100);
+
+#if (1 + 2 * 3 - 4 / 2 % 3 << 1 >> 1 < 5 == 1 & 3 ^ 1 | 4 && 1 || 0) != (1)
+#error "1 + 2 * 3 - 4 / 2 % 3 << 1 >> 1 < 5 == 1 & 3 ^ 1 | 4 && 1 || 0"
+#endif
+long case41 = (1 + 2 * 3 - 4 / 2 % 3 << 1 >> 1 < 5 == 1 & 3 ^ 1 | 4 && 1 || 0) == (1);
+
+#if ((1 + 2) * (3 - 4)) != (-3)
+#error "(1 + 2) * (3 - 4)"
+#endif
+long case42 = ((1 + 2) * (3 - 4)) == (-3);
+
+#if (1 < 2 ? 3 < 4 ? 5 : 6 : 7) != (5)
+#error "1 < 2 ? 3 < 4 ? 5 : 6 : 7"
+#endif
+long case43 = (1 < 2 ? 3 < 4 ? 5 : 6 : 7) == (5);
+
+#if (1.5) != (1.5)
+#error "1.5"
+#endif
+long case44 = (1.5) == (1.5);
+
+#if ((1, 2)) != (2)
+#error "(1, 2)"
+#endif
+long case45 = ((1, 2)) == (2);
+
+int main() {
+  ASSERT(1, case0);
+  ASSERT(1, case1);
+  ASSERT(1, case2);
+  ASSERT(1, case3);
+  ASSERT(1, case4);
+  ASSERT(1, case5);
+  ASSERT(1, case6);
+  ASSERT(1, case7);
+  ASSERT(1, case8);
+  ASSERT(1, case9);
+  ASSERT(1, case10);
+  ASSERT(1, case11);
+  ASSERT(1, case12);
+  ASSERT(1, case13);
+  ASSERT(1, case14);
+  ASSERT(1, case15);
+  ASSERT(1, case16);
+  ASSERT(1, case17);
+  ASSERT(1, case18);
+  ASSERT(1, case19);
+  ASSERT(1, case20);
+  ASSERT(1, case21);
+  ASSERT(1, case22);
+  ASSERT(1, case23);
+  ASSERT(1, case24);
+  ASSERT(1, case25);
+  ASSERT(1, case26);
+  ASSERT(1, case27);
+  ASSERT(1, case28);
+  ASSERT(1, case29);
+  ASSERT(1, case30);
+  ASSERT(1, case31);
+  ASSERT(1, case32);
+  ASSERT(1, case33);
+  ASSERT(1, case34);
+  ASSERT(1, case35);
+  ASSERT(1, case36);
+  ASSERT(1, case37);
+  ASSERT(1, case38);
+  ASSERT(1, case39);
+  ASSERT(1, case40);
+  ASSERT(1, case41);
+  ASSERT(1, case42);
+  ASSERT(1, case43);
+  ASSERT(1, case44);
+  ASSERT(1, case45);
+
+  printf("OK\n");
+  return 0;
+}
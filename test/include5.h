@@ -0,0 +1,26 @@
+#ifndef INCLUDE5_H
+#define INCLUDE5_H
+#define INCLUDE5_ADD(x, y) ((x) + (y))
+#if 0
+#error skipped
+# if 1
+#error nested
+# elif 1
+# else
+# endif
+#elif defined(INCLUDE5_H) && 0
+#error skipped elif
+#else
+# ifdef INCLUDE5_H
+int include5 = INCLUDE5_ADD(2, 3);
+# else
+#error skipped else
+# endif
+#endif
+#endif
+
+#ifndef INCLUDE5_ONCE
+#define INCLUDE5_ONCE
+#else
+#define INCLUDE5_TWICE 1
+#endif
@@ -1,6 +1,19 @@
 #include "test.h"
 
 int main() {
+  // Spliced lines have the number of their first physical line, and the lines
+  // after them keep theirs.
+  ASSERT(6, __LI\
+NE__);
+  ASSERT(8, __LINE__);
+  /* A comment that starts before a spliced line
+     and ends in it *\
+/ ASSERT(10, __LINE__);
+  ASSERT(12, __LINE__);
+  /* A comment that starts in a spliced \
+line
+     and ends after it */ ASSERT(15, __LINE__);
+
 #line 500 "foo"
   ASSERT(501, __LINE__);
   ASSERT(0, strcmp(__FILE__, "foo"));
@@ -16,6 +29,12 @@ int main() {
   ASSERT(201, __LINE__);
   ASSERT(0, strcmp(__FILE__, "xyz"));
 
+#if 1
+#line 300 "in_if"
+  ASSERT(301, __LINE__);
+  ASSERT(0, strcmp(__FILE__, "in_if"));
+#endif
+
   printf("OK\n");
   return 0;
 }
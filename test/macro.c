@@ -303,6 +303,27 @@ int main() {
 #endif
   ASSERT(5, m);
 
+#if -1 < 0u || 18446744073709551615UL < 0xffffffff || (1 ? -1 : 0u) < 0
+  m = 5;
+#else
+  m = 6;
+#endif
+  ASSERT(6, m);
+
+#if 0 && 1 / 0 || (0x7fffffff + 1 < 0) && 0xffffffffu >> 31 == 1 && -1 >> 63 == -1
+  m = 5;
+#else
+  m = 6;
+#endif
+  ASSERT(5, m);
+
+#if 'a' == 97 && (010 | 0x10) == 24 && 1 < 2 ? 3 < 4 ? 1 : 0 : 0
+  m = 5;
+#else
+  m = 6;
+#endif
+  ASSERT(5, m);
+
 #define STR(x) #x
 #define M12(x) STR(x)
 #define M13(x) M12(foo.x)
@@ -333,6 +354,11 @@ int main() {
 #include M13 >
   ASSERT(4, foo);
 
+#include "include5.h"
+#include "include5.h"
+  ASSERT(5, include5);
+  ASSERT(1, INCLUDE5_TWICE);
+
 #undef foo
 
   ASSERT(1, __STDC__);
@@ -409,6 +435,11 @@ int main() {
 #define M31(x, y) (1, ##x y)
   ASSERT(3, M31(, 3));
 
+#define M32(x) (x + sizeof(#x))
+#define M33 4
+  ASSERT(8, M32(M33));
+  ASSERT(18, M32(M33 + M33));
+
   printf("OK\n");
   return 0;
 }
@@ -7,9 +7,52 @@ _MAIN_TEMPLATE = r'''
 #include <stdlib.h>
 #include <string.h>
 
-static bool get_file_by_name(const char* filename, char** contents, size_t* size) {
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+#if defined(_WIN32)
+#include <direct.h>
+#define make_dir(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define make_dir(path) mkdir(path, 0755)
+#endif
+
+typedef struct LoaderFile {
+  const char* name;
+  const char* contents;
+} LoaderFile;
+
 %(initial_file_contents)s
 
+// Per-thread, as each context has its own copy of the files.
+static THREAD_LOCAL LoaderFile loader_files[] = {
+%(loader_files)s
+  {NULL, NULL},
+};
+
+static void set_file_contents(const char* filename, const char* contents) {
+  for (LoaderFile* f = loader_files; f->name; ++f) {
+    if (strcmp(f->name, filename) == 0) {
+      f->contents = contents;
+    }
+  }
+}
+
+static bool get_file_by_name(const char* filename, char** contents, size_t* size) {
+  for (LoaderFile* f = loader_files; f->name; ++f) {
+    if (strcmp(f->name, filename) == 0) {
+      // Has to be malloc+copied because the compiler assumes it should free.
+      *size = strlen(f->contents);
+      *contents = malloc(*size);
+      memcpy(*contents, f->contents, *size);
+      return true;
+    }
+  }
+
   // Otherwise, fallback to normal file loading (for includes, etc.)
   FILE* fp = fopen(filename, "rb");
   if (!fp) {
@@ -25,7 +68,9 @@ static bool get_file_by_name(const char* filename, char** contents, size_t* size
   return true;
 }
 
-int main(void) {
+static int run_steps(void) {
+  (void)set_file_contents;  // Only used by some tests.
+
   char* include_paths[] = {
     %(include_paths)s
   };
@@ -40,6 +85,7 @@ int main(void) {
       .load_file_contents = get_file_by_name,
       .get_function_address = NULL,
       .output_function = NULL,
+      .cache_dir = %(cache_dir)s,
       .use_ansi_codes = false,
   };
 
@@ -47,29 +93,126 @@ int main(void) {
 
   int final_result = 0;
 
-  if (!dyibicc_update(ctx, NULL, NULL)) {
-    printf("initial update failed\n");
-    final_result = 255;
-    goto fail;
-  }
-
+%(initial_update)s
 %(steps)s
 
-  printf("OK\n");
 fail:
   dyibicc_free(ctx);
   return final_result;
 }
+
+#define NUM_CONTEXTS %(num_contexts)d
+
+#if NUM_CONTEXTS > 1 && !defined(_WIN32)
+#include <pthread.h>
+
+static void* run_steps_thread(void* result) {
+  *(int*)result = run_steps();
+  return NULL;
+}
+#endif
+
+int main(void) {
+  // Each context runs all the steps independently, on its own thread where
+  // available.
+  int results[NUM_CONTEXTS] = {0};
+#if NUM_CONTEXTS > 1 && !defined(_WIN32)
+  pthread_t threads[NUM_CONTEXTS];
+  for (int i = 0; i < NUM_CONTEXTS; ++i)
+    pthread_create(&threads[i], NULL, run_steps_thread, &results[i]);
+  for (int i = 0; i < NUM_CONTEXTS; ++i)
+    pthread_join(threads[i], NULL);
+#else
+  for (int i = 0; i < NUM_CONTEXTS; ++i)
+    results[i] = run_steps();
+#endif
+
+  for (int i = 0; i < NUM_CONTEXTS; ++i) {
+    if (results[i] != 0)
+      return results[i];
+  }
+  printf("OK\n");
+  return 0;
+}
+'''
+
+_INITIAL_UPDATE_TEMPLATE = r'''
+  if (!dyibicc_update(ctx, NULL, NULL)) {
+    printf("initial update failed\n");
+    final_result = 255;
+    goto fail;
+  }
+'''
+
+_INITIAL_UPDATE_FAIL_TEMPLATE = r'''
+  if (dyibicc_update(ctx, NULL, NULL)) {
+    printf("%(exp_file)s:%(exp_line)d: initial update succeeded, but expected it to fail\n");
+    final_result = 251;
+    goto fail;
+  }
 '''
 
 _UPDATE_FILE_TEMPLATE = r'''
-  static char contents_step%(step)d[] = %(contents)s;
+  // Not static, as each context has its own.
+  char contents_step%(step)d[] = %(contents)s;
   if (!dyibicc_update(ctx, "%(filename)s", contents_step%(step)d)) {
     final_result = 255;
     goto fail;
   }
 '''
 
+_SET_FILE_TEMPLATE = r'''
+  static char contents_step%(step)d[] = %(contents)s;
+  set_file_contents("%(filename)s", contents_step%(step)d);
+'''
+
+_UPDATE_ALL_TEMPLATE = r'''
+  if (!dyibicc_update(ctx, NULL, NULL)) {
+    final_result = 255;
+    goto fail;
+  }
+'''
+
+_UPDATE_ALL_FAIL_TEMPLATE = r'''
+  if (dyibicc_update(ctx, NULL, NULL)) {
+    printf("%(exp_file)s:%(exp_line)d: update succeeded, but expected it to fail\n");
+    final_result = 251;
+    goto fail;
+  }
+'''
+
+_WRITE_FILE_TEMPLATE = r'''
+  {
+  static char contents_step%(step)d[] = %(contents)s;
+  FILE* fp = fopen("%(filename)s", "wb");
+  if (!fp) {
+    printf("couldn't write %(filename)s\n");
+    final_result = 250;
+    goto fail;
+  }
+  fputs(contents_step%(step)d, fp);
+  fclose(fp);
+  }
+'''
+
+_EXPECT_COMPILED_TEMPLATE = r'''
+  if (dyibicc_get_stats(ctx)->num_files_compiled != %(desired)d) {
+    printf("%(exp_file)s:%(exp_line)d: compiled %%d files, but expected %%d\n",
+           (int)dyibicc_get_stats(ctx)->num_files_compiled, %(desired)d);
+    final_result = 252;
+    goto fail;
+  }
+'''
+
+_RESTART_TEMPLATE = r'''
+  dyibicc_free(ctx);
+  ctx = dyibicc_set_environment(&env_data);
+  if (!dyibicc_update(ctx, NULL, NULL)) {
+    final_result = 255;
+    goto fail;
+  }
+'''
+
 _CALL_ENTRY_TEMPLATE = r'''
   {
   void* entry_point = dyibicc_find_export(ctx, "main");
@@ -98,6 +241,10 @@ _current = {}
 _is_dirty = {}
 _include_paths = []
 _initial_file_contents = {}
+_headers = set()
+_num_contexts = 1
+_cache_dir = None
+_initial_update = _INITIAL_UPDATE_TEMPLATE
 
 
 def _string_as_c_array(s):
@@ -117,11 +264,43 @@ def initial(file_to_contents):
     update_ok()
 
 
+def initial_fail(file_to_contents):
+    """Like initial(), but the initial update is expected to fail."""
+    import inspect
+    previous_frame = inspect.currentframe().f_back
+    (filename, line_number, _, _, _) = inspect.getframeinfo(previous_frame)
+    global _initial_update
+    for f, c in file_to_contents.items():
+        _current[f] = c
+        _is_dirty[f] = False
+        _initial_file_contents[f] = c
+    _initial_update = _INITIAL_UPDATE_FAIL_TEMPLATE % {
+        'exp_file': filename,
+        'exp_line': line_number}
+
+
+def headers(file_to_contents):
+    """Files that are only #included, rather than being compiled themselves."""
+    for f, c in file_to_contents.items():
+        _headers.add(f)
+        _current[f] = c
+        _is_dirty[f] = False
+        _initial_file_contents[f] = c
+
+
 def update_ok():
+    """Updates each changed file, whether a .c file or a header, on its own.
+    Headers are also changed in the loader, as they would be read again when
+    compiling the files that include them in later updates."""
     global _steps
     global _current
     for f, dirty in _is_dirty.items():
         if dirty:
+            if f in _headers:
+                _steps.append(_SET_FILE_TEMPLATE % {
+                    'filename': f,
+                    'contents': '{' + _string_as_c_array(_current[f]) + '}',
+                    'step': len(_steps)})
             _steps.append(_UPDATE_FILE_TEMPLATE % {
                 'filename': f,
                 'contents': '{' + _string_as_c_array(_current[f]) + '}',
@@ -129,6 +308,75 @@ def update_ok():
             _is_dirty[f] = False
 
 
+def update_all_ok():
+    """Like update_ok(), but by loading changed files in a full update."""
+    global _steps
+    for f, dirty in _is_dirty.items():
+        if dirty:
+            _steps.append(_SET_FILE_TEMPLATE % {
+                'filename': f,
+                'contents': '{' + _string_as_c_array(_current[f]) + '}',
+                'step': len(_steps)})
+            _is_dirty[f] = False
+    _steps.append(_UPDATE_ALL_TEMPLATE)
+
+
+def update_all_fail():
+    """Like update_all_ok(), but the update is expected to fail."""
+    import inspect
+    previous_frame = inspect.currentframe().f_back
+    (filename, line_number, _, _, _) = inspect.getframeinfo(previous_frame)
+    global _steps
+    for f, dirty in _is_dirty.items():
+        if dirty:
+            _steps.append(_SET_FILE_TEMPLATE % {
+                'filename': f,
+                'contents': '{' + _string_as_c_array(_current[f]) + '}',
+                'step': len(_steps)})
+            _is_dirty[f] = False
+    _steps.append(_UPDATE_ALL_FAIL_TEMPLATE % {
+        'exp_file': filename,
+        'exp_line': line_number})
+
+
+def include_path(path):
+    """Adds a directory to the include paths, relative to where the test runs."""
+    _include_paths.append('"%s"' % path)
+
+
+def make_dir(path):
+    """Creates a directory on disk, if it doesn't already exist."""
+    _steps.append('  make_dir("%s");\n' % path)
+
+
+def write_file(path, contents):
+    """Writes a file on disk, for files that are found through the include paths
+    rather than supplied by the loader."""
+    _steps.append(_WRITE_FILE_TEMPLATE % {
+        'filename': path,
+        'contents': '{' + _string_as_c_array(contents) + '}',
+        'step': len(_steps)})
+
+
+def remove_file(path):
+    _steps.append('  remove("%s");\n' % path)
+
+
+def flush_include_cache():
+    _steps.append('  dyibicc_flush_include_cache(ctx);\n')
+
+
+def expect_compiled(n):
+    """Checks how many files were compiled (rather than reused) by the last update."""
+    import inspect
+    previous_frame = inspect.currentframe().f_back
+    (filename, line_number, _, _, _) = inspect.getframeinfo(previous_frame)
+    _steps.append(_EXPECT_COMPILED_TEMPLATE % {
+        'desired': n,
+        'exp_file': filename,
+        'exp_line': line_number})
+
+
 def expect(rv):
     import inspect
     previous_frame = inspect.currentframe().f_back
@@ -149,28 +397,42 @@ def sub(filename, line, find, replace_with):
     _is_dirty[filename] = True
 
 
+def cache_dir(path):
+    global _cache_dir
+    _cache_dir = path
+
+
+def restart():
+    """Replaces the context with a new one, as if the process was restarted."""
+    _steps.append(_RESTART_TEMPLATE)
+
+
+def contexts(n):
+    global _num_contexts
+    _num_contexts = n
+
+
 def done():
     global _steps
     global _current
     global _include_paths
     global _initial_file_contents
-    files = ['"%s"' % x for x in _current.keys()] + ['NULL']
+    files = ['"%s"' % x for x in _current.keys() if x not in _headers] + ['NULL']
     _include_paths.append('NULL')
     initials = ''
+    loader_files = ''
     counter = 0
     for f, c in _initial_file_contents.items():
-        initials += '  if (strcmp("%s", filename) == 0) {\n' % f
-        initials += ('    static char initial_%d[] = {' % counter) + _string_as_c_array(c) + '};\n'
-        # Has to be malloc+copied because the compiler assumes it should free.
-        initials += '    *contents = malloc(%d);\n' % len(c)
-        initials += '    memcpy(*contents, initial_%d, %d);\n' % (counter, len(c))
-        initials += '    *size = %d;\n' % len(c)
-        initials += '    return true;\n'
-        initials += '  }\n\n'
+        initials += ('static char initial_%d[] = {' % counter) + _string_as_c_array(c) + '};\n'
+        loader_files += '  {"%s", initial_%d},\n' % (f, counter)
         counter += 1
     with open(sys.argv[1], 'w', newline='\n') as f:
         f.write(_MAIN_TEMPLATE % {
                 'initial_file_contents': initials,
+                'loader_files': loader_files,
                 'include_paths': ', '.join(_include_paths),
                 'input_paths': ', '.join(files),
-                'steps': '\n'.join(_steps)})
+                'initial_update': _initial_update,
+                'steps': '\n'.join(_steps),
+                'num_contexts': _num_contexts,
+                'cache_dir': '"%s"' % _cache_dir if _cache_dir else 'NULL'})
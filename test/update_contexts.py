@@ -0,0 +1,34 @@
+from test_helpers_for_update import *
+
+SRC1 = '''\
+extern int other(void);
+static int counter;
+static char digits[] = "0123456789";
+int main(void) {
+  return ++counter + digits[other() % 10];
+}
+'''
+
+SRC2 = '''\
+int other(void) {
+  return 100;
+}
+'''
+
+# Several contexts compiling and updating the same project at once must not
+# see each other's symbols, data, or compiler state.
+contexts(4)
+
+initial({'main.c': SRC1, 'second.c': SRC2})
+update_ok()
+expect(49)
+
+sub('second.c', 2, '100', '99')
+update_ok()
+expect(59)
+
+sub('main.c', 5, '++counter', '10 + ++counter')
+update_ok()
+expect(70)
+
+done()
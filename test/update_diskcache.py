@@ -0,0 +1,56 @@
+from test_helpers_for_update import *
+
+SRC1 = '''\
+#include "value.h"
+extern int other(void);
+static const char str[] = "abc";
+int table[] = {1, 2, 3};
+int main(void) {
+  return other() + VALUE + str[1] + table[2];
+}
+'''
+
+SRC2 = '''\
+int other(void) {
+  return 100;
+}
+'''
+
+HDR = '''\
+#define VALUE 1
+'''
+
+cache_dir('update_diskcache.cache')
+
+initial({'main.c': SRC1, 'second.c': SRC2})
+headers({'value.h': HDR})
+update_ok()
+expect(202)
+
+# A new context loads both files from the cache directory rather than
+# compiling them.
+restart()
+expect_compiled(0)
+expect(202)
+
+# Saved units are only used if the files they were compiled from still match.
+sub('value.h', 1, '1', '2')
+update_all_ok()
+expect_compiled(1)
+expect(203)
+
+restart()
+expect_compiled(0)
+expect(203)
+
+# Names in the units loaded from the cache are interned into each new
+# context's own pool, not one that an earlier context on this thread freed.
+restart()
+expect_compiled(0)
+expect(203)
+
+restart()
+expect_compiled(0)
+expect(203)
+
+done()
@@ -0,0 +1,51 @@
+from test_helpers_for_update import *
+
+SRC1 = '''\
+#include "common.h"
+extern int other(void);
+int main(void) {
+  return weigh() + where() + other();
+}
+'''
+
+SRC2 = '''\
+#include "common.h"
+int other(void) {
+  return SCALE * weigh();
+}
+'''
+
+# Both files get the header's tokens from the same cache entry. The literals'
+# types have to be rebuilt for each, and the #line only applies to the file
+# that's being compiled.
+HDR = '''\
+#pragma once
+#define SCALE 10
+static int weigh(void) {
+  return sizeof("ab") + sizeof(u"ab") + sizeof(U"ab") + (L"ab"[1] - 'b') + ("xyz"[1] - u'y');
+}
+#line 100
+static int where(void) { return __LINE__; }
+'''
+
+initial({'main.c': SRC1, 'second.c': SRC2})
+headers({'common.h': HDR})
+update_ok()
+expect(332)
+
+update_all_ok()
+expect_compiled(0)
+expect(332)
+
+# A changed header replaces the cached tokens.
+sub('common.h', 2, '10', '20')
+update_all_ok()
+expect_compiled(2)
+expect(542)
+
+sub('common.h', 6, '100', '200')
+update_all_ok()
+expect_compiled(2)
+expect(642)
+
+done()
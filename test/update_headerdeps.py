@@ -0,0 +1,55 @@
+from test_helpers_for_update import *
+
+SRC1 = '''\
+#include "a.h"
+extern int second(void);
+extern int third(void);
+int main(void) {
+  return A + second() + third();
+}
+'''
+
+SRC2 = '''\
+#include "b.h"
+int second(void) {
+  return B;
+}
+'''
+
+SRC3 = '''\
+#include "a.h"
+#include "b.h"
+int third(void) {
+  return A * B;
+}
+'''
+
+initial({'main.c': SRC1, 'second.c': SRC2, 'third.c': SRC3})
+headers({'a.h': '#define A 1\n', 'b.h': '#define B 10\n', 'unused.h': '#define C 0\n'})
+update_ok()
+expect(21)
+
+# Updating a header compiles just the files that include it, and links them
+# with the rest.
+sub('a.h', 1, '1', '2')
+update_ok()
+expect_compiled(2)
+expect(32)
+
+sub('b.h', 1, '10', '20')
+update_ok()
+expect_compiled(2)
+expect(62)
+
+sub('unused.h', 1, '0', '1')
+update_ok()
+expect_compiled(0)
+expect(62)
+
+# As does a .c file, with only itself.
+sub('second.c', 3, 'B', 'B + 1')
+update_ok()
+expect_compiled(1)
+expect(63)
+
+done()
@@ -0,0 +1,28 @@
+from test_helpers_for_update import *
+
+SRC1 = '''\
+#include "a.h"
+extern int second(void);
+int main(void) {
+  return A + second();
+}
+'''
+
+SRC2 = '''\
+#include "a.h"
+int second(void) {
+  return A * 10;
+}
+'''
+
+headers({'a.h': '#define A (1\n'})
+initial_fail({'main.c': SRC1, 'second.c': SRC2})
+
+# Neither file compiled, so which headers they read isn't known. Fixing the
+# header on its own compiles both of them.
+sub('a.h', 1, '(1', '(1)')
+update_ok()
+expect_compiled(2)
+expect(11)
+
+done()
@@ -0,0 +1,45 @@
+from test_helpers_for_update import *
+
+SRC = '''\
+#define VALUE 1
+int main(void) {
+  return VALUE;
+}
+'''
+
+# Where each header was found on the include paths is remembered by the
+# context, so one added in an earlier directory isn't seen until the cache is
+# flushed. Missing headers fail the update, which flushes the cache too.
+include_path('update_includecache.a')
+include_path('update_includecache.b')
+
+initial({'main.c': SRC})
+expect(1)
+
+remove_file('update_includecache.a/found.h')
+remove_file('update_includecache.b/found.h')
+make_dir('update_includecache.a')
+make_dir('update_includecache.b')
+
+sub('main.c', 1, '#define VALUE 1', '#include <found.h>')
+update_all_fail()
+
+write_file('update_includecache.b/found.h', '#define VALUE 2\n')
+update_all_ok()
+expect(2)
+
+write_file('update_includecache.a/found.h', '#define VALUE 3\n')
+sub('main.c', 3, 'VALUE', 'VALUE + 10')
+update_all_ok()
+expect_compiled(1)
+expect(12)
+
+flush_include_cache()
+sub('main.c', 3, 'VALUE + 10', 'VALUE + 20')
+update_all_ok()
+expect(23)
+
+remove_file('update_includecache.a/found.h')
+remove_file('update_includecache.b/found.h')
+
+done()
@@ -0,0 +1,43 @@
+from test_helpers_for_update import *
+
+SRC1 = '''\
+#undef __STDC_VERSION__
+#define __SIZEOF_INT__ 5
+#undef __LINE__
+extern int other(void);
+int main(void) {
+#if defined(__STDC_VERSION__) || defined(__LINE__)
+  return -1;
+#elif defined(__SIZEOF_INT__)
+  return other() + __SIZEOF_INT__;
+#else
+  return other();
+#endif
+}
+'''
+
+SRC2 = '''\
+int other(void) {
+#if __STDC_VERSION__ == 201112L
+  return __SIZEOF_INT__ * 10 + __LINE__;
+#else
+  return -2;
+#endif
+}
+'''
+
+# The predefined macros are shared by every translation unit, so redefining or
+# #undef'ing one only hides it in the file that does so.
+initial({'main.c': SRC1, 'second.c': SRC2})
+update_ok()
+expect(48)
+
+sub('main.c', 2, '#define __SIZEOF_INT__ 5', '#undef __SIZEOF_INT__')
+update_ok()
+expect(43)
+
+sub('main.c', 2, '#undef __SIZEOF_INT__', '#define __SIZEOF_INT__ 6')
+update_ok()
+expect(49)
+
+done()
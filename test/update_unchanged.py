@@ -0,0 +1,43 @@
+from test_helpers_for_update import *
+
+SRC1 = '''\
+#include "value.h"
+extern int other(void);
+int main(void) {
+  return other() + VALUE;
+}
+'''
+
+SRC2 = '''\
+int other(void) {
+  return 100;
+}
+'''
+
+HDR = '''\
+#define VALUE 1
+'''
+
+initial({'main.c': SRC1, 'second.c': SRC2})
+headers({'value.h': HDR})
+update_ok()
+expect(101)
+
+# Nothing has changed, so both files are reused.
+update_all_ok()
+expect_compiled(0)
+expect(101)
+
+# Only second.c changed.
+sub('second.c', 2, '100', '200')
+update_all_ok()
+expect_compiled(1)
+expect(201)
+
+# main.c is unchanged, but something it includes has changed.
+sub('value.h', 1, '1', '2')
+update_all_ok()
+expect_compiled(1)
+expect(202)
+
+done()